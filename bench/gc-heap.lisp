@@ -0,0 +1,33 @@
+;; Heap used by 'gc-threads.sh' for measuring the garbage collector. The script
+;; defines 'bench-size' and 'bench-runs' before loading this file, which builds
+;; the heap and then forces 'bench-runs' major collections.
+
+(defun build-list (n acc)
+  (if (= n 0)
+      acc
+      (build-list (- n 1) (cons n acc))))
+
+;; A balanced tree of pairs, with 2^depth leaves.
+(defun build-tree (depth)
+  (if (= depth 0)
+      depth
+      (cons (build-tree (- depth 1))
+            (build-tree (- depth 1)))))
+
+;; Keep half of the heap alive, and leave the other half as garbage for the
+;; sweep phase.
+(begin
+  (define live-list (build-list bench-size nil))
+  (define live-tree (build-tree 17))
+  (build-list bench-size nil)
+  nil)
+(gc)
+
+(defun force-collections (n)
+  (if (= n 0)
+      nil
+      (begin
+        (gc)
+        (build-list 1000 nil)
+        (force-collections (- n 1)))))
+(force-collections bench-runs)
@@ -0,0 +1,85 @@
+#!/usr/bin/env bash
+#
+# Copyright 2025 8dcc
+#
+# This file is part of SL.
+#
+# This program is free software: you can redistribute it and/or modify it under
+# the terms of the GNU General Public License as published by the Free Software
+# Foundation, either version 3 of the License, or any later version.
+#
+# This program is distributed in the hope that it will be useful, but WITHOUT
+# ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+# FOR A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along with
+# this program. If not, see <https://www.gnu.org/licenses/>.
+#
+# Measure the mark and sweep phases of the major collections of a big heap with
+# each number of garbage collector threads, from one up to the number of
+# processors. The times are read from the lines printed by '--gc-trace' for the
+# last RUNS major collections, which are the ones forced by the benchmark.
+#
+# With a single thread, the pool is swept lazily as the heap needs more items,
+# so most of the sweeping is not part of the collections. The speedup of the
+# sweep phase is therefore relative to the run with two threads, the first one
+# that sweeps the whole pool after each major collection.
+#
+# Usage: gc-threads.sh [MAX-THREADS] [HEAP-SIZE] [RUNS]
+
+err() {
+    echo -e "\033[31;1m$1\033[0m" 1>&2
+}
+
+speedup() {
+    awk "BEGIN { printf \"%.2f\", $1 / ($2 > 0 ? $2 : 1) }"
+}
+
+bench_dir="$(dirname "$(readlink -f "$0")")"
+root_dir="$(dirname "$bench_dir")"
+sl_bin="$root_dir/sl"
+
+max_threads="${1:-$(nproc)}"
+heap_size="${2:-1000000}"
+runs="${3:-10}"
+
+if [ ! -x "$sl_bin" ]; then
+    err "Could not find the interpreter at '$sl_bin'. Run 'make' first."
+    exit 1
+fi
+
+printf '%-8s %12s %12s %10s %10s\n' \
+       'threads' 'mark-us' 'sweep-us' 'mark-x' 'sweep-x'
+
+base_mark=''
+base_sweep=''
+for threads in $(seq 1 "$max_threads"); do
+    # Average the mark and sweep times of the last lines of the major
+    # collections, e.g. "[gc] #12 major: ... mark 1234 us (1 pauses), sweep
+    # 567 us".
+    if ! trace=$("$sl_bin" --gc-mode stop --gc-threads "$threads" --gc-trace \
+                          --no-stdlib --silent "$root_dir/stdlib.lisp"      \
+                          --silent <(echo "(define bench-size $heap_size)"  \
+                                          "(define bench-runs $runs)")      \
+                          --silent "$bench_dir/gc-heap.lisp" 2>&1 >/dev/null); then
+        err "The benchmark failed with $threads threads."
+        exit 1
+    fi
+
+    read -r mark sweep <<< "$(echo "$trace" | grep ' major: ' | tail -n "$runs" |
+        awk '{ for (i = 1; i < NF; i++) {
+                   if ($i == "mark")  m += $(i + 1);
+                   if ($i == "sweep") s += $(i + 1);
+               } }
+             END { printf "%.0f %.0f", m / NR, s / NR }')"
+
+    [ -z "$base_mark" ] && base_mark="$mark"
+    [ -z "$base_sweep" ] && [ "$threads" -gt 1 ] && base_sweep="$sweep"
+
+    mark_x=$(speedup "$base_mark" "$mark")
+    sweep_x='-'
+    [ -n "$base_sweep" ] && sweep_x=$(speedup "$base_sweep" "$sweep")
+
+    printf '%-8s %12s %12s %10s %10s\n' \
+           "$threads" "$mark" "$sweep" "$mark_x" "$sweep_x"
+done
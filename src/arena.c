@@ -0,0 +1,118 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdalign.h>
+#include <string.h>
+
+#include "include/arena.h"
+#include "include/memory.h"
+#include "include/error.h"
+
+/*
+ * Round the specified size up, so the next allocation is aligned.
+ */
+static inline size_t arena_align(size_t sz) {
+    const size_t align = alignof(max_align_t);
+    return (sz + align - 1) & ~(align - 1);
+}
+
+/*
+ * Add a new chunk to the arena, with at least 'min_sz' bytes. It's at least
+ * twice as big as the current one, so the number of chunks is logarithmic.
+ */
+static void arena_grow(Arena* arena, size_t min_sz) {
+    size_t sz = (arena->chunk == NULL) ? ARENA_BASE_SZ : arena->chunk->sz * 2;
+    while (sz < min_sz)
+        sz *= 2;
+
+    ArenaChunk* chunk = mem_alloc(sizeof(ArenaChunk) + sz);
+    chunk->prev       = arena->chunk;
+    chunk->sz         = sz;
+    chunk->pos        = 0;
+    arena->chunk      = chunk;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void* arena_alloc(Arena* arena, size_t sz) {
+    SL_ASSERT(arena != NULL);
+
+    sz = arena_align(sz);
+    if (arena->chunk == NULL || arena->chunk->sz - arena->chunk->pos < sz)
+        arena_grow(arena, sz);
+
+    ArenaChunk* chunk = arena->chunk;
+    void* result      = &chunk->data[chunk->pos];
+    chunk->pos += sz;
+    return result;
+}
+
+void* arena_realloc(Arena* arena, void* ptr, size_t old_sz, size_t new_sz) {
+    SL_ASSERT(arena != NULL);
+
+    if (ptr == NULL)
+        return arena_alloc(arena, new_sz);
+
+    /* If it's the last block of the current chunk, try to grow it in place */
+    ArenaChunk* chunk = arena->chunk;
+    if ((char*)ptr + arena_align(old_sz) == &chunk->data[chunk->pos]) {
+        const size_t offset = (char*)ptr - chunk->data;
+        if (offset + arena_align(new_sz) <= chunk->sz) {
+            chunk->pos = offset + arena_align(new_sz);
+            return ptr;
+        }
+    }
+
+    void* result = arena_alloc(arena, new_sz);
+    memcpy(result, ptr, (old_sz < new_sz) ? old_sz : new_sz);
+    return result;
+}
+
+void arena_reset(Arena* arena) {
+    SL_ASSERT(arena != NULL);
+
+    ArenaChunk* chunk = arena->chunk;
+    if (chunk == NULL)
+        return;
+
+    /* Free the previous chunks, which are always smaller than the last one */
+    ArenaChunk* prev = chunk->prev;
+    while (prev != NULL) {
+        ArenaChunk* next = prev->prev;
+        mem_free(prev);
+        prev = next;
+    }
+
+    if (chunk->sz > ARENA_MAX_KEEP_SZ) {
+        mem_free(chunk);
+        arena->chunk = NULL;
+        return;
+    }
+
+    chunk->prev = NULL;
+    chunk->pos  = 0;
+}
+
+void arena_free(Arena* arena) {
+    SL_ASSERT(arena != NULL);
+
+    arena_reset(arena);
+    mem_free(arena->chunk);
+    arena->chunk = NULL;
+}
@@ -6,6 +6,9 @@
 #include <string.h>
 
 #include "include/cmdargs.h"
+#include "include/expr_pool.h"        /* POOL_DEFAULT_GROWTH */
+#include "include/garbage_collector.h" /* GC_DEFAULT_BUDGET, EGcMode */
+#include "include/gc_threads.h"        /* GC_THREADS_MAX */
 
 #define CMDARGS_FATAL(...)                                                     \
     do {                                                                       \
@@ -24,6 +27,39 @@ static void cmdargs_load_defaults(CmdArgs* args) {
     args->input_files     = g_input_files;
     args->input_files_sz  = 0;
     args->load_sys_stdlib = true;
+    args->image_path      = NULL;
+    args->dump_image_path = NULL;
+    args->heap_growth     = POOL_DEFAULT_GROWTH;
+    args->gc_budget       = GC_DEFAULT_BUDGET;
+    args->gc_mode         = GC_MODE_STOP;
+    args->gc_max_pause_us = GC_DEFAULT_MAX_PAUSE_US;
+    args->gc_threads      = 1;
+    args->gc_trace        = false;
+
+    args->gc_compact_density = GC_DEFAULT_COMPACT_DENSITY;
+}
+
+/*
+ * Parse the value of a numeric option, which must be greater than 'min'. On
+ * error, the program is terminated.
+ */
+static double parse_flt_arg(const char* opt, const char* str, double min) {
+    char* endptr;
+    errno              = 0;
+    const double value = strtod(str, &endptr);
+    if (errno != 0 || endptr == str || *endptr != '\0' || !(value > min))
+        CMDARGS_FATAL("Invalid argument for '%s' option: '%s'.", opt, str);
+    return value;
+}
+
+static size_t parse_size_arg(const char* opt, const char* str, size_t min) {
+    char* endptr;
+    errno                          = 0;
+    const unsigned long long value = strtoull(str, &endptr, 10);
+    if (errno != 0 || endptr == str || *endptr != '\0' || str[0] == '-' ||
+        value <= min)
+        CMDARGS_FATAL("Invalid argument for '%s' option: '%s'.", opt, str);
+    return (size_t)value;
 }
 
 /*
@@ -83,6 +119,63 @@ CmdArgs cmdargs_parse(int argc, char** argv) {
             got_silent_opt = true;
         } else if (!strcmp(arg, "--no-stdlib")) {
             result.load_sys_stdlib = false;
+        } else if (!strcmp(arg, "--image")) {
+            if (i >= argc - 1)
+                CMDARGS_FATAL("Expected an argument after '%s' option.", arg);
+
+            result.image_path = argv[++i];
+        } else if (!strcmp(arg, "--dump-image")) {
+            if (i >= argc - 1)
+                CMDARGS_FATAL("Expected an argument after '%s' option.", arg);
+
+            result.dump_image_path = argv[++i];
+        } else if (!strcmp(arg, "--heap-growth")) {
+            if (i >= argc - 1)
+                CMDARGS_FATAL("Expected an argument after '%s' option.", arg);
+
+            result.heap_growth = parse_flt_arg(arg, argv[++i], 1.0);
+        } else if (!strcmp(arg, "--gc-budget")) {
+            if (i >= argc - 1)
+                CMDARGS_FATAL("Expected an argument after '%s' option.", arg);
+
+            result.gc_budget = parse_size_arg(arg, argv[++i], 0);
+        } else if (!strcmp(arg, "--gc-mode")) {
+            if (i >= argc - 1)
+                CMDARGS_FATAL("Expected an argument after '%s' option.", arg);
+
+            const char* mode = argv[++i];
+            if (!strcmp(mode, "stop"))
+                result.gc_mode = GC_MODE_STOP;
+            else if (!strcmp(mode, "incremental"))
+                result.gc_mode = GC_MODE_INCREMENTAL;
+            else
+                CMDARGS_FATAL("Invalid argument for '%s' option: '%s'.", arg,
+                              mode);
+        } else if (!strcmp(arg, "--gc-max-pause-us")) {
+            if (i >= argc - 1)
+                CMDARGS_FATAL("Expected an argument after '%s' option.", arg);
+
+            result.gc_max_pause_us = parse_size_arg(arg, argv[++i], 0);
+        } else if (!strcmp(arg, "--gc-threads")) {
+            if (i >= argc - 1)
+                CMDARGS_FATAL("Expected an argument after '%s' option.", arg);
+
+            result.gc_threads = parse_size_arg(arg, argv[++i], 0);
+            if (result.gc_threads > GC_THREADS_MAX)
+                CMDARGS_FATAL("The '%s' option is limited to %d threads.", arg,
+                              GC_THREADS_MAX);
+        } else if (!strcmp(arg, "--gc-trace")) {
+            result.gc_trace = true;
+        } else if (!strcmp(arg, "--gc-compact-density")) {
+            if (i >= argc - 1)
+                CMDARGS_FATAL("Expected an argument after '%s' option.", arg);
+
+            const char* density = argv[++i];
+            result.gc_compact_density = parse_flt_arg(arg, density, -1.0);
+            if (result.gc_compact_density < 0.0 ||
+                result.gc_compact_density > 1.0)
+                CMDARGS_FATAL("Invalid argument for '%s' option: '%s'.", arg,
+                              density);
         } else {
             CMDARGS_FATAL("Unknown option '%s'.", arg);
         }
@@ -0,0 +1,534 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * SL. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h> /* SIZE_MAX, uintptr_t */
+
+#include "include/compile.h"
+#include "include/env.h"
+#include "include/expr.h"
+#include "include/lambda.h"
+#include "include/memory.h"
+#include "include/util.h"
+#include "include/primitives.h"
+#include "include/garbage_collector.h"
+#include "include/error.h"
+
+/*
+ * State of the compiler while compiling the body of a single lambda. The
+ * 'slots' array contains the symbol bound to each slot of the activation
+ * frame, in the same order as 'lambdactx_bind_args' binds them.
+ */
+typedef struct Compiler Compiler;
+struct Compiler {
+    Env* env;
+    Bytecode* bc;
+    size_t code_cap;
+    size_t consts_cap;
+    size_t sites_cap;
+    size_t refs_cap;
+
+    const char** slots;
+    size_t slots_num;
+};
+
+/*
+ * Entry of the bytecode cache. The bytecode depends on the 'body' and on the
+ * symbols bound to each slot of the activation frame, so the slots are also
+ * stored.
+ */
+typedef struct BytecodeCacheEntry BytecodeCacheEntry;
+struct BytecodeCacheEntry {
+    const Expr* body;
+    const char** slots;
+    size_t slots_num;
+    Bytecode* bc;
+};
+
+/*
+ * The bytecode cache is an open-addressing hash table with linear probing,
+ * indexed by the address of the body, just like the macro expansion cache (see
+ * 'macro_expand_cached'). Each entry holds a reference to its bytecode.
+ */
+static BytecodeCacheEntry* g_bytecode_cache = NULL;
+static size_t g_bytecode_cache_sz           = 0;
+static size_t g_bytecode_cache_num          = 0;
+
+/*----------------------------------------------------------------------------*/
+
+static size_t emit(Compiler* c, enum EOpcode op, size_t arg) {
+    Bytecode* bc = c->bc;
+    if (bc->code_sz >= c->code_cap) {
+        c->code_cap = (c->code_cap == 0) ? 16 : c->code_cap * 2;
+        mem_realloc(&bc->code, c->code_cap * sizeof(Instr));
+    }
+
+    bc->code[bc->code_sz].op  = op;
+    bc->code[bc->code_sz].arg = arg;
+    return bc->code_sz++;
+}
+
+/*
+ * Make the jump instruction at position 'pos' point to the next instruction
+ * that will be emitted.
+ */
+static inline void patch_jump(Compiler* c, size_t pos) {
+    c->bc->code[pos].arg = c->bc->code_sz;
+}
+
+static size_t add_const(Compiler* c, Expr* e) {
+    Bytecode* bc = c->bc;
+    if (bc->consts_sz >= c->consts_cap) {
+        c->consts_cap = (c->consts_cap == 0) ? 8 : c->consts_cap * 2;
+        mem_realloc(&bc->consts, c->consts_cap * sizeof(Expr*));
+    }
+
+    bc->consts[bc->consts_sz] = e;
+    return bc->consts_sz++;
+}
+
+static size_t add_site(Compiler* c, Expr* form, size_t argc, bool tail) {
+    Bytecode* bc = c->bc;
+    if (bc->sites_sz >= c->sites_cap) {
+        c->sites_cap = (c->sites_cap == 0) ? 8 : c->sites_cap * 2;
+        mem_realloc(&bc->sites, c->sites_cap * sizeof(CallSite));
+    }
+
+    bc->sites[bc->sites_sz].form = form;
+    bc->sites[bc->sites_sz].argc = argc;
+    bc->sites[bc->sites_sz].end  = 0;
+    bc->sites[bc->sites_sz].tail = tail;
+    bc->sites[bc->sites_sz].special       = NULL;
+    bc->sites[bc->sites_sz].cache.parent  = NULL;
+    bc->sites[bc->sites_sz].cache.env     = NULL;
+    bc->sites[bc->sites_sz].cache.pos     = 0;
+    bc->sites[bc->sites_sz].cache.version = 0;
+    return bc->sites_sz++;
+}
+
+/*
+ * Return the index of the reference to the specified free variable, adding it
+ * if necessary. All the references to the same symbol share the same cache.
+ */
+static size_t add_ref(Compiler* c, const char* sym) {
+    Bytecode* bc = c->bc;
+    for (size_t i = 0; i < bc->refs_sz; i++)
+        if (bc->refs[i].sym == sym)
+            return i;
+
+    if (bc->refs_sz >= c->refs_cap) {
+        c->refs_cap = (c->refs_cap == 0) ? 8 : c->refs_cap * 2;
+        mem_realloc(&bc->refs, c->refs_cap * sizeof(VarRef));
+    }
+
+    bc->refs[bc->refs_sz].sym           = sym;
+    bc->refs[bc->refs_sz].cache.parent  = NULL;
+    bc->refs[bc->refs_sz].cache.env     = NULL;
+    bc->refs[bc->refs_sz].cache.pos     = 0;
+    bc->refs[bc->refs_sz].cache.version = 0;
+    return bc->refs_sz++;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Return the slot of the specified symbol in the activation frame, or -1 if
+ * it's not a formal argument of the lambda.
+ */
+static long find_slot(const Compiler* c, const char* sym) {
+    for (size_t i = 0; i < c->slots_num; i++)
+        if (c->slots[i] == sym)
+            return (long)i;
+    return -1;
+}
+
+/*
+ * Return the primitive of the special form bound to the specified symbol when
+ * the lambda is defined, or NULL if the symbol is not bound to a special form.
+ * Formal arguments shadow the special forms, so they are never considered.
+ */
+static const Primitive* special_form_of(const Compiler* c, const Expr* e) {
+    if (!EXPR_SYMBOL_P(e) || find_slot(c, e->val.s) >= 0)
+        return NULL;
+
+    if ((env_get_flags(c->env, e->val.s) & ENV_FLAG_SPECIAL) == 0)
+        return NULL;
+
+    const Expr* val = env_get(c->env, e->val.s);
+    return (val != NULL && EXPR_PRIM_P(val)) ? val->val.prim : NULL;
+}
+
+/*
+ * Can a call to the special form with the specified primitive and number of
+ * arguments be compiled inline? Invalid uses will report the error at runtime,
+ * so they are not compiled.
+ */
+static bool special_form_is_inline(PrimitiveFuncPtr prim, size_t arg_num) {
+    if (prim == prim_quote)
+        return arg_num == 1;
+    if (prim == prim_if)
+        return arg_num == 3;
+    return prim == prim_begin || prim == prim_or || prim == prim_and;
+}
+
+/*----------------------------------------------------------------------------*/
+
+static void compile_expr(Compiler* c, Expr* e, bool tail);
+
+/*
+ * Compile a list of expressions that are evaluated in order, like the body of
+ * `begin'. The value of the last one is left on the stack.
+ */
+static void compile_sequence(Compiler* c, Expr* list, bool tail) {
+    if (expr_is_nil(list)) {
+        emit(c, OP_CONST, add_const(c, g_nil));
+        return;
+    }
+
+    for (; !expr_is_nil(CDR(list)); list = CDR(list)) {
+        compile_expr(c, CAR(list), false);
+        emit(c, OP_POP, 0);
+    }
+    compile_expr(c, CAR(list), tail);
+}
+
+/*
+ * Compile the arguments of `and' or `or'. Each argument is evaluated in order,
+ * and the first one whose value is nil (for `and') or non-nil (for `or') is
+ * the value of the whole expression.
+ */
+static void compile_logical(Compiler* c, Expr* args, enum EOpcode jump_op,
+                            Expr* empty_val, bool tail) {
+    if (expr_is_nil(args)) {
+        emit(c, OP_CONST, add_const(c, empty_val));
+        return;
+    }
+
+    /*
+     * We don't know how many jumps we will need to patch, but they form a
+     * linked list through their 'arg' members, terminated by 'SIZE_MAX'.
+     */
+    size_t pending = SIZE_MAX;
+    for (; !expr_is_nil(CDR(args)); args = CDR(args)) {
+        compile_expr(c, CAR(args), false);
+        pending = emit(c, jump_op, pending);
+    }
+    compile_expr(c, CAR(args), tail);
+
+    while (pending != SIZE_MAX) {
+        const size_t next = c->bc->code[pending].arg;
+        patch_jump(c, pending);
+        pending = next;
+    }
+}
+
+/*
+ * Try to compile a call to one of the special forms that have an equivalent in
+ * the virtual machine. Returns false if the form should be compiled as a normal
+ * call instead (which will evaluate it with the tree-walking interpreter).
+ */
+static bool compile_special_form(Compiler* c, Expr* e, bool tail) {
+    const Primitive* special = special_form_of(c, CAR(e));
+    if (special == NULL)
+        return false;
+
+    const PrimitiveFuncPtr prim = special->list_func;
+    Expr* args                  = CDR(e);
+    const size_t arg_num        = expr_list_len(args);
+    if (!special_form_is_inline(prim, arg_num))
+        return false;
+
+    /*
+     * The bytecode might be shared with closures defined in other
+     * environments, where the symbol is not bound to the same special form, so
+     * it's checked before running the inline code.
+     */
+    const size_t id          = add_site(c, e, arg_num, tail);
+    c->bc->sites[id].special = special;
+    emit(c, OP_SPECIAL, id);
+
+    if (prim == prim_quote) {
+        emit(c, OP_CONST, add_const(c, CAR(args)));
+    } else if (prim == prim_if) {
+        compile_expr(c, CAR(args), false);
+        const size_t jump_false = emit(c, OP_JUMP_IF_NIL, 0);
+        compile_expr(c, CADR(args), tail);
+        const size_t jump_end = emit(c, OP_JUMP, 0);
+        patch_jump(c, jump_false);
+        compile_expr(c, CAR(CDDR(args)), tail);
+        patch_jump(c, jump_end);
+    } else if (prim == prim_begin) {
+        compile_sequence(c, args, tail);
+    } else if (prim == prim_or) {
+        compile_logical(c, args, OP_JUMP_IF_NOT_NIL_KEEP, g_nil, tail);
+    } else {
+        compile_logical(c, args, OP_JUMP_IF_NIL_KEEP, g_tru, tail);
+    }
+
+    c->bc->sites[id].end = c->bc->code_sz;
+    return true;
+}
+
+/*
+ * Compile a procedure call. The function is checked at runtime; if it's a
+ * special form or a macro, the VM doesn't evaluate the arguments, and falls
+ * back to the tree-walking interpreter.
+ */
+static void compile_call(Compiler* c, Expr* e, bool tail) {
+    Expr* car       = CAR(e);
+    Expr* args      = CDR(e);
+    const size_t id = add_site(c, e, expr_list_len(args), tail);
+
+    const long slot = EXPR_SYMBOL_P(car) ? find_slot(c, car->val.s) : -1;
+    if (EXPR_SYMBOL_P(car) && slot < 0) {
+        emit(c, OP_FUNC_SYM, id);
+    } else {
+        compile_expr(c, car, false);
+        emit(c, OP_FUNC_CHECK, id);
+    }
+
+    for (; !expr_is_nil(args); args = CDR(args))
+        compile_expr(c, CAR(args), false);
+
+    emit(c, OP_CALL, id);
+    c->bc->sites[id].end = c->bc->code_sz;
+}
+
+static void compile_expr(Compiler* c, Expr* e, bool tail) {
+    switch (e->type) {
+        case EXPR_SYMBOL: {
+            const long slot = find_slot(c, e->val.s);
+            if (slot >= 0)
+                emit(c, OP_LOCAL, (size_t)slot);
+            else
+                emit(c, OP_GLOBAL, add_ref(c, e->val.s));
+        } break;
+
+        case EXPR_PAIR: {
+            /*
+             * Improper lists are evaluated with the tree-walking interpreter,
+             * which will report the error.
+             */
+            if (!expr_is_proper_list(e)) {
+                emit(c, OP_EVAL, add_const(c, e));
+                break;
+            }
+
+            if (!compile_special_form(c, e, tail))
+                compile_call(c, e, tail);
+        } break;
+
+        default:
+            /* Everything else evaluates to itself */
+            emit(c, OP_CONST, add_const(c, e));
+            break;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Return the entry of the bytecode cache for the specified body, which is
+ * either empty (NULL 'body') or contains that body. The table must not be
+ * full.
+ */
+static BytecodeCacheEntry* bytecode_cache_find(BytecodeCacheEntry* table,
+                                               size_t table_sz,
+                                               const Expr* body) {
+    const size_t mask = table_sz - 1;
+    size_t i          = ((uintptr_t)body / sizeof(Expr)) & mask;
+    while (table[i].body != NULL && table[i].body != body)
+        i = (i + 1) & mask;
+    return &table[i];
+}
+
+static void bytecode_cache_entry_free(BytecodeCacheEntry* entry) {
+    mem_free(entry->slots);
+    bytecode_release(entry->bc);
+    entry->body = NULL;
+}
+
+/*
+ * Allocate a new table for the bytecode cache with the specified size, which
+ * must be a power of two, and re-insert the entries for which 'keep' returns
+ * true. The other entries are freed.
+ */
+static void bytecode_cache_rebuild(size_t new_sz,
+                                   bool (*keep)(const BytecodeCacheEntry*)) {
+    BytecodeCacheEntry* new_table =
+      mem_calloc(new_sz, sizeof(BytecodeCacheEntry));
+    size_t new_num = 0;
+
+    for (size_t i = 0; i < g_bytecode_cache_sz; i++) {
+        BytecodeCacheEntry* entry = &g_bytecode_cache[i];
+        if (entry->body == NULL)
+            continue;
+
+        if (!keep(entry)) {
+            bytecode_cache_entry_free(entry);
+            continue;
+        }
+
+        *bytecode_cache_find(new_table, new_sz, entry->body) = *entry;
+        new_num++;
+    }
+
+    mem_free(g_bytecode_cache);
+    g_bytecode_cache     = new_table;
+    g_bytecode_cache_sz  = new_sz;
+    g_bytecode_cache_num = new_num;
+}
+
+static bool bytecode_cache_keep_all(const BytecodeCacheEntry* entry) {
+    SL_UNUSED(entry);
+    return true;
+}
+
+static bool bytecode_cache_keep_marked(const BytecodeCacheEntry* entry) {
+    return gc_is_marked(entry->body);
+}
+
+/*
+ * Does the specified cache entry have the same slots as the compiler?
+ */
+static bool bytecode_cache_entry_matches(const BytecodeCacheEntry* entry,
+                                         const Compiler* c) {
+    if (entry->slots_num != c->slots_num)
+        return false;
+
+    for (size_t i = 0; i < c->slots_num; i++)
+        if (entry->slots[i] != c->slots[i])
+            return false;
+
+    return true;
+}
+
+Bytecode* compile_lambda(Env* env, const LambdaCtx* ctx) {
+    SL_ASSERT(env != NULL);
+    SL_ASSERT(expr_is_proper_list(ctx->body));
+
+    Compiler c = {
+        .env        = env,
+        .bc         = NULL,
+        .code_cap   = 0,
+        .consts_cap = 0,
+        .sites_cap  = 0,
+        .refs_cap   = 0,
+        .slots      = mem_alloc((ctx->formals_num + 1) * sizeof(char*)),
+        .slots_num  = 0,
+    };
+
+    /*
+     * Assign a slot to each formal argument, in the order they are bound to the
+     * frame. If the same symbol appears twice, it's bound to the first slot.
+     */
+    for (size_t i = 0; i < ctx->formals_num; i++)
+        if (find_slot(&c, ctx->formals[i]) < 0)
+            c.slots[c.slots_num++] = ctx->formals[i];
+    if (ctx->formal_rest != NULL && find_slot(&c, ctx->formal_rest) < 0)
+        c.slots[c.slots_num++] = ctx->formal_rest;
+
+    /*
+     * If this body was already compiled with the same slots, share its
+     * bytecode. The same body might also be used with other formals (e.g. by
+     * a macro), in which case the entry is replaced below.
+     */
+    if (g_bytecode_cache == NULL)
+        bytecode_cache_rebuild(BYTECODE_CACHE_BASE_SZ, bytecode_cache_keep_all);
+
+    BytecodeCacheEntry* entry =
+      bytecode_cache_find(g_bytecode_cache, g_bytecode_cache_sz, ctx->body);
+    if (entry->body != NULL && bytecode_cache_entry_matches(entry, &c)) {
+        mem_free(c.slots);
+        return bytecode_retain(entry->bc);
+    }
+
+    Bytecode* bc  = mem_alloc(sizeof(Bytecode));
+    bc->users     = 1;
+    bc->code      = NULL;
+    bc->code_sz   = 0;
+    bc->consts    = NULL;
+    bc->consts_sz = 0;
+    bc->sites     = NULL;
+    bc->sites_sz  = 0;
+    bc->refs      = NULL;
+    bc->refs_sz   = 0;
+
+    c.bc = bc;
+    compile_sequence(&c, ctx->body, true);
+    emit(&c, OP_RETURN, 0);
+
+    /*
+     * Replace the entry of the same body with other slots, or add a new one,
+     * keeping the load factor of the table under 1/2.
+     */
+    if (entry->body != NULL) {
+        bytecode_cache_entry_free(entry);
+    } else {
+        if ((g_bytecode_cache_num + 1) * 2 > g_bytecode_cache_sz) {
+            bytecode_cache_rebuild(g_bytecode_cache_sz * 2,
+                                   bytecode_cache_keep_all);
+            entry = bytecode_cache_find(g_bytecode_cache,
+                                        g_bytecode_cache_sz,
+                                        ctx->body);
+        }
+        g_bytecode_cache_num++;
+    }
+
+    /* The slots are now owned by the entry */
+    entry->body      = ctx->body;
+    entry->slots     = c.slots;
+    entry->slots_num = c.slots_num;
+    entry->bc        = bytecode_retain(bc);
+    return bc;
+}
+
+Bytecode* bytecode_retain(Bytecode* bc) {
+    __atomic_fetch_add(&bc->users, 1, __ATOMIC_RELAXED);
+    return bc;
+}
+
+void bytecode_release(Bytecode* bc) {
+    if (bc == NULL || __atomic_sub_fetch(&bc->users, 1, __ATOMIC_ACQ_REL) > 0)
+        return;
+
+    mem_free(bc->code);
+    mem_free(bc->consts);
+    mem_free(bc->sites);
+    mem_free(bc->refs);
+    mem_free(bc);
+}
+
+void bytecode_cache_collect(void) {
+    if (g_bytecode_cache == NULL)
+        return;
+
+    bytecode_cache_rebuild(g_bytecode_cache_sz, bytecode_cache_keep_marked);
+}
+
+void bytecode_cache_free(void) {
+    for (size_t i = 0; i < g_bytecode_cache_sz; i++)
+        if (g_bytecode_cache[i].body != NULL)
+            bytecode_cache_entry_free(&g_bytecode_cache[i]);
+
+    mem_free(g_bytecode_cache);
+    g_bytecode_cache     = NULL;
+    g_bytecode_cache_sz  = 0;
+    g_bytecode_cache_num = 0;
+}
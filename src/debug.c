@@ -23,6 +23,7 @@
 #include "include/expr.h"
 #include "include/memory.h"
 #include "include/debug.h"
+#include "include/garbage_collector.h"
 
 /*
  * Function used for printing expressions in 'debug_*' functions.
@@ -128,6 +129,11 @@ void debug_callstack_pop(void) {
     callstack[--callstack_pos] = NULL;
 }
 
+void debug_callstack_mark(void) {
+    for (size_t i = 0; i < callstack_pos; i++)
+        gc_mark_expr((Expr*)callstack[i]);
+}
+
 void debug_callstack_print(FILE* fp) {
     if (callstack_pos == 0) {
         fprintf(fp, "Callstack: (no callstack)\n");
@@ -25,35 +25,181 @@
 #include "include/expr.h"
 #include "include/util.h"
 #include "include/memory.h"
+#include "include/symbol.h"
 #include "include/primitives.h"
+#include "include/garbage_collector.h"
 
-/* Used in 'env_init_defaults' */
-#define BIND_PRIM_FLAGS(ENV, SYM, FUNC, FLAGS)                                 \
+/*
+ * Used in 'env_init_defaults'. Each primitive is described by a static
+ * 'Primitive' structure, initialized with the remaining arguments.
+ */
+#define BIND_PRIM_DESC(ENV, SYM, FLAGS, ...)                                   \
     do {                                                                       \
-        Expr* e     = expr_new(EXPR_PRIM);                                     \
-        e->val.prim = prim_##FUNC;                                             \
-        SL_ASSERT(env_bind(ENV, SYM, e, FLAGS) == ENV_ERR_NONE);               \
+        static const Primitive desc_ = { __VA_ARGS__ };                        \
+        Expr* e                      = expr_new(EXPR_PRIM);                    \
+        e->val.prim                  = &desc_;                                 \
+        env_register_primitive(SYM, &desc_);                                   \
+        SL_ASSERT(env_bind(ENV, symbol_intern(SYM), e, FLAGS) ==               \
+                  ENV_ERR_NONE);                                               \
     } while (0)
 
-#define BIND_PRIM(ENV, SYM, FUNC) BIND_PRIM_FLAGS(ENV, SYM, FUNC, ENV_FLAG_NONE)
+#define BIND_PRIM(ENV, SYM, FUNC)                                              \
+    BIND_PRIM_DESC(ENV, SYM, ENV_FLAG_NONE, prim_##FUNC, NULL, 0, PRIM_VARIADIC)
 #define BIND_SPECIAL(ENV, SYM, FUNC)                                           \
-    BIND_PRIM_FLAGS(ENV, SYM, FUNC, ENV_FLAG_CONST | ENV_FLAG_SPECIAL)
+    BIND_PRIM_DESC(ENV,                                                        \
+                   SYM,                                                        \
+                   ENV_FLAG_CONST | ENV_FLAG_SPECIAL,                          \
+                   prim_##FUNC,                                                \
+                   NULL,                                                       \
+                   0,                                                          \
+                   PRIM_VARIADIC)
+
+/*
+ * Bind a vector primitive (see 'PrimitiveVecPtr'), which receives between
+ * 'MIN' and 'MAX' arguments. The caller checks the number of arguments.
+ */
+#define BIND_PRIM_VEC(ENV, SYM, FUNC, MIN, MAX)                                \
+    BIND_PRIM_DESC(ENV, SYM, ENV_FLAG_NONE, NULL, prim_##FUNC, MIN, MAX)
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Maximum number of bindings in the activation frame stack. If a call doesn't
+ * fit in the stack, its bindings are allocated in the heap instead.
+ */
+#define FRAME_STACK_SZ 65536
 
 /*----------------------------------------------------------------------------*/
 
 /* Globals, initialized in 'env_init_defaults' if necessary. */
-Expr* g_nil              = NULL;
-Expr* g_tru              = NULL;
 Expr* g_debug_trace_list = NULL;
 
+/*
+ * Incremented whenever a binding is added to a searched environment, or a
+ * captured frame is freed. See 'EnvCache'.
+ */
+size_t g_env_version = 1;
+
+/*
+ * LIFO stack used for the bindings of activation frames, and the position of
+ * the first free binding.
+ */
+static EnvBinding* g_frame_stack = NULL;
+static size_t g_frame_stack_pos  = 0;
+
+/*
+ * Linked list of frame structures that can be reused by 'env_frame_new', and
+ * linked list of frames that were captured by a lambda and that should be
+ * freed by the garbage collector.
+ */
+static Env* g_free_frames     = NULL;
+static Env* g_captured_frames = NULL;
+
+/*
+ * Names and descriptions of the primitives bound by 'env_init_defaults', in the
+ * order they were bound. See 'env_primitive_index'.
+ */
+static const char* g_primitive_names[ENV_MAX_PRIMITIVES];
+static const Primitive* g_primitives[ENV_MAX_PRIMITIVES];
+static size_t g_primitives_num = 0;
+
+/*
+ * Linked list of the frames that were created with 'env_frame_new' and not yet
+ * released, most recent first. Their contents are roots for the garbage
+ * collector.
+ */
+static Env* g_active_frames = NULL;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Return the position of the slot in the hash index of 'env' that corresponds
+ * to the specified interned symbol. The slot is either empty (zero) or it
+ * contains the binding for that symbol.
+ *
+ * We use linear probing, and since bindings are never removed from an
+ * environment, we don't need tombstones.
+ */
+static size_t env_index_find_slot(const Env* env, const char* sym) {
+    SL_ASSERT(env->index != NULL);
+
+    const size_t mask = env->index_sz - 1;
+    size_t i          = symbol_from_name(sym)->hash & mask;
+    while (env->index[i] != 0 && env->bindings[env->index[i] - 1].sym != sym)
+        i = (i + 1) & mask;
+
+    return i;
+}
+
+/*
+ * Allocate a new hash index of 'index_sz' slots (which must be a power of two)
+ * for the specified environment, and insert all of its bindings.
+ */
+static void env_index_rebuild(Env* env, size_t index_sz) {
+    mem_free(env->index);
+    env->index    = mem_calloc(index_sz, sizeof(size_t));
+    env->index_sz = index_sz;
+
+    for (size_t i = 0; i < env->size; i++) {
+        const size_t slot = env_index_find_slot(env, env->bindings[i].sym);
+        env->index[slot]  = i + 1;
+    }
+}
+
+/*
+ * Return a pointer to the binding for the specified symbol, only in the
+ * specified environment (not in its parents), or NULL if it's not bound.
+ */
+static EnvBinding* env_get_local_binding(const Env* env, const char* sym) {
+    if (env->index != NULL) {
+        const size_t slot = env_index_find_slot(env, sym);
+        return (env->index[slot] == 0) ? NULL
+                                       : &env->bindings[env->index[slot] - 1];
+    }
+
+    for (size_t i = 0; i < env->size; i++)
+        if (env->bindings[i].sym == sym)
+            return &env->bindings[i];
+
+    return NULL;
+}
+
+/*
+ * Add a primitive to the list of known primitives, unless it was already
+ * registered by a previous call to 'env_init_defaults'.
+ */
+static void env_register_primitive(const char* name, const Primitive* prim) {
+    for (size_t i = 0; i < g_primitives_num; i++)
+        if (g_primitives[i] == prim)
+            return;
+
+    SL_ASSERT(g_primitives_num < ENV_MAX_PRIMITIVES);
+    g_primitive_names[g_primitives_num] = name;
+    g_primitives[g_primitives_num]      = prim;
+    g_primitives_num++;
+}
+
 /*----------------------------------------------------------------------------*/
 
 Env* env_new(void) {
     Env* env      = mem_alloc(sizeof(Env));
     env->parent   = NULL;
     env->size     = 0;
+    env->capacity = 0;
     env->bindings = NULL;
-    env->is_used  = true;
+    env->index    = NULL;
+    env->index_sz = 0;
+    env->gc_epoch = 0;
+
+    env->is_remembered = false;
+    env->has_defines   = false;
+    env->is_searched   = false;
+
+    env->stack_slots = 0;
+    env->on_stack    = false;
+    env->is_frame    = false;
+    env->is_captured = false;
+    env->next        = NULL;
     return env;
 }
 
@@ -63,24 +209,24 @@ void env_init_defaults(Env* env) {
      * primitives. See the 'env.h' header for more information on them.
      *
      * First, we initialize the C pointers if necessary, and then we bind them
-     * to the environment.
+     * to the environment. The `nil' and `tru' expressions are immortal (see
+     * 'expr.h'), so we just need to set their symbols.
+     *
+     * Note that the debug trace list is modified with `set' from Lisp, so it
+     * can't be the immortal 'g_nil' expression, even if it starts empty.
      */
-    if (g_nil == NULL) {
-        g_nil        = expr_new(EXPR_SYMBOL);
-        g_nil->val.s = mem_strdup("nil");
-    }
-    if (g_tru == NULL) {
-        g_tru        = expr_new(EXPR_SYMBOL);
-        g_tru->val.s = mem_strdup("tru");
-    }
+    g_nil->val.s = g_sym_nil;
+    g_tru->val.s = g_sym_tru;
     if (g_debug_trace_list == NULL) {
-        g_debug_trace_list = expr_clone(g_nil);
+        g_debug_trace_list        = expr_new(EXPR_SYMBOL);
+        g_debug_trace_list->val.s = g_sym_nil;
     }
-    SL_ASSERT(env_bind(env, "nil", g_nil, ENV_FLAG_CONST) == ENV_ERR_NONE);
-    SL_ASSERT(env_bind(env, "tru", g_tru, ENV_FLAG_CONST) == ENV_ERR_NONE);
-    SL_ASSERT(
-      env_bind(env, "*debug-trace*", g_debug_trace_list, ENV_FLAG_NONE) ==
-      ENV_ERR_NONE);
+    SL_ASSERT(env_bind(env, g_sym_nil, g_nil, ENV_FLAG_CONST) == ENV_ERR_NONE);
+    SL_ASSERT(env_bind(env, g_sym_tru, g_tru, ENV_FLAG_CONST) == ENV_ERR_NONE);
+    SL_ASSERT(env_bind(env,
+                       symbol_intern("*debug-trace*"),
+                       g_debug_trace_list,
+                       ENV_FLAG_NONE) == ENV_ERR_NONE);
 
     /* Special forms */
     BIND_SPECIAL(env, "quote", quote);
@@ -105,22 +251,25 @@ void env_init_defaults(Env* env) {
     BIND_PRIM(env, "clone", clone);
     BIND_PRIM(env, "random", random);
     BIND_PRIM(env, "set-random-seed", set_random_seed);
+    BIND_PRIM_VEC(env, "gc", gc, 0, 0);
+    BIND_PRIM_VEC(env, "gc-stats", gc_stats, 0, 0);
+    BIND_PRIM_VEC(env, "gc-compact", gc_compact, 0, 0);
 
-    BIND_PRIM(env, "equal?", equal);
-    BIND_PRIM(env, "=", equal_num);
-    BIND_PRIM(env, "<", lt);
-    BIND_PRIM(env, ">", gt);
+    BIND_PRIM_VEC(env, "equal?", equal, 2, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "=", equal_num, 2, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "<", lt, 2, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, ">", gt, 2, PRIM_VARIADIC);
 
     BIND_PRIM(env, "type-of", type_of);
-    BIND_PRIM(env, "int?", is_int);
-    BIND_PRIM(env, "flt?", is_flt);
-    BIND_PRIM(env, "symbol?", is_symbol);
-    BIND_PRIM(env, "string?", is_string);
-    BIND_PRIM(env, "pair?", is_pair);
-    BIND_PRIM(env, "list?", is_list);
-    BIND_PRIM(env, "primitive?", is_primitive);
-    BIND_PRIM(env, "lambda?", is_lambda);
-    BIND_PRIM(env, "macro?", is_macro);
+    BIND_PRIM_VEC(env, "int?", is_int, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "flt?", is_flt, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "symbol?", is_symbol, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "string?", is_string, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "pair?", is_pair, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "list?", is_list, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "primitive?", is_primitive, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "lambda?", is_lambda, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "macro?", is_macro, 1, PRIM_VARIADIC);
 
     BIND_PRIM(env, "int->flt", int2flt);
     BIND_PRIM(env, "flt->int", flt2int);
@@ -129,10 +278,10 @@ void env_init_defaults(Env* env) {
     BIND_PRIM(env, "str->int", str2int);
     BIND_PRIM(env, "str->flt", str2flt);
 
-    BIND_PRIM(env, "list", list);
-    BIND_PRIM(env, "cons", cons);
-    BIND_PRIM(env, "car", car);
-    BIND_PRIM(env, "cdr", cdr);
+    BIND_PRIM_VEC(env, "list", list, 0, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "cons", cons, 2, 2);
+    BIND_PRIM_VEC(env, "car", car, 1, 1);
+    BIND_PRIM_VEC(env, "cdr", cdr, 1, 1);
     BIND_PRIM(env, "nth", nth);
     BIND_PRIM(env, "length", length);
     BIND_PRIM(env, "append", append);
@@ -142,24 +291,24 @@ void env_init_defaults(Env* env) {
     BIND_PRIM(env, "substring", substring);
     BIND_PRIM(env, "re-match-groups", re_match_groups);
 
-    BIND_PRIM(env, "+", add);
-    BIND_PRIM(env, "-", sub);
-    BIND_PRIM(env, "*", mul);
-    BIND_PRIM(env, "/", div);
-    BIND_PRIM(env, "mod", mod);
-    BIND_PRIM(env, "quotient", quotient);
-    BIND_PRIM(env, "remainder", remainder);
+    BIND_PRIM_VEC(env, "+", add, 0, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "-", sub, 0, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "*", mul, 0, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "/", div, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "mod", mod, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "quotient", quotient, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "remainder", remainder, 1, PRIM_VARIADIC);
     BIND_PRIM(env, "round", round);
     BIND_PRIM(env, "floor", floor);
     BIND_PRIM(env, "ceiling", ceiling);
     BIND_PRIM(env, "truncate", truncate);
 
-    BIND_PRIM(env, "bit-and", bit_and);
-    BIND_PRIM(env, "bit-or", bit_or);
-    BIND_PRIM(env, "bit-xor", bit_xor);
-    BIND_PRIM(env, "bit-not", bit_not);
-    BIND_PRIM(env, "shr", shr);
-    BIND_PRIM(env, "shl", shl);
+    BIND_PRIM_VEC(env, "bit-and", bit_and, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "bit-or", bit_or, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "bit-xor", bit_xor, 1, PRIM_VARIADIC);
+    BIND_PRIM_VEC(env, "bit-not", bit_not, 1, 1);
+    BIND_PRIM_VEC(env, "shr", shr, 2, 2);
+    BIND_PRIM_VEC(env, "shl", shl, 2, 2);
 
     BIND_PRIM(env, "read", read);
     BIND_PRIM(env, "write", write);
@@ -171,21 +320,29 @@ void env_init_defaults(Env* env) {
 Env* env_clone(Env* env) {
     /*
      * When cloning an environment, the same parent pointer is shared, not a
-     * copy. New arrays are allocated for symbols and values, and a new copy is
-     * created for each one.
+     * copy. A new array is allocated for the bindings, but the symbols are
+     * interned and the values are copied by reference.
      */
     Env* cloned    = env_new();
     cloned->parent = env->parent;
 
     cloned->size     = env->size;
-    cloned->bindings = mem_alloc(cloned->size * sizeof(EnvBinding));
+    cloned->capacity = env->size;
+    cloned->bindings = mem_alloc(cloned->capacity * sizeof(EnvBinding));
 
     for (size_t i = 0; i < cloned->size; i++) {
-        cloned->bindings[i].sym   = mem_strdup(env->bindings[i].sym);
+        cloned->bindings[i].sym   = env->bindings[i].sym;
         cloned->bindings[i].val   = env->bindings[i].val;
         cloned->bindings[i].flags = env->bindings[i].flags;
     }
 
+    /* The positions of the bindings didn't change, copy the hash index */
+    if (env->index != NULL) {
+        cloned->index_sz = env->index_sz;
+        cloned->index    = mem_alloc(cloned->index_sz * sizeof(size_t));
+        memcpy(cloned->index, env->index, cloned->index_sz * sizeof(size_t));
+    }
+
     return cloned;
 }
 
@@ -195,58 +352,282 @@ void env_free(Env* env) {
 
     /*
      * No need to free the expressions, they might be in use somewhere else, and
-     * they will be garbage-collected if necessary.
+     * they will be garbage-collected if necessary. The symbols are owned by the
+     * symbol table.
      */
-    for (size_t i = 0; i < env->size; i++)
-        mem_free(env->bindings[i].sym);
-
     mem_free(env->bindings);
+    mem_free(env->index);
     mem_free(env);
 }
 
 /*----------------------------------------------------------------------------*/
 
+Env* env_frame_new(Env* parent, size_t size) {
+    Env* frame;
+    if (g_free_frames != NULL) {
+        frame         = g_free_frames;
+        g_free_frames = frame->next;
+    } else {
+        frame           = env_new();
+        frame->is_frame = true;
+    }
+
+    /*
+     * New frames are young; they become old once they are marked by the
+     * garbage collector, see 'gc_write_barrier_env'. No epoch is zero.
+     */
+    frame->gc_epoch = 0;
+
+    frame->parent      = parent;
+    frame->size        = 0;
+    frame->capacity    = size;
+    frame->index       = NULL;
+    frame->index_sz    = 0;
+    frame->is_captured = false;
+    frame->has_defines = false;
+    frame->is_searched = false;
+    frame->next        = g_active_frames;
+    g_active_frames    = frame;
+
+    if (g_frame_stack == NULL)
+        g_frame_stack = mem_alloc(FRAME_STACK_SZ * sizeof(EnvBinding));
+
+    /*
+     * Reserve the bindings from the frame stack if they fit. Otherwise, fall
+     * back to the heap, just like normal environments.
+     */
+    if (size == 0) {
+        frame->bindings    = NULL;
+        frame->stack_slots = 0;
+        frame->on_stack    = false;
+    } else if (g_frame_stack_pos + size <= FRAME_STACK_SZ) {
+        frame->bindings    = &g_frame_stack[g_frame_stack_pos];
+        frame->stack_slots = size;
+        frame->on_stack    = true;
+        g_frame_stack_pos += size;
+    } else {
+        frame->bindings    = mem_alloc(size * sizeof(EnvBinding));
+        frame->stack_slots = 0;
+        frame->on_stack    = false;
+    }
+
+    return frame;
+}
+
+void env_frame_free(Env* frame) {
+    SL_ASSERT(frame != NULL && frame->is_frame);
+    SL_ASSERT(frame == g_active_frames);
+    g_active_frames = frame->next;
+
+    /*
+     * Release the bindings we reserved in the frame stack. Since frames are
+     * freed in LIFO order, they must be at the top of the stack.
+     */
+    SL_ASSERT(frame->stack_slots <= g_frame_stack_pos);
+    g_frame_stack_pos -= frame->stack_slots;
+    frame->stack_slots = 0;
+
+    if (frame->is_captured) {
+        /*
+         * The frame is still used by some lambda. If its bindings were in the
+         * stack, move them to the heap, and let the garbage collector free the
+         * frame once it's not used.
+         */
+        if (frame->on_stack) {
+            EnvBinding* bindings = mem_alloc(frame->size * sizeof(EnvBinding));
+            memcpy(bindings, frame->bindings, frame->size * sizeof(EnvBinding));
+            frame->bindings = bindings;
+            frame->capacity = frame->size;
+            frame->on_stack = false;
+        }
+
+        frame->next       = g_captured_frames;
+        g_captured_frames = frame;
+        return;
+    }
+
+    if (!frame->on_stack)
+        mem_free(frame->bindings);
+    mem_free(frame->index);
+
+    /*
+     * The frame might still be in the remembered set of the garbage collector,
+     * so make sure it doesn't reference the released bindings.
+     */
+    frame->size     = 0;
+    frame->bindings = NULL;
+    frame->index    = NULL;
+    frame->on_stack = false;
+    frame->next     = g_free_frames;
+    g_free_frames   = frame;
+}
+
+Env* env_frame_new_captured(Env* parent) {
+    Env* frame         = env_new();
+    frame->parent      = parent;
+    frame->is_frame    = true;
+    frame->is_captured = true;
+
+    frame->next       = g_captured_frames;
+    g_captured_frames = frame;
+    return frame;
+}
+
+void env_frames_mark_active(void) {
+    for (Env* frame = g_active_frames; frame != NULL; frame = frame->next)
+        gc_mark_env_root(frame);
+}
+
+void env_frames_collect(void) {
+    Env** prev_ptr = &g_captured_frames;
+    while (*prev_ptr != NULL) {
+        Env* frame = *prev_ptr;
+        if (gc_env_is_marked(frame)) {
+            prev_ptr = &frame->next;
+            continue;
+        }
+
+        /*
+         * The inline caches might refer to this frame, and its address might
+         * be reused by another one, see 'EnvCache'.
+         */
+        *prev_ptr = frame->next;
+        env_free(frame);
+        g_env_version++;
+    }
+}
+
+void env_frames_close(void) {
+    while (g_captured_frames != NULL) {
+        Env* frame        = g_captured_frames;
+        g_captured_frames = frame->next;
+        env_free(frame);
+    }
+
+    while (g_free_frames != NULL) {
+        Env* frame    = g_free_frames;
+        g_free_frames = frame->next;
+        mem_free(frame);
+    }
+
+    mem_free(g_frame_stack);
+    g_frame_stack     = NULL;
+    g_frame_stack_pos = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
 enum EEnvErr env_bind(Env* env, const char* sym, Expr* val,
                       enum EEnvBindingFlags flags) {
     SL_ASSERT(env != NULL);
     SL_ASSERT(sym != NULL);
 
     /*
-     * Before creating a new item in the environment, traverse the existing
-     * nodes on the linked list and check if one of the symbols matches what we
-     * are trying to bind. If we find a match, and it's not a constant binding,
-     * overwrite its value and flags.
+     * Before creating a new item in the environment, check if one of the
+     * existing symbols matches what we are trying to bind. If we find a match,
+     * and it's not a constant binding, overwrite its value and flags.
      *
-     * Otherwise, reallocate the `bindings' array, add a clone of the "symbol"
-     * string, add the "value" expression, and the flags we received.
+     * Otherwise, grow the `bindings' array if necessary, add the "symbol"
+     * string, add the "value" expression, and the flags we received. Since
+     * symbols are interned, we can compare and store their pointers directly.
      *
      * Note how, in both cases, we store the value by reference, not by copy.
+     * The only exception are the shared small integers, which are copied so
+     * the binding can be modified with `set', see 'expr_unshare'.
      *
      * NOTE: This method doesn't check for symbols in parent environments,
      * ignoring their flags. In other words, you can overwrite special forms or
      * constants if you are not in the global environment.
      */
-    for (size_t i = 0; i < env->size; i++) {
-        if (strcmp(env->bindings[i].sym, sym) == 0) {
-            if ((env->bindings[i].flags & ENV_FLAG_CONST) != 0)
-                return ENV_ERR_CONST;
+    EnvBinding* binding = env_get_local_binding(env, sym);
+    if (binding != NULL) {
+        if ((binding->flags & ENV_FLAG_CONST) != 0)
+            return ENV_ERR_CONST;
+
+        binding->val   = expr_unshare(val);
+        binding->flags = flags;
+        gc_write_barrier_env(env);
+        return ENV_ERR_NONE;
+    }
 
-            env->bindings[i].val   = val;
-            env->bindings[i].flags = flags;
-            return ENV_ERR_NONE;
+    /*
+     * The array grows geometrically, so the number of reallocations is
+     * logarithmic on the number of bindings.
+     */
+    if (env->size >= env->capacity) {
+        env->capacity = (env->capacity == 0) ? 4 : env->capacity * 2;
+
+        /*
+         * The bindings of an activation frame might be in the frame stack,
+         * where they can't grow. Move them to the heap.
+         */
+        if (env->on_stack) {
+            EnvBinding* bindings = mem_alloc(env->capacity * sizeof(EnvBinding));
+            memcpy(bindings, env->bindings, env->size * sizeof(EnvBinding));
+            env->bindings = bindings;
+            env->on_stack = false;
+        } else {
+            mem_realloc(&env->bindings, env->capacity * sizeof(EnvBinding));
         }
     }
 
+    env->bindings[env->size].sym   = sym;
+    env->bindings[env->size].val   = expr_unshare(val);
+    env->bindings[env->size].flags = flags;
     env->size++;
-    mem_realloc(&env->bindings, env->size * sizeof(EnvBinding));
+    gc_write_barrier_env(env);
 
-    env->bindings[env->size - 1].sym   = mem_strdup(sym);
-    env->bindings[env->size - 1].val   = val;
-    env->bindings[env->size - 1].flags = flags;
+    /*
+     * The new binding might shadow a binding that was cached after searching
+     * this environment, so those caches are no longer valid. Lookups that
+     * start in this environment are checked separately, see 'EnvCache'.
+     */
+    env->has_defines = true;
+    if (env->is_searched) {
+        env->is_searched = false;
+        g_env_version++;
+    }
+
+    /*
+     * Keep the hash index up to date, if the environment is big enough to have
+     * one. The load factor of the index is kept under 1/2.
+     */
+    if (env->index != NULL && env->size * 2 <= env->index_sz) {
+        const size_t slot = env_index_find_slot(env, sym);
+        env->index[slot]  = env->size;
+    } else if (env->size > ENV_INDEX_THRESHOLD) {
+        size_t index_sz = (env->index_sz == 0) ? ENV_INDEX_THRESHOLD * 4
+                                               : env->index_sz * 2;
+        while (env->size * 2 > index_sz)
+            index_sz *= 2;
+        env_index_rebuild(env, index_sz);
+    }
 
     return ENV_ERR_NONE;
 }
 
+void env_frame_bind(Env* frame, const char* sym, Expr* val) {
+    SL_ASSERT(frame != NULL && frame->is_frame);
+    SL_ASSERT(sym != NULL);
+
+    /* Just like in 'env_bind', the arguments might be modified with `set' */
+    val = expr_unshare(val);
+
+    /* The same symbol might appear twice in the formals of a lambda */
+    EnvBinding* binding = env_get_local_binding(frame, sym);
+    if (binding != NULL) {
+        binding->val = val;
+        return;
+    }
+
+    /* The frame was allocated with room for all the formals */
+    SL_ASSERT(frame->size < frame->capacity);
+    frame->bindings[frame->size].sym   = sym;
+    frame->bindings[frame->size].val   = val;
+    frame->bindings[frame->size].flags = ENV_FLAG_NONE;
+    frame->size++;
+}
+
 enum EEnvErr env_bind_global(Env* env, const char* sym, Expr* val,
                              enum EEnvBindingFlags flags) {
     while (env->parent != NULL)
@@ -256,21 +637,17 @@ enum EEnvErr env_bind_global(Env* env, const char* sym, Expr* val,
 
 /*----------------------------------------------------------------------------*/
 
-/*
- * Return a pointer to the binding for the specified symbol in the specified
- * environment.
- */
-static const EnvBinding* env_get_binding(const Env* env, const char* sym) {
+const EnvBinding* env_get_binding(const Env* env, const char* sym) {
     SL_ASSERT(env != NULL);
     SL_ASSERT(sym != NULL);
 
     /*
-     * Iterate the symbol list until we find the one we are looking for, then
-     * return the binding.
+     * Search the symbol in the current environment, either in the hash index
+     * or linearly, and return the binding if we found it.
      */
-    for (size_t i = 0; i < env->size; i++)
-        if (strcmp(env->bindings[i].sym, sym) == 0)
-            return &env->bindings[i];
+    const EnvBinding* binding = env_get_local_binding(env, sym);
+    if (binding != NULL)
+        return binding;
 
     /*
      * We didn't find a value associated to that symbol. If there is a parent
@@ -280,6 +657,45 @@ static const EnvBinding* env_get_binding(const Env* env, const char* sym) {
     return (env->parent == NULL) ? NULL : env_get_binding(env->parent, sym);
 }
 
+const EnvBinding* env_cache_fill(Env* env, const char* sym, EnvCache* cache) {
+    SL_ASSERT(env != NULL);
+    SL_ASSERT(sym != NULL);
+
+    /*
+     * The first environment is different on each use of the cache (e.g. the
+     * activation frame of each call), so we can't cache bindings found there.
+     * If the symbol was not defined there, the cache is still valid.
+     */
+    const EnvBinding* binding = env_get_local_binding(env, sym);
+    if (binding != NULL)
+        return binding;
+    if (cache->version == g_env_version && cache->parent == env->parent)
+        return &cache->env->bindings[cache->pos];
+
+    /*
+     * Search the binding just like 'env_get_binding', but remember the
+     * environment where we found it. Bindings are never removed, so their
+     * position in that environment will stay the same. The environments where
+     * we didn't find it are marked, since a new binding in any of them would
+     * shadow the cached one.
+     */
+    for (Env* cur = env->parent; cur != NULL; cur = cur->parent) {
+        binding = env_get_local_binding(cur, sym);
+        if (binding == NULL) {
+            cur->is_searched = true;
+            continue;
+        }
+
+        cache->parent  = env->parent;
+        cache->env     = cur;
+        cache->pos     = (size_t)(binding - cur->bindings);
+        cache->version = g_env_version;
+        return binding;
+    }
+
+    return NULL;
+}
+
 Expr* env_get(const Env* env, const char* sym) {
     const EnvBinding* binding = env_get_binding(env, sym);
     if (binding == NULL)
@@ -293,6 +709,26 @@ enum EEnvBindingFlags env_get_flags(const Env* env, const char* sym) {
     return (binding == NULL) ? ENV_FLAG_NONE : binding->flags;
 }
 
+size_t env_primitive_index(const Primitive* prim) {
+    for (size_t i = 0; i < g_primitives_num; i++)
+        if (g_primitives[i] == prim)
+            return i;
+
+    SL_FATAL("Primitive at %p was not bound by 'env_init_defaults'.",
+             (const void*)prim);
+}
+
+size_t env_primitive_num(void) {
+    return g_primitives_num;
+}
+
+const Primitive* env_primitive_get(size_t index, const char** name) {
+    SL_ASSERT(index < g_primitives_num);
+    if (name != NULL)
+        *name = g_primitive_names[index];
+    return g_primitives[index];
+}
+
 /*----------------------------------------------------------------------------*/
 
 void env_print(FILE* fp, const Env* env) {
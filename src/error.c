@@ -53,25 +53,23 @@ Expr* err(const char* fmt, ...) {
     vsnprintf(result, data_size + 1, fmt, va);
     va_end(va);
 
-    Expr* ret  = expr_new(EXPR_ERR);
-    ret->val.s = result;
-    return ret;
+    return expr_new_str(EXPR_ERR, result);
 }
 
 void err_print(FILE* fp, const Expr* e) {
     SL_ASSERT(e != NULL);
     SL_ASSERT(EXPR_ERR_P(e));
-    SL_ASSERT(e->val.s != NULL);
+    SL_ASSERT(expr_str(e) != NULL);
 
 #ifdef SL_NO_COLOR
-    fprintf(fp, "Error: %s", e->val.s);
+    fprintf(fp, "Error: %s", expr_str(e));
 #else  /* not SL_NO_COLOR) */
     fprintf(fp,
             "%sError%s: %s%s%s",
             COL_BOLD_RED,
             COL_RESET,
             COL_NORM_YELLOW,
-            e->val.s,
+            expr_str(e),
             COL_RESET);
 #endif /* not SL_NO_COLOR */
 }
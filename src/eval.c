@@ -25,9 +25,12 @@
 #include "include/expr.h"
 #include "include/lambda.h"
 #include "include/util.h"
+#include "include/memory.h"
+#include "include/garbage_collector.h"
 #include "include/debug.h"
 #include "include/eval.h"
 #include "include/primitives.h"
+#include "include/vm.h"
 
 /*
  * NOTE: Make sure we only allocate when we are sure the expression will be
@@ -36,12 +39,23 @@
  */
 
 /*
- * Is this expression a special form symbol?
+ * Marker returned by 'eval_tail', and the environment and expression that
+ * should be evaluated in tail position by the caller.
  */
-static inline bool is_special_form(const Env* env, const Expr* e) {
-    return EXPR_SYMBOL_P(e) && e->val.s != NULL &&
-           (env_get_flags(env, e->val.s) & ENV_FLAG_SPECIAL) != 0;
-}
+static Expr g_tail_marker;
+static Env* g_tail_env   = NULL;
+static Expr* g_tail_expr = NULL;
+
+/*
+ * Buffer where the arguments of vector primitives (see 'PrimitiveVecPtr') and
+ * lambdas are evaluated, shared by all (possibly nested) calls to 'eval'. Since
+ * it can be reallocated, we always store positions instead of pointers.
+ */
+static Expr** g_args     = NULL;
+static size_t g_args_sz  = 0;
+static size_t g_args_pos = 0;
+
+/*----------------------------------------------------------------------------*/
 
 /*
  * Evaluate each expression in a list by calling 'eval', and return another list
@@ -57,6 +71,10 @@ static Expr* eval_list(Env* env, Expr* list) {
     dummy_copy.val.pair.cdr = g_nil;
     Expr* cur_copy          = &dummy_copy;
 
+    /* The list we are building is not reachable from anywhere else */
+    const size_t roots = gc_roots_save();
+    gc_root(&dummy_copy.val.pair.cdr);
+
     for (; !expr_is_nil(list); list = CDR(list)) {
         /*
          * Evaluate each argument. If one of them returns an error, propagate it
@@ -66,144 +84,381 @@ static Expr* eval_list(Env* env, Expr* list) {
          * argument in our linked list.
          */
         Expr* evaluated = eval(env, CAR(list));
-        if (EXPR_ERR_P(evaluated))
+        if (EXPR_ERR_P(evaluated)) {
+            gc_roots_restore(roots);
             return evaluated;
+        }
 
+        /*
+         * The previous pair might have become old while evaluating, so we need
+         * a write barrier. The dummy pair is not in the pool.
+         */
         CDR(cur_copy) = expr_new(EXPR_PAIR);
+        if (cur_copy != &dummy_copy)
+            gc_write_barrier(cur_copy);
         cur_copy      = CDR(cur_copy);
         CAR(cur_copy) = evaluated;
         CDR(cur_copy) = g_nil;
     }
 
+    gc_roots_restore(roots);
     return dummy_copy.val.pair.cdr;
 }
 
+static inline void args_push(Expr* e) {
+    if (g_args_pos >= g_args_sz) {
+        g_args_sz = (g_args_sz == 0) ? EVAL_ARGS_BASE_SZ : g_args_sz * 2;
+        mem_realloc(&g_args, g_args_sz * sizeof(Expr*));
+    }
+    g_args[g_args_pos++] = e;
+}
+
 /*
- * Evaluate a list expression as a function call, applying the (evaluated) `car'
- * to the `cdr'. This function is responsible for evaluating the arguments
- * (using 'eval_list') before applying the function, if necessary.
+ * Evaluate each expression in a list, just like 'eval_list', but push the
+ * results to the 'g_args' buffer instead of allocating a new list. Returns NULL
+ * on success, or the error returned by 'eval', in which case nothing is left in
+ * the buffer.
  */
-static Expr* eval_function_call(Env* env, Expr* e) {
-#ifdef SL_DEBUG_MAX_CALLSTACK
-    /* First, make sure we are not "overflowing" the call stack. */
-    if (debug_callstack_get_pos() > SL_DEBUG_MAX_CALLSTACK)
-        return err("Stack overflow (exceeded %d nested calls)",
-                   SL_DEBUG_MAX_CALLSTACK);
-#endif /* SL_DEBUG_MAX_CALLSTACK */
+static Expr* eval_argv(Env* env, Expr* list) {
+    SL_ASSERT(expr_is_proper_list(list));
 
-    Expr* car = CAR(e);
-    Expr* cdr = CDR(e);
+    const size_t base = g_args_pos;
+    for (; !expr_is_nil(list); list = CDR(list)) {
+        Expr* evaluated = eval(env, CAR(list));
+        if (EXPR_ERR_P(evaluated)) {
+            g_args_pos = base;
+            return evaluated;
+        }
 
-    /*
-     * Evaluate the expression representing the function. If the evaluation
-     * fails, stop. Note that both the evaluated function and the evaluated list
-     * of arguments is returned as an allocated clone, so we must free them when
-     * we are done.
-     */
-    Expr* func = eval(env, car);
-    if (EXPR_ERR_P(func))
-        return func;
-    SL_EXPECT(EXPR_APPLICABLE_P(func),
-              "Expected function or macro, got '%s'.",
-              exprtype2str(func->type));
+        args_push(evaluated);
+    }
 
-    /*
-     * If the 'g_debug_trace_list' variable contains this (evaluated) function,
-     * we should print its trace below.
-     */
-    const bool should_print_trace = debug_is_traced_function(func);
+    return NULL;
+}
 
-    /*
-     * Normally, we should evaluate each of the arguments before applying the
-     * function. However, this step is skipped if:
-     *   - There are no arguments.
-     *   - The function is a special form.
-     *   - The function is a macro.
-     * This boolean will be used when evaluating and freeing.
-     */
-    const bool should_eval_args =
-      (!expr_is_nil(cdr) && !is_special_form(env, car) && !EXPR_MACRO_P(func));
+/*
+ * Check if the number of arguments is valid for the specified vector
+ * primitive. Returns NULL if it is, or an error expression otherwise.
+ */
+static Expr* check_arg_num(const Primitive* prim, size_t argc) {
+    if (argc >= prim->min_args && argc <= prim->max_args)
+        return NULL;
 
-    /*
-     * If the arguments should be evaluated, evaluate them. If one of them
-     * didn't evaluate correctly, an error message was printed so we just have
-     * to stop.
-     *
-     * Otherwise, the arguments remain un-evaluated, but should not be freed.
-     */
-    Expr* args;
-    if (should_eval_args) {
-        args = eval_list(env, cdr);
-        if (EXPR_ERR_P(args))
-            return args;
-    } else {
-        args = cdr;
-    }
+    if (prim->min_args == prim->max_args)
+        return err("Expected exactly %zu arguments, got %zu.",
+                   prim->min_args,
+                   argc);
 
-    /*
-     * Push the function into the callstack, and print its trace if necessary.
-     *
-     * We will store the evaluated/unevaluated function depending on whether or
-     * not it was a symbol, but we could add a variable for controlling this.
-     */
-    const Expr* debug_func = EXPR_SYMBOL_P(car) ? car : func;
-    debug_callstack_push(debug_func);
-    if (should_print_trace)
-        debug_trace_print_pre(stdout, car, args);
+    if (prim->max_args == PRIM_VARIADIC)
+        return err("Expected at least %zu arguments, got %zu.",
+                   prim->min_args,
+                   argc);
 
-    /*
-     * Apply the evaluated function to the (potentially) evaluated argument
-     * list.
-     */
-    Expr* applied = apply(env, func, args);
-    if (applied == NULL)
-        applied = err("Unknown error (?)");
+    return err("Expected between %zu and %zu arguments, got %zu.",
+               prim->min_args,
+               prim->max_args,
+               argc);
+}
 
-    /*
-     * Pop the function from the callstack, and print its return value if it's
-     * being traced.
-     */
-    debug_callstack_pop();
-    if (should_print_trace)
-        debug_trace_print_post(stdout, applied);
+/*----------------------------------------------------------------------------*/
 
-    return applied;
+Expr* eval_tail(Env* env, Expr* e) {
+    SL_ASSERT(env != NULL && e != NULL);
+    g_tail_env  = env;
+    g_tail_expr = e;
+    return &g_tail_marker;
+}
+
+Expr* eval_resolve_tail(Expr* e) {
+    return (e == &g_tail_marker) ? eval(g_tail_env, g_tail_expr) : e;
 }
 
 Expr* eval(Env* env, Expr* e) {
     if (e == NULL)
         return NULL;
 
-    switch (e->type) {
-        case EXPR_PAIR: {
-            /* Evaluate the list as a procedure/macro call */
-            SL_EXPECT(expr_is_proper_list(e),
-                      "Expected a proper list for the procedure/macro call.");
-            return eval_function_call(env, e);
+    /*
+     * This function is implemented as a loop, so calls in tail position don't
+     * grow the C stack, nor the Lisp callstack. Instead of calling ourselves
+     * recursively, we overwrite 'env' and 'e' and jump to the next iteration.
+     * Expressions are in tail position when they are the last expression of a
+     * lambda body, the branches of `if', etc. See 'eval_tail'.
+     *
+     * The 'frame' variable contains the activation frame of the last lambda
+     * that we called in tail position, if any. It's owned by this call to
+     * 'eval', and it's released before calling the next lambda, or when
+     * returning.
+     *
+     * The 'pushed' variable indicates whether we pushed a function to the
+     * callstack. Each call in tail position replaces the previous one, so the
+     * depth of the callstack stays constant.
+     *
+     * The expression, the function and the list of arguments might not be
+     * reachable from the environment (e.g. a macro expansion, or a function
+     * that is redefined while evaluating its arguments), so they are
+     * registered as roots for the garbage collector.
+     */
+    Env* frame  = NULL;
+    bool pushed = false;
+    Expr* func  = NULL;
+    Expr* args  = NULL;
+    Expr* result;
+
+    const size_t roots = gc_roots_save();
+    gc_root(&e);
+    gc_root(&func);
+    gc_root(&args);
+
+    for (;;) {
+        func = NULL;
+        args = NULL;
+        gc_safepoint();
+
+        switch (e->type) {
+            case EXPR_PAIR:
+                /* Handled below */
+                break;
+
+            case EXPR_SYMBOL: {
+                /* Symbols evaluate to the bound value in the environment */
+                result = env_get(env, e->val.s);
+                if (result == NULL)
+                    result = err("Unbound symbol: `%s'.", e->val.s);
+                goto done;
+            }
+
+            case EXPR_ERR:
+            case EXPR_NUM_INT:
+            case EXPR_NUM_FLT:
+            case EXPR_STRING:
+            case EXPR_PRIM:
+            case EXPR_LAMBDA:
+            case EXPR_MACRO:
+                /* Not a parent nor a symbol, evaluates to itself */
+                result = e;
+                goto done;
+
+            case EXPR_UNKNOWN:
+                SL_FATAL("Tried to evaluate an expression of type 'Unknown'.");
         }
 
-        case EXPR_SYMBOL: {
-            /* Symbols evaluate to the bound value in the current environment */
-            Expr* val = env_get(env, e->val.s);
-            SL_EXPECT(val != NULL, "Unbound symbol: `%s'.", e->val.s);
-            return val;
+        /*
+         * If we reached this point, evaluate the list as a procedure/macro
+         * call, applying the (evaluated) `car' to the `cdr'.
+         */
+        if (!expr_is_proper_list(e)) {
+            result = err("Expected a proper list for the procedure/macro call.");
+            goto done;
         }
 
-        case EXPR_ERR:
-        case EXPR_NUM_INT:
-        case EXPR_NUM_FLT:
-        case EXPR_STRING:
-        case EXPR_PRIM:
-        case EXPR_LAMBDA:
-        case EXPR_MACRO:
-            /* Not a parent nor a symbol, evaluates to itself */
-            return e;
-
-        case EXPR_UNKNOWN:
-            SL_FATAL("Tried to evaluate an expression of type 'Unknown'.");
+#ifdef SL_DEBUG_MAX_CALLSTACK
+        /* First, make sure we are not "overflowing" the call stack. */
+        if (debug_callstack_get_pos() > SL_DEBUG_MAX_CALLSTACK) {
+            result = err("Stack overflow (exceeded %d nested calls)",
+                         SL_DEBUG_MAX_CALLSTACK);
+            goto done;
+        }
+#endif /* SL_DEBUG_MAX_CALLSTACK */
+
+        Expr* car = CAR(e);
+        Expr* cdr = CDR(e);
+
+        /*
+         * Evaluate the expression representing the function. If the
+         * evaluation fails, stop.
+         *
+         * If it's a symbol, we look up its binding directly, since we also
+         * need its flags for checking if it's a special form.
+         */
+        bool is_special_form;
+        if (EXPR_SYMBOL_P(car)) {
+            const EnvBinding* binding = env_get_binding(env, car->val.s);
+            if (binding == NULL) {
+                result = err("Unbound symbol: `%s'.", car->val.s);
+                goto done;
+            }
+            func            = binding->val;
+            is_special_form = (binding->flags & ENV_FLAG_SPECIAL) != 0;
+        } else {
+            func = eval(env, car);
+            if (EXPR_ERR_P(func)) {
+                result = func;
+                goto done;
+            }
+            is_special_form = false;
+        }
+        if (!EXPR_APPLICABLE_P(func)) {
+            result = err("Expected function or macro, got '%s'.",
+                         exprtype2str(func->type));
+            goto done;
+        }
+
+        /*
+         * If the 'g_debug_trace_list' variable contains this (evaluated)
+         * function, we should print its trace below.
+         */
+        const bool should_print_trace = debug_is_traced_function(func);
+
+        /*
+         * Normally, we should evaluate each of the arguments before applying
+         * the function. However, this step is skipped if:
+         *   - There are no arguments.
+         *   - The function is a special form.
+         *   - The function is a macro.
+         */
+        const bool should_eval_args =
+          (!expr_is_nil(cdr) && !is_special_form &&
+           !EXPR_MACRO_P(func));
+
+        /*
+         * Vector primitives and lambdas receive their arguments in the
+         * 'g_args' buffer, so we don't have to allocate a list for them. The
+         * arguments start at 'args_base'. Traced functions always receive a
+         * list, since it's printed.
+         */
+        const bool use_argv =
+          !should_print_trace &&
+          (EXPR_LAMBDA_P(func) ||
+           (EXPR_PRIM_P(func) && func->val.prim->vec_func != NULL));
+        const size_t args_base = g_args_pos;
+
+        /*
+         * If the arguments should be evaluated, evaluate them. If one of them
+         * didn't evaluate correctly, an error message was printed so we just
+         * have to stop.
+         */
+        if (use_argv) {
+            args = eval_argv(env, cdr);
+            if (args != NULL) {
+                result = args;
+                goto done;
+            }
+        } else if (should_eval_args) {
+            args = eval_list(env, cdr);
+            if (EXPR_ERR_P(args)) {
+                result = args;
+                goto done;
+            }
+        } else {
+            args = cdr;
+        }
+
+        /*
+         * Push the function into the callstack, replacing the function we
+         * pushed in the previous iteration, if any.
+         *
+         * We will store the evaluated/unevaluated function depending on whether
+         * or not it was a symbol, but we could add a variable for controlling
+         * this.
+         */
+        if (pushed)
+            debug_callstack_pop();
+        debug_callstack_push(EXPR_SYMBOL_P(car) ? car : func);
+        pushed = true;
+
+        /*
+         * Traced functions are applied normally (i.e. not in tail position),
+         * since we need to print their return value.
+         */
+        if (should_print_trace) {
+            debug_trace_print_pre(stdout, car, args);
+            result = apply(env, func, args);
+            debug_trace_print_post(stdout, result);
+            goto done;
+        }
+
+        switch (func->type) {
+            case EXPR_PRIM: {
+                /*
+                 * Call the primitive C function. Some special forms (e.g. `if')
+                 * return the marker from 'eval_tail', indicating that we should
+                 * evaluate an expression in tail position.
+                 */
+                if (use_argv) {
+                    result = apply_argv(env,
+                                        func,
+                                        g_args_pos - args_base,
+                                        &g_args[args_base]);
+                    g_args_pos = args_base;
+                } else {
+                    result = func->val.prim->list_func(env, args);
+                }
+                if (result == &g_tail_marker) {
+                    env = g_tail_env;
+                    e   = g_tail_expr;
+                    continue;
+                }
+                if (result == NULL)
+                    result = err("Unknown error (?)");
+                goto done;
+            }
+
+            case EXPR_MACRO: {
+                /*
+                 * Calling a macro is just evaluating its expansion, which is in
+                 * tail position. The expansion is memoized for this form, so
+                 * macro calls in loops are only expanded once.
+                 */
+                Expr* expansion = macro_expand_cached(env, func, e);
+                if (EXPR_ERR_P(expansion)) {
+                    result = expansion;
+                    goto done;
+                }
+                e = expansion;
+                continue;
+            }
+
+            case EXPR_LAMBDA: {
+                /*
+                 * Since the arguments were already evaluated, we don't need the
+                 * frame of the previous lambda anymore (unless it was captured,
+                 * which is handled by 'env_frame_free'). Release it before
+                 * creating the new one, so the frame stack doesn't grow.
+                 */
+                LambdaCtx* ctx = func->val.lambda;
+                if (frame != NULL) {
+                    env_frame_free(frame);
+                    frame = NULL;
+                }
+
+                Expr* bind_err = lambdactx_bind_argv(ctx,
+                                                     g_args_pos - args_base,
+                                                     &g_args[args_base],
+                                                     &frame);
+                g_args_pos = args_base;
+                if (bind_err != NULL) {
+                    result = bind_err;
+                    goto done;
+                }
+
+                /*
+                 * Run the compiled body of the lambda. The virtual machine
+                 * might ask us to evaluate the last expression, which is in
+                 * tail position.
+                 */
+                result = vm_run(func, &frame);
+                if (result == &g_tail_marker) {
+                    env = g_tail_env;
+                    e   = g_tail_expr;
+                    continue;
+                }
+                goto done;
+            }
+
+            default:
+                SL_FATAL("Unhandled applicable type (%s).",
+                         exprtype2str(func->type));
+        }
     }
 
-    SL_FATAL("Reached unexpected point, didn't return from switch.");
+done:
+    if (pushed)
+        debug_callstack_pop();
+    if (frame != NULL)
+        env_frame_free(frame);
+
+    gc_roots_restore(roots);
+    return result;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -223,18 +478,46 @@ Expr* apply(Env* env, Expr* func, Expr* args) {
     SL_ASSERT(EXPR_APPLICABLE_P(func));
     SL_ASSERT(expr_is_proper_list(args));
 
+    const size_t roots = gc_roots_save();
+    gc_root(&func);
+    gc_root(&args);
+
     Expr* result;
     switch (func->type) {
         case EXPR_PRIM: {
             /* Get primitive C function from the expression */
-            PrimitiveFuncPtr primitive = func->val.prim;
+            const Primitive* primitive = func->val.prim;
             SL_ASSERT(primitive != NULL);
 
+            /*
+             * Vector primitives receive the elements of the list in the
+             * 'g_args' buffer.
+             */
+            if (primitive->vec_func != NULL) {
+                const size_t base = g_args_pos;
+                for (; !expr_is_nil(args); args = CDR(args))
+                    args_push(CAR(args));
+
+                result     = apply_argv(env,
+                                        func,
+                                        g_args_pos - base,
+                                        &g_args[base]);
+                g_args_pos = base;
+                break;
+            }
+
             /*
              * Call primitive C function with the evaluated arguments we got
              * from 'eval'.
              */
-            result = primitive(env, args);
+            result = primitive->list_func(env, args);
+
+            /*
+             * Special forms might ask us to evaluate an expression in tail
+             * position, see 'eval_tail'. Since we are not in the main loop of
+             * 'eval', just evaluate it normally.
+             */
+            result = eval_resolve_tail(result);
         } break;
 
         case EXPR_LAMBDA: {
@@ -263,5 +546,40 @@ Expr* apply(Env* env, Expr* func, Expr* args) {
         } break;
     }
 
+    gc_roots_restore(roots);
     return result;
 }
+
+Expr* apply_argv(Env* env, Expr* func, size_t argc, Expr** argv) {
+    SL_ASSERT(env != NULL);
+    SL_ASSERT(func != NULL);
+    SL_ASSERT(EXPR_APPLICABLE_P(func));
+
+    /*
+     * Vector primitives receive the array directly, once we know that the
+     * number of arguments is valid. Any other function needs a list.
+     */
+    if (EXPR_PRIM_P(func) && func->val.prim->vec_func != NULL) {
+        const Primitive* primitive = func->val.prim;
+
+        Expr* arg_err = check_arg_num(primitive, argc);
+        if (arg_err != NULL)
+            return arg_err;
+
+        return primitive->vec_func(env, argc, argv);
+    }
+
+    return apply(env, func, expr_list_from_array(argc, argv));
+}
+
+void eval_mark_roots(void) {
+    for (size_t i = 0; i < g_args_pos; i++)
+        gc_mark_expr(g_args[i]);
+}
+
+void eval_close(void) {
+    mem_free(g_args);
+    g_args     = NULL;
+    g_args_sz  = 0;
+    g_args_pos = 0;
+}
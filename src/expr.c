@@ -27,11 +27,94 @@
 #include "include/lambda.h"
 #include "include/util.h"
 #include "include/memory.h"
+#include "include/symbol.h"
+#include "include/garbage_collector.h"
+
+/*
+ * Storage for the immortal expressions declared in 'expr.h'. Their symbol names
+ * are set in 'env_init_defaults', once the symbol table has been initialized.
+ */
+static Expr g_nil_storage = { .type = EXPR_SYMBOL };
+static Expr g_tru_storage = { .type = EXPR_SYMBOL };
+
+Expr* const g_nil = &g_nil_storage;
+Expr* const g_tru = &g_tru_storage;
+
+/*
+ * Since they are zero-initialized, the small integers that were not returned
+ * yet have the 'EXPR_UNKNOWN' type. See 'expr_new_int'.
+ */
+Expr g_small_ints[EXPR_SMALL_INT_MAX - EXPR_SMALL_INT_MIN + 1];
+
+/*
+ * Set the value of a string or error expression to a copy of the first 'len'
+ * characters of 's'. Short strings are stored inside the expression, and long
+ * ones are allocated in the string heap. See 'Expr'.
+ */
+static void expr_set_str_copy(Expr* e, const char* s, size_t len) {
+    if (len < EXPR_INLINE_STR_SZ) {
+        memcpy(e->val.inline_s, s, len);
+        e->val.inline_s[len] = '\0';
+        e->is_inline         = true;
+        return;
+    }
+
+    e->val.s     = strheap_alloc(s, len)->data;
+    e->is_inline = false;
+}
+
+/*----------------------------------------------------------------------------*/
 
 Expr* expr_new(enum EExprType type) {
-    Expr* ret = pool_alloc_or_expand(POOL_BASE_SZ);
-    ret->type = type;
+    Expr* ret      = pool_alloc_or_expand(POOL_BASE_SZ);
+    ret->type           = type;
+    ret->is_inline      = false;
+    ret->in_macro_cache = false;
     memset(&ret->val, 0, sizeof(ret->val));
+
+    g_expr_pool->stats.num_allocs[exprtype2index(type)]++;
+    return ret;
+}
+
+Expr* expr_new_int(LispInt n) {
+    if (n < EXPR_SMALL_INT_MIN || n > EXPR_SMALL_INT_MAX) {
+        Expr* ret  = expr_new(EXPR_NUM_INT);
+        ret->val.n = n;
+        return ret;
+    }
+
+    Expr* ret = &g_small_ints[n - EXPR_SMALL_INT_MIN];
+    if (ret->type == EXPR_UNKNOWN) {
+        ret->type  = EXPR_NUM_INT;
+        ret->val.n = n;
+    }
+
+    return ret;
+}
+
+Expr* expr_unshare(Expr* e) {
+    if (e == g_nil || e == g_tru || !expr_is_immortal(e))
+        return e;
+
+    Expr* ret  = expr_new(EXPR_NUM_INT);
+    ret->val.n = e->val.n;
+    return ret;
+}
+
+Expr* expr_new_str(enum EExprType type, char* s) {
+    SL_ASSERT(s != NULL);
+
+    Expr* ret = expr_new_str_copy(type, s, strlen(s));
+    mem_free(s);
+    return ret;
+}
+
+Expr* expr_new_str_copy(enum EExprType type, const char* s, size_t len) {
+    SL_ASSERT(type == EXPR_STRING || type == EXPR_ERR);
+    SL_ASSERT(s != NULL);
+
+    Expr* ret = expr_new(type);
+    expr_set_str_copy(ret, s, len);
     return ret;
 }
 
@@ -39,13 +122,11 @@ void expr_free_heap_members(Expr* e) {
     SL_ASSERT(e != NULL);
 
     switch (e->type) {
+        /* Long strings are owned by the string heap, see 'strheap_sweep' */
         case EXPR_ERR:
-        case EXPR_SYMBOL:
         case EXPR_STRING:
-            if (e->val.s != NULL) {
-                mem_free(e->val.s);
-                e->val.s = NULL;
-            }
+            e->is_inline = false;
+            e->val.s     = NULL;
             break;
 
         case EXPR_LAMBDA:
@@ -56,6 +137,8 @@ void expr_free_heap_members(Expr* e) {
             }
             break;
 
+        /* Symbols are interned, they are owned by the symbol table */
+        case EXPR_SYMBOL:
         case EXPR_UNKNOWN:
         case EXPR_NUM_INT:
         case EXPR_NUM_FLT:
@@ -69,6 +152,16 @@ void expr_free_heap_members(Expr* e) {
 
 void expr_set(Expr* dst, const Expr* src) {
     SL_ASSERT(dst != NULL && src != NULL);
+    SL_ASSERT(!expr_is_immortal(dst));
+
+    /*
+     * We don't know which memoized expansions depend on this expression, so
+     * they are all discarded. Since no entry is left, the flag can be cleared.
+     */
+    if (dst->in_macro_cache) {
+        macro_cache_clear();
+        dst->in_macro_cache = false;
+    }
 
     /* If we were going to overwrite "private" pointers, free them first */
     expr_free_heap_members(dst);
@@ -76,12 +169,10 @@ void expr_set(Expr* dst, const Expr* src) {
     dst->type = src->type;
 
     /*
-     * We have to be careful when setting certain expression types (like strings
-     * or lambdas), because since their values are pointers to the heap and they
-     * will be freed whenever the expression is garbage-collected.
-     *
-     * Even if we had a way of garbage-collecting strings and lambdas, it would
-     * be perhaps more intuitive to still clone these values.
+     * We have to be careful when setting lambdas, because their values are
+     * pointers to the heap and they will be freed whenever the expression is
+     * garbage-collected. Long strings are immutable and owned by the garbage
+     * collector, so they are shared instead.
      */
     switch (src->type) {
         case EXPR_NUM_INT:
@@ -101,10 +192,18 @@ void expr_set(Expr* dst, const Expr* src) {
             dst->val.prim = src->val.prim;
             break;
 
-        case EXPR_ERR:
         case EXPR_SYMBOL:
+            dst->val.s = src->val.s;
+            break;
+
+        case EXPR_ERR:
         case EXPR_STRING:
-            dst->val.s = mem_strdup(src->val.s);
+            if (src->is_inline)
+                memcpy(dst->val.inline_s, src->val.inline_s,
+                       EXPR_INLINE_STR_SZ);
+            else
+                dst->val.s = src->val.s;
+            dst->is_inline = src->is_inline;
             break;
 
         case EXPR_MACRO:
@@ -116,12 +215,21 @@ void expr_set(Expr* dst, const Expr* src) {
             SL_FATAL("Trying to set expression to type 'Unknown'.");
             break;
     }
+
+    /* The destination might be old, and reference young expressions now */
+    gc_write_barrier(dst);
 }
 
 Expr* expr_clone(const Expr* e) {
     if (e == NULL)
         return NULL;
 
+    /* There can only be one instance of `nil' and `tru' */
+    if (expr_is_nil(e))
+        return g_nil;
+    if (e == g_tru || (EXPR_SYMBOL_P(e) && e->val.s == g_sym_tru))
+        return g_tru;
+
     /*
      * Note that, in the case of pairs, since we call 'expr_set', the references
      * are copied instead of cloning the tree recursively. For this purpose, see
@@ -147,11 +255,6 @@ Expr* expr_clone_tree(const Expr* e) {
 
 /*----------------------------------------------------------------------------*/
 
-bool expr_is_nil(const Expr* e) {
-    return e != NULL && EXPR_SYMBOL_P(e) && e->val.s != NULL &&
-           strcmp(e->val.s, "nil") == 0;
-}
-
 bool expr_equal(const Expr* a, const Expr* b) {
     /*
      * If one of them is NULL, they are equal if the other is also NULL. This is
@@ -175,10 +278,12 @@ bool expr_equal(const Expr* a, const Expr* b) {
         case EXPR_NUM_FLT:
             return a->val.f == b->val.f;
 
-        case EXPR_ERR:
         case EXPR_SYMBOL:
+            return a->val.s == b->val.s;
+
+        case EXPR_ERR:
         case EXPR_STRING:
-            return strcmp(a->val.s, b->val.s) == 0;
+            return strcmp(expr_str(a), expr_str(b)) == 0;
 
         case EXPR_PAIR:
             return expr_equal(CAR(a), CAR(b)) && expr_equal(CDR(a), CDR(b));
@@ -220,7 +325,7 @@ bool expr_lt(const Expr* a, const Expr* b) {
         case EXPR_ERR:
         case EXPR_SYMBOL:
         case EXPR_STRING:
-            return strcmp(a->val.s, b->val.s) < 0;
+            return strcmp(expr_str(a), expr_str(b)) < 0;
 
         case EXPR_PAIR:
         case EXPR_PRIM:
@@ -252,7 +357,7 @@ bool expr_gt(const Expr* a, const Expr* b) {
         case EXPR_ERR:
         case EXPR_SYMBOL:
         case EXPR_STRING:
-            return strcmp(a->val.s, b->val.s) > 0;
+            return strcmp(expr_str(a), expr_str(b)) > 0;
 
         case EXPR_PAIR:
         case EXPR_PRIM:
@@ -315,7 +420,13 @@ Expr* expr_nconc(Expr* list, Expr* expr) {
     while (EXPR_PAIR_P(CDR(last_pair)))
         last_pair = CDR(last_pair);
 
+    if (last_pair->in_macro_cache) {
+        macro_cache_clear();
+        last_pair->in_macro_cache = false;
+    }
+
     CDR(last_pair) = expr;
+    gc_write_barrier(last_pair);
     return list;
 }
 
@@ -379,6 +490,46 @@ bool expr_list_has_only_lists(const Expr* list) {
     return true;
 }
 
+bool expr_array_is_homogeneous(size_t argc, Expr* const* argv) {
+    SL_ASSERT(argc > 0);
+
+    const enum EExprType first_type = argv[0]->type;
+    for (size_t i = 1; i < argc; i++)
+        if (argv[i]->type != first_type)
+            return false;
+
+    return true;
+}
+
+bool expr_array_has_only_numbers(size_t argc, Expr* const* argv) {
+    for (size_t i = 0; i < argc; i++)
+        if (!EXPR_NUMBER_P(argv[i]))
+            return false;
+
+    return true;
+}
+
+bool expr_array_has_only_type(size_t argc, Expr* const* argv,
+                              enum EExprType type) {
+    for (size_t i = 0; i < argc; i++)
+        if (argv[i]->type != type)
+            return false;
+
+    return true;
+}
+
+Expr* expr_list_from_array(size_t argc, Expr* const* argv) {
+    Expr* list = g_nil;
+    for (size_t i = argc; i-- > 0;) {
+        Expr* pair = expr_new(EXPR_PAIR);
+        CAR(pair)  = argv[i];
+        CDR(pair)  = list;
+        list       = pair;
+    }
+
+    return list;
+}
+
 /*----------------------------------------------------------------------------*/
 
 /*
@@ -426,11 +577,11 @@ bool expr_print(FILE* fp, const Expr* e) {
             break;
 
         case EXPR_SYMBOL:
-            fprintf(fp, "%s", e->val.s);
+            fprintf(fp, "%s", expr_str(e));
             break;
 
         case EXPR_STRING:
-            print_escaped_str(fp, e->val.s);
+            print_escaped_str(fp, expr_str(e));
             break;
 
         case EXPR_ERR:
@@ -476,11 +627,11 @@ bool expr_write(FILE* fp, const Expr* e) {
             break;
 
         case EXPR_SYMBOL:
-            fprintf(fp, "%s", e->val.s);
+            fprintf(fp, "%s", expr_str(e));
             break;
 
         case EXPR_STRING:
-            print_escaped_str(fp, e->val.s);
+            print_escaped_str(fp, expr_str(e));
             break;
 
         case EXPR_PAIR:
@@ -533,16 +684,16 @@ void expr_print_debug(FILE* fp, const Expr* e) {
         } break;
 
         case EXPR_ERR: {
-            fprintf(fp, "[ERR] \"%s\"\n", e->val.s);
+            fprintf(fp, "[ERR] \"%s\"\n", expr_str(e));
         } break;
 
         case EXPR_SYMBOL: {
-            fprintf(fp, "[SYM] \"%s\"\n", e->val.s);
+            fprintf(fp, "[SYM] \"%s\"\n", expr_str(e));
         } break;
 
         case EXPR_STRING: {
             fprintf(fp, "[STR] ");
-            print_escaped_str(fp, e->val.s);
+            print_escaped_str(fp, expr_str(e));
             fputc('\n', fp);
         } break;
 
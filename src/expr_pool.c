@@ -23,21 +23,24 @@
  * <https://github.com/8dcc/libpool>, along with my blog article
  * <https://8dcc.github.io/programming/pool-allocator.html>.
  *
- * The pool is simply an array of 'PoolItem' structures. This 'PoolItem'
- * structure is a bit different from the one used in the blog article, since it
- * contains the union (with the "next free" pointer and the expression itself),
- * but also a 'flags' member, used for garbage collection. See the enum and
- * structure definitions below for more information.
+ * The pool is a list of arrays of 'PoolItem' unions, each one containing
+ * either an expression or the "next free" pointer. Each array is allocated in
+ * a block aligned to its size, and it starts with an 'ArrayStart' header that
+ * contains bitmaps with the state of each item (free, marked by the garbage
+ * collector). See the structure definitions in the header for more
+ * information.
  */
 
 #include <stddef.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "include/expr_pool.h"
 #include "include/lambda.h"
 #include "include/memory.h"
 #include "include/error.h"
+#include "include/garbage_collector.h"
 
 #include "include/valgrind_valgrind.h"
 #include "include/valgrind_memcheck.h"
@@ -48,25 +51,85 @@
 ExprPool* g_expr_pool = NULL;
 
 /*----------------------------------------------------------------------------*/
-/* Public wrappers */
+/* Static functions */
 
-enum EPoolItemFlags pool_item_flags(const PoolItem* pool_item) {
-    VALGRIND_MAKE_MEM_DEFINED(&pool_item->flags, sizeof(enum EPoolItemFlags));
-    const enum EPoolItemFlags result = pool_item->flags;
-    VALGRIND_MAKE_MEM_NOACCESS(&pool_item->flags, sizeof(enum EPoolItemFlags));
-    return result;
+SL_STATIC_ASSERT(POOL_ARRAY_ITEMS % 64 == 0);
+SL_STATIC_ASSERT(sizeof(ArrayStart) + POOL_ARRAY_ITEMS * sizeof(PoolItem) <=
+                 POOL_ARRAY_BYTES);
+
+static inline void bitmap_set(uint64_t* bitmap, size_t i) {
+    bitmap[i / 64] |= (uint64_t)1 << (i % 64);
 }
 
-void pool_item_flag_set(PoolItem* pool_item, enum EPoolItemFlags flag) {
-    VALGRIND_MAKE_MEM_DEFINED(&pool_item->flags, sizeof(enum EPoolItemFlags));
-    pool_item->flags |= flag;
-    VALGRIND_MAKE_MEM_NOACCESS(&pool_item->flags, sizeof(enum EPoolItemFlags));
+static inline void bitmap_clear(uint64_t* bitmap, size_t i) {
+    bitmap[i / 64] &= ~((uint64_t)1 << (i % 64));
 }
 
-void pool_item_flag_unset(PoolItem* pool_item, enum EPoolItemFlags flag) {
-    VALGRIND_MAKE_MEM_DEFINED(&pool_item->flags, sizeof(enum EPoolItemFlags));
-    pool_item->flags &= ~flag;
-    VALGRIND_MAKE_MEM_NOACCESS(&pool_item->flags, sizeof(enum EPoolItemFlags));
+/*
+ * Allocate a new array of free items, link them together and prepend them to
+ * the list of free items.
+ */
+static void pool_add_array(void) {
+    ArrayStart* array_start = mem_map_aligned(POOL_ARRAY_BYTES,
+                                              POOL_ARRAY_BYTES);
+    PoolItem* arr = (PoolItem*)(array_start + 1);
+
+    /* Link the new free items together */
+    for (size_t i = 0; i < POOL_ARRAY_ITEMS - 1; i++)
+        arr[i].next = &arr[i + 1];
+
+    /* Prepend the new item array to the linked list of free items */
+    arr[POOL_ARRAY_ITEMS - 1].next = g_expr_pool->free_items;
+    g_expr_pool->free_items        = arr;
+
+    /* All items are free. The mapped memory is zeroed, so none is marked. */
+    memset(array_start->free_bits, 0xFF, sizeof(array_start->free_bits));
+
+    /* Prepend to the linked list of array starts */
+    array_start->arr          = arr;
+    array_start->arr_sz       = POOL_ARRAY_ITEMS;
+    array_start->next         = g_expr_pool->array_starts;
+    g_expr_pool->array_starts = array_start;
+    g_expr_pool->items_sz += POOL_ARRAY_ITEMS;
+    g_expr_pool->stats.num_free += POOL_ARRAY_ITEMS;
+    g_expr_pool->stats.num_arrays++;
+
+    VALGRIND_MAKE_MEM_NOACCESS(arr, POOL_ARRAY_ITEMS * sizeof(PoolItem));
+}
+
+/*
+ * Does the specified array have any item marked by the garbage collector?
+ */
+static bool array_has_marks(const ArrayStart* array_start) {
+    for (size_t w = 0; w < POOL_BITMAP_WORDS; w++)
+        if (array_start->mark_bits[w] != 0)
+            return true;
+    return false;
+}
+
+/*
+ * Free the heap members of the used items in the specified array, and return
+ * its memory to the system. The array must not be in any list.
+ */
+static void pool_release_array(ArrayStart* array_start) {
+    size_t num_used = 0;
+    for (size_t w = 0; w < POOL_BITMAP_WORDS; w++) {
+        uint64_t used = ~array_start->free_bits[w];
+        while (used != 0) {
+            const size_t bit = __builtin_ctzll(used);
+            used &= used - 1;
+
+            Expr* e = &array_start->arr[w * 64 + bit].expr;
+            expr_free_heap_members(e);
+            VALGRIND_MEMPOOL_FREE(g_expr_pool, e);
+            num_used++;
+        }
+    }
+
+    g_expr_pool->items_sz -= array_start->arr_sz;
+    g_expr_pool->stats.num_free -= array_start->arr_sz - num_used;
+    g_expr_pool->stats.num_arrays--;
+    mem_unmap(array_start, POOL_ARRAY_BYTES);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -75,56 +138,35 @@ void pool_item_flag_unset(PoolItem* pool_item, enum EPoolItemFlags flag) {
 bool pool_init(size_t pool_sz) {
     SL_ASSERT(g_expr_pool == NULL);
 
-    g_expr_pool   = mem_alloc(sizeof(ExprPool));
-    PoolItem* arr = g_expr_pool->free_items =
-      mem_alloc(pool_sz * sizeof(PoolItem));
+    g_expr_pool               = mem_alloc(sizeof(ExprPool));
+    g_expr_pool->free_items   = NULL;
+    g_expr_pool->array_starts = NULL;
+    g_expr_pool->sweep_cursor = NULL;
+    g_expr_pool->items_sz     = 0;
+    g_expr_pool->growth       = POOL_DEFAULT_GROWTH;
+    memset(&g_expr_pool->stats, 0, sizeof(g_expr_pool->stats));
 
-    for (size_t i = 0; i < pool_sz - 1; i++) {
-        arr[i].val.next = &arr[i + 1];
-        arr[i].flags    = POOL_FLAG_FREE;
-    }
-    arr[pool_sz - 1].val.next = NULL;
-    arr[pool_sz - 1].flags    = POOL_FLAG_FREE;
-
-    g_expr_pool->array_starts         = mem_alloc(sizeof(ArrayStart));
-    g_expr_pool->array_starts->next   = NULL;
-    g_expr_pool->array_starts->arr    = arr;
-    g_expr_pool->array_starts->arr_sz = pool_sz;
+    VALGRIND_CREATE_MEMPOOL(g_expr_pool, 0, 0);
 
-    VALGRIND_MAKE_MEM_NOACCESS(arr, pool_sz * sizeof(PoolItem));
-    VALGRIND_CREATE_MEMPOOL(g_expr_pool, sizeof(enum EPoolItemFlags), 0);
-
-    return true;
+    return pool_expand(pool_sz);
 }
 
 bool pool_expand(size_t extra_sz) {
     SL_ASSERT(g_expr_pool != NULL && extra_sz > 0);
 
-    ArrayStart* array_start = mem_alloc(sizeof(ArrayStart));
-    PoolItem* extra_arr     = mem_alloc(extra_sz * sizeof(PoolItem));
-
-    /* Link the new free items together */
-    for (size_t i = 0; i < extra_sz - 1; i++) {
-        extra_arr[i].val.next = &extra_arr[i + 1];
-        extra_arr[i].flags    = POOL_FLAG_FREE;
-    }
-
-    /* Prepend the new item array to the linked list of free items */
-    extra_arr[extra_sz - 1].val.next = g_expr_pool->free_items;
-    extra_arr[extra_sz - 1].flags    = POOL_FLAG_FREE;
-    g_expr_pool->free_items          = extra_arr;
-
-    /* Prepend to the linked list of array starts */
-    array_start->arr          = extra_arr;
-    array_start->arr_sz       = extra_sz;
-    array_start->next         = g_expr_pool->array_starts;
-    g_expr_pool->array_starts = array_start;
-
-    VALGRIND_MAKE_MEM_NOACCESS(extra_arr, extra_sz * sizeof(PoolItem));
+    const size_t num_arrays =
+      (extra_sz + POOL_ARRAY_ITEMS - 1) / POOL_ARRAY_ITEMS;
+    for (size_t i = 0; i < num_arrays; i++)
+        pool_add_array();
 
     return true;
 }
 
+void pool_set_growth(double growth) {
+    SL_ASSERT(g_expr_pool != NULL && growth > 1.0);
+    g_expr_pool->growth = growth;
+}
+
 void pool_close(void) {
     if (g_expr_pool == NULL)
         return;
@@ -141,17 +183,16 @@ void pool_close(void) {
 
         for (size_t i = 0; i < array_start->arr_sz; i++)
             if (!pool_item_is_free(&array_start->arr[i]))
-                pool_free(&array_start->arr[i].val.expr);
+                pool_free(&array_start->arr[i].expr);
     }
 
     /*
-     * Then we can actually free the expression arrays, along with the
-     * 'ArrayStart' structures themselves.
+     * Then we can actually unmap the expression arrays. The 'ArrayStart'
+     * structures are stored in the same block.
      */
     for (array_start = g_expr_pool->array_starts; array_start != NULL;) {
         ArrayStart* next = array_start->next;
-        mem_free(array_start->arr);
-        mem_free(array_start);
+        mem_unmap(array_start, POOL_ARRAY_BYTES);
         array_start = next;
     }
 
@@ -169,28 +210,56 @@ void pool_close(void) {
 Expr* pool_alloc(void) {
     SL_ASSERT(g_expr_pool != NULL);
 
-    if (g_expr_pool->free_items == NULL)
-        return NULL;
+    /*
+     * If there are no free items, sweep the arrays that were not swept since
+     * the last collection, until one of them has free items.
+     */
+    while (g_expr_pool->free_items == NULL)
+        if (!pool_sweep_step())
+            return NULL;
     VALGRIND_MAKE_MEM_DEFINED(g_expr_pool->free_items, sizeof(PoolItem*));
 
     PoolItem* result        = g_expr_pool->free_items;
-    g_expr_pool->free_items = g_expr_pool->free_items->val.next;
+    g_expr_pool->free_items = g_expr_pool->free_items->next;
 
+    ArrayStart* array_start = array_start_from_item(result);
+    const size_t index      = pool_item_index(array_start, result);
     SL_ASSERT(pool_item_is_free(result));
-    pool_item_flag_unset(result, POOL_FLAG_FREE);
+    bitmap_clear(array_start->free_bits, index);
+    g_expr_pool->stats.num_free--;
 
-    VALGRIND_MEMPOOL_ALLOC(g_expr_pool, &result->val.expr, sizeof(Expr));
+    VALGRIND_MEMPOOL_ALLOC(g_expr_pool, &result->expr, sizeof(Expr));
     VALGRIND_MAKE_MEM_NOACCESS(g_expr_pool->free_items, sizeof(PoolItem*));
 
-    return &result->val.expr;
+    return &result->expr;
 }
 
 Expr* pool_alloc_or_expand(size_t extra_sz) {
     SL_ASSERT(g_expr_pool != NULL);
-    if (g_expr_pool->free_items == NULL && !pool_expand(extra_sz))
-        return NULL;
 
-    return pool_alloc();
+    Expr* result = pool_alloc();
+    if (result == NULL) {
+        gc_pool_exhausted();
+
+        /*
+         * Grow geometrically, so big heaps don't need too many arrays.
+         */
+        const size_t growth_sz =
+          (size_t)(g_expr_pool->items_sz * (g_expr_pool->growth - 1.0));
+        if (growth_sz > extra_sz)
+            extra_sz = growth_sz;
+
+        if (!pool_expand(extra_sz))
+            return NULL;
+        result = pool_alloc();
+    } else if (g_expr_pool->stats.num_free < GC_INCREMENTAL_RESERVE &&
+               g_expr_pool->sweep_cursor == NULL) {
+        gc_pool_low();
+    }
+
+    gc_count_alloc(sizeof(Expr));
+
+    return result;
 }
 
 void pool_free(Expr* e) {
@@ -198,13 +267,15 @@ void pool_free(Expr* e) {
     if (e == NULL)
         return;
 
-    PoolItem* pool_item = pool_item_from_expr(e);
+    PoolItem* pool_item     = pool_item_from_expr(e);
+    ArrayStart* array_start = array_start_from_item(pool_item);
 
     /*
      * Avoid double-frees.
      */
     SL_ASSERT(!pool_item_is_free(pool_item));
-    pool_item_flag_set(pool_item, POOL_FLAG_FREE);
+    bitmap_set(array_start->free_bits, pool_item_index(array_start, pool_item));
+    g_expr_pool->stats.num_free++;
 
     /*
      * Before freeing the expression we have to free its heap members. They are
@@ -213,7 +284,7 @@ void pool_free(Expr* e) {
      */
     expr_free_heap_members(e);
 
-    pool_item->val.next     = g_expr_pool->free_items;
+    pool_item->next         = g_expr_pool->free_items;
     g_expr_pool->free_items = pool_item;
 
     VALGRIND_MEMPOOL_FREE(g_expr_pool, e);
@@ -221,14 +292,208 @@ void pool_free(Expr* e) {
 
 /*----------------------------------------------------------------------------*/
 
+void pool_sweep_start(size_t keep_sz, size_t max_release) {
+    SL_ASSERT(g_expr_pool != NULL);
+
+    /*
+     * The free items of the arrays that haven't been swept can't be allocated
+     * anymore, since any unmarked item in those arrays will be freed once they
+     * are swept. They are added back to the list by 'pool_sweep_step'.
+     */
+    g_expr_pool->free_items = NULL;
+
+    /*
+     * Release the arrays that only contain garbage, if the pool is too big.
+     */
+    ArrayStart** prev_ptr = &g_expr_pool->array_starts;
+    while (*prev_ptr != NULL && g_expr_pool->items_sz > keep_sz &&
+           max_release > 0) {
+        ArrayStart* array_start = *prev_ptr;
+        if (array_has_marks(array_start)) {
+            prev_ptr = &array_start->next;
+            continue;
+        }
+
+        *prev_ptr = array_start->next;
+        pool_release_array(array_start);
+        max_release--;
+    }
+
+    g_expr_pool->sweep_cursor = g_expr_pool->array_starts;
+}
+
+bool pool_sweep_step(void) {
+    SL_ASSERT(g_expr_pool != NULL);
+
+    ArrayStart* a = g_expr_pool->sweep_cursor;
+    if (a == NULL)
+        return false;
+    g_expr_pool->sweep_cursor = a->next;
+
+    const uint64_t start_us = gc_time_us();
+
+    PoolFreeList list = { NULL, NULL, 0 };
+    pool_sweep_array(a, &list);
+    pool_add_free_list(&list);
+
+    g_expr_pool->stats.sweep_us += gc_time_us() - start_us;
+    return true;
+}
+
+void pool_sweep_finish(void) {
+    while (pool_sweep_step())
+        ;
+}
+
+void pool_sweep_array(ArrayStart* a, PoolFreeList* list) {
+    for (size_t w = 0; w < POOL_BITMAP_WORDS; w++) {
+        /*
+         * Free the items that are neither free nor marked, and add them to the
+         * list. Then add the items that were already free.
+         */
+        uint64_t prev_free = a->free_bits[w];
+        uint64_t garbage   = ~(prev_free | a->mark_bits[w]);
+        uint64_t all_free  = prev_free | garbage;
+        a->free_bits[w]    = all_free;
+        list->num_freed += __builtin_popcountll(garbage);
+
+        while (garbage != 0) {
+            const size_t bit = __builtin_ctzll(garbage);
+            garbage &= garbage - 1;
+
+            /*
+             * Before freeing the expression we have to free its heap members,
+             * see 'pool_free'.
+             */
+            Expr* e = &a->arr[w * 64 + bit].expr;
+            expr_free_heap_members(e);
+            VALGRIND_MEMPOOL_FREE(g_expr_pool, e);
+        }
+
+        while (all_free != 0) {
+            const size_t bit = __builtin_ctzll(all_free);
+            all_free &= all_free - 1;
+
+            PoolItem* pool_item = &a->arr[w * 64 + bit];
+            VALGRIND_MAKE_MEM_DEFINED(pool_item, sizeof(PoolItem*));
+            pool_item->next = list->head;
+            VALGRIND_MAKE_MEM_NOACCESS(pool_item, sizeof(PoolItem*));
+
+            list->head = pool_item;
+            if (list->tail == NULL)
+                list->tail = pool_item;
+        }
+    }
+}
+
+void pool_add_free_list(const PoolFreeList* list) {
+    SL_ASSERT(g_expr_pool != NULL);
+
+    g_expr_pool->stats.num_free += list->num_freed;
+
+    if (list->head == NULL)
+        return;
+
+    VALGRIND_MAKE_MEM_DEFINED(list->tail, sizeof(PoolItem*));
+    list->tail->next        = g_expr_pool->free_items;
+    g_expr_pool->free_items = list->head;
+    VALGRIND_MAKE_MEM_NOACCESS(list->tail, sizeof(PoolItem*));
+}
+
+void pool_sweep_stop(void) {
+    SL_ASSERT(g_expr_pool != NULL);
+    g_expr_pool->sweep_cursor = NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+
+size_t pool_count_marked_arrays(void) {
+    SL_ASSERT(g_expr_pool != NULL);
+
+    size_t result = 0;
+    for (ArrayStart* a = g_expr_pool->array_starts; a != NULL; a = a->next)
+        if (array_has_marks(a))
+            result++;
+    return result;
+}
+
+ArrayStart* pool_detach_arrays(void) {
+    SL_ASSERT(g_expr_pool != NULL);
+
+    ArrayStart* result        = g_expr_pool->array_starts;
+    g_expr_pool->array_starts = NULL;
+    g_expr_pool->sweep_cursor = NULL;
+    g_expr_pool->free_items   = NULL;
+    return result;
+}
+
+Expr* pool_move(Expr* e) {
+    SL_ASSERT(g_expr_pool != NULL);
+
+    PoolItem* old_item      = pool_item_from_expr(e);
+    ArrayStart* array_start = array_start_from_item(old_item);
+    const size_t index      = pool_item_index(array_start, old_item);
+    SL_ASSERT(!pool_item_is_free(old_item));
+
+    /*
+     * The new arrays are only added once the previous one is full, so the
+     * moved expressions are stored next to each other.
+     */
+    Expr* result = pool_alloc();
+    if (result == NULL) {
+        pool_expand(POOL_ARRAY_ITEMS);
+        result = pool_alloc();
+    }
+
+    *result = *e;
+    pool_item_set_gcmarked(pool_item_from_expr(result));
+
+    /*
+     * The old item is freed without freeing its heap members, and it keeps its
+     * mark so it's recognized by 'pool_item_is_moved'.
+     */
+    bitmap_set(array_start->free_bits, index);
+    bitmap_set(array_start->mark_bits, index);
+    g_expr_pool->stats.num_free++;
+    VALGRIND_MEMPOOL_FREE(g_expr_pool, e);
+
+    VALGRIND_MAKE_MEM_DEFINED(old_item, sizeof(PoolItem*));
+    old_item->next = pool_item_from_expr(result);
+    VALGRIND_MAKE_MEM_NOACCESS(old_item, sizeof(PoolItem*));
+
+    return result;
+}
+
+Expr* pool_moved_to(Expr* e) {
+    PoolItem* pool_item = pool_item_from_expr(e);
+    SL_ASSERT(pool_item_is_moved(pool_item));
+
+    VALGRIND_MAKE_MEM_DEFINED(pool_item, sizeof(PoolItem*));
+    PoolItem* result = pool_item->next;
+    VALGRIND_MAKE_MEM_NOACCESS(pool_item, sizeof(PoolItem*));
+
+    return &result->expr;
+}
+
+void pool_release_arrays(ArrayStart* list) {
+    SL_ASSERT(g_expr_pool != NULL);
+
+    while (list != NULL) {
+        ArrayStart* next = list->next;
+        pool_release_array(list);
+        list = next;
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
 void pool_print_stats(FILE* fp) {
     size_t total_free = 0, total_items = 0, total_arrays = 0;
 
     for (ArrayStart* a = g_expr_pool->array_starts; a != NULL; a = a->next) {
         size_t num_free = 0;
-        for (size_t i = 0; i < a->arr_sz; i++)
-            if (pool_item_is_free(&a->arr[i]))
-                num_free++;
+        for (size_t i = 0; i < POOL_BITMAP_WORDS; i++)
+            num_free += __builtin_popcountll(a->free_bits[i]);
 
         fprintf(fp,
                 "Array %zu: %zu/%zu free.\n",
@@ -255,11 +520,12 @@ void pool_dump(FILE* fp) {
         for (size_t i = 0; i < a->arr_sz; i++) {
             const PoolItem* pool_item = &a->arr[i];
             fprintf(fp,
-                    "[%p] [%zu,%3zu] [F: %X] ",
+                    "[%p] [%zu,%4zu] [%c%c] ",
                     (void*)pool_item,
                     array_count,
                     i,
-                    pool_item_flags(pool_item));
+                    pool_item_is_free(pool_item) ? 'F' : '-',
+                    pool_item_is_gcmarked(pool_item) ? 'M' : '-');
 
             if (pool_item_is_free(pool_item)) {
                 fprintf(fp, "<invalid>");
@@ -270,14 +536,15 @@ void pool_dump(FILE* fp) {
                  * This might fail if this function is called when the current
                  * expression references another free expression.
                  */
-                expr_print(fp, &a->arr[i].val.expr);
+                expr_print(fp, &a->arr[i].expr);
 
                 /* Current expression uses a pointer, also print it */
-                const Expr* e             = &pool_item->val.expr;
+                const Expr* e             = &pool_item->expr;
                 const enum EExprType type = e->type;
-                if (type == EXPR_ERR || type == EXPR_SYMBOL ||
-                    type == EXPR_STRING || type == EXPR_LAMBDA ||
-                    type == EXPR_MACRO)
+                if (!e->is_inline &&
+                    (type == EXPR_ERR || type == EXPR_SYMBOL ||
+                     type == EXPR_STRING || type == EXPR_LAMBDA ||
+                     type == EXPR_MACRO))
                     fprintf(fp, " [%p]", (void*)e->val.s);
             }
 
@@ -16,140 +16,1156 @@
  * this program. If not, see <https://www.gnu.org/licenses/>.
  */
 
+#define _POSIX_C_SOURCE 199309L /* clock_gettime() */
+
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "include/env.h"
 #include "include/expr.h"
 #include "include/expr_pool.h"
+#include "include/string_heap.h"
 #include "include/lambda.h"
+#include "include/compile.h"
 #include "include/util.h"
 #include "include/memory.h"
 #include "include/garbage_collector.h"
 #include "include/error.h"
+#include "include/eval.h"
+#include "include/vm.h"
+#include "include/debug.h"
+#include "include/gc_threads.h"
+#include "include/gc_compact.h"
+
+/*----------------------------------------------------------------------------*/
+/* Globals */
+
+bool g_gc_requested         = false;
+bool g_gc_compact_requested = false;
+size_t g_gc_alloc_bytes     = 0;
+size_t g_gc_trigger         = GC_DEFAULT_BUDGET;
+size_t g_gc_epoch           = 1;
+
+Expr*** g_gc_roots    = NULL;
+size_t g_gc_roots_sz  = 0;
+size_t g_gc_roots_pos = 0;
+
+/* Global environment, see 'gc_set_global_env' */
+static Env* g_global_env = NULL;
+
+/* See 'gc_set_budget', 'gc_set_mode' and 'gc_set_max_pause' */
+static size_t g_gc_budget       = GC_DEFAULT_BUDGET;
+static enum EGcMode g_gc_mode   = GC_MODE_STOP;
+static size_t g_gc_max_pause_us = GC_DEFAULT_MAX_PAUSE_US;
+
+/* See 'gc_set_compact_density' */
+static double g_gc_compact_density = GC_DEFAULT_COMPACT_DENSITY;
 
 /*
- * Mark an environment and its contents as currently in use.
+ * True while the incremental collector is marking, between two calls to
+ * 'gc_run'. The roots are pushed to the mark stack at the start of a
+ * collection with 'g_gc_defer_drain' set, so they are scanned by the following
+ * steps instead of immediately.
  */
-static inline void gc_mark_env(Env* env) {
-    /*
-     * We assume that, if an environment is marked as "used", all of its
-     * expressions have been marked with 'gc_mark_expr' too, just like
-     * 'gc_mark_env_contents' does. In other words, we assume that an
-     * environment (and its contents) can't be "partially" marked.
-     */
-    if (env->is_used)
-        return;
+static bool g_gc_marking     = false;
+static bool g_gc_defer_drain = false;
 
-    env->is_used = true;
-    gc_mark_env_contents(env);
-}
+/*
+ * Set when the pool is about to run out of free items while the incremental
+ * collector is marking, see 'gc_pool_low'.
+ */
+static bool g_gc_finish_marking = false;
+
+/* Number of times the roots were scanned again, see 'gc_mark_incremental' */
+static int g_gc_rescans = 0;
+
+/* Number of old items that trigger a major collection, see 'gc_run' */
+static size_t g_threshold = GC_MIN_THRESHOLD;
 
 /*
- * Mark an environment, its contents and all parent environments until there
- * is no parent left.
+ * Whether the next collection should be a major one, see 'gc_collect', and
+ * whether a major collection was requested and not performed yet, see
+ * 'gc_request_major'.
  */
-static inline void gc_mark_env_and_parents(Env* env) {
-    for (; env != NULL; env = env->parent)
-            gc_mark_env(env);
-}
+static bool g_next_major      = true;
+static bool g_major_requested = false;
 
-/*----------------------------------------------------------------------------*/
+/* Number of bytes allocated since the last major collection */
+static size_t g_major_alloc_bytes = 0;
 
-void gc_unmark_all(void) {
-    for (ArrayStart* a = g_expr_pool->array_starts; a != NULL; a = a->next) {
-        for (size_t i = 0; i < a->arr_sz; i++) {
-            PoolItem* pool_item = &a->arr[i];
-            pool_item_flag_unset(pool_item, POOL_FLAG_GCMARKED);
+/*
+ * Counters returned by 'gc_get_stats', and whether a line is printed after
+ * each collection, see 'gc_set_trace'. The marking time and the number of
+ * pauses of the current collection are only used for the trace.
+ */
+static GcStats g_gc_stats       = { 0 };
+static bool g_gc_trace          = false;
+static uint64_t g_cycle_mark_us = 0;
+static size_t g_cycle_pauses    = 0;
 
-            /*
-             * If the current expression uses a 'LambdaCtx', unmark its
-             * environment and their parents.
-             */
-            if (!pool_item_is_free(pool_item)) {
-                const Expr* e = &pool_item->val.expr;
-
-                /*
-                 * TODO: This check is repeated in 'gc_collect', we should
-                 * abstract it.
-                 */
-                if (e->type == EXPR_LAMBDA || e->type == EXPR_MACRO)
-                    for (Env* env = e->val.lambda->env; env != NULL;
-                         env      = env->parent)
-                        env->is_used = false;
-            }
-        }
+/*
+ * Old expressions and environments that were modified since the last
+ * collection, see 'gc_write_barrier'.
+ */
+static Expr** g_remembered     = NULL;
+static size_t g_remembered_sz  = 0;
+static size_t g_remembered_pos = 0;
+
+static Env** g_remembered_envs     = NULL;
+static size_t g_remembered_envs_sz  = 0;
+static size_t g_remembered_envs_pos = 0;
+
+/*
+ * Stack of expressions and environments that have to be scanned by the marking
+ * phase, see 'gc_mark_push' and 'gc_mark_drain'. Environments are stored with
+ * the lowest bit of the pointer set, see 'GC_MARK_ENV_TAG'.
+ *
+ * The 'num_marked' member counts the expressions that were marked while
+ * scanning the stack. If 'parallel' is true, the stack is used by one of the
+ * threads of the parallel marking, see 'gc_mark_parallel', so the marks are
+ * set atomically.
+ */
+typedef struct MarkStack {
+    void** items;
+    size_t sz;
+    size_t pos;
+    size_t num_marked;
+    bool parallel;
+} MarkStack;
+
+#define GC_MARK_ENV_TAG ((uintptr_t)1)
+
+/*
+ * Mark stack of the main thread. Its 'num_marked' member is the number of
+ * expressions in the pool that are currently marked; marks are only cleared by
+ * 'gc_unmark_all', and only unmarked expressions are freed.
+ */
+static MarkStack g_mark = { NULL, 0, 0, 0, false };
+
+/*
+ * Mark stacks of each thread, and number of threads, for the parallel marking.
+ * See 'gc_set_threads'.
+ */
+static MarkStack* g_thread_stacks = NULL;
+static size_t g_gc_threads        = 1;
+
+/*----------------------------------------------------------------------------*/
+
+static inline void gc_mark_stack_push(MarkStack* st, void* p) {
+    if (st->pos >= st->sz) {
+        st->sz = (st->sz == 0) ? GC_MARK_STACK_BASE_SZ : st->sz * 2;
+        mem_realloc(&st->items, st->sz * sizeof(void*));
     }
+
+    st->items[st->pos++] = p;
 }
 
-void gc_mark_env_contents(Env* env) {
-    SL_ASSERT(env != NULL);
+/*
+ * Push an expression to the mark stack, so it's scanned in the next call to
+ * 'gc_mark_drain'. The expression is not checked here; instead, its pool item
+ * is prefetched, so it's hopefully in the cache when it's popped.
+ */
+static inline void gc_mark_push(MarkStack* st, Expr* e) {
+    if (expr_is_immortal(e))
+        return;
 
-    for (size_t i = 0; i < env->size; i++)
-        gc_mark_expr(env->bindings[i].val);
+    __builtin_prefetch(pool_item_from_expr(e), 1);
+    gc_mark_stack_push(st, e);
 }
 
-void gc_mark_expr(Expr* e) {
-    SL_ASSERT(e != NULL);
+/*
+ * Was the specified environment marked? In parallel, the epoch might be
+ * written by other threads at the same time.
+ */
+static inline bool gc_env_check(const MarkStack* st, Env* env) {
+    if (st->parallel)
+        return __atomic_load_n(&env->gc_epoch, __ATOMIC_RELAXED) == g_gc_epoch;
+    return gc_env_is_marked(env);
+}
 
-    PoolItem* pool_item = pool_item_from_expr(e);
-    if (pool_item_is_gcmarked(pool_item))
+/*
+ * Push an environment to the mark stack, unless it's already marked. Its
+ * contents and its parent will be scanned when it's popped, so marking a
+ * lambda doesn't need to walk its whole environment chain.
+ */
+static inline void gc_mark_push_env(MarkStack* st, Env* env) {
+    if (env == NULL || gc_env_check(st, env))
+        return;
+
+    __builtin_prefetch(env, 1);
+    gc_mark_stack_push(st, (void*)((uintptr_t)env | GC_MARK_ENV_TAG));
+}
+
+/*
+ * Push the parent and the contents of an environment to the mark stack. The
+ * environment itself is not checked or marked here.
+ */
+static void gc_scan_env(MarkStack* st, Env* env) {
+    gc_mark_push_env(st, env->parent);
+    for (size_t i = 0; i < env->size; i++)
+        gc_mark_push(st, env->bindings[i].val);
+}
+
+/*
+ * Mark the contents of a string or error expression, if they are in the string
+ * heap. Strings don't reference anything, so they are never pushed to the mark
+ * stack.
+ */
+static inline void gc_mark_str(const MarkStack* st, const Expr* e) {
+    if (e->is_inline || e->val.s == NULL)
         return;
-    pool_item_flag_set(pool_item, POOL_FLAG_GCMARKED);
 
+    HeapStr* str = strheap_from_data(e->val.s);
+    if (st->parallel)
+        __atomic_store_n(&str->gc_epoch, g_gc_epoch, __ATOMIC_RELAXED);
+    else
+        str->gc_epoch = g_gc_epoch;
+}
+
+/*
+ * Push the expressions referenced by the specified one, except one of them,
+ * which is returned instead so the caller can keep scanning it directly.
+ * Returns NULL if there is nothing left to scan.
+ *
+ * For pairs, the CDR is pushed and the CAR is returned. This way, marking a
+ * list of N elements doesn't need N entries in the mark stack, since the
+ * pushed CDR is popped right after the (usually small) CAR is scanned.
+ */
+static inline Expr* gc_scan_children(MarkStack* st, Expr* e) {
     switch (e->type) {
         case EXPR_PAIR:
-            gc_mark_expr(CAR(e));
-            gc_mark_expr(CDR(e));
-            break;
+            gc_mark_push(st, CDR(e));
+            return CAR(e);
 
         case EXPR_LAMBDA:
         case EXPR_MACRO:
             /*
-             * Mark the environment of the lambda (along with all parents) and
-             * its body.
+             * Mark the environment of the lambda (along with its parents, once
+             * it's popped) and its body.
              */
-            gc_mark_env_and_parents(e->val.lambda->env);
-            gc_mark_expr(e->val.lambda->body);
+            gc_mark_push_env(st, e->val.lambda->env);
+            return e->val.lambda->body;
+
+        case EXPR_ERR:
+        case EXPR_STRING:
+            gc_mark_str(st, e);
             break;
 
         case EXPR_UNKNOWN:
         case EXPR_NUM_INT:
         case EXPR_NUM_FLT:
-        case EXPR_ERR:
         case EXPR_SYMBOL:
-        case EXPR_STRING:
         case EXPR_PRIM:
             break;
     }
+
+    return NULL;
+}
+
+/*
+ * Mark a single expression, and scan its children with 'gc_scan_children'.
+ * Expressions that were already marked are not scanned again.
+ */
+static inline Expr* gc_mark_scan(MarkStack* st, Expr* e) {
+    if (expr_is_immortal(e))
+        return NULL;
+
+    PoolItem* pool_item = pool_item_from_expr(e);
+    const bool was_marked = st->parallel
+                              ? pool_item_set_gcmarked_atomic(pool_item)
+                              : pool_item_set_gcmarked(pool_item);
+    if (was_marked)
+        return NULL;
+    st->num_marked++;
+
+    return gc_scan_children(st, e);
+}
+
+/*
+ * Pop an expression or an environment from the mark stack, and scan it.
+ */
+static inline void gc_mark_pop(MarkStack* st) {
+    void* p = st->items[--st->pos];
+
+    if (((uintptr_t)p & GC_MARK_ENV_TAG) != 0) {
+        /*
+         * Might have been pushed more than once before being marked. In
+         * parallel, only the thread that changes the epoch scans it.
+         */
+        Env* env = (Env*)((uintptr_t)p & ~GC_MARK_ENV_TAG);
+        if (st->parallel) {
+            if (__atomic_exchange_n(&env->gc_epoch, g_gc_epoch,
+                                    __ATOMIC_RELAXED) == g_gc_epoch)
+                return;
+        } else {
+            if (gc_env_is_marked(env))
+                return;
+            env->gc_epoch = g_gc_epoch;
+        }
+
+        gc_scan_env(st, env);
+        return;
+    }
+
+    Expr* e = p;
+    while (e != NULL)
+        e = gc_mark_scan(st, e);
+}
+
+/*
+ * Function called by each thread of the parallel marking. When the thread runs
+ * out of work, it takes more from the shared pool of 'gc_threads_take'. While
+ * it has work, it periodically checks if any thread is waiting for work, and
+ * if so, it shares the bottom half of its stack, which usually contains the
+ * biggest structures.
+ */
+static void gc_mark_worker(size_t id, void* arg) {
+    (void)arg;
+    MarkStack* st = &g_thread_stacks[id];
+
+    for (;;) {
+        size_t items = 0;
+        while (st->pos > 0) {
+            gc_mark_pop(st);
+
+            if (++items % GC_PARALLEL_SHARE_ITEMS == 0 &&
+                st->pos >= GC_PARALLEL_MIN_SHARE && gc_threads_want_work()) {
+                const size_t half = st->pos / 2;
+                gc_threads_share(st->items, half);
+                memmove(st->items, &st->items[half],
+                        (st->pos - half) * sizeof(void*));
+                st->pos -= half;
+            }
+        }
+
+        if (st->sz < GC_PARALLEL_TAKE_ITEMS) {
+            st->sz = GC_PARALLEL_TAKE_ITEMS;
+            mem_realloc(&st->items, st->sz * sizeof(void*));
+        }
+
+        st->pos = gc_threads_take(st->items, GC_PARALLEL_TAKE_ITEMS);
+        if (st->pos == 0)
+            break;
+    }
+}
+
+/*
+ * Scan the contents of the main mark stack with all the threads of the
+ * collector, until there is nothing left to mark.
+ */
+static void gc_mark_parallel(void) {
+    gc_threads_share(g_mark.items, g_mark.pos);
+    g_mark.pos = 0;
+
+    gc_threads_run(gc_mark_worker, NULL);
+
+    for (size_t i = 0; i < g_gc_threads; i++) {
+        g_mark.num_marked += g_thread_stacks[i].num_marked;
+        g_thread_stacks[i].num_marked = 0;
+    }
+}
+
+/*
+ * Arrays that have to be swept by 'gc_sweep_worker', and the free list of each
+ * thread.
+ */
+typedef struct SweepJob {
+    ArrayStart** arrays;
+    size_t num_arrays;
+    size_t next;
+    PoolFreeList lists[GC_THREADS_MAX];
+} SweepJob;
+
+/*
+ * Function called by each thread of the parallel sweep. Each array is swept by
+ * the thread that increments the 'next' member.
+ */
+static void gc_sweep_worker(size_t id, void* arg) {
+    SweepJob* job      = arg;
+    PoolFreeList* list = &job->lists[id];
+
+    for (;;) {
+        const size_t i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (i >= job->num_arrays)
+            break;
+        pool_sweep_array(job->arrays[i], list);
+    }
+}
+
+/*
+ * Sweep all the arrays of the pool that were not swept yet, using all the
+ * threads of the collector. The free lists of each thread are added to the
+ * pool at the end.
+ */
+static void gc_sweep_parallel(void) {
+    static SweepJob job;
+
+    size_t num_arrays = 0;
+    for (ArrayStart* a = g_expr_pool->sweep_cursor; a != NULL; a = a->next)
+        num_arrays++;
+
+    job.arrays     = mem_alloc(num_arrays * sizeof(ArrayStart*));
+    job.num_arrays = 0;
+    job.next       = 0;
+    for (ArrayStart* a = g_expr_pool->sweep_cursor; a != NULL; a = a->next)
+        job.arrays[job.num_arrays++] = a;
+    pool_sweep_stop();
+
+    for (size_t i = 0; i < g_gc_threads; i++)
+        job.lists[i] = (PoolFreeList){ NULL, NULL, 0 };
+
+    gc_threads_run(gc_sweep_worker, &job);
+
+    for (size_t i = 0; i < g_gc_threads; i++)
+        pool_add_free_list(&job.lists[i]);
+    mem_free(job.arrays);
+}
+
+/*
+ * Should the marking and the sweeping use multiple threads? Parallelism is
+ * only worth it for big heaps.
+ */
+static inline bool gc_use_threads(void) {
+#ifdef SL_GC_STRESS
+    return g_gc_threads > 1;
+#else
+    return g_gc_threads > 1 && g_expr_pool->items_sz >= GC_PARALLEL_MIN_ITEMS;
+#endif
+}
+
+/*
+ * Scan every expression and environment in the mark stack until it's empty.
+ * Since the marking doesn't use recursion, its depth is not limited by the C
+ * stack.
+ */
+static void gc_mark_drain(void) {
+    if (g_gc_defer_drain)
+        return;
+
+    while (g_mark.pos > 0)
+        gc_mark_pop(&g_mark);
+}
+
+/*
+ * Pop an expression or an environment from the mark stack and scan it, like
+ * 'gc_mark_pop', but without following the children of the expression; the
+ * one returned by 'gc_scan_children' is pushed instead. Returns the amount of
+ * work that was performed, see 'GC_INCREMENTAL_CHECK_ITEMS'.
+ */
+static inline size_t gc_mark_pop_bounded(MarkStack* st) {
+    void* p = st->items[st->pos - 1];
+
+    if (((uintptr_t)p & GC_MARK_ENV_TAG) != 0) {
+        const Env* env = (Env*)((uintptr_t)p & ~GC_MARK_ENV_TAG);
+        gc_mark_pop(st);
+        return 1 + env->size;
+    }
+
+    st->pos--;
+    Expr* next = gc_mark_scan(st, p);
+    if (next != NULL)
+        gc_mark_push(st, next);
+    return 1;
+}
+
+/*
+ * Scan the mark stack until it's empty, or until the maximum pause of the
+ * incremental collector has passed since 'start_us'. Returns true if the mark
+ * stack is empty.
+ *
+ * The elapsed time is checked based on the work performed, rather than on the
+ * number of popped items, since scanning a single item with 'gc_mark_pop' can
+ * walk a whole nested list, or push every binding of a big environment.
+ */
+static bool gc_mark_step(uint64_t start_us) {
+    size_t work       = 0;
+    size_t next_check = GC_INCREMENTAL_CHECK_ITEMS;
+    while (g_mark.pos > 0) {
+        work += gc_mark_pop_bounded(&g_mark);
+        if (work < next_check)
+            continue;
+        next_check = work + GC_INCREMENTAL_CHECK_ITEMS;
+
+#ifdef SL_GC_STRESS
+        /* Split the marking into as many steps as possible */
+        SL_UNUSED(start_us);
+        return false;
+#else
+        if (gc_time_us() - start_us >= g_gc_max_pause_us)
+            return false;
+#endif
+    }
+
+    return true;
+}
+
+/*
+ * Scan the children of the old expressions and environments that were
+ * modified since the last collection. They are already marked, so they would
+ * not be scanned otherwise.
+ */
+static void gc_mark_remembered(void) {
+    for (size_t i = 0; i < g_remembered_pos; i++) {
+        Expr* e = g_remembered[i];
+
+        /* Might have been freed explicitly since it was remembered */
+        if (pool_item_is_free(pool_item_from_expr(e)))
+            continue;
+
+        Expr* next = gc_scan_children(&g_mark, e);
+        if (next != NULL)
+            gc_mark_push(&g_mark, next);
+    }
+
+    /*
+     * The parents of the remembered environments are old too, since they were
+     * marked along with them.
+     */
+    for (size_t i = 0; i < g_remembered_envs_pos; i++) {
+        Env* env = g_remembered_envs[i];
+        for (size_t j = 0; j < env->size; j++)
+            gc_mark_push(&g_mark, env->bindings[j].val);
+    }
+
+    gc_mark_drain();
+}
+
+/*
+ * Clear the remembered sets. After a collection, every surviving expression
+ * is old, so there are no references from old expressions to young ones.
+ */
+static void gc_clear_remembered(void) {
+    for (size_t i = 0; i < g_remembered_envs_pos; i++)
+        g_remembered_envs[i]->is_remembered = false;
+
+    g_remembered_pos      = 0;
+    g_remembered_envs_pos = 0;
+}
+
+/*
+ * Mark the expressions in the shadow root stack, see 'gc_root'.
+ */
+static void gc_mark_roots(void) {
+    for (size_t i = 0; i < g_gc_roots_pos; i++)
+        if (*g_gc_roots[i] != NULL)
+            gc_mark_expr(*g_gc_roots[i]);
+}
+
+/*----------------------------------------------------------------------------*/
+
+uint64_t gc_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void gc_roots_grow(void) {
+    g_gc_roots_sz = (g_gc_roots_sz == 0) ? GC_ROOTS_BASE_SZ : g_gc_roots_sz * 2;
+    mem_realloc(&g_gc_roots, g_gc_roots_sz * sizeof(Expr**));
+}
+
+void gc_close(void) {
+    mem_free(g_gc_roots);
+    g_gc_roots     = NULL;
+    g_gc_roots_sz  = 0;
+    g_gc_roots_pos = 0;
+
+    mem_free(g_mark.items);
+    g_mark.items = NULL;
+    g_mark.sz    = 0;
+    g_mark.pos   = 0;
+
+    gc_threads_close();
+    if (g_thread_stacks != NULL)
+        for (size_t i = 0; i < g_gc_threads; i++)
+            mem_free(g_thread_stacks[i].items);
+    mem_free(g_thread_stacks);
+    g_thread_stacks = NULL;
+    g_gc_threads    = 1;
+
+    gc_clear_remembered();
+    mem_free(g_remembered);
+    mem_free(g_remembered_envs);
+    g_remembered         = NULL;
+    g_remembered_sz      = 0;
+    g_remembered_envs    = NULL;
+    g_remembered_envs_sz = 0;
+}
+
+void gc_remember(Expr* e) {
+    /* Avoid remembering the same expression repeatedly, e.g. in a loop */
+    if (g_remembered_pos > 0 && g_remembered[g_remembered_pos - 1] == e)
+        return;
+
+    if (g_remembered_pos >= g_remembered_sz) {
+        g_remembered_sz = (g_remembered_sz == 0) ? GC_ROOTS_BASE_SZ
+                                                 : g_remembered_sz * 2;
+        mem_realloc(&g_remembered, g_remembered_sz * sizeof(Expr*));
+    }
+
+    g_remembered[g_remembered_pos++] = e;
+}
+
+void gc_remember_env(Env* env) {
+    if (g_remembered_envs_pos >= g_remembered_envs_sz) {
+        g_remembered_envs_sz = (g_remembered_envs_sz == 0)
+                                 ? GC_ROOTS_BASE_SZ
+                                 : g_remembered_envs_sz * 2;
+        mem_realloc(&g_remembered_envs, g_remembered_envs_sz * sizeof(Env*));
+    }
+
+    env->is_remembered                       = true;
+    g_remembered_envs[g_remembered_envs_pos++] = env;
+}
+
+void gc_write_barrier_env(Env* env) {
+    /*
+     * Environments are old once they were marked by a collection, just like
+     * expressions. See 'env_frame_new'.
+     */
+    if (gc_env_is_marked(env) && !env->is_remembered)
+        gc_remember_env(env);
+}
+
+void gc_set_global_env(Env* env) {
+    g_global_env = env;
+}
+
+void gc_set_budget(size_t bytes) {
+    SL_ASSERT(bytes > 0);
+    g_gc_budget  = bytes;
+    g_gc_trigger = bytes;
+}
+
+void gc_set_threads(size_t num) {
+    SL_ASSERT(num > 0 && num <= GC_THREADS_MAX);
+    SL_ASSERT(g_thread_stacks == NULL);
+
+    g_gc_threads = num;
+    if (num == 1)
+        return;
+
+    gc_threads_init(num);
+    g_thread_stacks = mem_calloc(num, sizeof(MarkStack));
+    for (size_t i = 0; i < num; i++)
+        g_thread_stacks[i].parallel = true;
+}
+
+void gc_set_mode(enum EGcMode mode) {
+    SL_ASSERT(!g_gc_marking);
+    g_gc_mode = mode;
+}
+
+void gc_set_max_pause(size_t us) {
+    SL_ASSERT(us > 0);
+    g_gc_max_pause_us = us;
+}
+
+void gc_set_trace(bool enabled) {
+    g_gc_trace = enabled;
+}
+
+void gc_set_compact_density(double density) {
+    SL_ASSERT(density >= 0.0 && density <= 1.0);
+    g_gc_compact_density = density;
+}
+
+GcStats gc_get_stats(void) {
+    GcStats result = g_gc_stats;
+    result.sweep_us += g_expr_pool->stats.sweep_us;
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void gc_unmark_all(void) {
+    for (ArrayStart* a = g_expr_pool->array_starts; a != NULL; a = a->next)
+        memset(a->mark_bits, 0, sizeof(a->mark_bits));
+    g_mark.num_marked = 0;
+
+    /*
+     * Environments and heap strings are unmarked by starting a new epoch, so
+     * we don't need to walk them.
+     */
+    g_gc_epoch++;
+}
+
+void gc_mark_env(Env* env) {
+    gc_mark_push_env(&g_mark, env);
+    gc_mark_drain();
+}
+
+void gc_mark_env_root(Env* env) {
+    SL_ASSERT(env != NULL);
+
+    env->gc_epoch = g_gc_epoch;
+    gc_scan_env(&g_mark, env);
+    gc_mark_drain();
+}
+
+void gc_mark_expr(Expr* e) {
+    SL_ASSERT(e != NULL);
+
+    gc_mark_push(&g_mark, e);
+    gc_mark_drain();
+}
+
+/*
+ * Update the number of old items that trigger the next major collection, after
+ * a collection that could free old expressions, in which 'num_used'
+ * expressions survived. See 'gc_collect'.
+ */
+static void gc_update_threshold(size_t num_used) {
+    g_threshold = num_used * GC_HEAP_GROWTH;
+    if (g_threshold < GC_MIN_THRESHOLD)
+        g_threshold = GC_MIN_THRESHOLD;
+    g_major_alloc_bytes = 0;
+}
+
+/*
+ * Request a compaction if the surviving expressions of a major collection are
+ * scattered across too many arrays. See 'gc_set_compact_density'.
+ */
+static void gc_check_fragmentation(size_t num_used) {
+    if (g_gc_compact_density <= 0.0)
+        return;
+
+    const size_t num_arrays = pool_count_marked_arrays();
+    if (num_arrays >= GC_COMPACT_MIN_ARRAYS &&
+        num_used < num_arrays * POOL_ARRAY_ITEMS * g_gc_compact_density)
+        g_gc_compact_requested = true;
+}
+
+bool gc_is_marked(const Expr* e) {
+    SL_ASSERT(e != NULL);
+    return expr_is_immortal(e) ||
+           pool_item_is_gcmarked(pool_item_from_expr((Expr*)e));
 }
 
 void gc_collect(void) {
     /*
-     * Iterate the list of array starts, then iterate the arrays themselves.
+     * The memoized macro expansions are kept as long as their call form is
+     * used. This might mark more expressions, so it's done before freeing.
+     * The bytecode of the bodies that are going to be freed is discarded.
      */
-    for (ArrayStart* a = g_expr_pool->array_starts; a != NULL; a = a->next) {
-        PoolItem* cur_arr = a->arr;
-        for (size_t i = 0; i < a->arr_sz; i++) {
-            const PoolItem* pool_item = &cur_arr[i];
+    macro_cache_collect();
+    bytecode_cache_collect();
 
-            /*
-             * Current expression is either marked, or already free. Ignore.
-             */
-            if (pool_item_is_gcmarked(pool_item) ||
-                pool_item_is_free(pool_item))
-                continue;
+    /*
+     * The unmarked expressions are freed lazily by the pool, as it needs more
+     * free items. See 'pool_sweep_start'. The number of surviving expressions
+     * is used for calculating when the next major collection happens, and how
+     * many items the pool should keep; after a major collection, the arrays
+     * that only contain garbage are released if the pool is bigger than that.
+     * Minor collections don't release memory, since the pool would probably
+     * need to grow again before the next collection.
+     *
+     * Releasing an array needs to scan its items, so the incremental collector
+     * only releases a few of them on each collection, to keep the pause short.
+     */
+    const size_t num_used = g_mark.num_marked;
+    g_gc_stats.num_marked = num_used;
+    pool_sweep_start(g_next_major ? num_used * GC_HEAP_GROWTH +
+                                      g_gc_budget / sizeof(Expr)
+                                  : SIZE_MAX,
+                     (g_gc_mode == GC_MODE_INCREMENTAL)
+                       ? GC_INCREMENTAL_MAX_RELEASE
+                       : SIZE_MAX);
 
-            /*
-             * Current expression is an unmarked lambda, but its environment is
-             * still in use. Keep both.
-             */
-            const Expr* e = &pool_item->val.expr;
-            if ((e->type == EXPR_LAMBDA || e->type == EXPR_MACRO) &&
-                e->val.lambda->env->is_used)
-                continue;
+    /*
+     * With multiple threads, the pool is swept right away after major
+     * collections, since the sweeping can be split across threads. After minor
+     * collections, the garbage is usually in a few arrays, so sweeping lazily
+     * is cheaper.
+     */
+    if (g_next_major && g_gc_mode == GC_MODE_STOP && gc_use_threads())
+        gc_sweep_parallel();
+
+    /*
+     * The unmarked strings are freed right away. Only the strings of unmarked
+     * expressions can be unmarked, and those are never read again.
+     */
+    strheap_sweep(g_next_major);
+
+    /*
+     * Every surviving expression is now old. If there are too many of them,
+     * the next collection will be a major one. The threshold is only updated
+     * after major collections, since those are the ones that can free old
+     * expressions.
+     *
+     * Old expressions might also die without the old generation growing
+     * (e.g. a big list that is no longer used), so a major collection is also
+     * performed once the program allocates as much as the threshold, but never
+     * more often than once every 'GC_MIN_MINORS' collections. The cost of major
+     * collections is still proportional to the allocated memory.
+     */
+    if (g_next_major) {
+        gc_update_threshold(num_used);
+        gc_check_fragmentation(num_used);
+    }
+    g_major_alloc_bytes += g_gc_alloc_bytes;
+
+    size_t major_alloc_limit = g_threshold * sizeof(Expr);
+    if (major_alloc_limit < GC_MIN_MINORS * g_gc_budget)
+        major_alloc_limit = GC_MIN_MINORS * g_gc_budget;
+
+    /* A requested major collection is performed once the current one ends */
+    if (g_next_major)
+        g_major_requested = false;
 
-            pool_free(&cur_arr[i].val.expr);
+    g_next_major = (g_major_requested || num_used >= g_threshold ||
+                    g_major_alloc_bytes >= major_alloc_limit);
+    g_gc_requested   = g_major_requested;
+    g_gc_alloc_bytes = 0;
+    g_gc_trigger     = g_gc_budget;
+
+    /*
+     * Free the captured frames that are not used by any marked lambda, or as
+     * the parent of another used environment.
+     */
+    env_frames_collect();
+}
+
+/*
+ * Mark everything that is reachable from the roots of the garbage collector.
+ */
+static void gc_mark_all_roots(void) {
+    gc_mark_env_root(g_global_env);
+    gc_mark_roots();
+    env_frames_mark_active();
+    eval_mark_roots();
+    vm_mark_roots();
+    debug_callstack_mark();
+}
+
+/*
+ * Start a collection of the incremental collector. The roots are only pushed
+ * to the mark stack, they are scanned by 'gc_mark_step'.
+ */
+static void gc_incremental_start(void) {
+    if (g_next_major) {
+        /*
+         * The arrays that were not swept since the last collection can't be
+         * swept while marking, since their unmarked items would no longer be
+         * garbage. They are swept before clearing the marks (usually by
+         * 'gc_sweep_step'); otherwise their free items could not be used until
+         * this collection finishes, and the pool would have to grow in the
+         * meantime.
+         */
+        pool_sweep_finish();
+        gc_unmark_all();
+
+        /*
+         * The remembered expressions are no longer marked, so they will be
+         * scanned anyway if they are reachable.
+         */
+        gc_clear_remembered();
+    }
+
+    g_gc_defer_drain = true;
+    gc_mark_all_roots();
+    g_gc_defer_drain = false;
+
+    g_gc_marking = true;
+    g_gc_rescans = 0;
+}
+
+/*
+ * Push the roots to the mark stack again, since they are modified without
+ * write barriers, along with the children of the marked expressions that were
+ * modified since the last rescan.
+ */
+static void gc_incremental_rescan(void) {
+    g_gc_defer_drain = true;
+    gc_mark_all_roots();
+    gc_mark_remembered();
+    g_gc_defer_drain = false;
+
+    gc_clear_remembered();
+    g_gc_rescans++;
+}
+
+/*
+ * Sweep the arrays that were not swept since the last collection, until there
+ * are none left, or until the maximum pause of the incremental collector has
+ * passed since 'start_us'. Returns true if every array was swept.
+ */
+static bool gc_sweep_step(uint64_t start_us) {
+    while (pool_sweep_step()) {
+#ifdef SL_GC_STRESS
+        SL_UNUSED(start_us);
+        return false;
+#else
+        if (gc_time_us() - start_us >= g_gc_max_pause_us)
+            return false;
+#endif
+    }
+
+    return true;
+}
+
+/*
+ * Perform the next step of the incremental collector once another part of the
+ * budget has been allocated.
+ */
+static void gc_incremental_pause(void) {
+    g_gc_requested = false;
+    g_gc_trigger   = g_gc_alloc_bytes + g_gc_budget / GC_INCREMENTAL_STEPS;
+}
+
+/*
+ * Perform a step of the incremental marking, see 'gc_run'. Returns true if the
+ * marking is finished, so the collection can be completed.
+ *
+ * Before a major collection, the arrays that were not swept since the last
+ * collection are swept in steps too, see 'gc_incremental_start'.
+ *
+ * Once the mark stack is empty, the roots are scanned again. The marking can
+ * only finish if the expressions that were reachable from them are scanned in
+ * the same step, so the evaluation doesn't modify anything in the meantime.
+ * Otherwise, the next step tries again. After 'GC_INCREMENTAL_MAX_RESCANS'
+ * attempts, the marking is finished without a time limit.
+ */
+static bool gc_mark_incremental(uint64_t start_us) {
+    if (!g_gc_marking) {
+#ifdef SL_GC_STRESS
+        static bool stress_major = false;
+        stress_major = !stress_major;
+        g_next_major = g_next_major || stress_major;
+#endif
+
+        /*
+         * Sweeping the whole pool could take longer than the maximum pause,
+         * so the collection only starts once the previous one has been swept.
+         */
+        if (g_next_major && !g_major_requested && !gc_sweep_step(start_us)) {
+            gc_incremental_pause();
+            return false;
+        }
+
+        gc_incremental_start();
+    }
+
+    /*
+     * If a major collection was requested, or if the pool is running out of
+     * free items, the marking is finished without a time limit. See
+     * 'gc_request_major' and 'gc_pool_low'.
+     */
+    if (g_major_requested || g_gc_finish_marking) {
+        gc_mark_drain();
+        gc_incremental_rescan();
+        gc_mark_drain();
+        g_gc_marking        = false;
+        g_gc_finish_marking = false;
+        return true;
+    }
+
+    bool rescanned = false;
+    for (;;) {
+        if (!gc_mark_step(start_us)) {
+            gc_incremental_pause();
+            return false;
         }
+
+        if (rescanned)
+            break;
+
+        gc_incremental_rescan();
+        rescanned = true;
+
+        if (g_gc_rescans >= GC_INCREMENTAL_MAX_RESCANS) {
+            gc_mark_drain();
+            break;
+        }
+    }
+
+    g_gc_marking = false;
+    return true;
+}
+
+/*
+ * Mark everything that is reachable from the roots in a single pause, see
+ * 'gc_run'.
+ */
+static void gc_mark_stop(void) {
+#ifdef SL_GC_STRESS
+    static bool stress_major = false;
+    stress_major = !stress_major;
+    g_next_major = g_next_major || stress_major;
+#endif
+
+    /*
+     * Major collections clear all marks. Minor collections keep them, but the
+     * contents of the global environment and the active frames are always
+     * scanned, since they are roots and they are modified without write
+     * barriers.
+     */
+    if (g_next_major)
+        gc_unmark_all();
+
+    /*
+     * With multiple threads, the roots are only pushed to the mark stack, and
+     * they are scanned in parallel afterwards.
+     */
+    const bool parallel = gc_use_threads();
+    g_gc_defer_drain    = parallel;
+
+    gc_mark_all_roots();
+    if (!g_next_major)
+        gc_mark_remembered();
+
+    g_gc_defer_drain = false;
+    if (parallel)
+        gc_mark_parallel();
+    gc_clear_remembered();
+}
+
+/*
+ * Print a line describing the collection that just finished, see
+ * 'gc_set_trace'.
+ */
+static void gc_print_trace(bool major, uint64_t sweep_us) {
+    const size_t num_collections = g_gc_stats.num_minor + g_gc_stats.num_major;
+    fprintf(stderr,
+            "[gc] #%zu %s: %zu marked, %zu/%zu items free in %zu arrays, "
+            "%zu string bytes, mark %llu us (%zu pauses), sweep %llu us\n",
+            num_collections,
+            major ? "major" : "minor",
+            g_mark.num_marked,
+            g_expr_pool->stats.num_free,
+            g_expr_pool->items_sz,
+            g_expr_pool->stats.num_arrays,
+            strheap_bytes(),
+            (unsigned long long)g_cycle_mark_us,
+            g_cycle_pauses,
+            (unsigned long long)sweep_us);
+}
+
+void gc_run(void) {
+    SL_ASSERT(g_global_env != NULL);
+
+    const uint64_t start_us = gc_time_us();
+
+    bool finished = true;
+    if (g_gc_mode == GC_MODE_INCREMENTAL)
+        finished = gc_mark_incremental(start_us);
+    else
+        gc_mark_stop();
+
+    const uint64_t mark_end_us = gc_time_us();
+    g_gc_stats.mark_us += mark_end_us - start_us;
+    g_cycle_mark_us += mark_end_us - start_us;
+    g_cycle_pauses++;
+
+    uint64_t end_us = mark_end_us;
+    if (finished) {
+        const bool major = g_next_major;
+        gc_collect();
+
+        end_us = gc_time_us();
+        g_gc_stats.sweep_us += end_us - mark_end_us;
+        if (major)
+            g_gc_stats.num_major++;
+        else
+            g_gc_stats.num_minor++;
+
+        if (g_gc_trace)
+            gc_print_trace(major, end_us - mark_end_us);
+        g_cycle_mark_us = 0;
+        g_cycle_pauses  = 0;
     }
+
+    g_gc_stats.num_pauses++;
+    if (end_us - start_us > g_gc_stats.max_pause_us)
+        g_gc_stats.max_pause_us = end_us - start_us;
+}
+
+void gc_request_major(void) {
+    /*
+     * The type of the current collection can't change while it's marking, so
+     * it's finished first, and the next one is major, see 'gc_collect'.
+     */
+    if (!g_gc_marking)
+        g_next_major = true;
+
+    g_major_requested = true;
+    g_gc_requested    = true;
+}
+
+void gc_pool_exhausted(void) {
+    if (g_expr_pool->items_sz >= g_threshold)
+        g_gc_requested = true;
+}
+
+void gc_pool_low(void) {
+    if (!g_gc_marking)
+        return;
+
+    g_gc_finish_marking = true;
+    g_gc_requested      = true;
+}
+
+void gc_compact(void) {
+    SL_ASSERT(g_global_env != NULL);
+
+    const uint64_t start_us     = gc_time_us();
+    const size_t old_num_arrays = g_expr_pool->stats.num_arrays;
+
+    /*
+     * The compaction finds every reachable expression by itself, so the
+     * collection of the incremental collector (if any) is discarded, along
+     * with the remembered sets.
+     */
+    g_mark.pos          = 0;
+    g_gc_marking        = false;
+    g_gc_finish_marking = false;
+    g_cycle_mark_us     = 0;
+    g_cycle_pauses      = 0;
+    gc_clear_remembered();
+
+    /*
+     * The memoized macro expansions and the cached bytecode are indexed by
+     * the address of their form, so they are discarded, and the macros are
+     * expanded again as needed. The bytecode that is still used by a lambda
+     * is updated along with it, see 'compact_lambda'.
+     */
+    macro_cache_free();
+    bytecode_cache_free();
+
+    gc_unmark_all();
+    g_mark.num_marked = gc_compact_heap(g_global_env);
+
+    /*
+     * Free the strings and the captured frames that were not reached, just
+     * like after a major collection.
+     */
+    strheap_sweep(true);
+    env_frames_collect();
+
+    gc_update_threshold(g_mark.num_marked);
+    g_next_major           = false;
+    g_major_requested      = false;
+    g_gc_requested         = false;
+    g_gc_compact_requested = false;
+    g_gc_alloc_bytes       = 0;
+    g_gc_trigger           = g_gc_budget;
+
+    const uint64_t elapsed_us = gc_time_us() - start_us;
+    g_gc_stats.num_compactions++;
+    g_gc_stats.num_marked = g_mark.num_marked;
+    g_gc_stats.compact_us += elapsed_us;
+
+    if (g_gc_trace)
+        fprintf(stderr,
+                "[gc] compaction: %zu moved, %zu arrays before, %zu after, "
+                "%zu string bytes, %llu us\n",
+                g_mark.num_marked,
+                old_num_arrays,
+                g_expr_pool->stats.num_arrays,
+                strheap_bytes(),
+                (unsigned long long)elapsed_us);
 }
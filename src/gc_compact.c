@@ -0,0 +1,233 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================================================================
+ *
+ * Compaction of the expression pool, used by 'gc_compact'. The live
+ * expressions are moved to new arrays with a copying collection: the roots are
+ * moved first, and then the moved expressions are scanned in the same order
+ * they were moved, moving their children to the end of the new arrays. The
+ * expressions that were moved but not scanned yet act as the queue of a
+ * breadth-first traversal, so no mark stack is needed.
+ *
+ * Each moved item of the old arrays stores the new address of its expression,
+ * see 'pool_move'.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#include "include/gc_compact.h"
+#include "include/garbage_collector.h"
+#include "include/expr_pool.h"
+#include "include/string_heap.h"
+#include "include/env.h"
+#include "include/expr.h"
+#include "include/lambda.h"
+#include "include/compile.h"
+#include "include/memory.h"
+#include "include/error.h"
+
+/*
+ * State of a compaction. The 'arrays' member contains the new arrays, in the
+ * order they were allocated, and 'alloc_end' is the number of items that were
+ * allocated from the last one. The expressions between the position indicated
+ * by 'scan_array' and 'scan_item', and the end of the allocated items, were
+ * moved but not scanned yet.
+ */
+typedef struct Compactor {
+    ArrayStart** arrays;
+    size_t arrays_sz;
+    size_t arrays_num;
+    size_t alloc_end;
+    size_t scan_array;
+    size_t scan_item;
+    size_t num_moved;
+} Compactor;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Register the item that was just allocated by 'pool_move'. Items are
+ * allocated in order, and a new array is only added once the previous one is
+ * full.
+ */
+static void compact_track(Compactor* c, Expr* moved) {
+    PoolItem* pool_item = pool_item_from_expr(moved);
+    ArrayStart* a       = array_start_from_item(pool_item);
+
+    if (c->arrays_num == 0 || c->arrays[c->arrays_num - 1] != a) {
+        if (c->arrays_num >= c->arrays_sz) {
+            c->arrays_sz = (c->arrays_sz == 0) ? GC_COMPACT_ARRAYS_BASE_SZ
+                                               : c->arrays_sz * 2;
+            mem_realloc(&c->arrays, c->arrays_sz * sizeof(ArrayStart*));
+        }
+
+        c->arrays[c->arrays_num++] = a;
+        c->alloc_end               = 0;
+    }
+
+    SL_ASSERT(pool_item_index(a, pool_item) == c->alloc_end);
+    c->alloc_end++;
+    c->num_moved++;
+}
+
+/*
+ * Return the new address of the specified expression, moving it if it was not
+ * moved yet. Expressions that are already in the new arrays are marked, and
+ * they are returned as-is.
+ */
+static Expr* compact_forward(Compactor* c, Expr* e) {
+    if (expr_is_immortal(e))
+        return e;
+
+    PoolItem* pool_item = pool_item_from_expr(e);
+    if (pool_item_is_moved(pool_item))
+        return pool_moved_to(e);
+    if (pool_item_is_gcmarked(pool_item))
+        return e;
+
+    Expr* moved = pool_move(e);
+    compact_track(c, moved);
+    return moved;
+}
+
+/*
+ * Update the bindings of the specified environment and its parents, unless
+ * they were already updated. Environments are not moved, so they are marked
+ * with the current epoch instead, just like in 'gc_mark_env'.
+ */
+static void compact_env(Compactor* c, Env* env) {
+    for (; env != NULL && !gc_env_is_marked(env); env = env->parent) {
+        env->gc_epoch = g_gc_epoch;
+        for (size_t i = 0; i < env->size; i++)
+            env->bindings[i].val = compact_forward(c, env->bindings[i].val);
+    }
+}
+
+/*
+ * Update the members of a lambda or macro. The constants and call sites of the
+ * bytecode point inside the body, so they are moved along with it. The
+ * bytecode might be shared by other lambdas, but forwarding an expression that
+ * was already moved returns it as-is.
+ */
+static void compact_lambda(Compactor* c, LambdaCtx* ctx) {
+    ctx->body = compact_forward(c, ctx->body);
+    compact_env(c, ctx->env);
+
+    Bytecode* bc = ctx->code;
+    if (bc == NULL)
+        return;
+
+    for (size_t i = 0; i < bc->consts_sz; i++)
+        bc->consts[i] = compact_forward(c, bc->consts[i]);
+    for (size_t i = 0; i < bc->sites_sz; i++)
+        bc->sites[i].form = compact_forward(c, bc->sites[i].form);
+}
+
+/*
+ * Update the references of an expression that was just moved, moving the
+ * expressions it points to.
+ */
+static void compact_scan(Compactor* c, Expr* e) {
+    switch (e->type) {
+        case EXPR_PAIR:
+            CAR(e) = compact_forward(c, CAR(e));
+            CDR(e) = compact_forward(c, CDR(e));
+            break;
+
+        case EXPR_LAMBDA:
+        case EXPR_MACRO:
+            compact_lambda(c, e->val.lambda);
+            break;
+
+        case EXPR_ERR:
+        case EXPR_STRING:
+            /* Heap strings are not moved, but they must be marked */
+            if (!e->is_inline && e->val.s != NULL)
+                strheap_from_data(e->val.s)->gc_epoch = g_gc_epoch;
+            break;
+
+        case EXPR_UNKNOWN:
+        case EXPR_NUM_INT:
+        case EXPR_NUM_FLT:
+        case EXPR_SYMBOL:
+        case EXPR_PRIM:
+            break;
+    }
+}
+
+/*
+ * Scan the moved expressions in order, until every expression that was moved
+ * has been scanned.
+ */
+static void compact_scan_all(Compactor* c) {
+    while (c->scan_array < c->arrays_num) {
+        ArrayStart* a = c->arrays[c->scan_array];
+        const bool is_last = (c->scan_array == c->arrays_num - 1);
+        const size_t end   = is_last ? c->alloc_end : a->arr_sz;
+
+        if (c->scan_item >= end) {
+            if (is_last)
+                break;
+
+            c->scan_array++;
+            c->scan_item = 0;
+            continue;
+        }
+
+        compact_scan(c, &a->arr[c->scan_item++].expr);
+    }
+}
+
+/*----------------------------------------------------------------------------*/
+
+size_t gc_compact_heap(Env* env) {
+    SL_ASSERT(env != NULL);
+
+    Compactor c = { NULL, 0, 0, 0, 0, 0, 0 };
+
+    /*
+     * The new arrays are allocated by the pool as usual, once the old ones
+     * are no longer in its list.
+     */
+    ArrayStart* old_arrays = pool_detach_arrays();
+
+    /*
+     * Move the roots. The global environment was unmarked by 'gc_unmark_all',
+     * so it's updated along with the rest.
+     */
+    compact_env(&c, env);
+
+    for (size_t i = 0; i < g_gc_roots_pos; i++)
+        if (*g_gc_roots[i] != NULL)
+            *g_gc_roots[i] = compact_forward(&c, *g_gc_roots[i]);
+
+    if (g_debug_trace_list != NULL)
+        g_debug_trace_list = compact_forward(&c, g_debug_trace_list);
+
+    compact_scan_all(&c);
+
+    /*
+     * Every reachable expression was moved, so the expressions that are left
+     * in the old arrays are garbage.
+     */
+    pool_release_arrays(old_arrays);
+    mem_free(c.arrays);
+
+    return c.num_moved;
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "include/gc_threads.h"
+#include "include/memory.h"
+#include "include/error.h"
+
+/*----------------------------------------------------------------------------*/
+/* Globals */
+
+/* Number of threads, including the main one, and the worker threads */
+static size_t g_num_threads = 1;
+static pthread_t* g_workers = NULL;
+
+/*
+ * The main thread starts a job by setting the function and incrementing
+ * 'g_job_id', and each worker runs it once. The last thread that finishes
+ * signals 'g_done_cond'.
+ */
+static pthread_mutex_t g_lock     = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_job_cond  = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_done_cond = PTHREAD_COND_INITIALIZER;
+static GcThreadFunc g_job_func    = NULL;
+static void* g_job_arg            = NULL;
+static size_t g_job_id            = 0;
+static size_t g_job_pending       = 0;
+static bool g_quit                = false;
+
+/*
+ * Shared work pool, see 'gc_threads_share'. The 'g_idle' counter is the number
+ * of threads waiting in 'gc_threads_take'.
+ */
+static pthread_mutex_t g_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_pool_cond  = PTHREAD_COND_INITIALIZER;
+static void** g_pool               = NULL;
+static size_t g_pool_sz            = 0;
+static size_t g_pool_pos           = 0;
+static size_t g_idle               = 0;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Mark the current job as done by the calling thread.
+ */
+static void job_done(void) {
+    pthread_mutex_lock(&g_lock);
+    if (--g_job_pending == 0)
+        pthread_cond_signal(&g_done_cond);
+    pthread_mutex_unlock(&g_lock);
+}
+
+/*
+ * Main loop of the worker threads. The 'arg' is the thread index.
+ */
+static void* worker_main(void* arg) {
+    const size_t id = (size_t)arg;
+    size_t last_job = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&g_lock);
+        while (!g_quit && g_job_id == last_job)
+            pthread_cond_wait(&g_job_cond, &g_lock);
+        if (g_quit) {
+            pthread_mutex_unlock(&g_lock);
+            break;
+        }
+
+        last_job          = g_job_id;
+        GcThreadFunc func = g_job_func;
+        void* func_arg    = g_job_arg;
+        pthread_mutex_unlock(&g_lock);
+
+        func(id, func_arg);
+        job_done();
+    }
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void gc_threads_init(size_t num_threads) {
+    SL_ASSERT(g_workers == NULL);
+    SL_ASSERT(num_threads > 0 && num_threads <= GC_THREADS_MAX);
+
+    g_num_threads = num_threads;
+    if (num_threads == 1)
+        return;
+
+    g_workers = mem_alloc((num_threads - 1) * sizeof(pthread_t));
+    for (size_t i = 1; i < num_threads; i++) {
+        void* arg = (void*)i;
+        if (pthread_create(&g_workers[i - 1], NULL, worker_main, arg) != 0)
+            SL_FATAL("Failed to create garbage collector thread.");
+    }
+}
+
+void gc_threads_close(void) {
+    if (g_workers != NULL) {
+        pthread_mutex_lock(&g_lock);
+        g_quit = true;
+        pthread_cond_broadcast(&g_job_cond);
+        pthread_mutex_unlock(&g_lock);
+
+        for (size_t i = 1; i < g_num_threads; i++)
+            pthread_join(g_workers[i - 1], NULL);
+
+        mem_free(g_workers);
+        g_workers = NULL;
+        g_quit    = false;
+    }
+
+    mem_free(g_pool);
+    g_pool        = NULL;
+    g_pool_sz     = 0;
+    g_pool_pos    = 0;
+    g_num_threads = 1;
+}
+
+size_t gc_threads_num(void) {
+    return g_num_threads;
+}
+
+void gc_threads_run(GcThreadFunc func, void* arg) {
+    pthread_mutex_lock(&g_lock);
+    g_job_func    = func;
+    g_job_arg     = arg;
+    g_job_pending = g_num_threads;
+    g_job_id++;
+    pthread_cond_broadcast(&g_job_cond);
+    pthread_mutex_unlock(&g_lock);
+
+    func(0, arg);
+    job_done();
+
+    pthread_mutex_lock(&g_lock);
+    while (g_job_pending > 0)
+        pthread_cond_wait(&g_done_cond, &g_lock);
+    pthread_mutex_unlock(&g_lock);
+
+    /* Every thread ran out of work, so the pool is empty */
+    SL_ASSERT(g_pool_pos == 0);
+    g_idle = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+void gc_threads_share(void* const* items, size_t num) {
+    if (num == 0)
+        return;
+
+    pthread_mutex_lock(&g_pool_lock);
+    if (g_pool_pos + num > g_pool_sz) {
+        while (g_pool_pos + num > g_pool_sz)
+            g_pool_sz = (g_pool_sz == 0) ? 1024 : g_pool_sz * 2;
+        mem_realloc(&g_pool, g_pool_sz * sizeof(void*));
+    }
+
+    memcpy(&g_pool[g_pool_pos], items, num * sizeof(void*));
+    g_pool_pos += num;
+    pthread_cond_broadcast(&g_pool_cond);
+    pthread_mutex_unlock(&g_pool_lock);
+}
+
+size_t gc_threads_take(void** dst, size_t max) {
+    SL_ASSERT(max > 0);
+
+    pthread_mutex_lock(&g_pool_lock);
+    __atomic_add_fetch(&g_idle, 1, __ATOMIC_RELAXED);
+
+    /*
+     * Once every thread is waiting and the pool is empty, nobody can add more
+     * work, so we are done.
+     */
+    while (g_pool_pos == 0 && g_idle < g_num_threads)
+        pthread_cond_wait(&g_pool_cond, &g_pool_lock);
+
+    if (g_pool_pos == 0) {
+        pthread_cond_broadcast(&g_pool_cond);
+        pthread_mutex_unlock(&g_pool_lock);
+        return 0;
+    }
+
+    __atomic_sub_fetch(&g_idle, 1, __ATOMIC_RELAXED);
+
+    const size_t num = (g_pool_pos < max) ? g_pool_pos : max;
+    g_pool_pos -= num;
+    memcpy(dst, &g_pool[g_pool_pos], num * sizeof(void*));
+
+    pthread_mutex_unlock(&g_pool_lock);
+    return num;
+}
+
+bool gc_threads_want_work(void) {
+    return __atomic_load_n(&g_idle, __ATOMIC_RELAXED) > 0;
+}
@@ -0,0 +1,977 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * SL. If not, see <https://www.gnu.org/licenses/>.
+ *
+ * ============================================================================
+ *
+ * Heap images, used by the '--dump-image' and '--image' options. See the
+ * layout of the file in "include/image.h".
+ *
+ * When dumping, each expression and environment gets the position of its
+ * record the first time it's referenced, and it's added to a queue. The queues
+ * are scanned in order, so the records are written in the same order as their
+ * positions, just like the compaction in 'gc_compact_heap'. The rest of the
+ * records (symbols, strings, etc.) are written as soon as they are found.
+ */
+
+#define _DEFAULT_SOURCE /* mmap(), fstat() */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "include/image.h"
+#include "include/env.h"
+#include "include/expr.h"
+#include "include/expr_pool.h"
+#include "include/string_heap.h"
+#include "include/lambda.h"
+#include "include/compile.h"
+#include "include/symbol.h"
+#include "include/memory.h"
+#include "include/error.h"
+
+/* The inline strings are copied as-is */
+SL_STATIC_ASSERT(sizeof(((ImageExpr*)NULL)->val.inline_s) ==
+                 EXPR_INLINE_STR_SZ);
+SL_STATIC_ASSERT(sizeof(ImageHeader) % sizeof(uint64_t) == 0);
+
+/*
+ * Initial number of entries in the tables used while dumping an image. Must be
+ * a power of two.
+ */
+#define PTRMAP_BASE_SZ 1024
+
+/*
+ * Size of a single record of each section.
+ */
+static const size_t g_record_sz[IMAGE_SEC_NUM] = {
+    [IMAGE_SEC_CHARS]    = sizeof(char),
+    [IMAGE_SEC_SYMBOLS]  = sizeof(uint64_t),
+    [IMAGE_SEC_PRIMS]    = sizeof(ImagePrim),
+    [IMAGE_SEC_STRINGS]  = sizeof(ImageStr),
+    [IMAGE_SEC_EXPRS]    = sizeof(ImageExpr),
+    [IMAGE_SEC_LAMBDAS]  = sizeof(ImageLambda),
+    [IMAGE_SEC_ENVS]     = sizeof(ImageEnv),
+    [IMAGE_SEC_BINDINGS] = sizeof(ImageBinding),
+    [IMAGE_SEC_WORDS]    = sizeof(uint64_t),
+    [IMAGE_SEC_INSTRS]   = sizeof(ImageInstr),
+    [IMAGE_SEC_SITES]    = sizeof(ImageSite),
+};
+
+/*----------------------------------------------------------------------------*/
+/* Dumping */
+
+/*
+ * Growable buffer with the records of a section.
+ */
+typedef struct ImageBuf {
+    char* data;
+    size_t sz;
+    size_t cap;
+} ImageBuf;
+
+/*
+ * Open-addressing hash table with linear probing, which associates addresses
+ * with the position of their record in the image. Entries are never removed,
+ * so we don't need tombstones.
+ */
+typedef struct PtrMapEntry {
+    const void* key;
+    uint64_t val;
+} PtrMapEntry;
+
+typedef struct PtrMap {
+    PtrMapEntry* entries;
+    size_t sz;
+    size_t num;
+} PtrMap;
+
+/*
+ * State of a dump. The 'exprs' and 'envs' arrays are the queues of expressions
+ * and environments, in the order of their records; the ones after 'exprs_scan'
+ * and 'envs_scan' were found, but their records were not written yet.
+ */
+typedef struct Dumper {
+    ImageBuf secs[IMAGE_SEC_NUM];
+
+    PtrMap expr_map;
+    PtrMap env_map;
+    PtrMap sym_map;
+    PtrMap str_map;
+    PtrMap prim_map;
+
+    const Expr** exprs;
+    size_t exprs_num;
+    size_t exprs_sz;
+    size_t exprs_scan;
+
+    const Env** envs;
+    size_t envs_num;
+    size_t envs_sz;
+    size_t envs_scan;
+} Dumper;
+
+/*
+ * Append 'sz' bytes to the specified section, and return the position of the
+ * first one.
+ */
+static uint64_t buf_append(ImageBuf* buf, const void* data, size_t sz) {
+    if (buf->sz + sz > buf->cap) {
+        size_t new_cap = (buf->cap == 0) ? 4096 : buf->cap * 2;
+        while (buf->sz + sz > new_cap)
+            new_cap *= 2;
+
+        mem_realloc(&buf->data, new_cap);
+        buf->cap = new_cap;
+    }
+
+    const uint64_t result = buf->sz;
+    memcpy(&buf->data[buf->sz], data, sz);
+    buf->sz += sz;
+    return result;
+}
+
+/*
+ * Append a record to the specified section of the image, and return its
+ * position in that section.
+ */
+static uint64_t dump_record(Dumper* d, enum EImageSection sec,
+                            const void* record) {
+    const size_t record_sz = g_record_sz[sec];
+    return buf_append(&d->secs[sec], record, record_sz) / record_sz;
+}
+
+static PtrMapEntry* ptrmap_find(PtrMapEntry* entries, size_t sz,
+                                const void* key) {
+    const size_t mask = sz - 1;
+    size_t i = (size_t)((uintptr_t)key >> 3) * 11400714819323198485ULL & mask;
+    while (entries[i].key != NULL && entries[i].key != key)
+        i = (i + 1) & mask;
+    return &entries[i];
+}
+
+/*
+ * Look for the specified address in the map, writing its value to 'val' if it
+ * was found.
+ */
+static bool ptrmap_get(const PtrMap* map, const void* key, uint64_t* val) {
+    if (map->entries == NULL)
+        return false;
+
+    const PtrMapEntry* entry = ptrmap_find(map->entries, map->sz, key);
+    if (entry->key == NULL)
+        return false;
+
+    *val = entry->val;
+    return true;
+}
+
+/*
+ * Add an address that is not in the map yet. The load factor of the map is
+ * kept under 1/2.
+ */
+static void ptrmap_put(PtrMap* map, const void* key, uint64_t val) {
+    if ((map->num + 1) * 2 > map->sz) {
+        const size_t new_sz = (map->sz == 0) ? PTRMAP_BASE_SZ : map->sz * 2;
+        PtrMapEntry* new_entries = mem_calloc(new_sz, sizeof(PtrMapEntry));
+
+        for (size_t i = 0; i < map->sz; i++)
+            if (map->entries[i].key != NULL)
+                *ptrmap_find(new_entries, new_sz, map->entries[i].key) =
+                  map->entries[i];
+
+        mem_free(map->entries);
+        map->entries = new_entries;
+        map->sz      = new_sz;
+    }
+
+    PtrMapEntry* entry = ptrmap_find(map->entries, map->sz, key);
+    SL_ASSERT(entry->key == NULL);
+    entry->key = key;
+    entry->val = val;
+    map->num++;
+}
+
+/*
+ * Return the offset of a copy of the specified string in 'IMAGE_SEC_CHARS'.
+ */
+static uint64_t dump_chars(Dumper* d, const char* s, size_t len) {
+    const uint64_t result = buf_append(&d->secs[IMAGE_SEC_CHARS], s, len);
+    buf_append(&d->secs[IMAGE_SEC_CHARS], "", 1);
+    return result;
+}
+
+/*
+ * Return the position of the specified interned symbol, writing it if it was
+ * not written yet.
+ */
+static uint64_t dump_sym_ref(Dumper* d, const char* sym) {
+    SL_ASSERT(sym != NULL);
+
+    uint64_t result;
+    if (ptrmap_get(&d->sym_map, sym, &result))
+        return result;
+
+    const uint64_t offset = dump_chars(d, sym, symbol_from_name(sym)->len);
+    result                = dump_record(d, IMAGE_SEC_SYMBOLS, &offset);
+    ptrmap_put(&d->sym_map, sym, result);
+    return result;
+}
+
+/*
+ * Return the position of the specified heap string, writing it if it was not
+ * written yet. The 's' argument is the 'data' member of the 'HeapStr'.
+ */
+static uint64_t dump_str_ref(Dumper* d, const char* s) {
+    uint64_t result;
+    if (ptrmap_get(&d->str_map, s, &result))
+        return result;
+
+    const HeapStr* heap_str = strheap_from_data(s);
+    const ImageStr record   = {
+        .offset = dump_chars(d, s, heap_str->len),
+        .len    = heap_str->len,
+    };
+    result = dump_record(d, IMAGE_SEC_STRINGS, &record);
+    ptrmap_put(&d->str_map, s, result);
+    return result;
+}
+
+/*
+ * Return the position of the specified primitive, writing it if it was not
+ * written yet.
+ */
+static uint64_t dump_prim_ref(Dumper* d, const Primitive* prim) {
+    uint64_t result;
+    if (ptrmap_get(&d->prim_map, prim, &result))
+        return result;
+
+    const char* name;
+    const size_t index = env_primitive_index(prim);
+    env_primitive_get(index, &name);
+
+    const ImagePrim record = {
+        .index = index,
+        .name  = dump_chars(d, name, strlen(name)),
+    };
+    result = dump_record(d, IMAGE_SEC_PRIMS, &record);
+    ptrmap_put(&d->prim_map, prim, result);
+    return result;
+}
+
+/*
+ * Return the reference to the specified expression, adding it to the queue if
+ * it was not found yet. See 'IMAGE_REF_EXPR'.
+ */
+static uint64_t dump_expr_ref(Dumper* d, const Expr* e) {
+    if (e == NULL)
+        return IMAGE_NONE;
+    if (e == g_nil)
+        return IMAGE_REF_IMMORTAL(0);
+    if (e == g_tru)
+        return IMAGE_REF_IMMORTAL(1);
+    if (expr_is_immortal(e))
+        return IMAGE_REF_IMMORTAL(2 + (size_t)(e - g_small_ints));
+
+    uint64_t result;
+    if (ptrmap_get(&d->expr_map, e, &result))
+        return IMAGE_REF_EXPR(result);
+
+    if (d->exprs_num >= d->exprs_sz) {
+        d->exprs_sz = (d->exprs_sz == 0) ? PTRMAP_BASE_SZ : d->exprs_sz * 2;
+        mem_realloc(&d->exprs, d->exprs_sz * sizeof(Expr*));
+    }
+
+    result                   = d->exprs_num;
+    d->exprs[d->exprs_num++] = e;
+    ptrmap_put(&d->expr_map, e, result);
+    return IMAGE_REF_EXPR(result);
+}
+
+/*
+ * Return the position of the specified environment, adding it to the queue if
+ * it was not found yet.
+ */
+static uint64_t dump_env_ref(Dumper* d, const Env* env) {
+    if (env == NULL)
+        return IMAGE_NONE;
+
+    uint64_t result;
+    if (ptrmap_get(&d->env_map, env, &result))
+        return result;
+
+    if (d->envs_num >= d->envs_sz) {
+        d->envs_sz = (d->envs_sz == 0) ? 16 : d->envs_sz * 2;
+        mem_realloc(&d->envs, d->envs_sz * sizeof(Env*));
+    }
+
+    result                 = d->envs_num;
+    d->envs[d->envs_num++] = env;
+    ptrmap_put(&d->env_map, env, result);
+    return result;
+}
+
+/*
+ * Write the record of a lambda or macro context, along with its formals and
+ * its bytecode, and return its position.
+ */
+static uint64_t dump_lambda(Dumper* d, const LambdaCtx* ctx) {
+    ImageLambda record = {
+        .env         = dump_env_ref(d, ctx->env),
+        .body        = dump_expr_ref(d, ctx->body),
+        .formals     = d->secs[IMAGE_SEC_WORDS].sz / sizeof(uint64_t),
+        .formals_num = ctx->formals_num,
+        .formal_rest = (ctx->formal_rest == NULL)
+                         ? IMAGE_NONE
+                         : dump_sym_ref(d, ctx->formal_rest),
+        .code        = IMAGE_NONE,
+    };
+
+    for (size_t i = 0; i < ctx->formals_num; i++) {
+        const uint64_t sym = dump_sym_ref(d, ctx->formals[i]);
+        dump_record(d, IMAGE_SEC_WORDS, &sym);
+    }
+
+    const Bytecode* bc = ctx->code;
+    if (bc != NULL) {
+        record.code    = d->secs[IMAGE_SEC_INSTRS].sz / sizeof(ImageInstr);
+        record.code_sz = bc->code_sz;
+        for (size_t i = 0; i < bc->code_sz; i++) {
+            const ImageInstr instr = { bc->code[i].op, bc->code[i].arg };
+            dump_record(d, IMAGE_SEC_INSTRS, &instr);
+        }
+
+        record.consts    = d->secs[IMAGE_SEC_WORDS].sz / sizeof(uint64_t);
+        record.consts_sz = bc->consts_sz;
+        for (size_t i = 0; i < bc->consts_sz; i++) {
+            const uint64_t ref = dump_expr_ref(d, bc->consts[i]);
+            dump_record(d, IMAGE_SEC_WORDS, &ref);
+        }
+
+        record.sites    = d->secs[IMAGE_SEC_SITES].sz / sizeof(ImageSite);
+        record.sites_sz = bc->sites_sz;
+        for (size_t i = 0; i < bc->sites_sz; i++) {
+            const ImageSite site = {
+                .form    = dump_expr_ref(d, bc->sites[i].form),
+                .argc    = bc->sites[i].argc,
+                .end     = bc->sites[i].end,
+                .tail    = bc->sites[i].tail,
+                .special = (bc->sites[i].special == NULL)
+                             ? IMAGE_NONE
+                             : dump_prim_ref(d, bc->sites[i].special),
+            };
+            dump_record(d, IMAGE_SEC_SITES, &site);
+        }
+
+        record.refs    = d->secs[IMAGE_SEC_WORDS].sz / sizeof(uint64_t);
+        record.refs_sz = bc->refs_sz;
+        for (size_t i = 0; i < bc->refs_sz; i++) {
+            const uint64_t sym = dump_sym_ref(d, bc->refs[i].sym);
+            dump_record(d, IMAGE_SEC_WORDS, &sym);
+        }
+    }
+
+    return dump_record(d, IMAGE_SEC_LAMBDAS, &record);
+}
+
+/*
+ * Write the record of an expression from the queue.
+ */
+static void dump_expr(Dumper* d, const Expr* e) {
+    ImageExpr record;
+    memset(&record, 0, sizeof(record));
+    record.type      = e->type;
+    record.is_inline = e->is_inline;
+
+    switch (e->type) {
+        case EXPR_NUM_INT:
+            record.val.n = e->val.n;
+            break;
+
+        case EXPR_NUM_FLT:
+            record.val.f = e->val.f;
+            break;
+
+        case EXPR_ERR:
+        case EXPR_STRING:
+            if (e->is_inline)
+                memcpy(record.val.inline_s,
+                       e->val.inline_s,
+                       sizeof(record.val.inline_s));
+            else
+                record.val.w[0] =
+                  (e->val.s == NULL) ? IMAGE_NONE : dump_str_ref(d, e->val.s);
+            break;
+
+        case EXPR_SYMBOL:
+            record.val.w[0] = dump_sym_ref(d, e->val.s);
+            break;
+
+        case EXPR_PAIR:
+            record.val.w[0] = dump_expr_ref(d, CAR(e));
+            record.val.w[1] = dump_expr_ref(d, CDR(e));
+            break;
+
+        case EXPR_PRIM:
+            record.val.w[0] = dump_prim_ref(d, e->val.prim);
+            break;
+
+        case EXPR_LAMBDA:
+        case EXPR_MACRO:
+            record.val.w[0] = dump_lambda(d, e->val.lambda);
+            break;
+
+        case EXPR_UNKNOWN:
+            break;
+    }
+
+    dump_record(d, IMAGE_SEC_EXPRS, &record);
+}
+
+/*
+ * Write the record of an environment from the queue, along with its bindings.
+ * Every environment except the global one must be a captured frame, since no
+ * call is being evaluated.
+ */
+static void dump_env(Dumper* d, const Env* env, bool is_global) {
+    SL_ASSERT(is_global || (env->is_frame && !env->on_stack));
+
+    const ImageEnv record = {
+        .parent       = dump_env_ref(d, env->parent),
+        .bindings     = d->secs[IMAGE_SEC_BINDINGS].sz / sizeof(ImageBinding),
+        .bindings_num = env->size,
+    };
+
+    for (size_t i = 0; i < env->size; i++) {
+        const ImageBinding binding = {
+            .sym   = dump_sym_ref(d, env->bindings[i].sym),
+            .val   = dump_expr_ref(d, env->bindings[i].val),
+            .flags = env->bindings[i].flags,
+        };
+        dump_record(d, IMAGE_SEC_BINDINGS, &binding);
+    }
+
+    dump_record(d, IMAGE_SEC_ENVS, &record);
+}
+
+/*
+ * Write the header and the sections of the image to the specified file.
+ * Returns false if there was a write error.
+ */
+static bool dump_write(const Dumper* d, uint64_t debug_trace_list,
+                       FILE* fp) {
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    header.version          = IMAGE_VERSION;
+    header.debug_trace_list = debug_trace_list;
+
+    /* Each section starts at an offset that is aligned to 8 bytes */
+    uint64_t offset = sizeof(ImageHeader);
+    for (int i = 0; i < IMAGE_SEC_NUM; i++) {
+        header.sections[i].offset = offset;
+        header.sections[i].num    = d->secs[i].sz / g_record_sz[i];
+        offset += (d->secs[i].sz + 7) & ~(uint64_t)7;
+    }
+    header.file_sz = offset;
+
+    if (fwrite(&header, sizeof(header), 1, fp) != 1)
+        return false;
+
+    static const char padding[8] = { 0 };
+    for (int i = 0; i < IMAGE_SEC_NUM; i++) {
+        const size_t sz = d->secs[i].sz;
+        if (sz > 0 && fwrite(d->secs[i].data, sz, 1, fp) != 1)
+            return false;
+        if (sz % 8 != 0 && fwrite(padding, 8 - sz % 8, 1, fp) != 1)
+            return false;
+    }
+
+    return true;
+}
+
+bool image_dump(const Env* env, const char* path) {
+    SL_ASSERT(env != NULL && env->parent == NULL);
+
+    Dumper d;
+    memset(&d, 0, sizeof(d));
+
+    /*
+     * The global environment is always the first one. The expressions and
+     * environments are written as they are taken from the queues, and writing
+     * them might add more to the queues, until every reachable one is written.
+     */
+    dump_env_ref(&d, env);
+    const uint64_t debug_trace_list = dump_expr_ref(&d, g_debug_trace_list);
+
+    while (d.envs_scan < d.envs_num || d.exprs_scan < d.exprs_num) {
+        if (d.envs_scan < d.envs_num) {
+            dump_env(&d, d.envs[d.envs_scan], d.envs_scan == 0);
+            d.envs_scan++;
+        } else {
+            dump_expr(&d, d.exprs[d.exprs_scan++]);
+        }
+    }
+
+    bool result = false;
+    FILE* fp    = fopen(path, "wb");
+    if (fp == NULL) {
+        SL_ERR("Couldn't open '%s': %s.", path, strerror(errno));
+    } else {
+        result = dump_write(&d, debug_trace_list, fp);
+        if (fclose(fp) != 0)
+            result = false;
+        if (!result)
+            SL_ERR("Couldn't write '%s': %s.", path, strerror(errno));
+    }
+
+    for (int i = 0; i < IMAGE_SEC_NUM; i++)
+        mem_free(d.secs[i].data);
+    mem_free(d.expr_map.entries);
+    mem_free(d.env_map.entries);
+    mem_free(d.sym_map.entries);
+    mem_free(d.str_map.entries);
+    mem_free(d.prim_map.entries);
+    mem_free(d.exprs);
+    mem_free(d.envs);
+
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+/* Loading */
+
+/*
+ * State of a load. The 'base' is the start of the mapped image, and the other
+ * arrays contain the objects that were allocated for each record, indexed by
+ * its position.
+ */
+typedef struct Loader {
+    const char* base;
+    const ImageHeader* header;
+
+    char** syms;
+    const Primitive** prims;
+    char** strs;
+    Expr** exprs;
+    LambdaCtx** lambdas;
+    Env** envs;
+} Loader;
+
+/*
+ * Return a pointer to the first record of the specified section.
+ */
+static inline const void* load_section(const Loader* l,
+                                       enum EImageSection sec) {
+    return l->base + l->header->sections[sec].offset;
+}
+
+static inline uint64_t load_num(const Loader* l, enum EImageSection sec) {
+    return l->header->sections[sec].num;
+}
+
+/*
+ * Return the string at the specified offset of 'IMAGE_SEC_CHARS'. The section
+ * ends with a null terminator, so the string is always terminated.
+ */
+static const char* load_chars(const Loader* l, uint64_t offset) {
+    SL_ASSERT(offset < load_num(l, IMAGE_SEC_CHARS));
+    return (const char*)load_section(l, IMAGE_SEC_CHARS) + offset;
+}
+
+/*
+ * Return the words at the specified position of 'IMAGE_SEC_WORDS'.
+ */
+static const uint64_t* load_words(const Loader* l, uint64_t pos, uint64_t num) {
+    SL_ASSERT(pos <= load_num(l, IMAGE_SEC_WORDS) &&
+              num <= load_num(l, IMAGE_SEC_WORDS) - pos);
+    return (const uint64_t*)load_section(l, IMAGE_SEC_WORDS) + pos;
+}
+
+static char* load_sym(const Loader* l, uint64_t pos) {
+    SL_ASSERT(pos < load_num(l, IMAGE_SEC_SYMBOLS));
+    return l->syms[pos];
+}
+
+static Env* load_env_ref(const Loader* l, uint64_t pos) {
+    if (pos == IMAGE_NONE)
+        return NULL;
+
+    SL_ASSERT(pos < load_num(l, IMAGE_SEC_ENVS));
+    return l->envs[pos];
+}
+
+/*
+ * Return the expression for the specified reference. See 'IMAGE_REF_EXPR'.
+ */
+static Expr* load_expr_ref(const Loader* l, uint64_t ref) {
+    if (ref == IMAGE_NONE)
+        return NULL;
+
+    const uint64_t pos = ref >> 1;
+    if ((ref & 1) == 0) {
+        SL_ASSERT(pos < load_num(l, IMAGE_SEC_EXPRS));
+        return l->exprs[pos];
+    }
+
+    if (pos == 0)
+        return g_nil;
+    if (pos == 1)
+        return g_tru;
+
+    /* The small integers are initialized by 'expr_new_int' */
+    SL_ASSERT(pos - 2 < sizeof(g_small_ints) / sizeof(g_small_ints[0]));
+    return expr_new_int(EXPR_SMALL_INT_MIN + (LispInt)(pos - 2));
+}
+
+/*
+ * Check the header of the mapped image, and the bounds of its sections.
+ */
+static bool load_check_header(const Loader* l, size_t file_sz) {
+    const ImageHeader* header = l->header;
+    if (file_sz < sizeof(ImageHeader) ||
+        memcmp(header->magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) {
+        SL_ERR("The file is not a heap image.");
+        return false;
+    }
+
+    if (header->version != IMAGE_VERSION || header->file_sz != file_sz) {
+        SL_ERR("Unsupported or truncated heap image (version %llu).",
+               (unsigned long long)header->version);
+        return false;
+    }
+
+    for (int i = 0; i < IMAGE_SEC_NUM; i++) {
+        const ImageSection* sec = &header->sections[i];
+        if (sec->offset % 8 != 0 || sec->offset > file_sz ||
+            sec->num > (file_sz - sec->offset) / g_record_sz[i]) {
+            SL_ERR("Invalid section in heap image.");
+            return false;
+        }
+    }
+
+    const uint64_t chars_num = load_num(l, IMAGE_SEC_CHARS);
+    if (chars_num > 0 &&
+        ((const char*)load_section(l, IMAGE_SEC_CHARS))[chars_num - 1] != '\0') {
+        SL_ERR("Invalid section in heap image.");
+        return false;
+    }
+
+    if (load_num(l, IMAGE_SEC_ENVS) == 0) {
+        SL_ERR("The heap image doesn't contain a global environment.");
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Intern the symbols of the image, and look up its primitives. Since nothing
+ * was allocated yet, the image can still be rejected if its primitives don't
+ * match the ones of this interpreter.
+ */
+static bool load_symbols_and_prims(Loader* l) {
+    const uint64_t* syms = load_section(l, IMAGE_SEC_SYMBOLS);
+    for (uint64_t i = 0; i < load_num(l, IMAGE_SEC_SYMBOLS); i++)
+        l->syms[i] = symbol_intern(load_chars(l, syms[i]));
+
+    const ImagePrim* prims = load_section(l, IMAGE_SEC_PRIMS);
+    for (uint64_t i = 0; i < load_num(l, IMAGE_SEC_PRIMS); i++) {
+        const char* name = NULL;
+        if (prims[i].index < env_primitive_num())
+            l->prims[i] = env_primitive_get(prims[i].index, &name);
+
+        if (name == NULL || strcmp(name, load_chars(l, prims[i].name)) != 0) {
+            SL_ERR("The heap image was created by a different version of the "
+                   "interpreter.");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Is the specified value one of the 'EExprType' enumerators? They are either
+ * zero or a single bit.
+ */
+static inline bool load_type_is_valid(uint32_t type) {
+    return type <= EXPR_MACRO && (type & (type - 1)) == 0;
+}
+
+/*
+ * Allocate an object for each record of the image, so the references between
+ * them can be fixed up in a single pass.
+ */
+static void load_alloc(Loader* l, Env* global_env) {
+    const ImageStr* strs = load_section(l, IMAGE_SEC_STRINGS);
+    for (uint64_t i = 0; i < load_num(l, IMAGE_SEC_STRINGS); i++) {
+        const char* s = load_chars(l, strs[i].offset);
+        SL_ASSERT(strs[i].len < load_num(l, IMAGE_SEC_CHARS) - strs[i].offset);
+        l->strs[i] = strheap_alloc(s, strs[i].len)->data;
+    }
+
+    /*
+     * Expand the pool once, so the expressions of the image don't share their
+     * arrays with the rest.
+     */
+    const uint64_t exprs_num = load_num(l, IMAGE_SEC_EXPRS);
+    const ImageExpr* exprs   = load_section(l, IMAGE_SEC_EXPRS);
+    if (exprs_num > 0 && !pool_expand(exprs_num))
+        SL_FATAL("Failed to expand the expression pool.");
+    for (uint64_t i = 0; i < exprs_num; i++) {
+        SL_ASSERT(load_type_is_valid(exprs[i].type));
+        l->exprs[i] = expr_new((enum EExprType)exprs[i].type);
+    }
+
+    for (uint64_t i = 0; i < load_num(l, IMAGE_SEC_LAMBDAS); i++)
+        l->lambdas[i] = lambdactx_new();
+
+    l->envs[0] = global_env;
+    for (uint64_t i = 1; i < load_num(l, IMAGE_SEC_ENVS); i++)
+        l->envs[i] = env_frame_new_captured(NULL);
+}
+
+static void load_expr(const Loader* l, Expr* e, const ImageExpr* record) {
+    e->is_inline = record->is_inline;
+
+    switch (e->type) {
+        case EXPR_NUM_INT:
+            e->val.n = record->val.n;
+            break;
+
+        case EXPR_NUM_FLT:
+            e->val.f = record->val.f;
+            break;
+
+        case EXPR_ERR:
+        case EXPR_STRING:
+            if (e->is_inline) {
+                memcpy(e->val.inline_s,
+                       record->val.inline_s,
+                       sizeof(e->val.inline_s));
+                e->val.inline_s[sizeof(e->val.inline_s) - 1] = '\0';
+            } else if (record->val.w[0] != IMAGE_NONE) {
+                SL_ASSERT(record->val.w[0] < load_num(l, IMAGE_SEC_STRINGS));
+                e->val.s = l->strs[record->val.w[0]];
+            }
+            break;
+
+        case EXPR_SYMBOL:
+            e->val.s = load_sym(l, record->val.w[0]);
+            break;
+
+        case EXPR_PAIR:
+            CAR(e) = load_expr_ref(l, record->val.w[0]);
+            CDR(e) = load_expr_ref(l, record->val.w[1]);
+            break;
+
+        case EXPR_PRIM:
+            SL_ASSERT(record->val.w[0] < load_num(l, IMAGE_SEC_PRIMS));
+            e->val.prim = l->prims[record->val.w[0]];
+            break;
+
+        case EXPR_LAMBDA:
+        case EXPR_MACRO:
+            SL_ASSERT(record->val.w[0] < load_num(l, IMAGE_SEC_LAMBDAS));
+            e->val.lambda = l->lambdas[record->val.w[0]];
+            break;
+
+        case EXPR_UNKNOWN:
+            break;
+    }
+}
+
+static void load_lambda(const Loader* l, LambdaCtx* ctx,
+                        const ImageLambda* record) {
+    ctx->env  = load_env_ref(l, record->env);
+    ctx->body = load_expr_ref(l, record->body);
+
+    const uint64_t* formals =
+      load_words(l, record->formals, record->formals_num);
+    ctx->formals_num = record->formals_num;
+    ctx->formals     = mem_alloc(ctx->formals_num * sizeof(char*));
+    for (size_t i = 0; i < ctx->formals_num; i++)
+        ctx->formals[i] = load_sym(l, formals[i]);
+
+    ctx->formal_rest = (record->formal_rest == IMAGE_NONE)
+                         ? NULL
+                         : load_sym(l, record->formal_rest);
+
+    if (record->code == IMAGE_NONE)
+        return;
+
+    /*
+     * The inline caches start empty. No version of the environments is zero,
+     * so they will be filled on the first call.
+     */
+    Bytecode* bc = mem_alloc(sizeof(Bytecode));
+    bc->users    = 1;
+
+    SL_ASSERT(record->code <= load_num(l, IMAGE_SEC_INSTRS) &&
+              record->code_sz <= load_num(l, IMAGE_SEC_INSTRS) - record->code);
+    const ImageInstr* instrs =
+      (const ImageInstr*)load_section(l, IMAGE_SEC_INSTRS) + record->code;
+    bc->code_sz = record->code_sz;
+    bc->code    = mem_alloc(bc->code_sz * sizeof(Instr));
+    for (size_t i = 0; i < bc->code_sz; i++) {
+        bc->code[i].op  = (enum EOpcode)instrs[i].op;
+        bc->code[i].arg = instrs[i].arg;
+    }
+
+    const uint64_t* consts = load_words(l, record->consts, record->consts_sz);
+    bc->consts_sz          = record->consts_sz;
+    bc->consts             = mem_alloc(bc->consts_sz * sizeof(Expr*));
+    for (size_t i = 0; i < bc->consts_sz; i++)
+        bc->consts[i] = load_expr_ref(l, consts[i]);
+
+    SL_ASSERT(record->sites <= load_num(l, IMAGE_SEC_SITES) &&
+              record->sites_sz <= load_num(l, IMAGE_SEC_SITES) - record->sites);
+    const ImageSite* sites =
+      (const ImageSite*)load_section(l, IMAGE_SEC_SITES) + record->sites;
+    bc->sites_sz = record->sites_sz;
+    bc->sites    = mem_calloc(bc->sites_sz, sizeof(CallSite));
+    for (size_t i = 0; i < bc->sites_sz; i++) {
+        bc->sites[i].form = load_expr_ref(l, sites[i].form);
+        bc->sites[i].argc = sites[i].argc;
+        bc->sites[i].end  = sites[i].end;
+        bc->sites[i].tail = sites[i].tail != 0;
+
+        if (sites[i].special != IMAGE_NONE) {
+            SL_ASSERT(sites[i].special < load_num(l, IMAGE_SEC_PRIMS));
+            bc->sites[i].special = l->prims[sites[i].special];
+        }
+    }
+
+    const uint64_t* refs = load_words(l, record->refs, record->refs_sz);
+    bc->refs_sz          = record->refs_sz;
+    bc->refs             = mem_calloc(bc->refs_sz, sizeof(VarRef));
+    for (size_t i = 0; i < bc->refs_sz; i++)
+        bc->refs[i].sym = load_sym(l, refs[i]);
+
+    ctx->code = bc;
+}
+
+/*
+ * Restore the bindings of an environment. The constant bindings of the global
+ * environment were bound by 'env_init_defaults', and they can't change, so
+ * they are kept.
+ */
+static void load_env(const Loader* l, Env* env, const ImageEnv* record) {
+    if (env->is_frame)
+        env->parent = load_env_ref(l, record->parent);
+
+    const uint64_t bindings_num = load_num(l, IMAGE_SEC_BINDINGS);
+    SL_ASSERT(record->bindings <= bindings_num &&
+              record->bindings_num <= bindings_num - record->bindings);
+    const ImageBinding* bindings =
+      (const ImageBinding*)load_section(l, IMAGE_SEC_BINDINGS) +
+      record->bindings;
+
+    for (size_t i = 0; i < record->bindings_num; i++) {
+        const enum EEnvErr err =
+          env_bind(env,
+                   load_sym(l, bindings[i].sym),
+                   load_expr_ref(l, bindings[i].val),
+                   (enum EEnvBindingFlags)bindings[i].flags);
+        SL_ASSERT(err == ENV_ERR_NONE || !env->is_frame);
+    }
+}
+
+bool image_load(Env* env, const char* path) {
+    SL_ASSERT(env != NULL && env->parent == NULL);
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        SL_ERR("Couldn't open '%s': %s.", path, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        SL_ERR("Couldn't read '%s'.", path);
+        close(fd);
+        return false;
+    }
+
+    const size_t file_sz = (size_t)st.st_size;
+    void* mapped = mmap(NULL, file_sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        SL_ERR("Couldn't map '%s': %s.", path, strerror(errno));
+        return false;
+    }
+
+    Loader l;
+    memset(&l, 0, sizeof(l));
+    l.base   = mapped;
+    l.header = mapped;
+
+    bool result = load_check_header(&l, file_sz);
+    if (result) {
+        l.syms    = mem_alloc(load_num(&l, IMAGE_SEC_SYMBOLS) * sizeof(char*));
+        l.prims   = mem_alloc(load_num(&l, IMAGE_SEC_PRIMS) * sizeof(Primitive*));
+        l.strs    = mem_alloc(load_num(&l, IMAGE_SEC_STRINGS) * sizeof(char*));
+        l.exprs   = mem_alloc(load_num(&l, IMAGE_SEC_EXPRS) * sizeof(Expr*));
+        l.lambdas = mem_alloc(load_num(&l, IMAGE_SEC_LAMBDAS) *
+                              sizeof(LambdaCtx*));
+        l.envs    = mem_alloc(load_num(&l, IMAGE_SEC_ENVS) * sizeof(Env*));
+
+        result = load_symbols_and_prims(&l);
+    }
+
+    if (result) {
+        load_alloc(&l, env);
+
+        const ImageExpr* exprs = load_section(&l, IMAGE_SEC_EXPRS);
+        for (uint64_t i = 0; i < load_num(&l, IMAGE_SEC_EXPRS); i++)
+            load_expr(&l, l.exprs[i], &exprs[i]);
+
+        const ImageLambda* lambdas = load_section(&l, IMAGE_SEC_LAMBDAS);
+        for (uint64_t i = 0; i < load_num(&l, IMAGE_SEC_LAMBDAS); i++)
+            load_lambda(&l, l.lambdas[i], &lambdas[i]);
+
+        const ImageEnv* envs = load_section(&l, IMAGE_SEC_ENVS);
+        for (uint64_t i = 0; i < load_num(&l, IMAGE_SEC_ENVS); i++)
+            load_env(&l, l.envs[i], &envs[i]);
+
+        /*
+         * The debug trace list of the image is bound in its global environment,
+         * so it replaced the one from 'env_init_defaults'.
+         */
+        Expr* debug_trace_list = load_expr_ref(&l, l.header->debug_trace_list);
+        if (debug_trace_list != NULL)
+            g_debug_trace_list = debug_trace_list;
+    }
+
+    mem_free(l.syms);
+    mem_free(l.prims);
+    mem_free(l.strs);
+    mem_free(l.exprs);
+    mem_free(l.lambdas);
+    mem_free(l.envs);
+    munmap(mapped, file_sz);
+
+    return result;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_ 1
+
+#include <stddef.h>
+
+/*
+ * Size of the first chunk of an arena. Each new chunk is at least twice as big
+ * as the previous one.
+ */
+#define ARENA_BASE_SZ 4096
+
+/*
+ * Chunks bigger than this are not kept by 'arena_reset', so reading a huge
+ * expression doesn't keep its memory for the rest of the program.
+ */
+#define ARENA_MAX_KEEP_SZ (1024 * 1024)
+
+/*
+ * Chunk of memory in an arena. The allocations are taken from its 'data'
+ * member, and the previous chunks are kept in a linked list.
+ */
+typedef struct ArenaChunk ArenaChunk;
+struct ArenaChunk {
+    ArenaChunk* prev;
+    size_t sz;
+    size_t pos;
+    _Alignas(max_align_t) char data[];
+};
+
+/*
+ * Bump allocator for short-lived data, like the buffers of the reader and the
+ * tokens of the lexer. The allocations are not freed individually; instead,
+ * all of them are freed at once by 'arena_reset' or 'arena_free'.
+ *
+ * An arena can be initialized to zero, in which case the first chunk is
+ * allocated on the first call to 'arena_alloc'.
+ */
+typedef struct Arena {
+    ArenaChunk* chunk;
+} Arena;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Allocate 'sz' bytes from the arena, aligned to 'max_align_t'. A bigger chunk
+ * is allocated if the current one is full. Ensures a valid pointer is returned.
+ */
+void* arena_alloc(Arena* arena, size_t sz);
+
+/*
+ * Change the size of a block returned by 'arena_alloc' from 'old_sz' to
+ * 'new_sz', and return its new address. If it's the last block of the arena and
+ * it fits, it grows in place; otherwise, its contents are copied to a new
+ * block, and the old one is not reused until the arena is reset.
+ */
+void* arena_realloc(Arena* arena, void* ptr, size_t old_sz, size_t new_sz);
+
+/*
+ * Free all the allocations of the arena at once. The last chunk is kept for the
+ * next allocations, unless it's bigger than 'ARENA_MAX_KEEP_SZ'.
+ */
+void arena_reset(Arena* arena);
+
+/*
+ * Free all the chunks of the arena. It can be used again afterwards.
+ */
+void arena_free(Arena* arena);
+
+#endif /* ARENA_H_ */
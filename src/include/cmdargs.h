@@ -6,6 +6,8 @@
 #include <stddef.h>
 #include <stdio.h> /* FILE */
 
+#include "garbage_collector.h" /* EGcMode */
+
 /*
  * Structure representing an input file specified by the user in the command
  * line.
@@ -24,6 +26,21 @@ typedef struct {
     size_t input_files_sz;
 
     bool load_sys_stdlib;
+
+    /* See 'image_load' and 'image_dump'. NULL if they were not specified. */
+    const char* image_path;
+    const char* dump_image_path;
+
+    /* See 'pool_set_growth', 'gc_set_budget', 'gc_set_mode',
+     * 'gc_set_max_pause', 'gc_set_threads', 'gc_set_trace' and
+     * 'gc_set_compact_density' */
+    double heap_growth;
+    size_t gc_budget;
+    enum EGcMode gc_mode;
+    size_t gc_max_pause_us;
+    size_t gc_threads;
+    bool gc_trace;
+    double gc_compact_density;
 } CmdArgs;
 
 /*----------------------------------------------------------------------------*/
@@ -0,0 +1,214 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * SL. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPILE_H_
+#define COMPILE_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "env.h" /* EnvCache */
+
+struct Expr;      /* expr.h */
+struct Primitive; /* expr.h */
+struct LambdaCtx; /* lambda.h */
+
+/*
+ * Initial number of entries in the bytecode cache. Must be a power of two. See
+ * 'compile_lambda'.
+ */
+#define BYTECODE_CACHE_BASE_SZ 256
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Instructions of the virtual machine (see "vm.h"). The VM is a stack machine;
+ * instructions pop their operands from the value stack, and push their result.
+ * The meaning of the 'arg' member of each 'Instr' depends on the opcode.
+ */
+enum EOpcode {
+    /* Push the constant at index 'arg' of the 'consts' array. */
+    OP_CONST,
+
+    /* Push the value of the formal argument at slot 'arg' of the current
+     * activation frame. */
+    OP_LOCAL,
+
+    /* Push the value bound to the symbol of the free variable at index 'arg'
+     * of the 'refs' array, searching in the current frame and its parents. */
+    OP_GLOBAL,
+
+    /* Discard the value at the top of the stack. */
+    OP_POP,
+
+    /* Unconditionally jump to the instruction at position 'arg'. */
+    OP_JUMP,
+
+    /* Pop a value, and jump to 'arg' if it's nil. */
+    OP_JUMP_IF_NIL,
+
+    /* If the value at the top is nil (or non-nil), keep it and jump to 'arg';
+     * otherwise, pop it. Used by `and' and `or'. */
+    OP_JUMP_IF_NIL_KEEP,
+    OP_JUMP_IF_NOT_NIL_KEEP,
+
+    /* Check that the 'car' of the call site at index 'arg' is still bound to
+     * the special form that was compiled inline after this instruction. If
+     * it's not, evaluate the whole form with 'eval' instead, and jump to the
+     * end of the call site. */
+    OP_SPECIAL,
+
+    /* Push the function of the call site at index 'arg', whose 'car' is a
+     * symbol. If it turns out to be a special form or a macro, evaluate the
+     * whole form with 'eval' instead, and jump to the end of the call site. */
+    OP_FUNC_SYM,
+
+    /* Check the function that was just pushed for the call site at index
+     * 'arg'. If it's a macro, expand it with the unevaluated arguments and
+     * evaluate the expansion, jumping to the end of the call site. */
+    OP_FUNC_CHECK,
+
+    /* Call the function below the arguments of the call site at index 'arg',
+     * replacing them with the returned value. */
+    OP_CALL,
+
+    /* Evaluate the expression at index 'arg' of the 'consts' array with the
+     * tree-walking interpreter, and push the result. */
+    OP_EVAL,
+
+    /* Pop a value and return it from the current lambda. */
+    OP_RETURN,
+};
+
+/*
+ * A single instruction of the virtual machine.
+ */
+typedef struct Instr Instr;
+struct Instr {
+    enum EOpcode op;
+    size_t arg;
+};
+
+/*
+ * Information about a procedure/macro call in the body of a lambda. The
+ * original 'form' is needed for the debugger, and for falling back to the
+ * tree-walking interpreter if the function is a special form or a macro. The
+ * 'end' member is the position of the first instruction after the call.
+ *
+ * If 'tail' is true, the call is in tail position (i.e. its value is returned
+ * by the lambda).
+ *
+ * If the function is a symbol, 'cache' is used for looking up its binding, so
+ * calls to global functions don't need to search the whole environment chain
+ * each time.
+ *
+ * If the call was compiled inline (see 'OP_SPECIAL'), 'special' is the
+ * primitive of the special form it was compiled for. Otherwise, it's NULL.
+ */
+typedef struct CallSite CallSite;
+struct CallSite {
+    struct Expr* form;
+    size_t argc;
+    size_t end;
+    bool tail;
+    const struct Primitive* special;
+    EnvCache cache;
+};
+
+/*
+ * A reference to a free variable (i.e. not a formal argument) in the body of a
+ * lambda, with its inline cache.
+ */
+typedef struct VarRef VarRef;
+struct VarRef {
+    const char* sym;
+    EnvCache cache;
+};
+
+/*
+ * The compiled body of a lambda. The constants and the call sites point to
+ * expressions inside the body of the lambda, so they don't need to be marked
+ * by the garbage collector separately.
+ *
+ * The closures created from the same lambda form share the same bytecode (see
+ * 'compile_lambda'), and 'users' is the number of lambdas using it, plus one if
+ * it's in the bytecode cache. The parent of their activation frames might be
+ * different, so the inline caches check it (see 'EnvCache').
+ */
+typedef struct Bytecode Bytecode;
+struct Bytecode {
+    size_t users;
+
+    Instr* code;
+    size_t code_sz;
+
+    struct Expr** consts;
+    size_t consts_sz;
+
+    CallSite* sites;
+    size_t sites_sz;
+
+    VarRef* refs;
+    size_t refs_sz;
+};
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Return the bytecode for the body of the specified lambda context, which
+ * should be released by the caller with 'bytecode_release'. The 'env' argument
+ * is the environment where the lambda is being defined; it's used to check
+ * which symbols refer to the special forms that can be compiled inline.
+ *
+ * The bytecode is cached, indexed by the address of the body, so closures
+ * created from the same lambda form (e.g. in a loop) share it instead of
+ * compiling the body again. The special forms that were compiled inline are
+ * checked at runtime (see 'OP_SPECIAL'), since the environment of each closure
+ * might be different. Just like 'macro_expand_cached', this assumes that the
+ * body is not modified.
+ *
+ * Compilation never fails; any expression that can't be compiled is evaluated
+ * with the tree-walking interpreter at runtime.
+ */
+Bytecode* compile_lambda(struct Env* env, const struct LambdaCtx* ctx);
+
+/*
+ * Add a user to the specified bytecode, and return it.
+ */
+Bytecode* bytecode_retain(Bytecode* bc);
+
+/*
+ * Remove a user from the specified bytecode, and free it along with all of its
+ * members if it was the last one. Since lambdas might be freed by the threads
+ * of the garbage collector, this is thread-safe.
+ */
+void bytecode_release(Bytecode* bc);
+
+/*
+ * Remove the entries of the bytecode cache whose body was not marked by the
+ * garbage collector, since the same address might be used by another body.
+ * Called by 'gc_collect' before freeing the unmarked expressions.
+ */
+void bytecode_cache_collect(void);
+
+/*
+ * Remove all the entries of the bytecode cache, and free it.
+ */
+void bytecode_cache_free(void);
+
+#endif /* COMPILE_H_ */
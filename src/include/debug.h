@@ -81,6 +81,12 @@ void debug_callstack_push(const struct Expr* e);
  */
 void debug_callstack_pop(void);
 
+/*
+ * Mark the expressions in the callstack, so they can be printed even if they
+ * are not used anywhere else. Called by the garbage collector.
+ */
+void debug_callstack_mark(void);
+
 /*
  * Print the callstack to the specified file.
  */
@@ -22,10 +22,23 @@
 #include <stdbool.h>
 #include <stdio.h> /* FILE */
 
-struct Expr; /* expr.h */
+struct Expr;      /* expr.h */
+struct Primitive; /* expr.h */
 
 /*----------------------------------------------------------------------------*/
 
+/*
+ * Minimum number of bindings in an environment for building a hash index. See
+ * the 'Env' structure below.
+ */
+#define ENV_INDEX_THRESHOLD 16
+
+/*
+ * Maximum number of primitives that can be bound by 'env_init_defaults'. See
+ * 'env_primitive_index'.
+ */
+#define ENV_MAX_PRIMITIVES 128
+
 /*
  * Environment error codes, returned by functions like 'env_bind'. See also
  * 'env_strerror' below.
@@ -59,49 +72,127 @@ enum EEnvBindingFlags {
 
 /*
  * An 'EnvBinding' structure is used to bind a symbol to its expression, with
- * some specified flags from the 'EEnvBindingFlags' enum.
+ * some specified flags from the 'EEnvBindingFlags' enum. The symbol is interned
+ * (see 'symbol_intern'), so it's not owned by the binding.
  */
 typedef struct EnvBinding EnvBinding;
 struct EnvBinding {
-    char* sym;
+    const char* sym;
     struct Expr* val;
     enum EEnvBindingFlags flags;
 };
 
 /*
  * An environment is simply an array of 'EnvBinding' structures, and a parent
- * environment.
+ * environment. The 'bindings' array can hold 'capacity' elements, but only the
+ * first 'size' are in use.
+ *
+ * Small environments (e.g. the ones used for lambda calls) are searched
+ * linearly. Once an environment grows past 'ENV_INDEX_THRESHOLD' bindings (e.g.
+ * the global environment), an open-addressing hash 'index' is built, whose
+ * 'index_sz' slots contain either zero (empty) or the position of a binding
+ * plus one. See 'env_bind' and 'env_get'.
+ *
+ * Each lambda call gets its own environment, called an "activation frame",
+ * allocated with 'env_frame_new'. The bindings of a frame are initially stored
+ * in a global LIFO stack, and they are released when the call returns with
+ * 'env_frame_free'. If a lambda was created inside the call, the frame is
+ * "captured", so its bindings are moved to the heap, and the garbage collector
+ * will free it once it's not used by any lambda. The 'stack_slots' member
+ * indicates the number of bindings reserved in the stack, and 'on_stack'
+ * indicates whether the 'bindings' array is still stored there.
+ *
+ * Environments are traced by the garbage collector just like pairs: marking an
+ * environment marks its bindings and its parent. The 'gc_epoch' member is used
+ * as its mark, see 'gc_env_is_marked'. Just like the marks of expressions, it's
+ * kept between minor collections, so it also indicates whether the environment
+ * is old. The 'is_remembered' member is set while the environment is in the
+ * remembered set of the garbage collector, see 'gc_write_barrier_env'.
  *
- * The 'is_used' member is needed to avoid accidentally freeing a lambda's
- * environment if it's being used as the parent of another environment.
+ * The 'has_defines' and 'is_searched' members are used for invalidating the
+ * inline caches, see 'EnvCache'.
  *
- * TODO: It's not ideal to store garbage-collection information in this
- * structure, this should be moved somewhere else if possible.
- * TODO: If the previous change is made, we should update the GC diagram.
+ * The 'next' member is used for building lists of frames; either the recycled
+ * ones, or the ones that were captured.
  */
 typedef struct Env Env;
 struct Env {
     Env* parent;
     size_t size;
+    size_t capacity;
     EnvBinding* bindings;
-    bool is_used;
+    size_t* index;
+    size_t index_sz;
+    size_t stack_slots;
+    bool on_stack;
+    bool is_frame;
+    bool is_captured;
+    bool is_remembered;
+    bool has_defines;
+    bool is_searched;
+    size_t gc_epoch;
+    Env* next;
+};
+
+/*
+ * An inline cache for looking up a symbol from a specific place in the code,
+ * like a call site of a compiled lambda (see "compile.h"). It stores the
+ * environment where the binding was found, and the position of the binding in
+ * it. The cache is only valid if 'version' matches 'g_env_version'.
+ *
+ * A new binding can only shadow the cached one if it's added to one of the
+ * environments that were searched before finding it, or to the first
+ * environment of the lookup, which is different each time the cache is used
+ * (e.g. the activation frame of each call):
+ *
+ *   - The searched environments are marked with 'is_searched', and adding a
+ *     binding to them increments 'g_env_version', invalidating all caches.
+ *   - Adding a binding to any environment with 'env_bind' (e.g. with a
+ *     `define' inside a lambda) sets its 'has_defines' member. Lookups from
+ *     those environments check their own bindings before using the cache.
+ *
+ * This way, defining a local variable or function inside a lambda doesn't
+ * invalidate the caches of the whole program. Since the global environment has
+ * no parent, it's only marked after looking up an unbound symbol, so global
+ * definitions don't normally invalidate them either.
+ *
+ * The same cache can be used from environments with different parents (e.g.
+ * the frames of closures that share their bytecode, see 'compile_lambda'), so
+ * it also stores the 'parent' of the environment it was filled from, and it's
+ * only used from environments with that same parent. Since the address of a
+ * freed frame might be reused by another one, 'env_frames_collect' increments
+ * 'g_env_version' whenever it frees a captured frame.
+ *
+ * Since the value and the flags are read from the binding itself, changing the
+ * value of an existing binding (e.g. with `define') doesn't invalidate the
+ * caches.
+ */
+typedef struct EnvCache EnvCache;
+struct EnvCache {
+    const Env* parent;
+    const Env* env;
+    size_t pos;
+    size_t version;
 };
 
 /*----------------------------------------------------------------------------*/
 
 /*
- * Globals, initialized (if necessary) on 'env_init_defaults'.
+ * Globals, initialized (if necessary) on 'env_init_defaults'. See also 'g_nil'
+ * and 'g_tru' in 'expr.h'.
  *
- *   - nil: Empty list, used to represent "false".
- *   - tru: Symbol that evaluates to itself, used for explicit truth in
- *     boolean functions (predicates).
  *   - *debug-trace*: List of functions that are currently being traced by
  *     the debugger.
  */
-extern struct Expr* g_nil;
-extern struct Expr* g_tru;
 extern struct Expr* g_debug_trace_list;
 
+/*
+ * Version of the environments, incremented each time a binding is added to an
+ * environment that was searched by an inline cache, or a captured frame is
+ * freed. See 'EnvCache'.
+ */
+extern size_t g_env_version;
+
 /*----------------------------------------------------------------------------*/
 
 /*
@@ -123,15 +214,72 @@ void env_init_defaults(Env* env);
 Env* env_clone(Env* env);
 
 /*
- * Free all elements of an Env structure, and the structure itself.
+ * Free all elements of an Env structure, and the structure itself. Not used for
+ * activation frames, see 'env_frame_free'.
  */
 void env_free(Env* env);
 
 /*----------------------------------------------------------------------------*/
 
+/*
+ * Allocate a new activation frame with the specified parent, with room for
+ * 'size' bindings. The bindings are allocated from a LIFO stack, so frames must
+ * be freed in the reverse order with 'env_frame_free'.
+ *
+ * The frame structure itself is recycled from previous calls if possible, so
+ * calls normally don't need to allocate anything.
+ */
+Env* env_frame_new(Env* parent, size_t size);
+
+/*
+ * Release an activation frame that was allocated with 'env_frame_new'. If the
+ * frame was captured (see 'env_frame_capture'), its bindings are moved to the
+ * heap and it will be freed by the garbage collector instead.
+ */
+void env_frame_free(Env* frame);
+
+/*
+ * Indicate that the specified environment is being captured, normally because
+ * a lambda was created inside of it. If the environment is not an activation
+ * frame, the function does nothing.
+ */
+static inline void env_frame_capture(Env* env) {
+    if (env->is_frame)
+        env->is_captured = true;
+}
+
+/*
+ * Allocate an activation frame that is already captured, with the specified
+ * parent and no bindings. Its bindings are stored in the heap, and it will be
+ * freed by the garbage collector once it's not used by any lambda. Used for
+ * restoring the closures of a heap image, see 'image_load'.
+ */
+Env* env_frame_new_captured(Env* parent);
+
+/*
+ * Mark the frames that have not been released yet with 'env_frame_free', along
+ * with their parents, since they are used by the calls that are being
+ * evaluated. Called by the garbage collector.
+ */
+void env_frames_mark_active(void);
+
+/*
+ * Free all captured frames that were not marked by the garbage collector, see
+ * 'gc_env_is_marked'. Called by the garbage collector after marking.
+ */
+void env_frames_collect(void);
+
+/*
+ * Free all the frames and the memory used for the frame stack. All frames
+ * become unusable.
+ */
+void env_frames_close(void);
+
+/*----------------------------------------------------------------------------*/
+
 /*
  * Bind the symbol 'sym' to the expression 'val' in environment 'env', with the
- * specified 'flags'.
+ * specified 'flags'. The symbol must have been interned with 'symbol_intern'.
  *
  * Returns 'ENV_ERR_NONE' (zero) on success, or non-zero on failure. The caller
  * is responsible for checking the returned value, handling errors and
@@ -140,6 +288,14 @@ void env_free(Env* env);
 enum EEnvErr env_bind(Env* env, const char* sym, struct Expr* val,
                       enum EEnvBindingFlags flags);
 
+/*
+ * Bind a formal argument in an activation frame that was just created with
+ * 'env_frame_new'. Unlike 'env_bind', this doesn't affect the inline caches
+ * (see 'EnvCache'), since the formals are the same on every call, and they are
+ * never looked up through the caches.
+ */
+void env_frame_bind(Env* frame, const char* sym, struct Expr* val);
+
 /*
  * Bind the symbol 'sym' to the expression 'val' in the top-most parent of
  * environment 'env', with the specified 'flags'.
@@ -147,10 +303,38 @@ enum EEnvErr env_bind(Env* env, const char* sym, struct Expr* val,
 enum EEnvErr env_bind_global(Env* env, const char* sym, struct Expr* val,
                              enum EEnvBindingFlags flags);
 
+/*
+ * Return a pointer to the binding of the symbol 'sym' in environment 'env', or
+ * in parent environments. Returns NULL if the symbol is not bound. The binding
+ * should not be modified by the caller.
+ */
+const EnvBinding* env_get_binding(const Env* env, const char* sym);
+
+/*
+ * Look up the binding of 'sym' like 'env_get_binding', and fill the specified
+ * inline cache if possible. Used by 'env_get_binding_cached'.
+ */
+const EnvBinding* env_cache_fill(Env* env, const char* sym, EnvCache* cache);
+
+/*
+ * Like 'env_get_binding', but use and update the specified inline cache. The
+ * cache should only be used for looking up the same symbol, usually from
+ * environments that have the same parent (e.g. the activation frames of a
+ * single lambda).
+ */
+static inline const EnvBinding* env_get_binding_cached(Env* env,
+                                                       const char* sym,
+                                                       EnvCache* cache) {
+    if (cache->version == g_env_version && cache->parent == env->parent &&
+        !env->has_defines)
+        return &cache->env->bindings[cache->pos];
+    return env_cache_fill(env, sym, cache);
+}
+
 /*
  * Get a copy of the expression associated to the symbol 'sym' in environment
  * 'env', or in parent environments. The returned copy must be freed by the
- * caller.
+ * caller. The symbol must have been interned with 'symbol_intern'.
  *
  * Returns NULL if the expression is not found.
  */
@@ -168,6 +352,28 @@ enum EEnvBindingFlags env_get_flags(const Env* env, const char* sym);
 
 /*----------------------------------------------------------------------------*/
 
+/*
+ * Return the position of the specified primitive in the list of primitives
+ * bound by 'env_init_defaults', in the order they were bound. The primitive
+ * must be in that list. Since the position doesn't depend on the address of
+ * the primitive, it can be stored in a heap image, see "image.h".
+ */
+size_t env_primitive_index(const struct Primitive* prim);
+
+/*
+ * Number of primitives bound by 'env_init_defaults'.
+ */
+size_t env_primitive_num(void);
+
+/*
+ * Return the primitive at the specified position, as returned by
+ * 'env_primitive_index'. If 'name' is not NULL, the symbol it was bound to is
+ * written to it.
+ */
+const struct Primitive* env_primitive_get(size_t index, const char** name);
+
+/*----------------------------------------------------------------------------*/
+
 /*
  * Print environment in Lisp list format.
  */
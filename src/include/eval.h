@@ -19,9 +19,17 @@
 #ifndef EVAL_H_
 #define EVAL_H_ 1
 
+#include <stddef.h>
+
 struct Env;  /* env.h */
 struct Expr; /* expr.h */
 
+/*
+ * Initial number of elements in the buffer where the arguments of vector
+ * primitives and lambdas are evaluated. It grows automatically.
+ */
+#define EVAL_ARGS_BASE_SZ 64
+
 /*
  * Evaluate expression recursively.
  *
@@ -32,6 +40,28 @@ struct Expr; /* expr.h */
  */
 struct Expr* eval(struct Env* env, struct Expr* e);
 
+/*
+ * Indicate that the expression 'e' should be evaluated in the environment 'env'
+ * by the caller, in tail position. Used by special forms like `if' or `begin'
+ * as their return value, instead of calling 'eval' themselves:
+ *
+ *     return eval_tail(env, consequent);
+ *
+ * This way, 'eval' can evaluate the expression without growing the C stack,
+ * allowing tail-call optimization. The returned value is an internal marker
+ * that should only be returned (unchanged) by special forms, and that is never
+ * seen by Lisp code; 'apply' also handles it when a special form is applied
+ * directly.
+ */
+struct Expr* eval_tail(struct Env* env, struct Expr* e);
+
+/*
+ * If 'e' is the marker returned by 'eval_tail', evaluate the pending expression
+ * and return the result. Otherwise, return 'e' unchanged. Used by callers that
+ * are not able to evaluate the expression in tail position themselves.
+ */
+struct Expr* eval_resolve_tail(struct Expr* e);
+
 /*
  * Call 'func' with the specified 'args'.
  *
@@ -43,4 +73,24 @@ struct Expr* eval(struct Env* env, struct Expr* e);
  */
 struct Expr* apply(struct Env* env, struct Expr* func, struct Expr* args);
 
+/*
+ * Like 'apply', but the arguments are received as an array of 'argc'
+ * expressions. Vector primitives (see 'PrimitiveVecPtr') receive the array
+ * directly, after checking the number of arguments; a list is only allocated
+ * for other functions.
+ */
+struct Expr* apply_argv(struct Env* env, struct Expr* func, size_t argc,
+                        struct Expr** argv);
+
+/*
+ * Mark the arguments that are being evaluated for function calls, which are
+ * stored in an internal buffer. Called by the garbage collector.
+ */
+void eval_mark_roots(void);
+
+/*
+ * Free the buffer used for evaluating the arguments of function calls.
+ */
+void eval_close(void);
+
 #endif /* EVAL_H_ */
@@ -21,10 +21,14 @@
 
 #include <stddef.h>
 #include <stdbool.h>
-#include <stdio.h> /* FILE, fputc() */
+#include <stdint.h> /* uintptr_t */
+#include <stdio.h>  /* FILE, fputc() */
+#include <string.h> /* strlen() */
 
-#include "lisp_types.h" /* LispInt, LispFlt, GenericNum */
-#include "error.h"      /* SL_FATAL() */
+#include "lisp_types.h"  /* LispInt, LispFlt, GenericNum */
+#include "error.h"       /* SL_FATAL() */
+#include "symbol.h"      /* g_sym_nil */
+#include "string_heap.h" /* HeapStr */
 
 struct Env;       /* env.h */
 struct LambdaCtx; /* lambda.h */
@@ -38,6 +42,40 @@ struct LambdaCtx; /* lambda.h */
  */
 typedef struct Expr* (*PrimitiveFuncPtr)(struct Env*, struct Expr*);
 
+/*
+ * Pointer to a Lisp primitive that receives its arguments as an array of
+ * 'argc' expressions, instead of a linked list. Used by the primitives that are
+ * called often, so the caller doesn't have to allocate a list for each call.
+ *
+ * The array might be part of a buffer that is reallocated when more arguments
+ * are evaluated, so these primitives should never evaluate expressions
+ * themselves.
+ */
+typedef struct Expr* (*PrimitiveVecPtr)(struct Env*, size_t argc,
+                                        struct Expr** argv);
+
+/*
+ * Value of 'Primitive.max_args' for primitives that accept any number of
+ * arguments.
+ */
+#define PRIM_VARIADIC ((size_t)-1)
+
+/*
+ * Description of a Lisp primitive, pointed to by expressions of type
+ * 'EXPR_PRIM'. Only one of 'list_func' and 'vec_func' is set.
+ *
+ * For primitives with a 'vec_func', the number of arguments is checked by the
+ * caller using 'min_args' and 'max_args', so the primitive doesn't need to do
+ * it. These members are ignored for primitives with a 'list_func'.
+ */
+typedef struct Primitive Primitive;
+struct Primitive {
+    PrimitiveFuncPtr list_func;
+    PrimitiveVecPtr vec_func;
+    size_t min_args;
+    size_t max_args;
+};
+
 /*
  * Possible expression types. They are mutually exclusive (i.e. an expression
  * can only have one type at a time), but we still use distinct bits for
@@ -61,6 +99,11 @@ enum EExprType {
     EXPR_MACRO   = (1 << 8),
 };
 
+/*
+ * Number of expression types, including 'EXPR_UNKNOWN'. See 'exprtype2index'.
+ */
+#define EXPR_TYPE_NUM 10
+
 /*
  * Expression type whose value has the same C type as 'GenericNum'.
  *
@@ -83,6 +126,13 @@ struct ExprPair {
     struct Expr* cdr;
 };
 
+/*
+ * Size of the buffer used for storing short strings inside the expression
+ * itself, including the null terminator. It overlaps with the rest of the
+ * 'val' union, so it doesn't make expressions bigger. See 'Expr'.
+ */
+#define EXPR_INLINE_STR_SZ (sizeof(struct ExprPair))
+
 /*
  * The main expression type. This will be used to hold basically all data in our
  * Lisp.
@@ -91,24 +141,84 @@ struct ExprPair {
  * union. Some types use the same union member (e.g. EXPR_STRING and
  * EXPR_SYMBOL). See the enum above for more information.
  *
- * Note that the expressions whose value is allocated (e.g. EXPR_STRING,
- * EXPR_LAMBDA, etc.) should own a unique pointer that is not being used by any
- * other expression. Therefore, we should be able to modify or free these
- * pointers without affecting other expressions.
+ * Note that the expressions whose value is allocated (e.g. EXPR_LAMBDA) should
+ * own a unique pointer that is not being used by any other expression.
+ * Therefore, we should be able to modify or free these pointers without
+ * affecting other expressions. The exceptions are symbols, whose strings are
+ * interned with 'symbol_intern' and shared by all symbols with the same name,
+ * so they can be compared by pointer; and strings, see below.
+ *
+ * Strings and errors that fit in 'EXPR_INLINE_STR_SZ' bytes are stored in the
+ * 'inline_s' member instead of being allocated, and 'is_inline' is set; the
+ * flag uses the padding after 'type'. Longer ones are immutable, and the 's'
+ * member points to the contents of a 'HeapStr', which is shared by the clones
+ * of the expression and freed by the garbage collector. Their contents should
+ * always be read with 'expr_str', which handles both cases. Symbols always use
+ * the 's' member.
+ *
+ * The 'in_macro_cache' flag, which also uses the padding, is set for the
+ * expressions of the forms whose expansion is memoized, see
+ * 'macro_expand_cached'.
  */
 typedef struct Expr Expr;
 struct Expr {
     enum EExprType type;
+    bool is_inline;
+    bool in_macro_cache;
     union {
         LispInt n;
         LispFlt f;
         char* s;
+        char inline_s[EXPR_INLINE_STR_SZ];
         struct ExprPair pair;
-        PrimitiveFuncPtr prim;
+        const Primitive* prim;
         struct LambdaCtx* lambda;
     } val;
 };
 
+/* The flags must fit in the padding after 'type' */
+SL_STATIC_ASSERT(sizeof(Expr) == sizeof(void*) + EXPR_INLINE_STR_SZ);
+
+/*----------------------------------------------------------------------------*/
+/* Globals */
+
+/*
+ * Unique, immortal expressions for the symbols `nil' and `tru'. They are not
+ * allocated from the expression pool, so they are never garbage-collected, and
+ * they can't be overwritten with `set'. Their values are initialized in
+ * 'env_init_defaults'.
+ *
+ *   - nil: Empty list, used to represent "false".
+ *   - tru: Symbol that evaluates to itself, used for explicit truth in
+ *     boolean functions (predicates).
+ *
+ * Every path that creates or clones these symbols (e.g. the parser or
+ * 'expr_clone') returns these pointers, so checking for `nil' is usually a
+ * single pointer comparison. See 'expr_is_nil'.
+ */
+extern struct Expr* const g_nil;
+extern struct Expr* const g_tru;
+
+/*
+ * Range of the integers that are preallocated by 'expr_new_int', from
+ * 'EXPR_SMALL_INT_MIN' to 'EXPR_SMALL_INT_MAX', both included.
+ */
+#define EXPR_SMALL_INT_MIN (-1024)
+#define EXPR_SMALL_INT_MAX 16383
+
+/*
+ * Immortal integer expressions, shared by all the numeric results in the range
+ * above, so the temporary values of arithmetic don't allocate. Just like `nil'
+ * and `tru', they are not allocated from the expression pool, and they are
+ * never garbage-collected. Each one is initialized the first time it's
+ * returned by 'expr_new_int'.
+ *
+ * Unlike `nil' and `tru', the user never sees them: they are copied by
+ * 'expr_unshare' before being bound to a symbol or stored in a pair, so every
+ * integer that can be modified with `set' is a separate expression.
+ */
+extern struct Expr g_small_ints[EXPR_SMALL_INT_MAX - EXPR_SMALL_INT_MIN + 1];
+
 /*----------------------------------------------------------------------------*/
 /* Callable macros */
 
@@ -145,6 +255,35 @@ struct Expr {
  */
 Expr* expr_new(enum EExprType type);
 
+/*
+ * Return an integer expression with the specified value. Integers between
+ * 'EXPR_SMALL_INT_MIN' and 'EXPR_SMALL_INT_MAX' are immortal and shared, see
+ * 'g_small_ints', so the result must not be modified; other values are
+ * allocated with 'expr_new'.
+ */
+Expr* expr_new_int(LispInt n);
+
+/*
+ * If the specified expression is one of the shared 'g_small_ints', return a
+ * newly allocated copy of it. Otherwise, return the expression itself. Used
+ * before storing a value where the user can reach it, like bindings and pairs.
+ */
+Expr* expr_unshare(Expr* e);
+
+/*
+ * Allocate a new expression of type 'EXPR_STRING' or 'EXPR_ERR', whose value is
+ * the specified string. The string must have been allocated with the functions
+ * in 'memory.h', and it's freed after being copied, either inside the expression
+ * if it's short enough, or to the string heap, see 'HeapStr'.
+ */
+Expr* expr_new_str(enum EExprType type, char* s);
+
+/*
+ * Like 'expr_new_str', but the first 'len' characters of the specified string
+ * are copied, and the string is not freed.
+ */
+Expr* expr_new_str_copy(enum EExprType type, const char* s, size_t len);
+
 /*
  * Free all previously-allocated members of an expression when necessary, and
  * set them to NULL. Doesn't free the 'Expr' structure itself.
@@ -153,17 +292,26 @@ Expr* expr_new(enum EExprType type);
  * frees "private" pointers that this expression "owns", that is, no other
  * expression or structure should store a copy of those pointers. See the
  * comment in 'Expr' above for more information.
+ *
+ * The strings of the heap are shared, so they are not freed here, see
+ * 'strheap_sweep'. This function can be called from multiple threads at the
+ * same time, see 'pool_sweep_array'.
  */
 void expr_free_heap_members(Expr* expr);
 
 /*
  * Set the value of a "destination" expression to the value of a "source"
- * expression.
+ * expression. The destination must not be immortal, see 'expr_is_immortal'.
+ *
+ * If the destination is part of a form whose macro expansion is memoized, the
+ * macro expansion cache is cleared, see 'macro_cache_clear'.
  */
 void expr_set(Expr* dst, const Expr* src);
 
 /*
  * Clone the specified 'Expr' structure into an allocated copy, and return it.
+ * The immortal 'g_nil' and 'g_tru' expressions are not cloned, they are
+ * returned as-is.
  *
  * In the case of pairs, it copies the references, doesn't clone recursively. To
  * clone recursively, use 'expr_clone_tree'.
@@ -175,14 +323,53 @@ Expr* expr_clone(const Expr* e);
  */
 Expr* expr_clone_tree(const Expr* e);
 
+/*----------------------------------------------------------------------------*/
+/* Accessors */
+
+/*
+ * Return the contents of an expression of type 'EXPR_STRING', 'EXPR_ERR' or
+ * 'EXPR_SYMBOL'. Short strings are stored inside the expression, so the
+ * returned pointer is only valid as long as the expression is not freed or
+ * overwritten.
+ */
+static inline const char* expr_str(const Expr* e) {
+    return e->is_inline ? e->val.inline_s : e->val.s;
+}
+
+/*
+ * Return the length of an expression of type 'EXPR_STRING' or 'EXPR_ERR'. The
+ * length of long strings is stored in their 'HeapStr', so it's not computed.
+ */
+static inline size_t expr_str_len(const Expr* e) {
+    return e->is_inline ? strlen(e->val.inline_s)
+                        : strheap_from_data(e->val.s)->len;
+}
+
 /*----------------------------------------------------------------------------*/
 /* Predicates for expressions */
 
+/*
+ * Is the specified expression one of the immortal expressions: 'g_nil', 'g_tru'
+ * or one of the 'g_small_ints'?
+ */
+static inline bool expr_is_immortal(const Expr* e) {
+    const uintptr_t small_int_offset = (uintptr_t)e - (uintptr_t)g_small_ints;
+    return e == g_nil || e == g_tru ||
+           small_int_offset < sizeof(g_small_ints);
+}
+
 /*
  * Is the specified expression an empty list? Note that the empty list is also
  * used to represent false in functions that return predicates.
+ *
+ * Almost every `nil' is the unique 'g_nil' expression, but `set' can still
+ * overwrite an existing expression with the value of `nil', so we also need to
+ * check the (interned) symbol if the pointers don't match.
  */
-bool expr_is_nil(const Expr* e);
+static inline bool expr_is_nil(const Expr* e) {
+    return e == g_nil ||
+           (e != NULL && EXPR_SYMBOL_P(e) && e->val.s == g_sym_nil);
+}
 
 /*
  * Return true if 'a' and 'b' have the same effective value.
@@ -268,6 +455,22 @@ static inline bool expr_list_has_only_type(const Expr* list,
     return expr_list_is_homogeneous(list) && CAR(list)->type == type;
 }
 
+/*
+ * Like 'expr_list_is_homogeneous', 'expr_list_has_only_numbers' and
+ * 'expr_list_has_only_type', but they operate on an array of 'argc'
+ * expressions, as received by vector primitives.
+ */
+bool expr_array_is_homogeneous(size_t argc, Expr* const* argv);
+bool expr_array_has_only_numbers(size_t argc, Expr* const* argv);
+bool expr_array_has_only_type(size_t argc, Expr* const* argv,
+                              enum EExprType type);
+
+/*
+ * Allocate a new list with the 'argc' expressions in 'argv', in order. The
+ * expressions themselves are not copied.
+ */
+Expr* expr_list_from_array(size_t argc, Expr* const* argv);
+
 /*
  * Does the specified list contain the specified expression? The check is
  * performed using 'expr_equal'.
@@ -324,6 +527,15 @@ static inline const char* exprtype2str(enum EExprType type) {
     __builtin_unreachable();
 }
 
+/*
+ * Return a unique index for the specified expression type, lower than
+ * 'EXPR_TYPE_NUM'. Used for arrays indexed by type, like the allocation
+ * counters in 'PoolStats'.
+ */
+static inline size_t exprtype2index(enum EExprType type) {
+    return (type == EXPR_UNKNOWN) ? 0 : (size_t)__builtin_ctz(type) + 1;
+}
+
 /*----------------------------------------------------------------------------*/
 /* Numerical functions */
 
@@ -4,6 +4,7 @@
 
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "expr.h"
 
@@ -12,7 +13,7 @@
 
 /*
  * Base pool size. Arbitrary number used when initializing and expanding the
- * global pool.
+ * global pool. It's rounded up to a whole array, see 'POOL_ARRAY_ITEMS'.
  *
  * It doesn't make much sense to declare this macro in this header while also
  * accepting size parameters in some 'pool_*' functions. Still, since this value
@@ -20,29 +21,31 @@
  */
 #define POOL_BASE_SZ 512
 
-/*----------------------------------------------------------------------------*/
-/* Enums and structures */
+/*
+ * Default growth factor of the pool. When the pool has no free items left, it
+ * grows by this factor, so the number of arrays (and expansions) is logarithmic
+ * on the number of expressions. See 'pool_set_growth'.
+ */
+#define POOL_DEFAULT_GROWTH 1.5
 
 /*
- * Flags stored in each item of the expression pool. These flags are NOT
- * mutually exclusive, so they can be OR'd together.
- *
- * Brief explanation of each flag:
- *
- *   - The 'FREE' flag is used to indicate that the current expression is
- *     free. This is not normally needed with pool allocators, since we directly
- *     look in the linked list. In this case, however, we will also iterate the
- *     whole pool when performing garbage collection, and we need to know which
- *     items are free without iterating the whole linked list each time
- *   - The 'GCMARKED' flag is used to indicate that the current expression
- *     should not be freed by the garbage collector. This flag is set/cleared
- *     exclusively by the garbage collector.
+ * Size and alignment in bytes of each array of the pool, including its
+ * 'ArrayStart' header. Since arrays are aligned to their size, the header of
+ * the array that contains an expression can be found by clearing the low bits
+ * of its address, see 'array_start_from_item'.
+ */
+#define POOL_ARRAY_BYTES 65536
+
+/*
+ * Number of items in each array of the pool, and number of 64-bit words in each
+ * of its bitmaps. The number of items is a multiple of 64, so every bit of the
+ * bitmaps corresponds to an item.
  */
-enum EPoolItemFlags {
-    POOL_FLAG_NONE     = 0,
-    POOL_FLAG_FREE     = (1 << 0),
-    POOL_FLAG_GCMARKED = (1 << 1),
-};
+#define POOL_ARRAY_ITEMS 2688
+#define POOL_BITMAP_WORDS (POOL_ARRAY_ITEMS / 64)
+
+/*----------------------------------------------------------------------------*/
+/* Enums and structures */
 
 /*
  * Each item in the pool will either store a valid expression (if the item is
@@ -50,34 +53,67 @@ enum EPoolItemFlags {
  * list). For more information on the advantages of this method, along with a
  * simpler implementation, see my pool allocation article, linked above.
  *
- * We also need a 'flags' member to store whether a specific item is free, if it
- * should be garbage-collected, etc.
+ * Whether an item is free, or marked by the garbage collector, is not stored in
+ * the item itself, but in the bitmaps of its array. See 'ArrayStart'.
  */
-typedef struct PoolItem {
-    union {
-        Expr expr;
-        struct PoolItem* next;
-    } val;
-
-    enum EPoolItemFlags flags;
+typedef union PoolItem {
+    Expr expr;
+    union PoolItem* next;
 } PoolItem;
 
 /*
- * Structure used to store the start of each array inside a pool.
+ * Header of each array inside a pool. It's stored at the start of the aligned
+ * block that contains the items themselves.
  *
  * We need to store them as a linked list, since there can be an arbitrary
- * number of them, one for each call to 'pool_expand' plus the initial one from
- * 'pool_new'. New pointers will be prepended to the linked list.
+ * number of them, one for each array allocated by 'pool_expand' plus the
+ * initial ones from 'pool_init'. New pointers will be prepended to the linked
+ * list.
+ *
+ * Each array has two bitmaps, with one bit for each item:
  *
- * We also need to store the size of the current array, since the garbage
- * collector will have to iterate over it.
+ *   - The 'free_bits' bitmap indicates which items are free. This is not
+ *     normally needed with pool allocators, since we directly look in the
+ *     linked list. In this case, however, we will also iterate the whole pool
+ *     when performing garbage collection, and we need to know which items are
+ *     free without iterating the whole linked list each time.
+ *   - The 'mark_bits' bitmap indicates which items should not be freed by the
+ *     garbage collector. This bitmap is set/cleared exclusively by the garbage
+ *     collector.
+ *
+ * Keeping them apart from the items allows the garbage collector to clear all
+ * marks with a 'memset', and to skip 64 items at once when sweeping.
  */
 typedef struct ArrayStart {
     struct ArrayStart* next;
     PoolItem* arr;
     size_t arr_sz;
+
+    uint64_t free_bits[POOL_BITMAP_WORDS];
+    uint64_t mark_bits[POOL_BITMAP_WORDS];
 } ArrayStart;
 
+/*
+ * Counters of the expression pool, updated as items are allocated and freed, so
+ * they can be read at any time without walking the pool. See 'gc_get_stats'
+ * for the counters of the garbage collector.
+ *
+ *   - The 'num_allocs' array contains the number of expressions allocated with
+ *     each type since the pool was initialized, indexed by 'exprtype2index'.
+ *   - The 'num_free' member is the number of items whose free bit is set.
+ *     Unmarked items are not free until their array is swept, see
+ *     'pool_sweep_start'.
+ *   - The 'num_arrays' member is the number of arrays in the pool.
+ *   - The 'sweep_us' member is the time spent sweeping arrays lazily, in
+ *     microseconds, see 'pool_sweep_step'.
+ */
+typedef struct PoolStats {
+    size_t num_allocs[EXPR_TYPE_NUM];
+    size_t num_free;
+    size_t num_arrays;
+    uint64_t sweep_us;
+} PoolStats;
+
 /*
  * The actual pool structure, which contains a pointer to the first item, and
  * a pointer to the start of the linked list of free items.
@@ -87,10 +123,26 @@ typedef struct ArrayStart {
  *
  * The user is able to allocate with O(1) time, because the 'ExprPool.free_expr'
  * pointer always points to a free item without needing to iterate anything.
+ *
+ * The 'items_sz' member is the total number of items in all arrays, used by the
+ * garbage collector for deciding when to run.
+ *
+ * The pool is swept lazily. After a collection, the 'sweep_cursor' member
+ * points to the next array that has to be swept, see 'pool_sweep_start'.
+ *
+ * The 'growth' member is the factor used for expanding the pool, see
+ * 'pool_set_growth'.
+ *
+ * The 'stats' member contains counters that are only used for reporting, see
+ * 'PoolStats'.
  */
 typedef struct ExprPool {
     PoolItem* free_items;
     ArrayStart* array_starts;
+    ArrayStart* sweep_cursor;
+    size_t items_sz;
+    double growth;
+    PoolStats stats;
 } ExprPool;
 
 /*----------------------------------------------------------------------------*/
@@ -106,20 +158,8 @@ extern ExprPool* g_expr_pool;
 /* Public functions */
 
 /*
- * Wrappers for getting and setting item flags. Useful for setting the memory
- * access with valgrind, since they mark the item as 'DEFINED' temporarily,
- * before setting it back as 'NOACCESS'.
- *
- * NOTE: This means that if the item was previously marked as 'DEFINED', you
- * will need to set it again.
- */
-enum EPoolItemFlags pool_item_flags(const PoolItem* item);
-void pool_item_flag_set(PoolItem* item, enum EPoolItemFlags flag);
-void pool_item_flag_unset(PoolItem* item, enum EPoolItemFlags flag);
-
-/*
- * Allocate and initialize the global expression pool with the specified number
- * of expressions. True is returned on success, or false otherwise.
+ * Allocate and initialize the global expression pool with (at least) the
+ * specified number of expressions. True is returned on success, or false otherwise.
  *
  * The caller is responsible for initializing the pool only once (or an
  * assertion will fail).
@@ -127,10 +167,18 @@ void pool_item_flag_unset(PoolItem* item, enum EPoolItemFlags flag);
 bool pool_init(size_t pool_sz);
 
 /*
- * Expand the global expression pool, adding 'extra_sz' free expressions.
+ * Expand the global expression pool, adding (at least) 'extra_sz' free
+ * expressions. The size is rounded up to a multiple of 'POOL_ARRAY_ITEMS'.
  */
 bool pool_expand(size_t extra_sz);
 
+/*
+ * Set the growth factor of the global expression pool, which must be greater
+ * than one. When an allocation finds no free items, the size of the pool is
+ * multiplied by (at least) this factor.
+ */
+void pool_set_growth(double growth);
+
 /*
  * Close the global expression pool, freeing all necessary data. All data in
  * the pool becomes unusable.
@@ -140,7 +188,9 @@ bool pool_expand(size_t extra_sz);
 void pool_close(void);
 
 /*
- * Retrieve a free expression from the global expression pool.
+ * Retrieve a free expression from the global expression pool. If there are no
+ * free items, arrays are swept until one is found; if there are no arrays left
+ * to sweep, NULL is returned.
  *
  * The caller is responsible for ensuring that the pool was previously
  * initialized with 'pool_init' (or an assertion will fail).
@@ -149,8 +199,11 @@ Expr* pool_alloc(void);
 
 /*
  * Like 'pool_get_expr', but if there are no free items in the pool, try to
- * expand it by 'extra_sz' items. If the pool can't be expanded (according to
+ * expand it according to its growth factor, by at least 'extra_sz' items. If the pool can't be expanded (according to
  * 'pool_expand'), NULL is returned.
+ *
+ * Before expanding the pool, the garbage collector is notified with
+ * 'gc_pool_exhausted', so it can run at the next safe point.
  */
 Expr* pool_alloc_or_expand(size_t extra_sz);
 
@@ -166,39 +219,205 @@ Expr* pool_alloc_or_expand(size_t extra_sz);
 void pool_free(Expr* e);
 
 /*
- * Print stats about the global expression pool to the specified file.
+ * Start sweeping the global expression pool, after the garbage collector has
+ * marked the used items.
+ *
+ * The arrays that don't have any marked items are returned to the system
+ * right away, as long as the pool has more than 'keep_sz' items, and at most
+ * 'max_release' of them. This way, memory is released after a burst of
+ * allocations. Instead of freeing all unmarked items at once, each
+ * array is swept by 'pool_sweep_step' when the previous ones don't have any
+ * free items left, so the time spent sweeping is spread across allocations.
+ *
+ * Until an array is swept, its free items are not used for allocating, so the
+ * unmarked items of an array are always garbage when it's swept.
  */
-void pool_print_stats(FILE* fp);
+void pool_sweep_start(size_t keep_sz, size_t max_release);
 
 /*
- * Dump the contents of the global expression pool to the specified file.
+ * Sweep the next array of the global expression pool: free its unmarked items,
+ * and add them (along with the items that were already free) to the list of
+ * free items. Returns false if all arrays have been swept since the last call
+ * to 'pool_sweep_start'.
  */
-void pool_dump(FILE* fp);
+bool pool_sweep_step(void);
 
-/*----------------------------------------------------------------------------*/
-/* Static functions and macros */
+/*
+ * Sweep all the remaining arrays of the global expression pool.
+ */
+void pool_sweep_finish(void);
+
+/*
+ * List of free items, with a pointer to its last element so it can be
+ * appended to another list in constant time. See 'pool_sweep_array'.
+ *
+ * The 'num_freed' member is the number of items that were freed when building
+ * the list. The stats of the pool are updated with it by 'pool_add_free_list'.
+ */
+typedef struct PoolFreeList {
+    PoolItem* head;
+    PoolItem* tail;
+    size_t num_freed;
+} PoolFreeList;
+
+/*
+ * Sweep the specified array of the global expression pool: free its unmarked
+ * items, and add them to the specified list, along with the items that were
+ * already free. The array must not be swept by 'pool_sweep_step' too, see
+ * 'pool_sweep_stop'.
+ *
+ * Different arrays can be swept at the same time from different threads, as
+ * long as each thread uses its own list. The lists can then be added to the
+ * pool with 'pool_add_free_list'.
+ */
+void pool_sweep_array(ArrayStart* array_start, PoolFreeList* list);
+
+/*
+ * Prepend the items of the specified list to the list of free items of the
+ * global expression pool.
+ */
+void pool_add_free_list(const PoolFreeList* list);
+
+/*
+ * Stop sweeping the global expression pool. The arrays that were not swept yet
+ * are not swept until the next call to 'pool_sweep_start', so their free items
+ * can't be allocated in the meantime. Used by the parallel sweep, which sweeps
+ * those arrays by itself, see 'pool_sweep_array'.
+ */
+void pool_sweep_stop(void);
+
+/*
+ * Number of arrays in the global expression pool that have at least one item
+ * marked by the garbage collector. Used for measuring the fragmentation of the
+ * pool, see 'gc_set_compact_density'.
+ */
+size_t pool_count_marked_arrays(void);
+
+/*
+ * Remove all the arrays from the global expression pool, and return them as a
+ * linked list. The pool is left without free items, so it allocates new arrays
+ * as they are needed. The counters of the pool still include the detached
+ * arrays until they are released with 'pool_release_arrays'.
+ *
+ * Used by the compacting collector, along with 'pool_move', see
+ * 'gc_compact_heap'.
+ */
+ArrayStart* pool_detach_arrays(void);
 
 /*
- * Is the specified item flagged as free?
+ * Move the specified expression to a new item of the global expression pool,
+ * and return its new address. The new item is marked by the garbage collector,
+ * and the heap members of the expression now belong to it.
+ *
+ * The old item becomes free, but it stays marked, and it stores the new
+ * address, so other references to the same expression can be updated. See
+ * 'pool_item_is_moved' and 'pool_moved_to'.
  */
-#define pool_item_is_free(pool_item)                                           \
-    ((pool_item_flags(pool_item) & POOL_FLAG_FREE) != 0)
+Expr* pool_move(Expr* e);
 
 /*
- * Is the specified item flagged for garbage collection?
+ * Return the new address of an expression that was moved with 'pool_move'.
  */
-#define pool_item_is_gcmarked(pool_item)                                       \
-    ((pool_item_flags(pool_item) & POOL_FLAG_GCMARKED) != 0)
+Expr* pool_moved_to(Expr* e);
+
+/*
+ * Return the arrays of a list returned by 'pool_detach_arrays' to the system.
+ * The heap members of the items that are neither free nor moved are freed.
+ */
+void pool_release_arrays(ArrayStart* list);
+
+/*
+ * Print stats about each array of the global expression pool to the specified
+ * file. This walks the whole pool; for cheaper counters, see 'PoolStats'.
+ */
+void pool_print_stats(FILE* fp);
+
+/*
+ * Dump the contents of the global expression pool to the specified file.
+ */
+void pool_dump(FILE* fp);
+
+/*----------------------------------------------------------------------------*/
+/* Static functions and macros */
 
 /*
  * Return the pool item for the specified expression.
  *
  * We are able to cast an 'Expr' pointer to a 'PoolItem' one because the
- * expression is stored (inside a union) in the first member of 'PoolItem'. This
- * might not always be the case, so it's useful to have this function.
+ * expression is stored in a union with the "next free" pointer. This might not
+ * always be the case, so it's useful to have this function.
  */
 static inline PoolItem* pool_item_from_expr(Expr* e) {
     return (PoolItem*)e;
 }
 
+/*
+ * Return the header of the array that contains the specified pool item.
+ */
+static inline ArrayStart* array_start_from_item(const PoolItem* pool_item) {
+    return (ArrayStart*)((uintptr_t)pool_item &
+                         ~(uintptr_t)(POOL_ARRAY_BYTES - 1));
+}
+
+/*
+ * Return the position of the specified item inside its array.
+ */
+static inline size_t pool_item_index(const ArrayStart* a,
+                                     const PoolItem* pool_item) {
+    return (size_t)(pool_item - a->arr);
+}
+
+/*
+ * Is the specified item free?
+ */
+static inline bool pool_item_is_free(const PoolItem* pool_item) {
+    const ArrayStart* a = array_start_from_item(pool_item);
+    const size_t i      = pool_item_index(a, pool_item);
+    return (a->free_bits[i / 64] >> (i % 64)) & 1;
+}
+
+/*
+ * Is the specified item marked by the garbage collector?
+ */
+static inline bool pool_item_is_gcmarked(const PoolItem* pool_item) {
+    const ArrayStart* a = array_start_from_item(pool_item);
+    const size_t i      = pool_item_index(a, pool_item);
+    return (a->mark_bits[i / 64] >> (i % 64)) & 1;
+}
+
+/*
+ * Was the specified item moved by 'pool_move'? The compacting collector clears
+ * all marks before moving anything, so the moved items are the only ones that
+ * are both free and marked.
+ */
+static inline bool pool_item_is_moved(const PoolItem* pool_item) {
+    return pool_item_is_free(pool_item) && pool_item_is_gcmarked(pool_item);
+}
+
+/*
+ * Mark the specified item for the garbage collector. Returns true if it was
+ * already marked, so checking and marking only needs to locate the bit once.
+ */
+static inline bool pool_item_set_gcmarked(PoolItem* pool_item) {
+    ArrayStart* a       = array_start_from_item(pool_item);
+    const size_t i      = pool_item_index(a, pool_item);
+    const uint64_t bit  = (uint64_t)1 << (i % 64);
+    const bool was_set  = (a->mark_bits[i / 64] & bit) != 0;
+    a->mark_bits[i / 64] |= bit;
+    return was_set;
+}
+
+/*
+ * Atomic version of 'pool_item_set_gcmarked', for marking from multiple
+ * threads at the same time.
+ */
+static inline bool pool_item_set_gcmarked_atomic(PoolItem* pool_item) {
+    ArrayStart* a      = array_start_from_item(pool_item);
+    const size_t i     = pool_item_index(a, pool_item);
+    const uint64_t bit = (uint64_t)1 << (i % 64);
+    const uint64_t old =
+      __atomic_fetch_or(&a->mark_bits[i / 64], bit, __ATOMIC_RELAXED);
+    return (old & bit) != 0;
+}
+
 #endif /* EXPR_POOL_H_ */
@@ -19,34 +19,403 @@
 #ifndef GARBAGE_COLLECTION_H_
 #define GARBAGE_COLLECTION_H_ 1
 
-struct Env;  /* env.h */
-struct Expr; /* expr.h */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "env.h"       /* Env */
+#include "expr.h"      /* expr_is_immortal() */
+#include "expr_pool.h" /* pool_item_is_gcmarked() */
 
 /*
- * Unmark all nodes in 'g_expr_pool', declared in 'expr_pool.h'.
+ * Default number of bytes that can be allocated after a collection before the
+ * next (minor) collection is requested. See 'gc_set_budget' and 'gc_run'.
  */
-void gc_unmark_all(void);
+#define GC_DEFAULT_BUDGET (512 * 1024)
+
+/*
+ * Minimum number of old expressions (i.e. expressions that survived a
+ * collection) before the next collection is a major one. After each major
+ * collection, the limit is set to 'GC_HEAP_GROWTH' times the number of items
+ * that survived it, so the time spent in major collections is proportional to
+ * the allocated memory.
+ */
+#define GC_MIN_THRESHOLD 16384
+#define GC_HEAP_GROWTH   2
+
+/*
+ * Minimum number of budgets (see 'gc_set_budget') that have to be allocated
+ * since the last major collection for triggering another one, if the old
+ * generation didn't grow past the threshold.
+ */
+#define GC_MIN_MINORS 4
+
+/*
+ * Default maximum duration of each step of the incremental collector, in
+ * microseconds. See 'gc_set_max_pause'.
+ */
+#define GC_DEFAULT_MAX_PAUSE_US 1000
+
+/*
+ * While the incremental collector is marking, a step is performed each time
+ * 'GC_INCREMENTAL_STEPS' parts of the budget have been allocated (see
+ * 'gc_set_budget').
+ */
+#define GC_INCREMENTAL_STEPS 8
+
+/*
+ * Amount of work that the incremental collector performs between each check of
+ * the elapsed time: the number of scanned expressions, plus the number of
+ * bindings of the scanned environments. See 'gc_mark_step'.
+ */
+#define GC_INCREMENTAL_CHECK_ITEMS 256
+
+/*
+ * Number of free items left in the expression pool below which the incremental
+ * collector is considered to be falling behind the allocations, so the current
+ * marking is finished without a time limit. See 'gc_pool_low'.
+ */
+#define GC_INCREMENTAL_RESERVE POOL_ARRAY_ITEMS
+
+/*
+ * Maximum number of times that the incremental collector scans the roots again
+ * while trying to finish the marking in a single step, before finishing it
+ * without a time limit. See 'gc_run'.
+ */
+#define GC_INCREMENTAL_MAX_RESCANS 8
+
+/*
+ * Maximum number of empty arrays that the incremental collector returns to the
+ * system after each collection. See 'pool_sweep_start'.
+ */
+#define GC_INCREMENTAL_MAX_RELEASE 16
+
+/*
+ * Default density of the arrays of the expression pool under which a
+ * compaction is requested, and minimum number of arrays with live expressions
+ * for requesting it. See 'gc_set_compact_density'.
+ */
+#define GC_DEFAULT_COMPACT_DENSITY 0.25
+#define GC_COMPACT_MIN_ARRAYS      16
+
+/*
+ * Minimum number of items in the expression pool for marking and sweeping with
+ * multiple threads, see 'gc_set_threads'. For smaller heaps, the time needed
+ * for waking up the threads is not worth it.
+ */
+#define GC_PARALLEL_MIN_ITEMS (256 * 1024)
+
+/*
+ * Number of expressions that each thread of the parallel marking scans between
+ * each check for idle threads, minimum number of entries in its mark stack for
+ * sharing half of them, and maximum number of mark stack entries that an idle
+ * thread takes at once from the shared pool.
+ *
+ * Sharing very small stacks is not worth it, since they are usually the rest
+ * of a list that is being marked, which would then be passed back and forth.
+ */
+#define GC_PARALLEL_SHARE_ITEMS 64
+#define GC_PARALLEL_MIN_SHARE   16
+#define GC_PARALLEL_TAKE_ITEMS  64
+
+/*
+ * Initial number of elements in the shadow root stack. It grows automatically.
+ */
+#define GC_ROOTS_BASE_SZ 256
+
+/*
+ * Initial number of elements in the mark stack, used for marking expressions
+ * without recursion. It grows automatically.
+ */
+#define GC_MARK_STACK_BASE_SZ 1024
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Modes of the garbage collector, see 'gc_set_mode'.
+ */
+enum EGcMode {
+    /* Each collection marks everything and collects in a single pause. */
+    GC_MODE_STOP,
+
+    /* The marking is split into small steps, interleaved with the evaluation,
+     * and only the end of each collection needs a single longer pause. */
+    GC_MODE_INCREMENTAL,
+};
+
+/*
+ * Counters of the garbage collector, see 'gc_get_stats'. Times are in
+ * microseconds.
+ *
+ *   - The 'num_minor' and 'num_major' members are the number of finished minor
+ *     and major collections.
+ *   - The 'num_compactions' member is the number of times the expression pool
+ *     was compacted, see 'gc_compact'.
+ *   - The 'num_pauses' member is the number of calls to 'gc_run'. In
+ *     'GC_MODE_INCREMENTAL', each collection usually needs many of them.
+ *   - The 'num_marked' member is the number of expressions that survived the
+ *     last collection or compaction. The ones marked so far by an unfinished
+ *     incremental collection are not included, since a major one starts by
+ *     clearing all marks.
+ *   - The 'mark_us' and 'sweep_us' members are the total time spent marking
+ *     and sweeping. The time spent by the pool sweeping lazily is included,
+ *     see 'PoolStats'. The 'compact_us' member is the total time spent
+ *     compacting.
+ *   - The 'max_pause_us' member is the duration of the longest call to
+ *     'gc_run'.
+ */
+typedef struct GcStats {
+    size_t num_minor;
+    size_t num_major;
+    size_t num_compactions;
+    size_t num_pauses;
+    size_t num_marked;
+    uint64_t mark_us;
+    uint64_t sweep_us;
+    uint64_t compact_us;
+    uint64_t max_pause_us;
+} GcStats;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Set when the expression pool is full and it has grown past the threshold, or
+ * by 'gc_request_major'. The collection itself happens in the next call to
+ * 'gc_safepoint'.
+ */
+extern bool g_gc_requested;
+
+/*
+ * Set when the expression pool should be compacted, either because it's too
+ * fragmented or because it was requested explicitly. The compaction itself
+ * happens in the next call to 'gc_compact_safepoint'.
+ */
+extern bool g_gc_compact_requested;
+
+/*
+ * Number of bytes allocated since the last collection, and number of bytes
+ * that trigger the next collection, or the next step of the incremental
+ * collector. See 'gc_count_alloc'.
+ */
+extern size_t g_gc_alloc_bytes;
+extern size_t g_gc_trigger;
+
+/*
+ * Current mark epoch of environments and heap strings. An environment is marked
+ * if its 'gc_epoch' member matches this value, see 'gc_env_is_marked', and the
+ * same applies to 'HeapStr'. It's incremented by each major collection, which
+ * unmarks all of them at once.
+ */
+extern size_t g_gc_epoch;
+
+/*
+ * Stack of pointers to C variables that hold expressions which are not
+ * reachable from the environment, like the arguments of a call that is being
+ * evaluated. See 'gc_root'.
+ */
+extern struct Expr*** g_gc_roots;
+extern size_t g_gc_roots_sz;
+extern size_t g_gc_roots_pos;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Grow the shadow root stack. Called by 'gc_root' when it's full.
+ */
+void gc_roots_grow(void);
+
+/*
+ * Register the C variable pointed to by 'slot' as a root for the garbage
+ * collector, so the expression it contains (if any) is not collected. Since the
+ * variable is read on each collection, it can be modified after calling this
+ * function.
+ *
+ * Roots are registered in a LIFO stack, and they must be removed before the
+ * variable goes out of scope, by restoring the position returned by
+ * 'gc_roots_save':
+ *
+ *     const size_t roots = gc_roots_save();
+ *     gc_root(&list);
+ *     ...
+ *     gc_roots_restore(roots);
+ */
+static inline void gc_root(struct Expr** slot) {
+    if (g_gc_roots_pos >= g_gc_roots_sz)
+        gc_roots_grow();
+    g_gc_roots[g_gc_roots_pos++] = slot;
+}
+
+static inline size_t gc_roots_save(void) {
+    return g_gc_roots_pos;
+}
+
+static inline void gc_roots_restore(size_t pos) {
+    g_gc_roots_pos = pos;
+}
+
+/*
+ * Called by the expression pool for each allocation. When enough bytes have
+ * been allocated since the last collection, request a minor collection (or the
+ * next step of the current one, in incremental mode).
+ */
+static inline void gc_count_alloc(size_t bytes) {
+    g_gc_alloc_bytes += bytes;
+    if (g_gc_alloc_bytes >= g_gc_trigger)
+        g_gc_requested = true;
+}
+
+/*
+ * Was the specified environment marked by the garbage collector since the last
+ * major collection? Just like expressions, marked environments are old.
+ */
+static inline bool gc_env_is_marked(const struct Env* env) {
+    return env->gc_epoch == g_gc_epoch;
+}
+
+/*
+ * Remember an old expression that might now point to young expressions. Used
+ * by 'gc_write_barrier'.
+ */
+void gc_remember(struct Expr* e);
 
 /*
- * Mark all expressions in the specified environment as currently used. This
- * function doesn't free or collect anything, use 'gc_collect' for that.
- * Multiple environments can be marked before collecting.
+ * Remember an old environment that might now point to young expressions. Used
+ * by 'gc_write_barrier_env'.
+ */
+void gc_remember_env(struct Env* env);
+
+/*
+ * Write barriers. They must be called after storing an expression inside an
+ * existing expression or environment, which might be old. Minor collections
+ * don't scan old expressions, so the modified ones are remembered and scanned
+ * in the next collection.
  *
- * This only marks the expressions directly in the specified environment, it
- * does not mark parent environments.
+ * Expressions that were allocated since the last collection, and the ones
+ * that are not in the pool, don't need to be remembered. Note that 'e' must not
+ * point to an expression outside of the pool, other than the immortal ones.
+ */
+static inline void gc_write_barrier(struct Expr* e) {
+    if (!expr_is_immortal(e) && pool_item_is_gcmarked(pool_item_from_expr(e)))
+        gc_remember(e);
+}
+
+void gc_write_barrier_env(struct Env* env);
+
+/*
+ * Free the shadow root stack, the mark stack and the remembered sets.
+ */
+void gc_close(void);
+
+/*
+ * Set the global environment, which is the main root of the garbage collector.
+ */
+void gc_set_global_env(struct Env* env);
+
+/*
+ * Set the number of bytes that can be allocated between collections, which
+ * must be greater than zero. Bigger values mean fewer collections, but more
+ * memory usage.
+ */
+void gc_set_budget(size_t bytes);
+
+/*
+ * Set the number of threads used by the garbage collector, including the main
+ * thread, which must be between one and 'GC_THREADS_MAX'. It must be called
+ * once, before the first collection.
+ *
+ * With more than one thread, the marking of the stop mode (see 'gc_set_mode')
+ * is performed in parallel: each thread has its own mark stack, and the
+ * threads that run out of work take it from the ones that still have some.
+ * After major collections, the pool is also swept in parallel, right after
+ * marking, instead of lazily.
+ */
+void gc_set_threads(size_t num);
+
+/*
+ * Set the mode of the garbage collector. It must be called before the first
+ * collection. The default mode is 'GC_MODE_STOP'.
+ */
+void gc_set_mode(enum EGcMode mode);
+
+/*
+ * Set the maximum duration of each marking step of the incremental collector,
+ * in microseconds, which must be greater than zero. The pause at the end of
+ * each collection is not limited, but it usually only needs to scan the roots
+ * again, along with the expressions that were modified while marking.
+ */
+void gc_set_max_pause(size_t us);
+
+/*
+ * Enable or disable the trace of the garbage collector. When enabled, a line
+ * with the stats of each collection is printed to 'stderr' once it finishes.
+ */
+void gc_set_trace(bool enabled);
+
+/*
+ * Set the density under which the expression pool is compacted, between zero
+ * and one. After each major collection, if the surviving expressions occupy
+ * less than this fraction of the arrays that contain them, and there are at
+ * least 'GC_COMPACT_MIN_ARRAYS' of those, a compaction is requested. A density
+ * of zero disables these compactions. See 'gc_compact'.
+ */
+void gc_set_compact_density(double density);
+
+/*
+ * Return the current counters of the garbage collector. They are updated as
+ * the collector runs, so this function doesn't need to walk the pool. For the
+ * counters of the expression pool, see 'PoolStats'.
+ */
+GcStats gc_get_stats(void);
+
+/*
+ * Current time in microseconds, only used for measuring intervals.
+ */
+uint64_t gc_time_us(void);
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Unmark all nodes in 'g_expr_pool', declared in 'expr_pool.h', and all
+ * environments.
  */
-void gc_mark_env_contents(struct Env* env);
+void gc_unmark_all(void);
 
 /*
- * Mark the specified expression as currently used, recursively. This function
- * doesn't free or collect anything, use 'gc_collect' for that. Multiple
- * expressions can be marked before collecting.
+ * Mark the specified environment, its contents and all of its parents as
+ * currently used. Environments are traced just like pairs: the contents and
+ * the parent are only scanned if the environment was not marked already.
+ */
+void gc_mark_env(struct Env* env);
+
+/*
+ * Mark the specified environment as a root: its contents are scanned even if
+ * it was already marked, since roots (e.g. the global environment or the
+ * active frames) are modified without write barriers. Its parents are marked
+ * with 'gc_mark_env'.
+ */
+void gc_mark_env_root(struct Env* env);
+
+/*
+ * Mark the specified expression and everything reachable from it as currently
+ * used. This function doesn't free or collect anything, use 'gc_collect' for
+ * that. Multiple expressions can be marked before collecting.
+ *
+ * The marking uses an explicit stack instead of recursion, so expressions of
+ * any depth (e.g. very long lists) can be marked.
  */
 void gc_mark_expr(struct Expr* expr);
 
 /*
- * Collect all unmarked expressions (i.e. all nodes whose 'NODE_GCMARKED' flag
- * is not set) in 'g_expr_pool', declared in 'expr_pool.h'.
+ * Was the specified expression marked since the last call to 'gc_unmark_all'?
+ * Immortal expressions (see 'expr_is_immortal') are always considered marked.
+ */
+bool gc_is_marked(const struct Expr* expr);
+
+/*
+ * Collect all unmarked expressions (i.e. all items whose mark bit is not set)
+ * in 'g_expr_pool', declared in 'expr_pool.h'. The expressions are not freed
+ * immediately; the pool sweeps its arrays lazily as it needs more free items,
+ * see 'pool_sweep_start'.
  *
  * This function is usually called after unmarking all nodes with
  * 'gc_unmark_all', and then marking the desired nodes with one or more calls to
@@ -54,4 +423,97 @@ void gc_mark_expr(struct Expr* expr);
  */
 void gc_collect(void);
 
+/*
+ * Perform a collection: mark everything that is reachable from the roots (the
+ * global environment, the active activation frames, the shadow root stack, the
+ * stacks of the virtual machine, etc.) and collect the rest.
+ *
+ * The collector is generational. Every expression that survives a collection
+ * keeps its mark, and becomes "old". Most collections are minor: they don't
+ * clear the marks, so the marking stops at old expressions, and only the young
+ * ones (allocated since the last collection) can be freed. The old expressions
+ * that were modified since the last collection are scanned too, see
+ * 'gc_write_barrier'. When the number of old expressions reaches a threshold,
+ * the next collection is a major one, which clears all marks first.
+ *
+ * In 'GC_MODE_INCREMENTAL', each call only performs a step of the current
+ * collection (starting a new one if needed), see 'gc_set_mode'. The marking is
+ * resumed in the next call, and the marked expressions that are modified in
+ * the meantime are remembered by the write barriers, just like old ones, and
+ * scanned again once the mark stack is empty, along with the roots.
+ */
+void gc_run(void);
+
+/*
+ * Request a major collection, which is performed by the next call to
+ * 'gc_safepoint', without the time limit of the incremental collector. If the
+ * incremental collector is marking, the current collection is finished first,
+ * and the major one is performed by the following call.
+ */
+void gc_request_major(void);
+
+/*
+ * Called by the expression pool when it has no free items left, before
+ * expanding it. If the pool is big enough, request a collection.
+ */
+void gc_pool_exhausted(void);
+
+/*
+ * Called by the expression pool when it has less than 'GC_INCREMENTAL_RESERVE'
+ * free items left, and no arrays left to sweep. If the incremental collector is
+ * marking, the marking is finished by the next call to 'gc_safepoint', without
+ * a time limit, so the garbage can be reused instead of growing the pool.
+ */
+void gc_pool_low(void);
+
+/*
+ * Compact the expression pool: move every reachable expression to new arrays,
+ * next to each other, update all references to them and return the old arrays
+ * to the system. See 'gc_compact_heap'.
+ *
+ * This is a full collection, so it also frees the unreachable environments and
+ * strings. If the incremental collector was marking, that collection is
+ * discarded. The memoized macro expansions are also discarded, since they are
+ * indexed by the address of their call form.
+ *
+ * Since the expressions pointed to by C variables can't be updated, this must
+ * only be called when nothing is being evaluated, see 'gc_compact_safepoint'.
+ */
+void gc_compact(void);
+
+/*
+ * Run the garbage collector if a collection was requested. Called from points
+ * of the evaluation where all the live expressions are reachable from the
+ * roots; currently before evaluating an expression, and before each call in the
+ * virtual machine.
+ *
+ * If 'SL_GC_STRESS' is defined, a collection is performed on every call, which
+ * is useful for finding expressions that are not registered as roots, or
+ * missing write barriers. Minor and major collections are alternated.
+ */
+static inline void gc_safepoint(void) {
+#ifdef SL_GC_STRESS
+    gc_run();
+#else
+    if (g_gc_requested)
+        gc_run();
+#endif
+}
+
+/*
+ * Compact the expression pool if it was requested. Called from the top level of
+ * the REPL, after each expression has been evaluated and collected.
+ *
+ * If 'SL_GC_STRESS' is defined, the pool is compacted on every call, which is
+ * useful for finding references to expressions that are not updated.
+ */
+static inline void gc_compact_safepoint(void) {
+#ifdef SL_GC_STRESS
+    gc_compact();
+#else
+    if (g_gc_compact_requested)
+        gc_compact();
+#endif
+}
+
 #endif /* GARBAGE_COLLECTION_H_ */
@@ -0,0 +1,57 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GC_COMPACT_H_
+#define GC_COMPACT_H_ 1
+
+#include <stddef.h>
+
+struct Env; /* env.h */
+
+/*
+ * Initial number of arrays that can be tracked by the compaction before its
+ * list has to grow. See 'gc_compact_heap'.
+ */
+#define GC_COMPACT_ARRAYS_BASE_SZ 16
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Move every expression that is reachable from the global environment 'env' to
+ * new arrays of the expression pool, and return the old arrays to the system.
+ * Returns the number of expressions that were moved.
+ *
+ * The expressions are copied in the order they are found, starting from the
+ * roots, so the elements of a list end up next to each other. The pointers to
+ * the moved expressions are updated in every place that can hold them: pairs,
+ * the body of lambdas and their compiled bytecode, the bindings of reachable
+ * environments, the shadow root stack (see 'gc_root') and
+ * 'g_debug_trace_list'.
+ *
+ * The marks of the pool must have been cleared with 'gc_unmark_all', since the
+ * mark bits of the old arrays are used for finding the expressions that were
+ * already moved. The moved expressions, the environments and the heap strings
+ * that are reachable from them are marked, just like after a major collection.
+ *
+ * Since C variables can't be updated, this must only be called when no
+ * expression is being evaluated (i.e. from the top level), and the activation
+ * frames, the stacks of the virtual machine and the callstack must be empty.
+ */
+size_t gc_compact_heap(struct Env* env);
+
+#endif /* GC_COMPACT_H_ */
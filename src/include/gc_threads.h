@@ -0,0 +1,94 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef GC_THREADS_H_
+#define GC_THREADS_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Maximum number of threads used by the garbage collector, including the main
+ * thread.
+ */
+#define GC_THREADS_MAX 256
+
+/*
+ * Function called by each thread in 'gc_threads_run'. The 'id' argument is
+ * the index of the thread, from zero (the calling thread) to the number of
+ * threads minus one.
+ */
+typedef void (*GcThreadFunc)(size_t id, void* arg);
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Start the worker threads of the garbage collector. The 'num_threads'
+ * argument includes the calling thread, so no threads are started if it's one.
+ * The workers sleep until 'gc_threads_run' is called.
+ */
+void gc_threads_init(size_t num_threads);
+
+/*
+ * Stop the worker threads, and free the shared work pool.
+ */
+void gc_threads_close(void);
+
+/*
+ * Number of threads that are used by 'gc_threads_run', including the calling
+ * thread.
+ */
+size_t gc_threads_num(void);
+
+/*
+ * Call 'func' from every thread, including the calling one, and wait until all
+ * of them return.
+ */
+void gc_threads_run(GcThreadFunc func, void* arg);
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * The threads can balance their work through a shared pool of pointers. A
+ * thread that runs out of work calls 'gc_threads_take', and a busy thread adds
+ * some of its work with 'gc_threads_share' when 'gc_threads_want_work' returns
+ * true. The pool is empty when 'gc_threads_run' returns.
+ */
+
+/*
+ * Add 'num' pointers to the shared work pool, waking up the threads that are
+ * waiting in 'gc_threads_take'. It can also be called before
+ * 'gc_threads_run', for distributing the initial work.
+ */
+void gc_threads_share(void* const* items, size_t num);
+
+/*
+ * Move up to 'max' pointers from the shared work pool to 'dst', waiting until
+ * there is some work available. Returns the number of pointers that were
+ * moved, or zero if every thread ran out of work, in which case there is
+ * nothing left to do.
+ */
+size_t gc_threads_take(void** dst, size_t max);
+
+/*
+ * Is any thread waiting for work in 'gc_threads_take'? This is only a hint,
+ * and it can be called without synchronization.
+ */
+bool gc_threads_want_work(void);
+
+#endif /* GC_THREADS_H_ */
@@ -0,0 +1,259 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * SL. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef IMAGE_H_
+#define IMAGE_H_ 1
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct Env; /* env.h */
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Magic bytes at the start of every heap image, and version of the format. The
+ * version must be incremented whenever the layout of the records below
+ * changes.
+ */
+#define IMAGE_MAGIC   "SLIMAGE"
+#define IMAGE_VERSION 2
+
+/*
+ * Value of the references and positions that don't point to anything, like the
+ * "&rest" formal of a lambda that doesn't have one.
+ */
+#define IMAGE_NONE UINT64_MAX
+
+/*
+ * A heap image is a single file with the global environment and everything
+ * that is reachable from it. It only contains fixed-size records, aligned to 8
+ * bytes, which are grouped in the sections below. The records never store
+ * addresses; they refer to each other by their position in the corresponding
+ * section, so the file can be mapped anywhere, and it's read in place.
+ *
+ * The references to expressions (e.g. the 'car' of a pair) are encoded with
+ * 'IMAGE_REF_EXPR' and 'IMAGE_REF_IMMORTAL'. Symbols, environments and the
+ * other records are referred to by their position.
+ */
+enum EImageSection {
+    /* Null-terminated strings: symbol names, primitive names and long
+     * strings. Other records refer to them by their offset in the section. */
+    IMAGE_SEC_CHARS,
+
+    /* Offsets of symbol names in 'IMAGE_SEC_CHARS', one per symbol. */
+    IMAGE_SEC_SYMBOLS,
+
+    /* Primitives used by the image, see 'ImagePrim'. */
+    IMAGE_SEC_PRIMS,
+
+    /* Strings of the string heap, see 'ImageStr'. Each one is allocated once
+     * when loading, so the expressions that shared it keep sharing it. */
+    IMAGE_SEC_STRINGS,
+
+    /* Expressions, see 'ImageExpr'. */
+    IMAGE_SEC_EXPRS,
+
+    /* Lambda and macro contexts, see 'ImageLambda'. */
+    IMAGE_SEC_LAMBDAS,
+
+    /* Environments, see 'ImageEnv'. The first one is the global
+     * environment. */
+    IMAGE_SEC_ENVS,
+
+    /* Bindings of the environments, see 'ImageBinding'. */
+    IMAGE_SEC_BINDINGS,
+
+    /* Arrays of 64-bit values used by the lambdas: their formals and the
+     * symbols of their variable references, as symbols, and their bytecode
+     * constants, as expressions. */
+    IMAGE_SEC_WORDS,
+
+    /* Instructions of the bytecode of the lambdas, see 'ImageInstr'. */
+    IMAGE_SEC_INSTRS,
+
+    /* Call sites of the bytecode of the lambdas, see 'ImageSite'. */
+    IMAGE_SEC_SITES,
+
+    IMAGE_SEC_NUM,
+};
+
+/*
+ * Encode a reference to the expression at position 'I' of 'IMAGE_SEC_EXPRS',
+ * or to an immortal expression: 'g_nil' (zero), 'g_tru' (one), or the
+ * integer at position 'I - 2' of 'g_small_ints'.
+ */
+#define IMAGE_REF_EXPR(I)     ((uint64_t)(I) << 1)
+#define IMAGE_REF_IMMORTAL(I) (((uint64_t)(I) << 1) | 1)
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Position and number of records of a section.
+ */
+typedef struct ImageSection {
+    uint64_t offset;
+    uint64_t num;
+} ImageSection;
+
+/*
+ * Header at the start of the image. The 'file_sz' member is used for detecting
+ * truncated images, and 'debug_trace_list' is the reference to the expression
+ * used as 'g_debug_trace_list'.
+ */
+typedef struct ImageHeader {
+    char magic[8];
+    uint64_t version;
+    uint64_t file_sz;
+    uint64_t debug_trace_list;
+    ImageSection sections[IMAGE_SEC_NUM];
+} ImageHeader;
+
+/*
+ * A primitive, identified by its position in the list returned by
+ * 'env_primitive_index'. The 'name' is the offset of the symbol it was bound
+ * to, which is checked when loading, so an image created by a different
+ * version of the interpreter is rejected.
+ */
+typedef struct ImagePrim {
+    uint64_t index;
+    uint64_t name;
+} ImagePrim;
+
+/*
+ * A string of the string heap, with its offset in 'IMAGE_SEC_CHARS' and its
+ * length.
+ */
+typedef struct ImageStr {
+    uint64_t offset;
+    uint64_t len;
+} ImageStr;
+
+/*
+ * An expression. The 'type' and 'is_inline' members are the same as in 'Expr',
+ * and the meaning of 'val' depends on the type:
+ *
+ *   - Numbers and inline strings: the same bits as in 'Expr'.
+ *   - Long strings and errors: the position of the 'ImageStr' in 'w[0]'.
+ *   - Symbols: the position of the symbol in 'w[0]'.
+ *   - Pairs: the references to the 'car' and 'cdr' in 'w[0]' and 'w[1]'.
+ *   - Primitives: the position of the 'ImagePrim' in 'w[0]'.
+ *   - Lambdas and macros: the position of the 'ImageLambda' in 'w[0]'.
+ */
+typedef struct ImageExpr {
+    uint32_t type;
+    uint32_t is_inline;
+    union {
+        int64_t n;
+        double f;
+        char inline_s[16];
+        uint64_t w[2];
+    } val;
+} ImageExpr;
+
+/*
+ * The context of a lambda or macro. The 'formals', 'consts' and 'refs' members
+ * are positions in 'IMAGE_SEC_WORDS', the 'code' is a position in
+ * 'IMAGE_SEC_INSTRS' and the 'sites' are a position in 'IMAGE_SEC_SITES'; each
+ * one is followed by its number of elements. If the lambda was not compiled,
+ * 'code' is 'IMAGE_NONE'.
+ */
+typedef struct ImageLambda {
+    uint64_t env;
+    uint64_t body;
+    uint64_t formals;
+    uint64_t formals_num;
+    uint64_t formal_rest;
+    uint64_t code;
+    uint64_t code_sz;
+    uint64_t consts;
+    uint64_t consts_sz;
+    uint64_t sites;
+    uint64_t sites_sz;
+    uint64_t refs;
+    uint64_t refs_sz;
+} ImageLambda;
+
+/*
+ * An environment, whose bindings are 'bindings_num' consecutive records of
+ * 'IMAGE_SEC_BINDINGS'. Every environment except the global one is a captured
+ * activation frame.
+ */
+typedef struct ImageEnv {
+    uint64_t parent;
+    uint64_t bindings;
+    uint64_t bindings_num;
+} ImageEnv;
+
+/*
+ * A binding of an environment, with the position of the symbol, a reference to
+ * the value, and the flags.
+ */
+typedef struct ImageBinding {
+    uint64_t sym;
+    uint64_t val;
+    uint64_t flags;
+} ImageBinding;
+
+/*
+ * An instruction of the bytecode, see 'Instr'.
+ */
+typedef struct ImageInstr {
+    uint64_t op;
+    uint64_t arg;
+} ImageInstr;
+
+/*
+ * A call site of the bytecode, see 'CallSite'. The 'special' member is the
+ * position of the 'ImagePrim', or 'IMAGE_NONE'. The inline cache is not
+ * stored, it's filled again on the first call.
+ */
+typedef struct ImageSite {
+    uint64_t form;
+    uint64_t argc;
+    uint64_t end;
+    uint64_t tail;
+    uint64_t special;
+} ImageSite;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Write the global environment 'env', and everything that is reachable from
+ * it, to a new heap image at 'path'. Returns true on success, or false if an
+ * error was printed.
+ *
+ * This must only be called from the top level, when no expression is being
+ * evaluated, since the activation frames of the calls are not stored.
+ */
+bool image_dump(const struct Env* env, const char* path);
+
+/*
+ * Map the heap image at 'path', and restore its contents into the global
+ * environment 'env', which must have been initialized with
+ * 'env_init_defaults'. The bindings of the image replace the ones with the same
+ * symbol, except for the constant ones, which can't change. Returns true on
+ * success, or false if an error was printed.
+ *
+ * The records of the image are read in place, and each expression, lambda and
+ * environment is allocated once, so loading is a single pass over the file,
+ * plus the fixup of the references between them.
+ */
+bool image_load(struct Env* env, const char* path);
+
+#endif /* IMAGE_H_ */
@@ -23,8 +23,15 @@
 #include <stdbool.h>
 #include <stdio.h> /* FILE */
 
-struct Expr; /* expr.h */
-struct Env;  /* env.h */
+struct Expr;     /* expr.h */
+struct Env;      /* env.h */
+struct Bytecode; /* compile.h */
+
+/*
+ * Initial number of entries in the macro expansion cache. Must be a power of
+ * two. See 'macro_expand_cached'.
+ */
+#define MACRO_CACHE_BASE_SZ 256
 
 enum ELambdaCtxErr {
     LAMBDACTX_ERR_NONE = 0,
@@ -34,11 +41,11 @@ enum ELambdaCtxErr {
 
 typedef struct LambdaCtx LambdaCtx;
 struct LambdaCtx {
-    /* Environment for binding the formal arguments to the actual values when
-     * calling the lambda. */
+    /* Environment where the lambda was defined, used as the parent of the
+     * activation frame of each call. Not owned by the lambda. */
     struct Env* env;
 
-    /* Mandatory formal arguments */
+    /* Mandatory formal arguments, as interned symbols */
     char** formals;
     size_t formals_num;
 
@@ -48,6 +55,9 @@ struct LambdaCtx {
 
     /* List of expressions to be evaluated in order when calling the lambda */
     struct Expr* body;
+
+    /* The body, compiled for the virtual machine (see 'compile_lambda') */
+    struct Bytecode* code;
 };
 
 /*----------------------------------------------------------------------------*/
@@ -75,22 +85,23 @@ enum ELambdaCtxErr lambdactx_init(struct Env* env, LambdaCtx* ctx,
  * Copy the specified 'LambdaCtx' structure into an allocated copy, and return
  * it.
  *
- * Note that the list of body expressions is copied by reference, and that the
- * environment is cloned using `env_clone', which also copies references (i.e.
- * expressions are not cloned).
+ * Note that the environment and the list of body expressions are copied by
+ * reference. The formals are interned symbols, so they are not copied either.
+ * The compiled body is shared, see 'bytecode_retain'.
  */
 LambdaCtx* lambdactx_clone(const LambdaCtx* ctx);
 
 /*
- * Free all members of a 'LambdaCtx' structure, including its environment, and
- * the structure itself.
+ * Free all members of a 'LambdaCtx' structure, and the structure itself. The
+ * environment is not freed, since it's not owned by the lambda.
  */
 void lambdactx_free(LambdaCtx* ctx);
 
 /*----------------------------------------------------------------------------*/
 
 /*
- * Are two 'LambdaCtx' structures equal? Uses 'strcmp' and 'expr_list_equal'.
+ * Are two 'LambdaCtx' structures equal? Compares the interned formals by
+ * pointer, and the body with 'expr_equal'.
  */
 bool lambdactx_equal(const LambdaCtx* a, const LambdaCtx* b);
 
@@ -104,6 +115,26 @@ void lambdactx_print_args(FILE* fp, const LambdaCtx* ctx);
 
 /*----------------------------------------------------------------------------*/
 
+/*
+ * Create a new activation frame for calling a lambda with the specified context
+ * and arguments, and bind each formal argument in it. The frame is written to
+ * 'frame', and it should be released by the caller with 'env_frame_free'.
+ *
+ * On success, NULL is returned. If the number of arguments is not valid, an
+ * error expression is returned, and no frame is created.
+ */
+struct Expr* lambdactx_bind_args(const LambdaCtx* ctx, struct Expr* args,
+                                 struct Env** frame);
+
+/*
+ * Like 'lambdactx_bind_args', but the arguments are received as an array of
+ * 'argc' expressions, instead of a list.
+ */
+struct Expr* lambdactx_bind_argv(const LambdaCtx* ctx, size_t argc,
+                                 struct Expr* const* argv, struct Env** frame);
+
+/*----------------------------------------------------------------------------*/
+
 /*
  * Call the specified lambda 'func' in the specified environment 'env' with the
  * specified arguments 'args'.
@@ -117,6 +148,41 @@ struct Expr* lambda_call(struct Env* env, struct Expr* func, struct Expr* args);
 struct Expr* macro_expand(struct Env* env, struct Expr* macro,
                           struct Expr* args);
 
+/*
+ * Expand the call to a macro in 'form', whose 'car' evaluated to 'macro', and
+ * whose 'cdr' are the arguments.
+ *
+ * The expansion is memoized, so expanding the same form again (e.g. a macro
+ * call inside a loop) returns the same expansion without calling the macro, as
+ * long as the form is called with the same macro. This assumes that macros
+ * don't depend on anything but their arguments. The returned expansion should
+ * not be modified by the caller.
+ *
+ * The expressions of the cached forms are flagged, and modifying one of them
+ * (e.g. with `set') clears the cache, so forms that are built as data and
+ * passed to `eval' are expanded again after they change.
+ */
+struct Expr* macro_expand_cached(struct Env* env, struct Expr* macro,
+                                 struct Expr* form);
+
+/*
+ * Remove the entries of the macro expansion cache whose form was not marked by
+ * the garbage collector, and mark the expansions of the remaining ones. Called
+ * by 'gc_collect' before freeing the unmarked expressions.
+ */
+void macro_cache_collect(void);
+
+/*
+ * Remove every entry of the macro expansion cache, keeping the table. It might
+ * be called while a macro is being expanded.
+ */
+void macro_cache_clear(void);
+
+/*
+ * Free the macro expansion cache.
+ */
+void macro_cache_free(void);
+
 /*
  * Call the specified 'macro' in the specified environment 'env' with the
  * specified arguments 'args'.
@@ -22,6 +22,7 @@
 #include <stdio.h> /* FILE */
 
 #include "lisp_types.h" /* LispInt, LispFlt */
+#include "arena.h"      /* Arena */
 
 enum ETokenType {
     /*
@@ -34,7 +35,7 @@ enum ETokenType {
      */
     TOKEN_NUM_INT, /* Number (LispInt) */
     TOKEN_NUM_FLT, /* Number (LispFlt) */
-    TOKEN_SYMBOL,  /* Symbol (string) */
+    TOKEN_SYMBOL,  /* Symbol (interned string) */
     TOKEN_STRING,  /* String (string) */
 
     /*
@@ -66,15 +67,10 @@ typedef struct Token {
 /*----------------------------------------------------------------------------*/
 
 /*
- * Allocate and fill an array of Tokens from the input. Must be freed by the
- * caller.
+ * Fill an array of Tokens from the input. The array and the contents of the
+ * string tokens are allocated from 'arena', so they are freed along with it.
  */
-Token* tokenize(char* input);
-
-/*
- * Free an array of tokens, along with all the memory used by each element.
- */
-void tokens_free(Token* arr);
+Token* tokenize(char* input, Arena* arena);
 
 /*
  * Is 'c' a token separator? Used by 'get_token' and 'read_expr'.
@@ -33,6 +33,15 @@
 void* mem_alloc(size_t sz) WARN_UNUSED_RESULT;
 void* mem_calloc(size_t nmemb, size_t size) WARN_UNUSED_RESULT;
 
+/*
+ * Map 'sz' bytes of anonymous memory aligned to 'alignment' bytes, ensuring a
+ * valid pointer is returned. Both values must be multiples of the page size,
+ * and the alignment must be a power of two. The returned memory is zeroed, and
+ * it must be unmapped with 'mem_unmap', which returns it to the system.
+ */
+void* mem_map_aligned(size_t alignment, size_t sz) WARN_UNUSED_RESULT;
+void mem_unmap(void* ptr, size_t sz);
+
 /*
  * Allocate a new string big enough to hold 's', and copy it. Ensures a valid
  * pointer is returned. The caller is responsible for freeing the returned
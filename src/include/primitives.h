@@ -22,8 +22,14 @@
 struct Env;  /* env.h */
 struct Expr; /* expr.h */
 
+#include <stddef.h>
+
 #define DECLARE_PRIM(NAME) struct Expr* prim_##NAME(struct Env*, struct Expr*)
 
+/* Vector primitives, see 'PrimitiveVecPtr' in "expr.h" */
+#define DECLARE_PRIM_VEC(NAME)                                                 \
+    struct Expr* prim_##NAME(struct Env*, size_t, struct Expr**)
+
 /* Special Form (prim_special.c) */
 DECLARE_PRIM(quote);
 DECLARE_PRIM(backquote);
@@ -46,24 +52,27 @@ DECLARE_PRIM(set);
 DECLARE_PRIM(clone);
 DECLARE_PRIM(random);
 DECLARE_PRIM(set_random_seed);
+DECLARE_PRIM_VEC(gc);
+DECLARE_PRIM_VEC(gc_stats);
+DECLARE_PRIM_VEC(gc_compact);
 
 /* Logical (prim_logic.c) */
-DECLARE_PRIM(equal);
-DECLARE_PRIM(equal_num); /* Redundant */
-DECLARE_PRIM(lt);
-DECLARE_PRIM(gt);
+DECLARE_PRIM_VEC(equal);
+DECLARE_PRIM_VEC(equal_num); /* Redundant */
+DECLARE_PRIM_VEC(lt);
+DECLARE_PRIM_VEC(gt);
 
 /* Type-checking (prim_type.c) */
 DECLARE_PRIM(type_of);
-DECLARE_PRIM(is_int);
-DECLARE_PRIM(is_flt);
-DECLARE_PRIM(is_symbol);
-DECLARE_PRIM(is_string);
-DECLARE_PRIM(is_pair);
-DECLARE_PRIM(is_list); /* Redundant */
-DECLARE_PRIM(is_primitive);
-DECLARE_PRIM(is_lambda);
-DECLARE_PRIM(is_macro);
+DECLARE_PRIM_VEC(is_int);
+DECLARE_PRIM_VEC(is_flt);
+DECLARE_PRIM_VEC(is_symbol);
+DECLARE_PRIM_VEC(is_string);
+DECLARE_PRIM_VEC(is_pair);
+DECLARE_PRIM_VEC(is_list); /* Redundant */
+DECLARE_PRIM_VEC(is_primitive);
+DECLARE_PRIM_VEC(is_lambda);
+DECLARE_PRIM_VEC(is_macro);
 
 /* Type conversion (prim_type.c) */
 DECLARE_PRIM(int2flt);
@@ -74,10 +83,10 @@ DECLARE_PRIM(str2int);
 DECLARE_PRIM(str2flt);
 
 /* List-related (prim_list.c) */
-DECLARE_PRIM(list); /* Redundant */
-DECLARE_PRIM(cons);
-DECLARE_PRIM(car);
-DECLARE_PRIM(cdr);
+DECLARE_PRIM_VEC(list); /* Redundant */
+DECLARE_PRIM_VEC(cons);
+DECLARE_PRIM_VEC(car);
+DECLARE_PRIM_VEC(cdr);
 DECLARE_PRIM(nth); /* Redundant */
 DECLARE_PRIM(length);
 DECLARE_PRIM(append); /* Redundant */
@@ -89,25 +98,25 @@ DECLARE_PRIM(substring);
 DECLARE_PRIM(re_match_groups);
 
 /* Arithmetic (prim_arith.c) */
-DECLARE_PRIM(add);
-DECLARE_PRIM(sub);
-DECLARE_PRIM(mul);
-DECLARE_PRIM(div);
-DECLARE_PRIM(mod);
-DECLARE_PRIM(quotient);
-DECLARE_PRIM(remainder);
+DECLARE_PRIM_VEC(add);
+DECLARE_PRIM_VEC(sub);
+DECLARE_PRIM_VEC(mul);
+DECLARE_PRIM_VEC(div);
+DECLARE_PRIM_VEC(mod);
+DECLARE_PRIM_VEC(quotient);
+DECLARE_PRIM_VEC(remainder);
 DECLARE_PRIM(round);
 DECLARE_PRIM(floor);
 DECLARE_PRIM(ceiling);
 DECLARE_PRIM(truncate);
 
 /* Bit-wise (prim_bitwise.c) */
-DECLARE_PRIM(bit_and);
-DECLARE_PRIM(bit_or);
-DECLARE_PRIM(bit_xor);
-DECLARE_PRIM(bit_not);
-DECLARE_PRIM(shr);
-DECLARE_PRIM(shl);
+DECLARE_PRIM_VEC(bit_and);
+DECLARE_PRIM_VEC(bit_or);
+DECLARE_PRIM_VEC(bit_xor);
+DECLARE_PRIM_VEC(bit_not);
+DECLARE_PRIM_VEC(shr);
+DECLARE_PRIM_VEC(shl);
 
 /* Input/Output (prim_io.c) */
 DECLARE_PRIM(read);
@@ -22,8 +22,10 @@
 #include <stdbool.h>
 #include <stdio.h> /* FILE */
 
-/* Allocate string and read a single Lisp expression. Returns NULL if it
- * encountered EOF on the last call. */
-char* read_expr(FILE* fp);
+#include "arena.h" /* Arena */
+
+/* Read a single Lisp expression into a string allocated from 'arena'. Returns
+ * NULL if it encountered EOF on the last call. */
+char* read_expr(FILE* fp, Arena* arena);
 
 #endif /* READ_H_ */
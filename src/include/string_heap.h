@@ -0,0 +1,82 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STRING_HEAP_H_
+#define STRING_HEAP_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Initial number of strings that fit in each list of the string heap, before
+ * it has to grow.
+ */
+#define STRHEAP_BASE_SZ 1024
+
+/*
+ * Immutable string, used for the values of string and error expressions that
+ * don't fit inside the expression itself. Strings are owned by the garbage
+ * collector: expressions only store a pointer to the 'data' member, which is
+ * shared by all the expressions that were cloned from the same string, and the
+ * string is freed once none of them is reachable. See 'strheap_sweep'.
+ *
+ * Just like environments, a string is marked if its 'gc_epoch' member matches
+ * 'g_gc_epoch'.
+ */
+typedef struct HeapStr {
+    size_t gc_epoch;
+    size_t len;
+    char data[];
+} HeapStr;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Allocate a new string in the string heap, with a copy of the first 'len'
+ * characters of 's', and a null terminator. The allocation is counted by the
+ * garbage collector, see 'gc_count_alloc'.
+ */
+HeapStr* strheap_alloc(const char* s, size_t len);
+
+/*
+ * Free the strings that were not marked by the last collection. Minor
+ * collections only check the strings that were allocated since the previous
+ * collection, since the old ones keep their marks; major collections check all
+ * of them. The surviving strings become old.
+ */
+void strheap_sweep(bool major);
+
+/*
+ * Free every string in the heap, along with the lists used for tracking them.
+ */
+void strheap_close(void);
+
+/*
+ * Number of bytes currently used by the strings in the heap, including their
+ * headers.
+ */
+size_t strheap_bytes(void);
+
+/*
+ * Return the string whose 'data' member is pointed to by 's'.
+ */
+static inline HeapStr* strheap_from_data(const char* s) {
+    return (HeapStr*)(s - offsetof(HeapStr, data));
+}
+
+#endif /* STRING_HEAP_H_ */
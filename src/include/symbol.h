@@ -0,0 +1,99 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * SL. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SYMBOL_H_
+#define SYMBOL_H_ 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Initial number of slots in the symbol table. Must be a power of two. The
+ * table grows automatically, so this is just an arbitrary starting point big
+ * enough for all the primitives and the standard library.
+ */
+#define SYMBOL_TABLE_BASE_SZ 512
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Each symbol name is stored exactly once in the global symbol table. Symbol
+ * expressions, environment bindings and lambda formals all point to the 'name'
+ * member of one of these structures, so two symbols are the same if (and only
+ * if) their pointers are equal.
+ *
+ * Since the 'name' is the last member, we can get the 'Symbol' structure back
+ * from a name pointer with 'symbol_from_name'.
+ */
+typedef struct Symbol Symbol;
+struct Symbol {
+    size_t hash;
+    size_t len;
+    char name[];
+};
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Symbols that are used internally by the interpreter, interned once in
+ * 'symbol_table_init'. They can be compared directly against the 'val.s'
+ * member of symbol expressions.
+ */
+extern char* g_sym_nil;
+extern char* g_sym_tru;
+extern char* g_sym_rest;
+extern char* g_sym_quote;
+extern char* g_sym_backquote;
+extern char* g_sym_unquote;
+extern char* g_sym_splice;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Initialize the global symbol table, and intern the internal symbols declared
+ * above. Returns true on success, or false otherwise.
+ */
+bool symbol_table_init(void);
+
+/*
+ * Free the global symbol table and every symbol in it. All the pointers
+ * returned by 'symbol_intern' become unusable.
+ */
+void symbol_table_free(void);
+
+/*
+ * Return the unique, interned version of the specified symbol name, adding it
+ * to the global symbol table if necessary.
+ *
+ * The returned string is owned by the symbol table; it should never be modified
+ * or freed by the caller. The input string is copied, so it can be freed after
+ * the call.
+ */
+char* symbol_intern(const char* name);
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Return the 'Symbol' structure that contains the specified interned name. The
+ * argument must have been returned by 'symbol_intern'.
+ */
+static inline Symbol* symbol_from_name(const char* name) {
+    return (Symbol*)(name - offsetof(Symbol, name));
+}
+
+#endif /* SYMBOL_H_ */
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * SL. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef VM_H_
+#define VM_H_ 1
+
+struct Env;  /* env.h */
+struct Expr; /* expr.h */
+
+/*
+ * Initial number of elements in the value stack and in the frame stack of the
+ * virtual machine. They grow automatically.
+ */
+#define VM_STACK_BASE_SZ 256
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Run the compiled body of the specified lambda or macro (see
+ * 'compile_lambda'). The 'frame' argument should point to the activation frame
+ * of the call, with the arguments already bound (see 'lambdactx_bind_args').
+ *
+ * Calls to other lambdas are handled by the virtual machine itself, without
+ * growing the C stack. A call in tail position releases the current frame
+ * before creating the new one, so '*frame' might be overwritten; the caller is
+ * still responsible for releasing it with 'env_frame_free', unless it's NULL.
+ *
+ * If the value of the lambda needs to be evaluated by the tree-walking
+ * interpreter (e.g. a macro call in tail position), the marker from 'eval_tail'
+ * is returned, so it can be evaluated by the caller without growing the stack.
+ * See also 'eval_resolve_tail'.
+ */
+struct Expr* vm_run(struct Expr* func, struct Env** frame);
+
+/*
+ * Mark the values in the stack of the virtual machine, and the lambdas that are
+ * being executed. Called by the garbage collector.
+ */
+void vm_mark_roots(void);
+
+/*
+ * Free the stacks used by the virtual machine.
+ */
+void vm_close(void);
+
+#endif /* VM_H_ */
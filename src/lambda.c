@@ -17,15 +17,42 @@
  */
 
 #include <stddef.h>
+#include <stdint.h> /* uintptr_t */
 #include <stdio.h>
-#include <string.h>
 
 #include "include/env.h"
 #include "include/expr.h"
 #include "include/lambda.h"
 #include "include/util.h"
 #include "include/memory.h"
+#include "include/symbol.h"
 #include "include/eval.h"
+#include "include/compile.h"
+#include "include/vm.h"
+#include "include/garbage_collector.h"
+
+/*
+ * Entry of the macro expansion cache. The 'form' is the call to the macro,
+ * including the macro itself and its (unevaluated) arguments. The 'expansion'
+ * is only valid if the macro that is being called is still the same, so we
+ * also store the macro expression and its context.
+ */
+typedef struct MacroCacheEntry MacroCacheEntry;
+struct MacroCacheEntry {
+    const Expr* form;
+    Expr* macro;
+    const LambdaCtx* ctx;
+    Expr* expansion;
+};
+
+/*
+ * The macro expansion cache is an open-addressing hash table with linear
+ * probing, indexed by the address of the form. Entries are only removed when
+ * the table is rebuilt by 'macro_cache_collect', so we don't need tombstones.
+ */
+static MacroCacheEntry* g_macro_cache = NULL;
+static size_t g_macro_cache_sz        = 0;
+static size_t g_macro_cache_num       = 0;
 
 /*
  * Count and validate the number of formal arguments in a list. Returns
@@ -52,7 +79,7 @@ static enum ELambdaCtxErr count_formals(const Expr* list, size_t* mandatory,
          *   ^(list)     ^(list.cdr.car)
          *              ^(list.cdr)
          */
-        if (strcmp(cur->val.s, "&rest") == 0) {
+        if (cur->val.s == g_sym_rest) {
             if (expr_is_nil(CDR(list)) || !expr_is_nil(CDDR(list)))
                 return LAMBDACTX_ERR_NOREST;
 
@@ -75,6 +102,7 @@ LambdaCtx* lambdactx_new(void) {
     ret->formals     = NULL;
     ret->formal_rest = NULL;
     ret->body        = NULL;
+    ret->code        = NULL;
     return ret;
 }
 
@@ -92,27 +120,26 @@ enum ELambdaCtxErr lambdactx_init(Env* env, LambdaCtx* ctx, const Expr* formals,
         return formal_err;
 
     /*
-     * Initialize the lambda's environment. This environment will be used to:
+     * Store the environment where the lambda is being defined. Each time the
+     * lambda is called, a new activation frame will be created (see
+     * 'lambdactx_eval_body') for:
      *
-     *   1. Bind the formal argument symbols to the argument values, when the
-     *      lambda is called.
-     *   2. If more symbols are bound inside this function call, the current
-     *      lambda's environment will be used (restricting the scope of nested
-     *      functions, for example).
+     *   1. Binding the formal argument symbols to the argument values.
+     *   2. Binding other symbols inside this function call (restricting the
+     *      scope of nested functions, for example).
      *
-     * When the lambda is created, no symbols are bound in their
-     * environment. However, we need to set the parent environment when the
-     * lambda is created (instead of when called), so it's able to create a
-     * closure with the caller:
+     * The parent of that frame is the environment where the lambda was created
+     * (instead of where it was called), so it's able to create a closure with
+     * the caller:
      *
      *     (lambda (a)
      *       (lambda (b)  ; Inner lambda needs to access 'a' later.
      *         (+ a b)))
      *
-     * There is another problem: whenever we free a lambda, we are also freeing
-     * its environment. Since the lifetime of the parent environment might be
-     * shorter than the one of the lambda we are creating, we should create a
-     * clone of the parent environment instead.
+     * In the previous example, the lifetime of the outer call's frame must be
+     * extended, since the inner lambda will use it. We mark it as captured, so
+     * it's not released when the outer call returns. The garbage collector is
+     * responsible for freeing it once it's not used anymore.
      *
      * Since a lambda can't access the environment where it was called,
      * something like this is not valid, because 'b' was not defined when the
@@ -127,8 +154,8 @@ enum ELambdaCtxErr lambdactx_init(Env* env, LambdaCtx* ctx, const Expr* formals,
      * This last detail is the difference between "dynamic" and "lexical"
      * binding. This Lisp uses lexical binding.
      */
-    ctx->env         = env_new();
-    ctx->env->parent = env;
+    ctx->env = env;
+    env_frame_capture(env);
 
     /*
      * Apart from the environment, the lambda needs to store:
@@ -147,13 +174,13 @@ enum ELambdaCtxErr lambdactx_init(Env* env, LambdaCtx* ctx, const Expr* formals,
     ctx->body        = body;
 
     /*
-     * For each formal argument we counted above, store the symbol as a C string
-     * in the array we just allocated. Note that we already verified that all of
+     * For each formal argument we counted above, store the interned symbol in
+     * the array we just allocated. Note that we already verified that all of
      * the formals are symbols when counting them in 'count_formals'.
      */
     const Expr* cur_formal = formals;
     for (size_t i = 0; i < mandatory; i++) {
-        ctx->formals[i] = mem_strdup(CAR(cur_formal)->val.s);
+        ctx->formals[i] = CAR(cur_formal)->val.s;
         cur_formal      = CDR(cur_formal);
     }
 
@@ -162,7 +189,16 @@ enum ELambdaCtxErr lambdactx_init(Env* env, LambdaCtx* ctx, const Expr* formals,
      * the context.
      */
     if (has_rest)
-        ctx->formal_rest = mem_strdup(CADR(cur_formal)->val.s);
+        ctx->formal_rest = CADR(cur_formal)->val.s;
+
+    /*
+     * Finally, compile the body for the virtual machine. Formal arguments are
+     * resolved to their position in the activation frame, and some special
+     * forms are compiled inline, so this needs the formals and the
+     * environment. The closures created from the same lambda form share the
+     * same bytecode.
+     */
+    ctx->code = compile_lambda(env, ctx);
 
     return LAMBDACTX_ERR_NONE;
 }
@@ -171,19 +207,24 @@ LambdaCtx* lambdactx_clone(const LambdaCtx* ctx) {
     /* Allocate a new LambdaCtx structure */
     LambdaCtx* ret = mem_alloc(sizeof(LambdaCtx));
 
-    /* Copy the environment and the list of body expressions */
-    ret->env  = env_clone(ctx->env);
+    /* Copy the environment and the list of body expressions by reference */
+    ret->env  = ctx->env;
     ret->body = ctx->body;
 
-    /* Allocate a new string array for the mandatory formals, and copy them */
+    /*
+     * Allocate a new array for the mandatory formals, and copy them. The
+     * symbols themselves are interned, so we just copy the pointers.
+     */
     ret->formals_num = ctx->formals_num;
     ret->formals     = mem_alloc(ret->formals_num * sizeof(char*));
     for (size_t i = 0; i < ret->formals_num; i++)
-        ret->formals[i] = mem_strdup(ctx->formals[i]);
+        ret->formals[i] = ctx->formals[i];
 
     /* If it had a "&rest" formal, copy it */
-    ret->formal_rest =
-      (ctx->formal_rest == NULL) ? NULL : mem_strdup(ctx->formal_rest);
+    ret->formal_rest = ctx->formal_rest;
+
+    /* The bytecode points to the body, which is shared */
+    ret->code = (ctx->code == NULL) ? NULL : bytecode_retain(ctx->code);
 
     return ret;
 }
@@ -192,25 +233,16 @@ void lambdactx_free(LambdaCtx* ctx) {
     SL_ASSERT(ctx != NULL);
 
     /*
-     * 1. Free the lambda environment. We assume that if the environment was in
-     *    use somewhere else, the 'LambdaCtx' wouldn't have been freed.  Either
-     *    way, expressions in that environment are not freed, so they can still
-     *    be used somewhere else.
-     * 2. Free each formal argument string, and the pointer to the array itself.
-     * 3. Free the "&rest" formal string. This might be NULL, but it's a valid
-     *    value for 'free'.
-     * 4. Finally, free the 'LambdaCtx' structure itself.
+     * 1. Free the array of formal arguments. The symbols themselves are
+     *    interned, so they are owned by the symbol table.
+     * 2. Release the compiled body, which might be shared.
+     * 3. Free the 'LambdaCtx' structure itself.
      *
-     * Note how we don't free the body, since those expressions might be in use
-     * somewhere else, and they will be garbage-collected if necessary.
+     * Note how we don't free the environment or the body, since they might be
+     * in use somewhere else, and they will be garbage-collected if necessary.
      */
-    env_free(ctx->env);
-
-    for (size_t i = 0; i < ctx->formals_num; i++)
-        mem_free(ctx->formals[i]);
     mem_free(ctx->formals);
-
-    mem_free(ctx->formal_rest);
+    bytecode_release(ctx->code);
     mem_free(ctx);
 }
 
@@ -221,12 +253,10 @@ bool lambdactx_equal(const LambdaCtx* a, const LambdaCtx* b) {
         return false;
 
     for (size_t i = 0; i < a->formals_num; i++)
-        if (strcmp(a->formals[i], b->formals[i]) != 0)
+        if (a->formals[i] != b->formals[i])
             return false;
 
-    if (a->formal_rest != b->formal_rest &&
-        (a->formal_rest == NULL || b->formal_rest == NULL ||
-         strcmp(a->formal_rest, b->formal_rest) != 0))
+    if (a->formal_rest != b->formal_rest)
         return false;
 
     if (!expr_equal(a->body, b->body))
@@ -262,12 +292,13 @@ void lambdactx_print_args(FILE* fp, const LambdaCtx* ctx) {
 
 /*----------------------------------------------------------------------------*/
 
-static Expr* lambdactx_eval_body(LambdaCtx* ctx, Expr* args) {
-    SL_ASSERT(expr_is_proper_list(args));
-
-    /* Count the number of arguments that we received */
-    const size_t arg_num = expr_list_len(args);
-
+/*
+ * Make sure that 'arg_num' is a valid number of arguments for the specified
+ * lambda, and create the activation frame for the call. Returns NULL on
+ * success, or an error expression otherwise.
+ */
+static Expr* lambdactx_new_frame(const LambdaCtx* ctx, size_t arg_num,
+                                 Env** frame) {
     /* Make sure the number of arguments that we got is what we expected */
     SL_EXPECT(ctx->formal_rest != NULL || arg_num == ctx->formals_num,
               "Invalid number of arguments. Expected %zu, got %zu.",
@@ -275,57 +306,240 @@ static Expr* lambdactx_eval_body(LambdaCtx* ctx, Expr* args) {
               arg_num);
 
     /*
-     * In the lambda's environment, bind each mandatory formal argument to its
+     * Create a new activation frame for this call, whose parent is the
+     * environment where the lambda was defined. It has room for each formal
+     * argument, including the "&rest" formal.
+     */
+    const size_t frame_sz =
+      ctx->formals_num + ((ctx->formal_rest != NULL) ? 1 : 0);
+    *frame = env_frame_new(ctx->env, frame_sz);
+
+    return NULL;
+}
+
+Expr* lambdactx_bind_args(const LambdaCtx* ctx, Expr* args, Env** frame) {
+    SL_ASSERT(expr_is_proper_list(args));
+
+    Expr* frame_err = lambdactx_new_frame(ctx, expr_list_len(args), frame);
+    if (frame_err != NULL)
+        return frame_err;
+
+    /*
+     * In the new frame, bind each mandatory formal argument to its
      * corresponding argument value.
      */
     const Expr* rem_args = args;
     for (size_t i = 0; i < ctx->formals_num && !expr_is_nil(rem_args); i++) {
-        const enum EEnvErr code =
-          env_bind(ctx->env, ctx->formals[i], CAR(rem_args), ENV_FLAG_NONE);
-        SL_EXPECT(code == ENV_ERR_NONE,
-                  "Could not bind symbol `%s': %s",
-                  ctx->formals[i],
-                  env_strerror(code));
-
+        env_frame_bind(*frame, ctx->formals[i], CAR(rem_args));
         rem_args = CDR(rem_args);
     }
 
     /* If the lambda has a "&rest" formal, bind it */
     if (ctx->formal_rest != NULL) {
         Expr* rest_list = expr_clone_tree(rem_args);
-        const enum EEnvErr code =
-          env_bind(ctx->env, ctx->formal_rest, rest_list, ENV_FLAG_NONE);
-        SL_EXPECT(code == ENV_ERR_NONE,
-                  "Could not bind symbol `%s': %s",
-                  ctx->formal_rest,
-                  env_strerror(code));
+        env_frame_bind(*frame, ctx->formal_rest, rest_list);
     }
 
+    return NULL;
+}
+
+Expr* lambdactx_bind_argv(const LambdaCtx* ctx, size_t argc, Expr* const* argv,
+                          Env** frame) {
+    Expr* frame_err = lambdactx_new_frame(ctx, argc, frame);
+    if (frame_err != NULL)
+        return frame_err;
+
+    for (size_t i = 0; i < ctx->formals_num; i++)
+        env_frame_bind(*frame, ctx->formals[i], argv[i]);
+
     /*
-     * Evaluate each expression in the body of the lambda, using its environment
-     * with the bound the formal arguments. Return the last evaluated
-     * expression.
+     * Build the "&rest" list from the remaining arguments. Just like in
+     * 'lambdactx_bind_args', the arguments are cloned.
      */
-    Expr* last_evaluated = NULL;
-    for (Expr* exprs = ctx->body; !expr_is_nil(exprs); exprs = CDR(exprs)) {
-        last_evaluated = eval(ctx->env, CAR(exprs));
-        if (EXPR_ERR_P(last_evaluated))
-            break;
+    if (ctx->formal_rest != NULL) {
+        Expr* rest_list = g_nil;
+        for (size_t i = argc; i-- > ctx->formals_num;) {
+            Expr* pair = expr_new(EXPR_PAIR);
+            CAR(pair)  = expr_clone_tree(argv[i]);
+            CDR(pair)  = rest_list;
+            rest_list  = pair;
+        }
+
+        env_frame_bind(*frame, ctx->formal_rest, rest_list);
     }
 
-    return last_evaluated;
+    return NULL;
+}
+
+static Expr* lambdactx_eval_body(Expr* func, Expr* args) {
+    Env* frame;
+    Expr* bind_err = lambdactx_bind_args(func->val.lambda, args, &frame);
+    if (bind_err != NULL)
+        return bind_err;
+
+    /*
+     * Run the compiled body of the lambda, using the frame with the bound
+     * formal arguments. Since we are not in the main loop of 'eval', the last
+     * expression is evaluated here if necessary.
+     */
+    Expr* result = eval_resolve_tail(vm_run(func, &frame));
+
+    /* The frame is only kept if a lambda captured it */
+    if (frame != NULL)
+        env_frame_free(frame);
+    return result;
 }
 
 Expr* lambda_call(Env* env, Expr* func, Expr* args) {
     SL_UNUSED(env);
     SL_ASSERT(EXPR_LAMBDA_P(func));
-    return lambdactx_eval_body(func->val.lambda, args);
+    return lambdactx_eval_body(func, args);
 }
 
 Expr* macro_expand(Env* env, Expr* func, Expr* args) {
     SL_UNUSED(env);
     SL_ASSERT(EXPR_MACRO_P(func));
-    return lambdactx_eval_body(func->val.lambda, args);
+    return lambdactx_eval_body(func, args);
+}
+
+/*
+ * Return the entry of the macro cache for the specified form, which is either
+ * empty (NULL 'form') or contains that form. The table must not be full.
+ */
+static MacroCacheEntry* macro_cache_find(MacroCacheEntry* table,
+                                         size_t table_sz, const Expr* form) {
+    const size_t mask = table_sz - 1;
+    size_t i          = ((uintptr_t)form / sizeof(Expr)) & mask;
+    while (table[i].form != NULL && table[i].form != form)
+        i = (i + 1) & mask;
+    return &table[i];
+}
+
+/*
+ * Allocate a new table for the macro cache with the specified size, which must
+ * be a power of two, and re-insert the entries for which 'keep' returns true.
+ */
+static void macro_cache_rebuild(size_t new_sz,
+                                bool (*keep)(const MacroCacheEntry*)) {
+    MacroCacheEntry* new_table = mem_calloc(new_sz, sizeof(MacroCacheEntry));
+    size_t new_num             = 0;
+
+    for (size_t i = 0; i < g_macro_cache_sz; i++) {
+        const MacroCacheEntry* entry = &g_macro_cache[i];
+        if (entry->form == NULL || !keep(entry))
+            continue;
+
+        *macro_cache_find(new_table, new_sz, entry->form) = *entry;
+        new_num++;
+    }
+
+    mem_free(g_macro_cache);
+    g_macro_cache     = new_table;
+    g_macro_cache_sz  = new_sz;
+    g_macro_cache_num = new_num;
+}
+
+/*
+ * Set the 'in_macro_cache' flag of every expression in a form that is stored in
+ * the cache, so modifying any of them clears the cache. The immortal
+ * expressions can't be modified.
+ */
+static void macro_cache_flag_form(Expr* e) {
+    for (; EXPR_PAIR_P(e); e = CDR(e)) {
+        e->in_macro_cache = true;
+        macro_cache_flag_form(CAR(e));
+    }
+
+    if (!expr_is_immortal(e))
+        e->in_macro_cache = true;
+}
+
+static bool macro_cache_keep_all(const MacroCacheEntry* entry) {
+    SL_UNUSED(entry);
+    return true;
+}
+
+static bool macro_cache_keep_marked(const MacroCacheEntry* entry) {
+    return gc_is_marked(entry->form);
+}
+
+Expr* macro_expand_cached(Env* env, Expr* func, Expr* form) {
+    SL_ASSERT(EXPR_MACRO_P(func));
+    SL_ASSERT(EXPR_PAIR_P(form));
+
+    if (g_macro_cache == NULL)
+        macro_cache_rebuild(MACRO_CACHE_BASE_SZ, macro_cache_keep_all);
+
+    /*
+     * If we already expanded this form with the same macro, return the same
+     * expansion. Note that the macro might have been redefined, or its value
+     * overwritten with `set'.
+     */
+    MacroCacheEntry* entry =
+      macro_cache_find(g_macro_cache, g_macro_cache_sz, form);
+    if (entry->form != NULL && entry->macro == func &&
+        entry->ctx == func->val.lambda)
+        return entry->expansion;
+
+    Expr* expansion = macro_expand(env, func, CDR(form));
+    if (EXPR_ERR_P(expansion))
+        return expansion;
+
+    /*
+     * The table might have been rebuilt while expanding the macro, either by
+     * a nested expansion or by the garbage collector, so look for the entry
+     * again.
+     */
+    entry = macro_cache_find(g_macro_cache, g_macro_cache_sz, form);
+
+    /* Keep the load factor of the table under 1/2 */
+    if (entry->form == NULL) {
+        if ((g_macro_cache_num + 1) * 2 > g_macro_cache_sz) {
+            macro_cache_rebuild(g_macro_cache_sz * 2, macro_cache_keep_all);
+            entry = macro_cache_find(g_macro_cache, g_macro_cache_sz, form);
+        }
+        g_macro_cache_num++;
+    }
+
+    entry->form      = form;
+    entry->macro     = func;
+    entry->ctx       = func->val.lambda;
+    entry->expansion = expansion;
+    macro_cache_flag_form(form);
+    return expansion;
+}
+
+void macro_cache_collect(void) {
+    if (g_macro_cache == NULL)
+        return;
+
+    /*
+     * Remove the entries whose form is going to be freed, since the same
+     * address might be used by another form. The expansions of the remaining
+     * entries are still needed.
+     */
+    macro_cache_rebuild(g_macro_cache_sz, macro_cache_keep_marked);
+
+    for (size_t i = 0; i < g_macro_cache_sz; i++) {
+        if (g_macro_cache[i].form == NULL)
+            continue;
+
+        gc_mark_expr(g_macro_cache[i].macro);
+        gc_mark_expr(g_macro_cache[i].expansion);
+    }
+}
+
+void macro_cache_clear(void) {
+    for (size_t i = 0; i < g_macro_cache_sz; i++)
+        g_macro_cache[i].form = NULL;
+    g_macro_cache_num = 0;
+}
+
+void macro_cache_free(void) {
+    mem_free(g_macro_cache);
+    g_macro_cache     = NULL;
+    g_macro_cache_sz  = 0;
+    g_macro_cache_num = 0;
 }
 
 Expr* macro_call(Env* env, Expr* func, Expr* args) {
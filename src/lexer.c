@@ -7,24 +7,29 @@
 
 #include "include/lisp_types.h"
 #include "include/util.h"
-#include "include/memory.h"
+#include "include/arena.h"
 #include "include/error.h"
+#include "include/symbol.h"
 #include "include/lexer.h"
 
-#define TOKEN_BUFSZ  100
-#define STRING_BUFSZ 100
+/*
+ * Initial size of the token array and of the buffer for each string token.
+ * They double in size whenever they are full.
+ */
+#define TOKEN_BUFSZ  128
+#define STRING_BUFSZ 64
 
 /*
- * Read the user input and store it in an allocated string, parsing the
- * supported escape sequences. Returns the number of parsed characters from the
- * input, including the final double quote.
+ * Read the user input and store it in a string allocated from 'arena', parsing
+ * the supported escape sequences. Returns the number of parsed characters from
+ * the input, including the final double quote.
  */
-static size_t parse_user_string(const char* input, char** dst) {
+static size_t parse_user_string(const char* input, Arena* arena, char** dst) {
     SL_ASSERT(input[0] == '\"');
 
     size_t result_pos = 0;
     size_t result_sz  = STRING_BUFSZ;
-    char* result      = mem_alloc(result_sz);
+    char* result      = arena_alloc(arena, result_sz);
 
     size_t input_pos;
     for (input_pos = 1; input[input_pos] != '\"'; input_pos++, result_pos++) {
@@ -35,8 +40,8 @@ static size_t parse_user_string(const char* input, char** dst) {
         }
 
         if (result_pos >= result_sz - 1) {
-            result_sz += TOKEN_BUFSZ;
-            mem_realloc(&result, result_sz);
+            result = arena_realloc(arena, result, result_sz, result_sz * 2);
+            result_sz *= 2;
         }
 
         /* Parse escape sequences */
@@ -80,9 +85,9 @@ static void set_value_from_str(Token* dst, char* str) {
     }
 
     /* If we couldn't convert it to a 'double' or a 'long long', assume it's a
-     * symbol. */
+     * symbol. Symbols are interned, so they are not owned by the token. */
     dst->type  = TOKEN_SYMBOL;
-    dst->val.s = mem_strdup(str);
+    dst->val.s = symbol_intern(str);
 }
 
 /*
@@ -90,9 +95,9 @@ static void set_value_from_str(Token* dst, char* str) {
  * pointer accordingly.
  *
  * If the end of the string is found, TOKEN_EOF is returned and 'input_ptr' is
- * set to NULL.
+ * set to NULL. The contents of string tokens are allocated from 'arena'.
  */
-static Token get_token(char** input_ptr) {
+static Token get_token(char** input_ptr, Arena* arena) {
     char* input = *input_ptr;
 
     /* Skip the spaces before the token, if any */
@@ -145,7 +150,7 @@ static Token get_token(char** input_ptr) {
 
         case '\"':
             result.type = TOKEN_STRING;
-            input += parse_user_string(input, &result.val.s);
+            input += parse_user_string(input, arena, &result.val.s);
             goto done;
 
         default:
@@ -178,32 +183,27 @@ done:
 
 /*----------------------------------------------------------------------------*/
 
-Token* tokenize(char* input) {
+Token* tokenize(char* input, Arena* arena) {
     size_t tokens_num = TOKEN_BUFSZ;
-    Token* tokens     = mem_calloc(TOKEN_BUFSZ, sizeof(Token));
+    Token* tokens     = arena_alloc(arena, tokens_num * sizeof(Token));
 
     for (size_t i = 0; input != NULL; i++) {
         if (i >= tokens_num) {
-            tokens_num += TOKEN_BUFSZ;
-            mem_realloc(&tokens, tokens_num * sizeof(Token));
+            tokens = arena_realloc(arena,
+                                   tokens,
+                                   tokens_num * sizeof(Token),
+                                   tokens_num * 2 * sizeof(Token));
+            tokens_num *= 2;
         }
 
         /* Try to scan the token pointed to by 'input', and increase the pointer
          * accordingly. */
-        tokens[i] = get_token(&input);
+        tokens[i] = get_token(&input, arena);
     }
 
     return tokens;
 }
 
-void tokens_free(Token* arr) {
-    for (int i = 0; arr[i].type != TOKEN_EOF; i++)
-        if (arr[i].type == TOKEN_SYMBOL || arr[i].type == TOKEN_STRING)
-            mem_free(arr[i].val.s);
-
-    mem_free(arr);
-}
-
 bool is_token_separator(char c) {
     /*
      * TODO: Should we add quote-like characters? E.g. '\'', '`' and ','.
@@ -27,30 +27,43 @@
 #include "include/env.h"
 #include "include/expr.h"
 #include "include/expr_pool.h"
+#include "include/string_heap.h"
 #include "include/garbage_collector.h"
 #include "include/util.h"
 #include "include/memory.h"
+#include "include/symbol.h"
 #include "include/error.h"
 #include "include/debug.h"
 #include "include/cmdargs.h"
+#include "include/arena.h"
 #include "include/read.h"
 #include "include/lexer.h"
 #include "include/parser.h"
 #include "include/eval.h"
+#include "include/vm.h"
+#include "include/lambda.h"
+#include "include/compile.h"
+#include "include/image.h"
 
 #define STDLIB_PATH "/usr/local/lib/sl/stdlib.lisp"
 
 static void repl_until_eof(Env* env, FILE* file, bool print_evaluated,
                            bool print_prompt) {
+    /*
+     * The input string and the tokens of each expression are allocated from
+     * this arena, and they are all freed at once after parsing.
+     */
+    Arena arena = { NULL };
+
     for (;;) {
         if (print_prompt)
             printf("\nsl> ");
 
         /*
-         * Allocate string and read an expression. If 'read_expr' returned NULL,
-         * it encountered EOF.
+         * Read an expression into the arena. If 'read_expr' returned NULL, it
+         * encountered EOF.
          */
-        char* input = read_expr(file);
+        char* input = read_expr(file, &arena);
         if (input == NULL) {
             if (print_prompt)
                 putchar('\n');
@@ -58,16 +71,13 @@ static void repl_until_eof(Env* env, FILE* file, bool print_evaluated,
         }
 
         /* Tokenize input. We don't need to check for NULL. */
-        Token* tokens = tokenize(input);
-
-        /* We are done with the string from 'read_expr', free it */
-        mem_free(input);
+        Token* tokens = tokenize(input, &arena);
 
         /* Get expression (AST) from token array */
         Expr* expr = parse(tokens);
 
-        /* We are done with the token array, free it */
-        tokens_free(tokens);
+        /* We are done with the input string and the token array */
+        arena_reset(&arena);
 
         if (expr == NULL)
             continue;
@@ -81,23 +91,45 @@ static void repl_until_eof(Env* env, FILE* file, bool print_evaluated,
             expr_println(EXPR_ERR_P(evaluated) ? stderr : stdout, evaluated);
 
         /*
-         * Collect all garbage that is not in the current environment.
+         * Collect all garbage that is not in the global environment. The
+         * garbage collector might also run while evaluating, if the expression
+         * pool grows too much.
+         */
+        gc_run();
+
+        /*
+         * Nothing is being evaluated, so the expressions can be moved if the
+         * pool has to be compacted.
          */
-        gc_unmark_all();
-        gc_mark_env_contents(env);
-        gc_collect();
+        gc_compact_safepoint();
     }
+
+    arena_free(&arena);
 }
 
 int main(int argc, char** argv) {
     CmdArgs cmd_args           = cmdargs_parse(argc, argv);
-    const bool interactive_run = (cmd_args.input_files_sz == 0 && isatty(0));
+    const bool interactive_run = (cmd_args.input_files_sz == 0 && isatty(0) &&
+                                  cmd_args.dump_image_path == NULL);
 
     /*
      * Allocate the initial expression pool. It will be expanded when needed.
      */
     if (!pool_init(POOL_BASE_SZ))
         SL_FATAL("Failed to initialize the expression pool.");
+    pool_set_growth(cmd_args.heap_growth);
+    gc_set_budget(cmd_args.gc_budget);
+    gc_set_mode(cmd_args.gc_mode);
+    gc_set_max_pause(cmd_args.gc_max_pause_us);
+    gc_set_threads(cmd_args.gc_threads);
+    gc_set_trace(cmd_args.gc_trace);
+    gc_set_compact_density(cmd_args.gc_compact_density);
+
+    /*
+     * Initialize the symbol table, used for interning all symbols.
+     */
+    if (!symbol_table_init())
+        SL_FATAL("Failed to initialize the symbol table.");
 
     /*
      * Initialize the callstack.
@@ -112,6 +144,7 @@ int main(int argc, char** argv) {
     Env* global_env = env_new();
     SL_ASSERT(global_env != NULL);
     env_init_defaults(global_env);
+    gc_set_global_env(global_env);
 
     /*
      * Set unique random seed, can be overwritten with the `set-random-seed'
@@ -120,9 +153,15 @@ int main(int argc, char** argv) {
     srand(time(NULL));
 
     /*
-     * Try to silently load the standard library from the known path.
+     * If a heap image was specified, it replaces the standard library, since
+     * it was normally dumped after loading it. Otherwise, try to silently load
+     * the standard library from the known path.
      */
-    if (cmd_args.load_sys_stdlib) {
+    if (cmd_args.image_path != NULL) {
+        if (!image_load(global_env, cmd_args.image_path))
+            SL_FATAL("Failed to load the heap image from '%s'.",
+                     cmd_args.image_path);
+    } else if (cmd_args.load_sys_stdlib) {
         FILE* file_stdlib = fopen(STDLIB_PATH, "r");
         if (file_stdlib == NULL) {
             fprintf(stderr,
@@ -153,9 +192,26 @@ int main(int argc, char** argv) {
                            false);
     }
 
+    /*
+     * Once everything has been loaded, store the global environment so the
+     * next runs can start from it, see '--image'.
+     */
+    if (cmd_args.dump_image_path != NULL &&
+        !image_dump(global_env, cmd_args.dump_image_path))
+        SL_FATAL("Failed to dump the heap image to '%s'.",
+                 cmd_args.dump_image_path);
+
     env_free(global_env);
+    macro_cache_free();
+    bytecode_cache_free();
+    env_frames_close();
+    vm_close();
+    eval_close();
+    gc_close();
     debug_callstack_free();
     pool_close();
+    strheap_close();
+    symbol_table_free();
     cmdargs_close_files(&cmd_args);
     return 0;
 }
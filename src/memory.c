@@ -17,11 +17,14 @@
  */
 
 #define _XOPEN_SOURCE 500 /* strdup() */
+#define _DEFAULT_SOURCE   /* MAP_ANONYMOUS */
 
 #include <errno.h>
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
 
 #include "include/memory.h"
 #include "include/error.h"
@@ -47,6 +50,47 @@ void* mem_calloc(size_t nmemb, size_t size) {
     return result;
 }
 
+void* mem_map_aligned(size_t alignment, size_t size) {
+    /*
+     * Map enough memory for an aligned block of the specified size, and unmap
+     * the unaligned parts before and after it.
+     */
+    const size_t mapped_sz = size + alignment;
+    char* mapped = mmap(NULL,
+                        mapped_sz,
+                        PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS,
+                        -1,
+                        0);
+    if (mapped == MAP_FAILED)
+        SL_FATAL("Failed to map %zu bytes: %s (%d).",
+                 mapped_sz,
+                 strerror(errno),
+                 errno);
+
+    const uintptr_t addr = (uintptr_t)mapped;
+    char* result =
+      (char*)((addr + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    const size_t head_sz = result - mapped;
+    const size_t tail_sz = mapped_sz - head_sz - size;
+
+    if (head_sz > 0)
+        munmap(mapped, head_sz);
+    if (tail_sz > 0)
+        munmap(result + size, tail_sz);
+
+    return result;
+}
+
+void mem_unmap(void* ptr, size_t size) {
+    if (munmap(ptr, size) != 0)
+        SL_FATAL("Failed to unmap %zu bytes at %p: %s (%d).",
+                 size,
+                 ptr,
+                 strerror(errno),
+                 errno);
+}
+
 void mem_realloc(void* double_ptr, size_t new_size) {
     void** casted_ptr = double_ptr;
     void* result      = realloc(*casted_ptr, new_size);
@@ -23,13 +23,13 @@
 
 #include "include/expr.h"
 #include "include/env.h"
-#include "include/expr_pool.h"
 #include "include/util.h"
 #include "include/memory.h"
+#include "include/symbol.h"
 #include "include/lexer.h"
 #include "include/parser.h"
 
-static size_t parse_recur(Expr* dst, const Token* tokens);
+static size_t parse_recur(Expr** dst, const Token* tokens);
 
 static inline bool is_list_closer(enum ETokenType token_type) {
     return token_type == TOKEN_LIST_CLOSE || token_type == TOKEN_EOF;
@@ -37,37 +37,40 @@ static inline bool is_list_closer(enum ETokenType token_type) {
 
 /*
  * Parse the next expression in 'tokens', and wrap it in a list whose first
- * element is the symbol 'func_name'. Return the number of parsed tokens.
+ * element is the symbol 'func_name', which must be interned. Return the number
+ * of parsed tokens.
  */
-static size_t wrap_in_call(Expr* dst, const Token* tokens,
-                           const char* func_name) {
+static size_t wrap_in_call(Expr** dst, const Token* tokens, char* func_name) {
     /*
      * First item of the list is the function name:
      *   (FUNC-NAME . ???)
      */
-    dst->type       = EXPR_PAIR;
-    CAR(dst)        = expr_new(EXPR_SYMBOL);
-    CAR(dst)->val.s = mem_strdup(func_name);
+    *dst             = expr_new(EXPR_PAIR);
+    CAR(*dst)        = expr_new(EXPR_SYMBOL);
+    CAR(*dst)->val.s = func_name;
 
     /*
      * The second element is the actual expression, which might consist of
      * multiple Tokens.
      *
      * The parsed expression will be placed in the `cadr' of the destination:
-     *   (FUNC-NAME . (UNKNOWN . nil))
+     *   (FUNC-NAME . (??? . nil))
      */
-    CDR(dst)  = expr_new(EXPR_PAIR);
-    CADR(dst) = expr_new(EXPR_UNKNOWN);
-    CDDR(dst) = g_nil;
+    CDR(*dst)  = expr_new(EXPR_PAIR);
+    CDDR(*dst) = g_nil;
 
-    const size_t parsed_in_call = parse_recur(CADR(dst), tokens);
+    const size_t parsed_in_call = parse_recur(&CADR(*dst), tokens);
     SL_ASSERT(parsed_in_call > 0);
     return parsed_in_call;
 }
 
 /*
- * Parse an expression recursively. Writes to 'dst', and returns the number of
- * parsed tokens. See comment in 'parse' below.
+ * Parse an expression recursively. Writes a pointer to the parsed expression
+ * in 'dst', and returns the number of parsed tokens. See comment in 'parse'
+ * below.
+ *
+ * Since the parsed expression might be one of the unique 'g_nil' or 'g_tru'
+ * expressions, we can't write to a pre-allocated expression.
  *
  * TODO: The following expressions fail assertions in the parser:
  *   sl> `,@
@@ -75,7 +78,7 @@ static size_t wrap_in_call(Expr* dst, const Token* tokens,
  *   sl> .
  *   sl> '(a . )
  */
-static size_t parse_recur(Expr* dst, const Token* tokens) {
+static size_t parse_recur(Expr** dst, const Token* tokens) {
     SL_ASSERT(tokens != NULL);
     SL_ASSERT(tokens[0].type != TOKEN_LIST_CLOSE);
 
@@ -84,29 +87,42 @@ static size_t parse_recur(Expr* dst, const Token* tokens) {
 
     size_t parsed = 0;
 
-    /* Expression type and value should be set on each case */
+    /* The destination pointer should be set on each case */
     switch (tokens[0].type) {
         case TOKEN_NUM_INT: {
-            dst->type  = EXPR_NUM_INT;
-            dst->val.n = tokens[0].val.n;
+            *dst          = expr_new(EXPR_NUM_INT);
+            (*dst)->val.n = tokens[0].val.n;
             parsed++;
         } break;
 
         case TOKEN_NUM_FLT: {
-            dst->type  = EXPR_NUM_FLT;
-            dst->val.f = tokens[0].val.f;
+            *dst          = expr_new(EXPR_NUM_FLT);
+            (*dst)->val.f = tokens[0].val.f;
             parsed++;
         } break;
 
         case TOKEN_STRING: {
-            dst->type  = EXPR_STRING;
-            dst->val.s = mem_strdup(tokens[0].val.s);
+            *dst = expr_new_str_copy(EXPR_STRING,
+                                     tokens[0].val.s,
+                                     strlen(tokens[0].val.s));
             parsed++;
         } break;
 
         case TOKEN_SYMBOL: {
-            dst->type  = EXPR_SYMBOL;
-            dst->val.s = mem_strdup(tokens[0].val.s);
+            /*
+             * The symbols "nil" and "tru" always evaluate to the unique
+             * 'g_nil' and 'g_tru' expressions, so we use them directly. This
+             * way, quoted lists share the same 'nil' as the rest of the
+             * interpreter.
+             */
+            if (tokens[0].val.s == g_sym_nil) {
+                *dst = g_nil;
+            } else if (tokens[0].val.s == g_sym_tru) {
+                *dst = g_tru;
+            } else {
+                *dst          = expr_new(EXPR_SYMBOL);
+                (*dst)->val.s = tokens[0].val.s;
+            }
             parsed++;
         } break;
 
@@ -114,11 +130,10 @@ static size_t parse_recur(Expr* dst, const Token* tokens) {
             parsed++;
 
             /*
-             * Empty lists get replaced by the symbol "nil" in the parser.
+             * Empty lists get replaced by 'nil' in the parser.
              */
             if (is_list_closer(tokens[parsed].type)) {
-                dst->type  = EXPR_SYMBOL;
-                dst->val.s = mem_strdup("nil");
+                *dst = g_nil;
                 parsed++;
                 break;
             }
@@ -127,14 +142,13 @@ static size_t parse_recur(Expr* dst, const Token* tokens) {
              * We got a non-empty list/pair, write the first 'car' and loop over
              * the rest of the list.
              */
-            dst->type             = EXPR_PAIR;
-            CAR(dst)              = expr_new(EXPR_UNKNOWN);
-            size_t parsed_in_call = parse_recur(CAR(dst), &tokens[parsed]);
-            CDR(dst)              = g_nil;
+            *dst                  = expr_new(EXPR_PAIR);
+            size_t parsed_in_call = parse_recur(&CAR(*dst), &tokens[parsed]);
+            CDR(*dst)             = g_nil;
             SL_ASSERT(parsed_in_call > 0);
             parsed += parsed_in_call;
 
-            Expr* cur = dst;
+            Expr* cur = *dst;
             while (!is_list_closer(tokens[parsed].type)) {
                 /*
                  * If there is a dot inside the list, it indicates that the next
@@ -147,8 +161,7 @@ static size_t parse_recur(Expr* dst, const Token* tokens) {
                     if (is_list_closer(tokens[parsed].type))
                         break;
 
-                    CDR(cur)       = expr_new(EXPR_UNKNOWN);
-                    parsed_in_call = parse_recur(CDR(cur), &tokens[parsed]);
+                    parsed_in_call = parse_recur(&CDR(cur), &tokens[parsed]);
                     SL_ASSERT(parsed_in_call > 0);
                     parsed += parsed_in_call;
                     break;
@@ -161,8 +174,7 @@ static size_t parse_recur(Expr* dst, const Token* tokens) {
                  * Parse the current children recursively, storing the parsed
                  * Tokens in that call.
                  */
-                CAR(cur)       = expr_new(EXPR_UNKNOWN);
-                parsed_in_call = parse_recur(CAR(cur), &tokens[parsed]);
+                parsed_in_call = parse_recur(&CAR(cur), &tokens[parsed]);
                 CDR(cur)       = g_nil;
 
                 /*
@@ -179,30 +191,31 @@ static size_t parse_recur(Expr* dst, const Token* tokens) {
 
         case TOKEN_DOT: {
             /* TODO: Dot outside of a list, propagate error upwards */
+            *dst = expr_new(EXPR_UNKNOWN);
         } break;
 
         case TOKEN_QUOTE: {
             /* Wrap the next expression in (quote ...) */
             parsed++;
-            parsed += wrap_in_call(dst, &tokens[parsed], "quote");
+            parsed += wrap_in_call(dst, &tokens[parsed], g_sym_quote);
         } break;
 
         case TOKEN_BACKQUOTE: {
             /* The function for backquoting is called "`". */
             parsed++;
-            parsed += wrap_in_call(dst, &tokens[parsed], "`");
+            parsed += wrap_in_call(dst, &tokens[parsed], g_sym_backquote);
         } break;
 
         case TOKEN_UNQUOTE: {
             /* The function for unquoting is called ",". */
             parsed++;
-            parsed += wrap_in_call(dst, &tokens[parsed], ",");
+            parsed += wrap_in_call(dst, &tokens[parsed], g_sym_unquote);
         } break;
 
         case TOKEN_SPLICE: {
             /* The function for splicing is called ",@". */
             parsed++;
-            parsed += wrap_in_call(dst, &tokens[parsed], ",@");
+            parsed += wrap_in_call(dst, &tokens[parsed], g_sym_splice);
         } break;
 
         case TOKEN_EOF:
@@ -216,7 +229,7 @@ static size_t parse_recur(Expr* dst, const Token* tokens) {
 
 Expr* parse(const Token* tokens) {
     /*
-     * We need another function that writes to an 'Expr' parameter and that
+     * We need another function that writes to an 'Expr' pointer and that
      * returns the written bytes, since the function will call itself
      * recursively, and the caller must know how many elements of the 'Token'
      * array were parsed inside that recursive call (to skip over them).
@@ -242,11 +255,10 @@ Expr* parse(const Token* tokens) {
      * call is done parsing the list, we want to continue parsing at the "123",
      * not the "a".
      */
-    Expr* expr                 = expr_new(EXPR_UNKNOWN);
-    const size_t tokens_parsed = parse_recur(expr, tokens);
-    if (tokens_parsed == 0) {
-        pool_free(expr);
+    Expr* expr                 = NULL;
+    const size_t tokens_parsed = parse_recur(&expr, tokens);
+    if (tokens_parsed == 0)
         return NULL;
-    }
+
     return expr;
 }
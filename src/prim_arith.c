@@ -24,15 +24,11 @@
 #include "include/util.h"
 #include "include/primitives.h"
 
-Expr* prim_add(Env* env, Expr* args) {
+Expr* prim_add(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-
-    const bool no_args = expr_is_nil(args);
-    SL_EXPECT(no_args || expr_list_has_only_numbers(args),
+    SL_EXPECT(expr_array_has_only_numbers(argc, argv),
               "Unexpected non-numeric argument.");
 
-    const Expr* first_arg = CAR(args);
-
     /*
      * If there are no arguments, return zero.
      *   (+) => 0
@@ -44,46 +40,40 @@ Expr* prim_add(Env* env, Expr* args) {
      *   (+ 9.0 5.0 1.0) => 15.0
      */
     Expr* ret = NULL;
-    if (no_args) {
-        ret        = expr_new(EXPR_NUM_INT);
-        ret->val.n = 0;
-    } else if (!expr_list_is_homogeneous(args)) {
+    if (argc == 0) {
+        ret = expr_new_int(0);
+    } else if (!expr_array_is_homogeneous(argc, argv)) {
         GenericNum total = 0;
-        for (; !expr_is_nil(args); args = CDR(args))
-            total += expr_get_generic_num(CAR(args));
+        for (size_t i = 0; i < argc; i++)
+            total += expr_get_generic_num(argv[i]);
 
         ret = expr_new(EXPR_NUM_GENERIC);
         expr_set_generic_num(ret, total);
-    } else if (EXPR_INT_P(first_arg)) {
+    } else if (EXPR_INT_P(argv[0])) {
         LispInt total = 0;
-        for (; !expr_is_nil(args); args = CDR(args))
-            total += CAR(args)->val.n;
+        for (size_t i = 0; i < argc; i++)
+            total += argv[i]->val.n;
 
-        ret        = expr_new(EXPR_NUM_INT);
-        ret->val.n = total;
-    } else if (EXPR_FLT_P(first_arg)) {
+        ret = expr_new_int(total);
+    } else if (EXPR_FLT_P(argv[0])) {
         LispFlt total = 0.0;
-        for (; !expr_is_nil(args); args = CDR(args))
-            total += CAR(args)->val.f;
+        for (size_t i = 0; i < argc; i++)
+            total += argv[i]->val.f;
 
         ret        = expr_new(EXPR_NUM_FLT);
         ret->val.f = total;
     } else {
-        SL_FATAL("Unhandled numeric type (%s).", exprtype2str(first_arg->type));
+        SL_FATAL("Unhandled numeric type (%s).", exprtype2str(argv[0]->type));
     }
 
     return ret;
 }
 
-Expr* prim_sub(Env* env, Expr* args) {
+Expr* prim_sub(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-
-    const bool no_args = expr_is_nil(args);
-    SL_EXPECT(no_args || expr_list_has_only_numbers(args),
+    SL_EXPECT(expr_array_has_only_numbers(argc, argv),
               "Unexpected non-numeric argument.");
 
-    const Expr* first_arg = CAR(args);
-
     /*
      * If there are no arguments, return zero.
      *   (-) => 0
@@ -97,49 +87,43 @@ Expr* prim_sub(Env* env, Expr* args) {
      *   (- 9.0 5.0 1.0) => 3.0
      */
     Expr* ret = NULL;
-    if (no_args) {
-        ret        = expr_new(EXPR_NUM_INT);
-        ret->val.n = 0;
-    } else if (expr_is_nil(CDR(args))) {
-        ret = expr_clone(first_arg);
+    if (argc == 0) {
+        ret = expr_new_int(0);
+    } else if (argc == 1) {
+        ret = expr_clone(argv[0]);
         expr_negate_num_val(ret);
-    } else if (!expr_list_is_homogeneous(args)) {
-        GenericNum total = expr_get_generic_num(first_arg);
-        for (args = CDR(args); !expr_is_nil(args); args = CDR(args))
-            total -= expr_get_generic_num(CAR(args));
+    } else if (!expr_array_is_homogeneous(argc, argv)) {
+        GenericNum total = expr_get_generic_num(argv[0]);
+        for (size_t i = 1; i < argc; i++)
+            total -= expr_get_generic_num(argv[i]);
 
         ret = expr_new(EXPR_NUM_GENERIC);
         expr_set_generic_num(ret, total);
-    } else if (EXPR_INT_P(first_arg)) {
-        LispInt total = first_arg->val.n;
-        for (args = CDR(args); !expr_is_nil(args); args = CDR(args))
-            total -= CAR(args)->val.n;
-
-        ret        = expr_new(EXPR_NUM_INT);
-        ret->val.n = total;
-    } else if (EXPR_FLT_P(first_arg)) {
-        LispFlt total = first_arg->val.f;
-        for (args = CDR(args); !expr_is_nil(args); args = CDR(args))
-            total -= CAR(args)->val.f;
+    } else if (EXPR_INT_P(argv[0])) {
+        LispInt total = argv[0]->val.n;
+        for (size_t i = 1; i < argc; i++)
+            total -= argv[i]->val.n;
+
+        ret = expr_new_int(total);
+    } else if (EXPR_FLT_P(argv[0])) {
+        LispFlt total = argv[0]->val.f;
+        for (size_t i = 1; i < argc; i++)
+            total -= argv[i]->val.f;
 
         ret        = expr_new(EXPR_NUM_FLT);
         ret->val.f = total;
     } else {
-        SL_FATAL("Unhandled numeric type (%s).", exprtype2str(first_arg->type));
+        SL_FATAL("Unhandled numeric type (%s).", exprtype2str(argv[0]->type));
     }
 
     return ret;
 }
 
-Expr* prim_mul(Env* env, Expr* args) {
+Expr* prim_mul(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-
-    const bool no_args = expr_is_nil(args);
-    SL_EXPECT(no_args || expr_list_has_only_numbers(args),
+    SL_EXPECT(expr_array_has_only_numbers(argc, argv),
               "Unexpected non-numeric argument.");
 
-    const Expr* first_arg = CAR(args);
-
     /*
      * If there are no arguments, return one.
      *   (*) => 1
@@ -153,50 +137,47 @@ Expr* prim_mul(Env* env, Expr* args) {
      *   (* 9.0 5.0 1.0) => 3.0
      */
     Expr* ret = NULL;
-    if (no_args) {
-        ret        = expr_new(EXPR_NUM_INT);
-        ret->val.n = 1;
-    } else if (!expr_list_is_homogeneous(args)) {
-        GenericNum total = expr_get_generic_num(first_arg);
-        for (args = CDR(args); !expr_is_nil(args); args = CDR(args))
-            total *= expr_get_generic_num(CAR(args));
+    if (argc == 0) {
+        ret = expr_new_int(1);
+    } else if (!expr_array_is_homogeneous(argc, argv)) {
+        GenericNum total = expr_get_generic_num(argv[0]);
+        for (size_t i = 1; i < argc; i++)
+            total *= expr_get_generic_num(argv[i]);
 
         ret = expr_new(EXPR_NUM_GENERIC);
         expr_set_generic_num(ret, total);
-    } else if (EXPR_INT_P(first_arg)) {
-        LispInt total = first_arg->val.n;
-        for (args = CDR(args); !expr_is_nil(args); args = CDR(args))
-            total *= CAR(args)->val.n;
-
-        ret        = expr_new(EXPR_NUM_INT);
-        ret->val.n = total;
-    } else if (EXPR_FLT_P(first_arg)) {
-        LispFlt total = first_arg->val.f;
-        for (args = CDR(args); !expr_is_nil(args); args = CDR(args))
-            total *= CAR(args)->val.f;
+    } else if (EXPR_INT_P(argv[0])) {
+        LispInt total = argv[0]->val.n;
+        for (size_t i = 1; i < argc; i++)
+            total *= argv[i]->val.n;
+
+        ret = expr_new_int(total);
+    } else if (EXPR_FLT_P(argv[0])) {
+        LispFlt total = argv[0]->val.f;
+        for (size_t i = 1; i < argc; i++)
+            total *= argv[i]->val.f;
 
         ret        = expr_new(EXPR_NUM_FLT);
         ret->val.f = total;
     } else {
-        SL_FATAL("Unhandled numeric type (%s).", exprtype2str(first_arg->type));
+        SL_FATAL("Unhandled numeric type (%s).", exprtype2str(argv[0]->type));
     }
 
     return ret;
 }
 
-Expr* prim_div(Env* env, Expr* args) {
+Expr* prim_div(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT(!expr_is_nil(args), "Expected at least one argument.");
-    SL_EXPECT(expr_list_has_only_numbers(args),
+    SL_EXPECT(expr_array_has_only_numbers(argc, argv),
               "Unexpected non-numeric argument.");
 
     /*
      * The `div' primitive always returns a 'GenericNum' result. For integer
      * division, use `quotient'.
      */
-    GenericNum total = expr_get_generic_num(CAR(args));
-    for (args = CDR(args); !expr_is_nil(args); args = CDR(args)) {
-        const GenericNum n = expr_get_generic_num(CAR(args));
+    GenericNum total = expr_get_generic_num(argv[0]);
+    for (size_t i = 1; i < argc; i++) {
+        const GenericNum n = expr_get_generic_num(argv[i]);
         SL_EXPECT(n != 0, "Trying to divide by zero.");
         total /= n;
     }
@@ -206,10 +187,9 @@ Expr* prim_div(Env* env, Expr* args) {
     return ret;
 }
 
-Expr* prim_mod(Env* env, Expr* args) {
+Expr* prim_mod(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT(!expr_is_nil(args), "Expected at least one argument.");
-    SL_EXPECT(expr_list_has_only_numbers(args),
+    SL_EXPECT(expr_array_has_only_numbers(argc, argv),
               "Unexpected non-numeric argument.");
 
     /*
@@ -225,9 +205,9 @@ Expr* prim_mod(Env* env, Expr* args) {
      * Note that, although the behavior of `mod' in SL is the same as in Elisp,
      * the `floor' and `/' functions are not.
      */
-    GenericNum total = expr_get_generic_num(CAR(args));
-    for (args = CDR(args); !expr_is_nil(args); args = CDR(args)) {
-        const GenericNum num = expr_get_generic_num(CAR(args));
+    GenericNum total = expr_get_generic_num(argv[0]);
+    for (size_t i = 1; i < argc; i++) {
+        const GenericNum num = expr_get_generic_num(argv[i]);
         SL_EXPECT(num != 0, "Trying to divide by zero.");
         total = fmod(total, num);
         if (num < 0 ? total > 0 : total < 0)
@@ -239,36 +219,29 @@ Expr* prim_mod(Env* env, Expr* args) {
     return ret;
 }
 
-Expr* prim_quotient(Env* env, Expr* args) {
+Expr* prim_quotient(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT(!expr_is_nil(args), "Expected at least one argument.");
-
-    const Expr* first_arg = CAR(args);
-    SL_EXPECT_TYPE(first_arg, EXPR_NUM_INT);
+    SL_EXPECT_TYPE(argv[0], EXPR_NUM_INT);
 
     /*
      * The `quotient' function is just like `/', but it only operates with
      * integers.
      */
-    LispInt total = first_arg->val.n;
-    for (args = CDR(args); !expr_is_nil(args); args = CDR(args)) {
-        const Expr* arg = CAR(args);
+    LispInt total = argv[0]->val.n;
+    for (size_t i = 1; i < argc; i++) {
+        const Expr* arg = argv[i];
         SL_EXPECT_TYPE(arg, EXPR_NUM_INT);
         SL_EXPECT(arg->val.n != 0, "Trying to divide by zero.");
         total /= arg->val.n;
     }
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = total;
+    Expr* ret = expr_new_int(total);
     return ret;
 }
 
-Expr* prim_remainder(Env* env, Expr* args) {
+Expr* prim_remainder(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT(!expr_is_nil(args), "Expected at least one argument.");
-
-    const Expr* first_arg = CAR(args);
-    SL_EXPECT_TYPE(first_arg, EXPR_NUM_INT);
+    SL_EXPECT_TYPE(argv[0], EXPR_NUM_INT);
 
     /*
      * The `remainder' function is just like `mod', but it only operates with
@@ -277,16 +250,15 @@ Expr* prim_remainder(Env* env, Expr* args) {
      *   (+ (remainder dividend divisor)
      *      (* (quotient dividend divisor) divisor))
      */
-    LispInt total = first_arg->val.n;
-    for (args = CDR(args); !expr_is_nil(args); args = CDR(args)) {
-        const Expr* arg = CAR(args);
+    LispInt total = argv[0]->val.n;
+    for (size_t i = 1; i < argc; i++) {
+        const Expr* arg = argv[i];
         SL_EXPECT_TYPE(arg, EXPR_NUM_INT);
         SL_EXPECT(arg->val.n != 0, "Trying to divide by zero.");
         total %= arg->val.n;
     }
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = total;
+    Expr* ret = expr_new_int(total);
     return ret;
 }
 
@@ -23,90 +23,84 @@
 #include "include/util.h"
 #include "include/primitives.h"
 
-Expr* prim_bit_and(Env* env, Expr* args) {
+Expr* prim_bit_and(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT(!expr_is_nil(args), "Expected at least one argument.");
+    SL_EXPECT_TYPE(argv[0], EXPR_NUM_INT);
 
-    LispInt total = CAR(args)->val.n;
-    for (args = CDR(args); !expr_is_nil(args); args = CDR(args)) {
-        const Expr* arg = CAR(args);
+    LispInt total = argv[0]->val.n;
+    for (size_t i = 1; i < argc; i++) {
+        const Expr* arg = argv[i];
         SL_EXPECT_TYPE(arg, EXPR_NUM_INT);
         total &= arg->val.n;
     }
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = total;
+    Expr* ret = expr_new_int(total);
     return ret;
 }
 
-Expr* prim_bit_or(Env* env, Expr* args) {
+Expr* prim_bit_or(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT(!expr_is_nil(args), "Expected at least one argument.");
+    SL_EXPECT_TYPE(argv[0], EXPR_NUM_INT);
 
-    LispInt total = CAR(args)->val.n;
-    for (args = CDR(args); !expr_is_nil(args); args = CDR(args)) {
-        const Expr* arg = CAR(args);
+    LispInt total = argv[0]->val.n;
+    for (size_t i = 1; i < argc; i++) {
+        const Expr* arg = argv[i];
         SL_EXPECT_TYPE(arg, EXPR_NUM_INT);
         total |= arg->val.n;
     }
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = total;
+    Expr* ret = expr_new_int(total);
     return ret;
 }
 
-Expr* prim_bit_xor(Env* env, Expr* args) {
+Expr* prim_bit_xor(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT(!expr_is_nil(args), "Expected at least one argument.");
+    SL_EXPECT_TYPE(argv[0], EXPR_NUM_INT);
 
-    LispInt total = CAR(args)->val.n;
-    for (args = CDR(args); !expr_is_nil(args); args = CDR(args)) {
-        const Expr* arg = CAR(args);
+    LispInt total = argv[0]->val.n;
+    for (size_t i = 1; i < argc; i++) {
+        const Expr* arg = argv[i];
         SL_EXPECT_TYPE(arg, EXPR_NUM_INT);
         total ^= arg->val.n;
     }
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = total;
+    Expr* ret = expr_new_int(total);
     return ret;
 }
 
-Expr* prim_bit_not(Env* env, Expr* args) {
+Expr* prim_bit_not(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT_ARG_NUM(args, 1);
+    SL_UNUSED(argc);
 
-    const Expr* arg = CAR(args);
+    const Expr* arg = argv[0];
     SL_EXPECT_TYPE(arg, EXPR_NUM_INT);
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = ~(arg->val.n);
+    Expr* ret = expr_new_int(~(arg->val.n));
     return ret;
 }
 
-Expr* prim_shr(Env* env, Expr* args) {
+Expr* prim_shr(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT_ARG_NUM(args, 2);
+    SL_UNUSED(argc);
 
-    const Expr* num = CAR(args);
+    const Expr* num = argv[0];
     SL_EXPECT_TYPE(num, EXPR_NUM_INT);
-    const Expr* count = CADR(args);
+    const Expr* count = argv[1];
     SL_EXPECT_TYPE(count, EXPR_NUM_INT);
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = (num->val.n >> count->val.n);
+    Expr* ret = expr_new_int(num->val.n >> count->val.n);
     return ret;
 }
 
-Expr* prim_shl(Env* env, Expr* args) {
+Expr* prim_shl(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT_ARG_NUM(args, 2);
+    SL_UNUSED(argc);
 
-    const Expr* num = CAR(args);
+    const Expr* num = argv[0];
     SL_EXPECT_TYPE(num, EXPR_NUM_INT);
-    const Expr* count = CADR(args);
+    const Expr* count = argv[1];
     SL_EXPECT_TYPE(count, EXPR_NUM_INT);
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = (num->val.n << count->val.n);
+    Expr* ret = expr_new_int(num->val.n << count->val.n);
     return ret;
 }
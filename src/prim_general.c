@@ -25,8 +25,36 @@
 #include "include/lambda.h"
 #include "include/util.h"
 #include "include/eval.h"
+#include "include/symbol.h"
+#include "include/expr_pool.h"
+#include "include/string_heap.h"
+#include "include/garbage_collector.h"
 #include "include/primitives.h"
 
+/*
+ * Prepend a pair with the specified symbol and value to an association list,
+ * and return the new list. Used by 'prim_gc_stats'.
+ */
+static Expr* alist_prepend(Expr* alist, const char* name, Expr* val) {
+    Expr* key  = expr_new(EXPR_SYMBOL);
+    key->val.s = symbol_intern(name);
+
+    Expr* entry = expr_new(EXPR_PAIR);
+    CAR(entry)  = key;
+    CDR(entry)  = val;
+
+    Expr* pair = expr_new(EXPR_PAIR);
+    CAR(pair)  = entry;
+    CDR(pair)  = alist;
+    return pair;
+}
+
+static Expr* alist_prepend_int(Expr* alist, const char* name, size_t num) {
+    Expr* val  = expr_new(EXPR_NUM_INT);
+    val->val.n = (LispInt)num;
+    return alist_prepend(alist, name, val);
+}
+
 Expr* prim_eval(Env* env, Expr* args) {
     SL_EXPECT_ARG_NUM(args, 1);
     return eval(env, CAR(args));
@@ -84,7 +112,21 @@ Expr* prim_set(Env* env, Expr* args) {
      * The `set' primitive copies the value of the "source" argument into the
      * "destination". Note that it doesn't replace the reference of the
      * destination, it replaces its entire value and type.
+     *
+     * The unique `nil' and `tru' expressions are shared by the whole
+     * interpreter, so they can't be overwritten.
+     */
+    SL_EXPECT(dst != g_nil && dst != g_tru,
+              "Can't overwrite the value of `%s'.",
+              expr_str(dst));
+
+    /*
+     * The small integers returned by 'expr_new_int' are also shared, but they
+     * are never stored in bindings or pairs (see 'expr_unshare'), so a shared
+     * destination is a temporary value that nothing else references. Setting a
+     * copy of it has the same effect.
      */
+    dst = expr_unshare(dst);
     expr_set(dst, src);
     return dst;
 }
@@ -139,3 +181,72 @@ Expr* prim_set_random_seed(Env* env, Expr* args) {
     srand(seed->val.n);
     return g_tru;
 }
+
+Expr* prim_gc(Env* env, size_t argc, Expr** argv) {
+    SL_UNUSED(env);
+    SL_UNUSED(argc);
+    SL_UNUSED(argv);
+
+    /*
+     * The callers of the primitives might hold expressions that are not
+     * registered as roots, so the collection is performed at the next safe
+     * point. See 'gc_request_major'.
+     */
+    gc_request_major();
+    return g_tru;
+}
+
+Expr* prim_gc_stats(Env* env, size_t argc, Expr** argv) {
+    SL_UNUSED(env);
+    SL_UNUSED(argc);
+    SL_UNUSED(argv);
+
+    /*
+     * The counters are maintained by the garbage collector and the expression
+     * pool as they run, so this doesn't walk the heap. The list is built from
+     * the end.
+     */
+    const GcStats gc             = gc_get_stats();
+    const PoolStats* pool        = &g_expr_pool->stats;
+    const enum EExprType types[] = {
+        EXPR_NUM_INT, EXPR_NUM_FLT, EXPR_ERR,    EXPR_SYMBOL, EXPR_STRING,
+        EXPR_PAIR,    EXPR_PRIM,    EXPR_LAMBDA, EXPR_MACRO,
+    };
+
+    Expr* allocs = g_nil;
+    for (size_t i = LENGTH(types); i-- > 0;)
+        allocs = alist_prepend_int(allocs,
+                                   exprtype2str(types[i]),
+                                   pool->num_allocs[exprtype2index(types[i])]);
+
+    Expr* ret = g_nil;
+    ret       = alist_prepend(ret, "allocations", allocs);
+    ret       = alist_prepend_int(ret, "string-bytes", strheap_bytes());
+    ret       = alist_prepend_int(ret, "arrays", pool->num_arrays);
+    ret       = alist_prepend_int(ret, "free-items", pool->num_free);
+    ret       = alist_prepend_int(ret, "items", g_expr_pool->items_sz);
+    ret       = alist_prepend_int(ret, "marked", gc.num_marked);
+    ret       = alist_prepend_int(ret, "max-pause-us", gc.max_pause_us);
+    ret       = alist_prepend_int(ret, "compact-us", gc.compact_us);
+    ret       = alist_prepend_int(ret, "sweep-us", gc.sweep_us);
+    ret       = alist_prepend_int(ret, "mark-us", gc.mark_us);
+    ret       = alist_prepend_int(ret, "pauses", gc.num_pauses);
+    ret       = alist_prepend_int(ret, "compactions", gc.num_compactions);
+    ret       = alist_prepend_int(ret, "major-collections", gc.num_major);
+    ret       = alist_prepend_int(ret, "minor-collections", gc.num_minor);
+    return ret;
+}
+
+Expr* prim_gc_compact(Env* env, size_t argc, Expr** argv) {
+    SL_UNUSED(env);
+    SL_UNUSED(argc);
+    SL_UNUSED(argv);
+
+    /*
+     * The expressions can't be moved while they are being used by the
+     * evaluation, so the pool is compacted once the current top-level
+     * expression returns. See 'gc_compact_safepoint'.
+     */
+    g_gc_compact_requested = true;
+    return g_tru;
+}
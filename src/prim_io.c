@@ -44,14 +44,14 @@ Expr* prim_read(Env* env, Expr* args) {
     SL_UNUSED(env);
     SL_UNUSED(args);
 
-    char* str = read_expr(stdin);
+    /* Nothing is allocated from the arena if 'read_expr' fails */
+    Arena arena = { NULL };
+    char* str   = read_expr(stdin, &arena);
     SL_EXPECT(str != NULL, "Error reading expression.");
 
-    Token* tokens = tokenize(str);
-    mem_free(str);
-
-    Expr* expr = parse(tokens);
-    tokens_free(tokens);
+    Token* tokens = tokenize(str, &arena);
+    Expr* expr    = parse(tokens);
+    arena_free(&arena);
 
     return expr;
 }
@@ -89,7 +89,7 @@ Expr* prim_scan_str(Env* env, Expr* args) {
     if (arg_num == 1) {
         const Expr* arg = CAR(args);
         SL_EXPECT_TYPE(arg, EXPR_STRING);
-        delimiters = arg->val.s;
+        delimiters = expr_str(arg);
     }
 
     size_t str_pos = 0;
@@ -111,9 +111,7 @@ Expr* prim_scan_str(Env* env, Expr* args) {
 
     str[str_pos] = '\0';
 
-    Expr* ret  = expr_new(EXPR_STRING);
-    ret->val.s = str;
-    return ret;
+    return expr_new_str(EXPR_STRING, str);
 }
 
 Expr* prim_print_str(Env* env, Expr* args) {
@@ -123,7 +121,7 @@ Expr* prim_print_str(Env* env, Expr* args) {
     Expr* arg = CAR(args);
     SL_EXPECT_TYPE(arg, EXPR_STRING);
 
-    printf("%s", arg->val.s);
+    printf("%s", expr_str(arg));
     return arg;
 }
 
@@ -137,5 +135,5 @@ Expr* prim_error(Env* env, Expr* args) {
     /*
      * TODO: Use 'prim_format' and '&rest'. Move outside of 'prim_io.c'.
      */
-    return err("%s", arg->val.s);
+    return err("%s", expr_str(arg));
 }
@@ -60,36 +60,43 @@ static Expr* string_append(Expr* args) {
     for (const Expr* rem = args; !expr_is_nil(rem); rem = CDR(rem)) {
         const Expr* arg = CAR(rem);
         SL_ASSERT(EXPR_STRING_P(arg));
-        SL_ASSERT(arg->val.s != NULL);
+        SL_ASSERT(expr_str(arg) != NULL);
 
-        total_len += strlen(arg->val.s);
+        total_len += expr_str_len(arg);
     }
 
-    Expr* ret  = expr_new(EXPR_STRING);
-    ret->val.s = mem_alloc(total_len + 1);
+    char* dst = mem_alloc(total_len + 1);
 
-    char* last_copied = ret->val.s;
+    char* last_copied = dst;
     for (const Expr* rem = args; !expr_is_nil(rem); rem = CDR(rem))
-        last_copied = stpcpy(last_copied, CAR(rem)->val.s);
+        last_copied = stpcpy(last_copied, expr_str(CAR(rem)));
 
-    return ret;
+    return expr_new_str(EXPR_STRING, dst);
 }
 
 /*----------------------------------------------------------------------------*/
 
-Expr* prim_list(Env* env, Expr* args) {
+Expr* prim_list(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
 
     /*
      * (list)          ===> nil
      * (list 'a 'b 'c) ===> (a b c)
      */
-    return expr_clone_tree(args);
+    Expr* ret = g_nil;
+    for (size_t i = argc; i-- > 0;) {
+        Expr* pair = expr_new(EXPR_PAIR);
+        CAR(pair)  = expr_clone_tree(argv[i]);
+        CDR(pair)  = ret;
+        ret        = pair;
+    }
+
+    return ret;
 }
 
-Expr* prim_cons(Env* env, Expr* args) {
+Expr* prim_cons(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT_ARG_NUM(args, 2);
+    SL_UNUSED(argc);
 
     /*
      * (cons 'a 'b)     ===> (a . b)
@@ -97,17 +104,17 @@ Expr* prim_cons(Env* env, Expr* args) {
      * (cons 'a nil)    ===> (a)
      */
     Expr* ret = expr_new(EXPR_PAIR);
-    CAR(ret)  = expr_list_nth(args, 1);
-    CDR(ret)  = expr_list_nth(args, 2);
+    CAR(ret)  = expr_unshare(argv[0]);
+    CDR(ret)  = expr_unshare(argv[1]);
 
     return ret;
 }
 
-Expr* prim_car(Env* env, Expr* args) {
+Expr* prim_car(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT_ARG_NUM(args, 1);
+    SL_UNUSED(argc);
 
-    Expr* arg = CAR(args);
+    Expr* arg = argv[0];
     SL_EXPECT(EXPR_PAIR_P(arg) || expr_is_nil(arg),
               "Expected an expression of type '%s' or `nil', got '%s'.",
               exprtype2str(EXPR_PAIR),
@@ -124,11 +131,11 @@ Expr* prim_car(Env* env, Expr* args) {
     return CAR(arg);
 }
 
-Expr* prim_cdr(Env* env, Expr* args) {
+Expr* prim_cdr(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT_ARG_NUM(args, 1);
+    SL_UNUSED(argc);
 
-    Expr* arg = CAR(args);
+    Expr* arg = argv[0];
     SL_EXPECT(EXPR_PAIR_P(arg) || expr_is_nil(arg),
               "Expected an expression of type '%s' or `nil', got '%s'.",
               exprtype2str(EXPR_PAIR),
@@ -182,13 +189,12 @@ Expr* prim_length(Env* env, Expr* args) {
         SL_EXPECT_PROPER_LIST(arg);
         result = expr_list_len(arg);
     } else if (EXPR_STRING_P(arg)) {
-        result = strlen(arg->val.s);
+        result = expr_str_len(arg);
     } else {
         return err("Invalid argument of type '%s'.", exprtype2str(arg->type));
     }
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = result;
+    Expr* ret = expr_new_int(result);
     return ret;
 }
 
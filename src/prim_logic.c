@@ -23,73 +23,48 @@
 #include "include/util.h"
 #include "include/primitives.h"
 
-Expr* prim_equal(Env* env, Expr* args) {
+Expr* prim_equal(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT_MIN_ARG_NUM(args, 2);
-
-    bool result = true;
 
     /* (A == B == ...) */
-    for (; !expr_is_nil(CDR(args)); args = CDR(args)) {
-        if (!expr_equal(CAR(args), CADR(args))) {
-            result = false;
-            break;
-        }
-    }
+    for (size_t i = 1; i < argc; i++)
+        if (!expr_equal(argv[i - 1], argv[i]))
+            return g_nil;
 
-    return (result) ? g_tru : g_nil;
+    return g_tru;
 }
 
-Expr* prim_equal_num(Env* env, Expr* args) {
+Expr* prim_equal_num(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT_MIN_ARG_NUM(args, 2);
-    SL_EXPECT(expr_list_has_only_numbers(args),
+    SL_EXPECT(expr_array_has_only_numbers(argc, argv),
               "Expected only numeric arguments.");
 
-    bool result = true;
-
     /* (N1 == N2 == ...) */
-    for (; !expr_is_nil(CDR(args)); args = CDR(args)) {
-        if (expr_get_generic_num(CAR(args)) !=
-            expr_get_generic_num(CADR(args))) {
-            result = false;
-            break;
-        }
-    }
+    for (size_t i = 1; i < argc; i++)
+        if (expr_get_generic_num(argv[i - 1]) != expr_get_generic_num(argv[i]))
+            return g_nil;
 
-    return (result) ? g_tru : g_nil;
+    return g_tru;
 }
 
-Expr* prim_lt(Env* env, Expr* args) {
+Expr* prim_lt(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT_MIN_ARG_NUM(args, 2);
-
-    bool result = true;
 
     /* (A < B < ...) */
-    for (; !expr_is_nil(CDR(args)); args = CDR(args)) {
-        if (!expr_lt(CAR(args), CADR(args))) {
-            result = false;
-            break;
-        }
-    }
+    for (size_t i = 1; i < argc; i++)
+        if (!expr_lt(argv[i - 1], argv[i]))
+            return g_nil;
 
-    return (result) ? g_tru : g_nil;
+    return g_tru;
 }
 
-Expr* prim_gt(Env* env, Expr* args) {
+Expr* prim_gt(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    SL_EXPECT_MIN_ARG_NUM(args, 2);
-
-    bool result = true;
 
     /* (A > B > ...) */
-    for (; !expr_is_nil(CDR(args)); args = CDR(args)) {
-        if (!expr_gt(CAR(args), CADR(args))) {
-            result = false;
-            break;
-        }
-    }
+    for (size_t i = 1; i < argc; i++)
+        if (!expr_gt(argv[i - 1], argv[i]))
+            return g_nil;
 
-    return (result) ? g_tru : g_nil;
+    return g_tru;
 }
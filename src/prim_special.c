@@ -21,64 +21,37 @@
  */
 
 #include <stddef.h>
-#include <string.h>
 
 #include "include/env.h"
 #include "include/expr.h"
 #include "include/lambda.h"
 #include "include/util.h"
+#include "include/symbol.h"
 #include "include/eval.h"
+#include "include/garbage_collector.h"
 #include "include/primitives.h"
 
 /*
  * Is the specified list a call to a function with the specified name? In other
- * words, a list whose `car' is a symbol with the specified value.
+ * words, a list whose `car' is the specified symbol. Since symbols are interned,
+ * the 'func' argument must have been returned by 'symbol_intern'.
  */
 static inline bool is_call_to(const Expr* list, const char* func) {
     SL_ASSERT(expr_is_proper_list(list));
-    return EXPR_SYMBOL_P(CAR(list)) && CAR(list)->val.s != NULL &&
-           strcmp(CAR(list)->val.s, func) == 0;
+    return EXPR_SYMBOL_P(CAR(list)) && CAR(list)->val.s == func;
 }
 
+static Expr* handle_backquote_arg(Env* env, Expr* arg);
+
 /*
- * Evaluate the necessary parts of a single backquoted expression, and return
- * it.
- *
- * If the argument is a list, this function is a "selective" version of the
- * 'eval_list' function from 'eval.c'.
+ * Handle each element of a backquoted list that is not a call to unquote,
+ * appending the results to 'result'. Returns NULL on success, or an error
+ * expression otherwise.
  */
-static Expr* handle_backquote_arg(Env* env, Expr* arg) {
-    /* Not a proper list, return unevaluated, just like `quote' */
-    if (!expr_is_proper_list(arg))
-        return arg;
-
-    /*
-     * If we reached this point, the expression is a proper list. Check if
-     * it's a call to one of the special unquoting symbols.
-     *
-     * We can't splice directly outside of a list:
-     *   `,@expr  =>  (` (,@ expr))  =>  <Error>
-     *
-     * We can unquote outside of a list. This conditional is useful since this
-     * 'handle_backquote_arg' function calls itself recursively below.
-     *   `,expr  =>  (` (, expr))  =>  (eval expr)
-     */
-    SL_EXPECT(!is_call_to(arg, ",@"), "Can't splice (,@) outside of a list.");
-    if (is_call_to(arg, ",")) {
-        SL_EXPECT(!expr_is_nil(CDR(arg)) && expr_is_nil(CDDR(arg)),
-                  "Call to unquote (,) expected exactly one argument.");
-        return eval(env, CADR(arg));
-    }
-
-    /*
-     * If we reached this point, the backquoted expression is a normal list. We
-     * handle each element recursively to allow calls to unquote from nested
-     * lists. We will also handle valid calls to the splice function (,@) here.
-     */
-    Expr* result = g_nil;
+static Expr* handle_backquote_list(Env* env, const Expr* arg, Expr** result) {
     for (const Expr* list = arg; !expr_is_nil(list); list = CDR(list)) {
         Expr* cur = CAR(list);
-        if (expr_is_proper_list(cur) && is_call_to(cur, ",@")) {
+        if (expr_is_proper_list(cur) && is_call_to(cur, g_sym_splice)) {
             /*
              * Calls to splice are handled when parsing a list:
              *
@@ -103,7 +76,7 @@ static Expr* handle_backquote_arg(Env* env, Expr* arg) {
             /*
              * Concatenate the list we got from the evaluation to the result.
              */
-            result = expr_nconc(result, evaluated);
+            *result = expr_nconc(*result, evaluated);
         } else {
             /*
              * The current element of the list is not a call to the splice
@@ -115,13 +88,62 @@ static Expr* handle_backquote_arg(Env* env, Expr* arg) {
                 return handled;
 
             Expr* pair = expr_new(EXPR_PAIR);
-            CAR(pair)  = handled;
+            CAR(pair)  = expr_unshare(handled);
             CDR(pair)  = g_nil;
-            result     = expr_nconc(result, pair);
+            *result    = expr_nconc(*result, pair);
         }
     }
 
-    return result;
+    return NULL;
+}
+
+/*
+ * Evaluate the necessary parts of a single backquoted expression, and return
+ * it.
+ *
+ * If the argument is a list, this function is a "selective" version of the
+ * 'eval_list' function from 'eval.c'.
+ */
+static Expr* handle_backquote_arg(Env* env, Expr* arg) {
+    /* Not a proper list, return unevaluated, just like `quote' */
+    if (!expr_is_proper_list(arg))
+        return arg;
+
+    /*
+     * If we reached this point, the expression is a proper list. Check if
+     * it's a call to one of the special unquoting symbols.
+     *
+     * We can't splice directly outside of a list:
+     *   `,@expr  =>  (` (,@ expr))  =>  <Error>
+     *
+     * We can unquote outside of a list. This conditional is useful since this
+     * 'handle_backquote_arg' function calls itself recursively below.
+     *   `,expr  =>  (` (, expr))  =>  (eval expr)
+     */
+    SL_EXPECT(!is_call_to(arg, g_sym_splice),
+              "Can't splice (,@) outside of a list.");
+    if (is_call_to(arg, g_sym_unquote)) {
+        SL_EXPECT(!expr_is_nil(CDR(arg)) && expr_is_nil(CDDR(arg)),
+                  "Call to unquote (,) expected exactly one argument.");
+        return eval(env, CADR(arg));
+    }
+
+    /*
+     * If we reached this point, the backquoted expression is a normal list. We
+     * handle each element recursively to allow calls to unquote from nested
+     * lists. We will also handle valid calls to the splice function (,@) here.
+     *
+     * The list we are building is not reachable from anywhere else, so it's
+     * registered as a root while the elements are evaluated.
+     */
+    Expr* result = g_nil;
+
+    const size_t roots = gc_roots_save();
+    gc_root(&result);
+    Expr* list_err = handle_backquote_list(env, arg, &result);
+    gc_roots_restore(roots);
+
+    return (list_err != NULL) ? list_err : result;
 }
 
 /*----------------------------------------------------------------------------*/
@@ -303,16 +325,20 @@ Expr* prim_begin(Env* env, Expr* args) {
      *   (apply begin
      *          '((+ 1 2)
      *            (+ 3 4)))
+     *
+     * The last expression is in tail position, so it's evaluated by the caller.
+     * See 'eval_tail'.
      */
-    Expr* last_evaluated = g_nil;
+    if (expr_is_nil(args))
+        return g_nil;
 
-    for (; !expr_is_nil(args); args = CDR(args)) {
-        last_evaluated = eval(env, CAR(args));
-        if (EXPR_ERR_P(last_evaluated))
-            break;
+    for (; !expr_is_nil(CDR(args)); args = CDR(args)) {
+        Expr* evaluated = eval(env, CAR(args));
+        if (EXPR_ERR_P(evaluated))
+            return evaluated;
     }
 
-    return last_evaluated;
+    return eval_tail(env, CAR(args));
 }
 
 /*----------------------------------------------------------------------------*/
@@ -330,13 +356,16 @@ Expr* prim_if(Env* env, Expr* args) {
      * First, evaluate the predicate (first argument). If the predicate is false
      * (nil), the expression to be evaluated is the "alternative" (third
      * argument); otherwise, evaluate the "consequent" (second argument).
+     *
+     * The selected expression is in tail position, so it's evaluated by the
+     * caller. See 'eval_tail'.
      */
     Expr* evaluated_predicate = eval(env, predicate);
     if (EXPR_ERR_P(evaluated_predicate))
         return evaluated_predicate;
 
     Expr* result = !expr_is_nil(evaluated_predicate) ? consequent : alternative;
-    return eval(env, result);
+    return eval_tail(env, result);
 }
 
 Expr* prim_or(Env* env, Expr* args) {
@@ -347,16 +376,20 @@ Expr* prim_or(Env* env, Expr* args) {
      * them is true, we stop evaluating the arguments and return that one. The
      * same is true for 'prim_and', but we stop as soon as one of them is `nil'
      * (false).
+     *
+     * If we reach the last argument, its value is the result of the whole
+     * expression, so it's in tail position. See 'eval_tail'.
      */
-    Expr* result = g_nil;
+    if (expr_is_nil(args))
+        return g_nil;
 
-    for (; !expr_is_nil(args); args = CDR(args)) {
-        result = eval(env, CAR(args));
+    for (; !expr_is_nil(CDR(args)); args = CDR(args)) {
+        Expr* result = eval(env, CAR(args));
         if (EXPR_ERR_P(result) || !expr_is_nil(result))
-            break;
+            return result;
     }
 
-    return result;
+    return eval_tail(env, CAR(args));
 }
 
 Expr* prim_and(Env* env, Expr* args) {
@@ -366,13 +399,14 @@ Expr* prim_and(Env* env, Expr* args) {
      * Also note that we are returning `tru' if we didn't receive any arguments.
      * This is the standard behavior in Scheme.
      */
-    Expr* result = g_tru;
+    if (expr_is_nil(args))
+        return g_tru;
 
-    for (; !expr_is_nil(args); args = CDR(args)) {
-        result = eval(env, CAR(args));
+    for (; !expr_is_nil(CDR(args)); args = CDR(args)) {
+        Expr* result = eval(env, CAR(args));
         if (EXPR_ERR_P(result) || expr_is_nil(result))
-            break;
+            return result;
     }
 
-    return result;
+    return eval_tail(env, CAR(args));
 }
@@ -47,9 +47,7 @@ Expr* prim_write_to_str(Env* env, Expr* args) {
                    exprtype2str(arg->type));
     }
 
-    Expr* ret  = expr_new(EXPR_STRING);
-    ret->val.s = str;
-    return ret;
+    return expr_new_str(EXPR_STRING, str);
 }
 
 /*
@@ -65,7 +63,7 @@ Expr* prim_format(Env* env, Expr* args) {
     SL_EXPECT(!expr_is_nil(args), "Expected at least a format argument.");
 
     SL_EXPECT_TYPE(CAR(args), EXPR_STRING);
-    const char* fmt = CAR(args)->val.s;
+    const char* fmt = expr_str(CAR(args));
     args            = CDR(args);
 
     size_t dst_pos = 0;
@@ -161,7 +159,11 @@ Expr* prim_format(Env* env, Expr* args) {
          */
         switch (expr_type) {
             case EXPR_STRING:
-                sl_concat_format(&dst, &dst_sz, &dst_pos, c_format, arg->val.s);
+                sl_concat_format(&dst,
+                                 &dst_sz,
+                                 &dst_pos,
+                                 c_format,
+                                 expr_str(arg));
                 break;
 
             case EXPR_NUM_INT:
@@ -189,9 +191,7 @@ done:
      * specified to many arguments for this format.
      */
 
-    Expr* ret  = expr_new(EXPR_STRING);
-    ret->val.s = dst;
-    return ret;
+    return expr_new_str(EXPR_STRING, dst);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -206,7 +206,7 @@ Expr* prim_substring(Env* env, Expr* args) {
     /* First argument, string */
     const Expr* str_expr = expr_list_nth(args, 1);
     SL_EXPECT_TYPE(str_expr, EXPR_STRING);
-    const LispInt str_len = (LispInt)strlen(str_expr->val.s);
+    const LispInt str_len = (LispInt)expr_str_len(str_expr);
 
     /* Second argument, start index */
     LispInt start_idx = 0;
@@ -243,15 +243,9 @@ Expr* prim_substring(Env* env, Expr* args) {
     end_idx   = CLAMP(end_idx, 0, str_len);
     start_idx = CLAMP(start_idx, 0, end_idx);
 
-    Expr* ret  = expr_new(EXPR_STRING);
-    ret->val.s = mem_alloc(end_idx - start_idx + 1);
-
-    LispInt dst_i, src_i;
-    for (dst_i = 0, src_i = start_idx; src_i < end_idx; dst_i++, src_i++)
-        ret->val.s[dst_i] = str_expr->val.s[src_i];
-    ret->val.s[dst_i] = '\0';
-
-    return ret;
+    return expr_new_str_copy(EXPR_STRING,
+                             expr_str(str_expr) + start_idx,
+                             end_idx - start_idx);
 }
 
 /*----------------------------------------------------------------------------*/
@@ -286,10 +280,10 @@ Expr* prim_re_match_groups(Env* env, Expr* args) {
      *   https://www.gnu.org/software/sed/manual/html_node/Character-Classes-and-Bracket-Expressions.html
      */
     SL_EXPECT_TYPE(CAR(args), EXPR_STRING);
-    const char* pattern = CAR(args)->val.s;
+    const char* pattern = expr_str(CAR(args));
 
     SL_EXPECT_TYPE(CADR(args), EXPR_STRING);
-    const char* string = CADR(args)->val.s;
+    const char* string = expr_str(CADR(args));
 
     const bool ignore_case =
       (arg_num >= 3 && !expr_is_nil(expr_list_nth(args, 3)));
@@ -23,6 +23,7 @@
 #include "include/expr.h"
 #include "include/util.h"
 #include "include/memory.h"
+#include "include/symbol.h"
 #include "include/primitives.h"
 
 /*----------------------------------------------------------------------------*/
@@ -33,61 +34,65 @@ Expr* prim_type_of(Env* env, Expr* args) {
     SL_EXPECT_ARG_NUM(args, 1);
 
     Expr* ret  = expr_new(EXPR_SYMBOL);
-    ret->val.s = mem_strdup(exprtype2str(CAR(args)->type));
+    ret->val.s = symbol_intern(exprtype2str(CAR(args)->type));
     return ret;
 }
 
-Expr* prim_is_int(Env* env, Expr* args) {
+Expr* prim_is_int(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    const bool result = expr_list_has_only_type(args, EXPR_NUM_INT);
+    const bool result = expr_array_has_only_type(argc, argv, EXPR_NUM_INT);
     return (result) ? g_tru : g_nil;
 }
 
-Expr* prim_is_flt(Env* env, Expr* args) {
+Expr* prim_is_flt(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    const bool result = expr_list_has_only_type(args, EXPR_NUM_FLT);
+    const bool result = expr_array_has_only_type(argc, argv, EXPR_NUM_FLT);
     return (result) ? g_tru : g_nil;
 }
 
-Expr* prim_is_symbol(Env* env, Expr* args) {
+Expr* prim_is_symbol(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    const bool result = expr_list_has_only_type(args, EXPR_SYMBOL);
+    const bool result = expr_array_has_only_type(argc, argv, EXPR_SYMBOL);
     return (result) ? g_tru : g_nil;
 }
 
-Expr* prim_is_string(Env* env, Expr* args) {
+Expr* prim_is_string(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    const bool result = expr_list_has_only_type(args, EXPR_STRING);
+    const bool result = expr_array_has_only_type(argc, argv, EXPR_STRING);
     return (result) ? g_tru : g_nil;
 }
 
-Expr* prim_is_pair(Env* env, Expr* args) {
+Expr* prim_is_pair(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    const bool result = expr_list_has_only_type(args, EXPR_PAIR);
+    const bool result = expr_array_has_only_type(argc, argv, EXPR_PAIR);
     return (result) ? g_tru : g_nil;
 }
 
-Expr* prim_is_list(Env* env, Expr* args) {
+Expr* prim_is_list(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    const bool result = expr_list_has_only_lists(args);
-    return (result) ? g_tru : g_nil;
+
+    for (size_t i = 0; i < argc; i++)
+        if (!expr_is_proper_list(argv[i]))
+            return g_nil;
+
+    return g_tru;
 }
 
-Expr* prim_is_primitive(Env* env, Expr* args) {
+Expr* prim_is_primitive(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    const bool result = expr_list_has_only_type(args, EXPR_PRIM);
+    const bool result = expr_array_has_only_type(argc, argv, EXPR_PRIM);
     return (result) ? g_tru : g_nil;
 }
 
-Expr* prim_is_lambda(Env* env, Expr* args) {
+Expr* prim_is_lambda(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    const bool result = expr_list_has_only_type(args, EXPR_LAMBDA);
+    const bool result = expr_array_has_only_type(argc, argv, EXPR_LAMBDA);
     return (result) ? g_tru : g_nil;
 }
 
-Expr* prim_is_macro(Env* env, Expr* args) {
+Expr* prim_is_macro(Env* env, size_t argc, Expr** argv) {
     SL_UNUSED(env);
-    const bool result = expr_list_has_only_type(args, EXPR_MACRO);
+    const bool result = expr_array_has_only_type(argc, argv, EXPR_MACRO);
     return (result) ? g_tru : g_nil;
 }
 
@@ -113,8 +118,7 @@ Expr* prim_flt2int(Env* env, Expr* args) {
     const Expr* arg = CAR(args);
     SL_EXPECT_TYPE(arg, EXPR_NUM_FLT);
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = (LispInt)arg->val.f;
+    Expr* ret = expr_new_int((LispInt)arg->val.f);
     return ret;
 }
 
@@ -133,9 +137,7 @@ Expr* prim_int2str(Env* env, Expr* args) {
     const size_t written = int2str(arg->val.n, &s);
     SL_EXPECT(written > 0, "Failed to convert Integer to String.");
 
-    Expr* ret  = expr_new(EXPR_STRING);
-    ret->val.s = s;
-    return ret;
+    return expr_new_str(EXPR_STRING, s);
 }
 
 Expr* prim_flt2str(Env* env, Expr* args) {
@@ -149,9 +151,7 @@ Expr* prim_flt2str(Env* env, Expr* args) {
     const size_t written = flt2str(arg->val.f, &s);
     SL_EXPECT(written > 0, "Failed to convert Float to String.");
 
-    Expr* ret  = expr_new(EXPR_STRING);
-    ret->val.s = s;
-    return ret;
+    return expr_new_str(EXPR_STRING, s);
 }
 
 Expr* prim_str2int(Env* env, Expr* args) {
@@ -161,8 +161,7 @@ Expr* prim_str2int(Env* env, Expr* args) {
     const Expr* arg = CAR(args);
     SL_EXPECT_TYPE(arg, EXPR_STRING);
 
-    Expr* ret  = expr_new(EXPR_NUM_INT);
-    ret->val.n = strtoll(arg->val.s, NULL, STRTOLL_ANY_BASE);
+    Expr* ret = expr_new_int(strtoll(expr_str(arg), NULL, STRTOLL_ANY_BASE));
     return ret;
 }
 
@@ -174,6 +173,6 @@ Expr* prim_str2flt(Env* env, Expr* args) {
     SL_EXPECT_TYPE(arg, EXPR_STRING);
 
     Expr* ret  = expr_new(EXPR_NUM_FLT);
-    ret->val.f = strtod(arg->val.s, NULL);
+    ret->val.f = strtod(expr_str(arg), NULL);
     return ret;
 }
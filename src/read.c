@@ -27,12 +27,16 @@
 #include <ctype.h>
 
 #include "include/util.h"
-#include "include/memory.h"
+#include "include/arena.h"
 #include "include/error.h"
 #include "include/read.h"
 #include "include/lexer.h" /* is_token_separator() */
 
-#define READ_BUFSZ 100
+/*
+ * Initial size of the buffers used for reading expressions. They double in size
+ * whenever they are full.
+ */
+#define READ_BUFSZ 128
 
 /*----------------------------------------------------------------------------*/
 
@@ -88,17 +92,33 @@ static int get_next_non_comment(FILE* fp) {
 
 /*----------------------------------------------------------------------------*/
 
+/*
+ * Make sure the buffer pointed to by 'dst', allocated from 'arena', has room
+ * for at least two more characters after 'pos', doubling its size if needed.
+ */
+static inline void read_buf_reserve(Arena* arena, char** dst, size_t* dst_sz,
+                                    size_t pos) {
+    if (pos + 2 <= *dst_sz)
+        return;
+
+    const size_t old_sz = *dst_sz;
+    *dst_sz *= 2;
+    *dst = arena_realloc(arena, *dst, old_sz, *dst_sz);
+}
+
+/*----------------------------------------------------------------------------*/
+
 /*
  * Read a double-quote-terminated string into the 'dst' buffer, modifying its
  * size and position. Assumes the opening double-quote has just been written to
  * 'dst'; and reads up to the final non-escaped double-quote, included.
  *
- * The string will be reallocated if necessary, ensuring there is enough space
- * for the null terminator after the closing double-quote, but without actually
- * writing it.
+ * The string will be reallocated from the arena if necessary, ensuring there is
+ * enough space for the null terminator after the closing double-quote, but
+ * without actually writing it.
  */
-static void read_user_string(FILE* fp, char** dst, size_t* dst_sz,
-                             size_t* dst_pos) {
+static void read_user_string(FILE* fp, Arena* arena, char** dst,
+                             size_t* dst_sz, size_t* dst_pos) {
     /*
      * Important notes:
      *   - There are no comments (starting with ';') in strings.
@@ -111,10 +131,8 @@ static void read_user_string(FILE* fp, char** dst, size_t* dst_sz,
      */
     int c = 0;
     while (c != '\"') {
-        if (*dst_pos + 1 >= *dst_sz) {
-            *dst_sz += READ_BUFSZ;
-            mem_realloc(dst, *dst_sz);
-        }
+        /* An escaped character writes two bytes */
+        read_buf_reserve(arena, dst, dst_sz, *dst_pos + 1);
 
         c = fgetc(fp);
         if (c == EOF)
@@ -136,10 +154,10 @@ static void read_user_string(FILE* fp, char** dst, size_t* dst_sz,
  * Read a user list with the form "(...)". Assumes the caller just received an
  * opening parentheses, but didn't write it anywhere.
  */
-static char* read_user_list(FILE* fp) {
+static char* read_user_list(FILE* fp, Arena* arena) {
     size_t result_pos = 0;
     size_t result_sz  = READ_BUFSZ;
-    char* result      = mem_alloc(result_sz);
+    char* result      = arena_alloc(arena, result_sz);
 
     /* Will increase when encountering '(' and decrease with ')' */
     int nesting_level = 1;
@@ -148,10 +166,7 @@ static char* read_user_list(FILE* fp) {
     result[result_pos++] = get_next_non_comment(fp);
 
     while (nesting_level > 0) {
-        if (result_pos + 1 >= result_sz) {
-            result_sz += READ_BUFSZ;
-            mem_realloc(&result, result_sz);
-        }
+        read_buf_reserve(arena, &result, &result_sz, result_pos);
 
         const int c = get_next_non_comment(fp);
         if (c == EOF)
@@ -176,7 +191,8 @@ static char* read_user_list(FILE* fp) {
                 break;
 
             case '\"':
-                read_user_string(fp, &result, &result_sz, &result_pos);
+                read_user_string(fp, arena, &result, &result_sz,
+                                 &result_pos);
                 break;
 
             default:
@@ -194,15 +210,15 @@ static char* read_user_list(FILE* fp) {
  * reads a string using the 'read_user_string' function (used in other places),
  * and writes the final null terminator.
  */
-static char* read_isolated_user_string(FILE* fp) {
+static char* read_isolated_user_string(FILE* fp, Arena* arena) {
     size_t result_pos = 0;
     size_t result_sz  = READ_BUFSZ;
-    char* result      = mem_alloc(result_sz);
+    char* result      = arena_alloc(arena, result_sz);
 
     SL_ASSERT(get_incoming(fp) == '\"');
     result[result_pos++] = get_next_non_comment(fp);
 
-    read_user_string(fp, &result, &result_sz, &result_pos);
+    read_user_string(fp, arena, &result, &result_sz, &result_pos);
     result[result_pos] = '\0';
     return result;
 }
@@ -210,10 +226,10 @@ static char* read_isolated_user_string(FILE* fp) {
 /*
  * Reads characters until a token separator is found.
  */
-static char* read_isolated_atom(FILE* fp) {
+static char* read_isolated_atom(FILE* fp, Arena* arena) {
     size_t result_pos = 0;
     size_t result_sz  = READ_BUFSZ;
-    char* result      = mem_alloc(result_sz);
+    char* result      = arena_alloc(arena, result_sz);
 
     /*
      * Read until the incoming character is a token separator. This includes
@@ -225,11 +241,7 @@ static char* read_isolated_atom(FILE* fp) {
         if (is_token_separator(incoming) || incoming == EOF)
             break;
 
-        if (result_pos + 1 >= result_sz) {
-            result_sz += READ_BUFSZ;
-            mem_realloc(&result, result_sz);
-        }
-
+        read_buf_reserve(arena, &result, &result_sz, result_pos);
         result[result_pos++] = get_next_non_comment(fp);
     }
 
@@ -243,26 +255,25 @@ static char* read_isolated_atom(FILE* fp) {
  *
  * First, we store the quote character, then we read an expression
  * (independently of the type) and we prepend the character we stored to the
- * string. Technically, this uses more allocations than necessary, but it keeps
- * the code clean and modular.
+ * string. Technically, this uses more memory than necessary, but it keeps the
+ * code clean and modular, and the arena frees both strings at once.
  */
-static char* read_quoted_expr(FILE* fp) {
+static char* read_quoted_expr(FILE* fp, Arena* arena) {
     const char quote_char = get_next_non_comment(fp);
 
-    char* expr_str        = read_expr(fp);
+    char* expr_str        = read_expr(fp, arena);
     const size_t expr_len = strlen(expr_str);
 
-    char* result = mem_alloc(1 + expr_len + 1);
+    char* result = arena_alloc(arena, 1 + expr_len + 1);
     result[0]    = quote_char;
     memcpy(&result[1], expr_str, expr_len + 1);
 
-    mem_free(expr_str);
     return result;
 }
 
 /*----------------------------------------------------------------------------*/
 
-char* read_expr(FILE* fp) {
+char* read_expr(FILE* fp, Arena* arena) {
     int incoming = get_incoming(fp);
 
     /* Skip leading spaces or comments, if any */
@@ -290,23 +301,23 @@ char* read_expr(FILE* fp) {
      */
     switch (incoming) {
         case '(':
-            return read_user_list(fp);
+            return read_user_list(fp, arena);
 
         case '\"':
-            return read_isolated_user_string(fp);
+            return read_isolated_user_string(fp, arena);
 
         default:
-            return read_isolated_atom(fp);
+            return read_isolated_atom(fp, arena);
 
         case '\'':
         case '`':
         case ',':
-            return read_quoted_expr(fp);
+            return read_quoted_expr(fp, arena);
 
         case ')':
             SL_ERR("Encountered unmatched ')'.");
             get_next_non_comment(fp);
-            return read_expr(fp);
+            return read_expr(fp, arena);
 
         case EOF:
             return NULL;
@@ -0,0 +1,148 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "include/string_heap.h"
+#include "include/garbage_collector.h"
+#include "include/memory.h"
+#include "include/error.h"
+
+/*
+ * List of strings that are tracked by the heap. The heap has two of them: the
+ * young list, with the strings allocated since the last collection, and the
+ * old list, with the strings that survived a collection.
+ */
+typedef struct StrList {
+    HeapStr** items;
+    size_t sz;
+    size_t pos;
+} StrList;
+
+/*----------------------------------------------------------------------------*/
+/* Globals */
+
+static StrList g_young = { NULL, 0, 0 };
+static StrList g_old   = { NULL, 0, 0 };
+
+/* See 'strheap_bytes' */
+static size_t g_bytes = 0;
+
+/*----------------------------------------------------------------------------*/
+
+static inline size_t strheap_size(const HeapStr* str) {
+    return sizeof(HeapStr) + str->len + 1;
+}
+
+static void strlist_push(StrList* list, HeapStr* str) {
+    if (list->pos >= list->sz) {
+        list->sz = (list->sz == 0) ? STRHEAP_BASE_SZ : list->sz * 2;
+        mem_realloc(&list->items, list->sz * sizeof(HeapStr*));
+    }
+
+    list->items[list->pos++] = str;
+}
+
+/*
+ * Free the unmarked strings of the specified list. The marked ones are moved
+ * to 'dst', which can be the same list.
+ */
+static void strlist_sweep(StrList* list, StrList* dst) {
+    const size_t num = list->pos;
+    if (list == dst)
+        dst->pos = 0;
+
+    for (size_t i = 0; i < num; i++) {
+        HeapStr* str = list->items[i];
+        if (str->gc_epoch == g_gc_epoch) {
+            strlist_push(dst, str);
+            continue;
+        }
+
+        g_bytes -= strheap_size(str);
+        mem_free(str);
+    }
+
+    if (list != dst)
+        list->pos = 0;
+}
+
+/*
+ * Halve the size of a list if it's mostly empty, so a burst of allocations
+ * doesn't keep a big list forever.
+ */
+static void strlist_shrink(StrList* list) {
+    if (list->sz <= STRHEAP_BASE_SZ || list->pos >= list->sz / 4)
+        return;
+
+    list->sz /= 2;
+    mem_realloc(&list->items, list->sz * sizeof(HeapStr*));
+}
+
+static void strlist_free(StrList* list) {
+    for (size_t i = 0; i < list->pos; i++)
+        mem_free(list->items[i]);
+    mem_free(list->items);
+
+    list->items = NULL;
+    list->sz    = 0;
+    list->pos   = 0;
+}
+
+/*----------------------------------------------------------------------------*/
+
+HeapStr* strheap_alloc(const char* s, size_t len) {
+    SL_ASSERT(s != NULL);
+
+    HeapStr* str  = mem_alloc(sizeof(HeapStr) + len + 1);
+    str->gc_epoch = 0;
+    str->len      = len;
+    memcpy(str->data, s, len);
+    str->data[len] = '\0';
+
+    strlist_push(&g_young, str);
+    g_bytes += strheap_size(str);
+    gc_count_alloc(strheap_size(str));
+    return str;
+}
+
+void strheap_sweep(bool major) {
+    /*
+     * The old list is swept first, so the survivors that are moved to it from
+     * the young list are not checked twice in major collections.
+     */
+    if (major) {
+        strlist_sweep(&g_old, &g_old);
+        strlist_shrink(&g_old);
+    }
+
+    strlist_sweep(&g_young, &g_old);
+    strlist_shrink(&g_young);
+}
+
+void strheap_close(void) {
+    strlist_free(&g_young);
+    strlist_free(&g_old);
+    g_bytes = 0;
+}
+
+size_t strheap_bytes(void) {
+    return g_bytes;
+}
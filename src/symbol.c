@@ -0,0 +1,160 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * SL. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "include/symbol.h"
+#include "include/memory.h"
+#include "include/error.h"
+
+/*
+ * The symbol table is an open-addressing hash table with linear probing. Since
+ * symbols are never removed from the table, we don't need tombstones.
+ */
+static Symbol** g_symbol_table   = NULL;
+static size_t g_symbol_table_sz  = 0;
+static size_t g_symbol_table_num = 0;
+
+/* Internal symbols, see 'symbol.h' */
+char* g_sym_nil       = NULL;
+char* g_sym_tru       = NULL;
+char* g_sym_rest      = NULL;
+char* g_sym_quote     = NULL;
+char* g_sym_backquote = NULL;
+char* g_sym_unquote   = NULL;
+char* g_sym_splice    = NULL;
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * FNV-1a hash of a null-terminated string. Also writes the length of the string
+ * to 'len', since we need it anyway.
+ */
+static size_t hash_str(const char* s, size_t* len) {
+    size_t hash = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; s[i] != '\0'; i++) {
+        hash ^= (unsigned char)s[i];
+        hash *= 1099511628211ULL;
+    }
+    *len = i;
+    return hash;
+}
+
+/*
+ * Insert an existing symbol in the table, assuming it's not already there and
+ * that there is at least one free slot.
+ */
+static void table_insert(Symbol** table, size_t table_sz, Symbol* sym) {
+    const size_t mask = table_sz - 1;
+    size_t i          = sym->hash & mask;
+    while (table[i] != NULL)
+        i = (i + 1) & mask;
+    table[i] = sym;
+}
+
+/*
+ * Double the size of the symbol table, re-inserting the existing symbols.
+ */
+static void table_grow(void) {
+    const size_t new_sz = g_symbol_table_sz * 2;
+    Symbol** new_table  = mem_calloc(new_sz, sizeof(Symbol*));
+
+    for (size_t i = 0; i < g_symbol_table_sz; i++)
+        if (g_symbol_table[i] != NULL)
+            table_insert(new_table, new_sz, g_symbol_table[i]);
+
+    mem_free(g_symbol_table);
+    g_symbol_table    = new_table;
+    g_symbol_table_sz = new_sz;
+}
+
+/*----------------------------------------------------------------------------*/
+
+bool symbol_table_init(void) {
+    SL_ASSERT(g_symbol_table == NULL);
+
+    g_symbol_table     = mem_calloc(SYMBOL_TABLE_BASE_SZ, sizeof(Symbol*));
+    g_symbol_table_sz  = SYMBOL_TABLE_BASE_SZ;
+    g_symbol_table_num = 0;
+
+    g_sym_nil       = symbol_intern("nil");
+    g_sym_tru       = symbol_intern("tru");
+    g_sym_rest      = symbol_intern("&rest");
+    g_sym_quote     = symbol_intern("quote");
+    g_sym_backquote = symbol_intern("`");
+    g_sym_unquote   = symbol_intern(",");
+    g_sym_splice    = symbol_intern(",@");
+
+    return true;
+}
+
+void symbol_table_free(void) {
+    if (g_symbol_table == NULL)
+        return;
+
+    for (size_t i = 0; i < g_symbol_table_sz; i++)
+        mem_free(g_symbol_table[i]);
+
+    mem_free(g_symbol_table);
+    g_symbol_table     = NULL;
+    g_symbol_table_sz  = 0;
+    g_symbol_table_num = 0;
+}
+
+char* symbol_intern(const char* name) {
+    SL_ASSERT(g_symbol_table != NULL);
+    SL_ASSERT(name != NULL);
+
+    size_t len;
+    const size_t hash = hash_str(name, &len);
+
+    /*
+     * Look for the symbol in the table. Since the table is never full, we will
+     * always find either the symbol or an empty slot.
+     */
+    const size_t mask = g_symbol_table_sz - 1;
+    size_t i          = hash & mask;
+    while (g_symbol_table[i] != NULL) {
+        Symbol* cur = g_symbol_table[i];
+        if (cur->hash == hash && cur->len == len &&
+            memcmp(cur->name, name, len) == 0)
+            return cur->name;
+
+        i = (i + 1) & mask;
+    }
+
+    /*
+     * It's a new symbol. Keep the load factor under 1/2 so the probe sequences
+     * stay short.
+     */
+    if ((g_symbol_table_num + 1) * 2 > g_symbol_table_sz)
+        table_grow();
+
+    Symbol* sym = mem_alloc(sizeof(Symbol) + len + 1);
+    sym->hash   = hash;
+    sym->len    = len;
+    memcpy(sym->name, name, len + 1);
+
+    table_insert(g_symbol_table, g_symbol_table_sz, sym);
+    g_symbol_table_num++;
+
+    return sym->name;
+}
@@ -0,0 +1,506 @@
+/*
+ * Copyright 2024 8dcc
+ *
+ * This file is part of SL.
+ *
+ * This program is free software: you can redistribute it and/or modify it under
+ * the terms of the GNU General Public License as published by the Free Software
+ * Foundation, either version 3 of the License, or any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License along with
+ * SL. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "include/vm.h"
+#include "include/compile.h"
+#include "include/env.h"
+#include "include/expr.h"
+#include "include/lambda.h"
+#include "include/memory.h"
+#include "include/debug.h"
+#include "include/eval.h"
+#include "include/error.h"
+#include "include/garbage_collector.h"
+
+/*
+ * Each lambda that is being executed by the virtual machine has a 'VmFrame',
+ * with the lambda itself, its bytecode, the position of the next instruction,
+ * its activation frame and the position of the value stack where its values
+ * start. The lambda is kept so the garbage collector doesn't free its body
+ * (and its bytecode) while it's running.
+ */
+typedef struct VmFrame VmFrame;
+struct VmFrame {
+    Expr* func;
+    Bytecode* bc;
+    size_t pc;
+    Env* env;
+    size_t base;
+};
+
+/*
+ * The value stack and the frame stack, shared by all (possibly nested) calls
+ * to 'vm_run'. Since they can be reallocated, we always store positions
+ * instead of pointers.
+ */
+static Expr** g_stack     = NULL;
+static size_t g_stack_sz  = 0;
+static size_t g_stack_pos = 0;
+
+static VmFrame* g_frames   = NULL;
+static size_t g_frames_sz  = 0;
+static size_t g_frames_pos = 0;
+
+/*----------------------------------------------------------------------------*/
+
+static inline void stack_push(Expr* e) {
+    if (g_stack_pos >= g_stack_sz) {
+        g_stack_sz = (g_stack_sz == 0) ? VM_STACK_BASE_SZ : g_stack_sz * 2;
+        mem_realloc(&g_stack, g_stack_sz * sizeof(Expr*));
+    }
+    g_stack[g_stack_pos++] = e;
+}
+
+static inline Expr* stack_pop(void) {
+    SL_ASSERT(g_stack_pos > 0);
+    return g_stack[--g_stack_pos];
+}
+
+static inline void frame_push(Expr* func, Env* env, size_t base) {
+    if (g_frames_pos >= g_frames_sz) {
+        g_frames_sz = (g_frames_sz == 0) ? VM_STACK_BASE_SZ : g_frames_sz * 2;
+        mem_realloc(&g_frames, g_frames_sz * sizeof(VmFrame));
+    }
+
+    VmFrame* frame = &g_frames[g_frames_pos++];
+    frame->func    = func;
+    frame->bc      = func->val.lambda->code;
+    frame->pc      = 0;
+    frame->env     = env;
+    frame->base    = base;
+}
+
+/*----------------------------------------------------------------------------*/
+
+/*
+ * Return the expression that should be pushed to the callstack for the
+ * specified call site and (evaluated) function, just like 'eval' does.
+ */
+static inline const Expr* callstack_func(const CallSite* site,
+                                         const Expr* func) {
+    const Expr* car = CAR(site->form);
+    return EXPR_SYMBOL_P(car) ? car : func;
+}
+
+/*
+ * Return an error if the callstack is too deep, or NULL otherwise. Primitives
+ * like 'apply' can call lambdas, which run in a nested 'vm_run', so recursion
+ * through them also grows the C stack, and it's checked as well.
+ */
+static inline Expr* check_callstack(void) {
+#ifdef SL_DEBUG_MAX_CALLSTACK
+    if (debug_callstack_get_pos() > SL_DEBUG_MAX_CALLSTACK)
+        return err("Stack overflow (exceeded %d nested calls)",
+                   SL_DEBUG_MAX_CALLSTACK);
+#endif /* SL_DEBUG_MAX_CALLSTACK */
+
+    return NULL;
+}
+
+/*
+ * Apply a function that is not handled by the virtual machine itself (e.g.
+ * primitives and traced functions) to a list of evaluated arguments.
+ */
+static Expr* call_external(Env* env, const CallSite* site, Expr* func,
+                           Expr* args) {
+    Expr* result = check_callstack();
+    if (result != NULL)
+        return result;
+
+    debug_callstack_push(callstack_func(site, func));
+
+    if (debug_is_traced_function(func)) {
+        debug_trace_print_pre(stdout, CAR(site->form), args);
+        result = apply(env, func, args);
+        debug_trace_print_post(stdout, result);
+    } else {
+        result = apply(env, func, args);
+    }
+
+    debug_callstack_pop();
+
+    if (result == NULL)
+        result = err("Unknown error (?)");
+    return result;
+}
+
+/*
+ * Like 'call_external', but the arguments are received as an array. A list is
+ * only allocated if the function needs one (see 'apply_argv'), or if it's
+ * traced.
+ */
+static Expr* call_external_argv(Env* env, const CallSite* site, Expr* func,
+                                size_t argc, Expr** argv) {
+    if (debug_is_traced_function(func))
+        return call_external(env, site, func, expr_list_from_array(argc, argv));
+
+    Expr* result = check_callstack();
+    if (result != NULL)
+        return result;
+
+    debug_callstack_push(callstack_func(site, func));
+    result = apply_argv(env, func, argc, argv);
+    debug_callstack_pop();
+
+    if (result == NULL)
+        result = err("Unknown error (?)");
+    return result;
+}
+
+/*----------------------------------------------------------------------------*/
+
+Expr* vm_run(Expr* entry_func, Env** entry_env) {
+    SL_ASSERT(EXPR_LAMBDA_P(entry_func) || EXPR_MACRO_P(entry_func));
+    SL_ASSERT(entry_func->val.lambda->code != NULL);
+    SL_ASSERT(*entry_env != NULL);
+
+    /*
+     * This function might be called recursively (e.g. from a primitive that
+     * calls a lambda), so we only handle the frames above 'entry_pos'. The
+     * first frame belongs to the caller, and it's written back to 'entry_env'
+     * whenever it changes.
+     */
+    Expr* result = check_callstack();
+    if (result != NULL)
+        return result;
+
+    const size_t entry_pos   = g_frames_pos;
+    const size_t entry_stack = g_stack_pos;
+    frame_push(entry_func, *entry_env, g_stack_pos);
+
+    for (;;) {
+        VmFrame* frame      = &g_frames[g_frames_pos - 1];
+        const bool at_entry = (g_frames_pos - 1 == entry_pos);
+        const Instr* instr  = &frame->bc->code[frame->pc++];
+
+        switch (instr->op) {
+            case OP_CONST:
+                stack_push(frame->bc->consts[instr->arg]);
+                break;
+
+            case OP_LOCAL:
+                stack_push(frame->env->bindings[instr->arg].val);
+                break;
+
+            case OP_GLOBAL: {
+                VarRef* ref = &frame->bc->refs[instr->arg];
+                const EnvBinding* binding =
+                  env_get_binding_cached(frame->env, ref->sym, &ref->cache);
+                if (binding == NULL) {
+                    result = err("Unbound symbol: `%s'.", ref->sym);
+                    goto error;
+                }
+                stack_push(binding->val);
+            } break;
+
+            case OP_POP:
+                stack_pop();
+                break;
+
+            case OP_JUMP:
+                frame->pc = instr->arg;
+                break;
+
+            case OP_JUMP_IF_NIL:
+                if (expr_is_nil(stack_pop()))
+                    frame->pc = instr->arg;
+                break;
+
+            case OP_JUMP_IF_NIL_KEEP:
+                if (expr_is_nil(g_stack[g_stack_pos - 1]))
+                    frame->pc = instr->arg;
+                else
+                    stack_pop();
+                break;
+
+            case OP_JUMP_IF_NOT_NIL_KEEP:
+                if (!expr_is_nil(g_stack[g_stack_pos - 1]))
+                    frame->pc = instr->arg;
+                else
+                    stack_pop();
+                break;
+
+            case OP_SPECIAL: {
+                CallSite* site  = &frame->bc->sites[instr->arg];
+                const char* sym = CAR(site->form)->val.s;
+
+                /*
+                 * If the symbol is still bound to the special form, run the
+                 * inline code that follows. Otherwise, the form is evaluated
+                 * by the tree-walking interpreter, which will call whatever
+                 * it's bound to now (or report that it's unbound).
+                 */
+                const EnvBinding* binding =
+                  env_get_binding_cached(frame->env, sym, &site->cache);
+                if (binding != NULL &&
+                    (binding->flags & ENV_FLAG_SPECIAL) != 0 &&
+                    EXPR_PRIM_P(binding->val) &&
+                    binding->val->val.prim == site->special)
+                    break;
+
+                if (site->tail && at_entry) {
+                    result = eval_tail(frame->env, site->form);
+                    goto done;
+                }
+
+                result = eval(frame->env, site->form);
+                if (EXPR_ERR_P(result))
+                    goto error;
+
+                stack_push(result);
+                g_frames[g_frames_pos - 1].pc = site->end;
+            } break;
+
+            case OP_FUNC_SYM: {
+                CallSite* site  = &frame->bc->sites[instr->arg];
+                const char* sym = CAR(site->form)->val.s;
+
+                const EnvBinding* binding =
+                  env_get_binding_cached(frame->env, sym, &site->cache);
+                if (binding == NULL) {
+                    result = err("Unbound symbol: `%s'.", sym);
+                    goto error;
+                }
+
+                Expr* func = binding->val;
+                if (!EXPR_APPLICABLE_P(func)) {
+                    result = err("Expected function or macro, got '%s'.",
+                                 exprtype2str(func->type));
+                    goto error;
+                }
+
+                if ((binding->flags & ENV_FLAG_SPECIAL) == 0 &&
+                    !EXPR_MACRO_P(func)) {
+                    stack_push(func);
+                    break;
+                }
+
+                /*
+                 * Special forms and macros receive their arguments
+                 * unevaluated, so the whole form is evaluated by the
+                 * tree-walking interpreter. Since the function is a symbol,
+                 * evaluating it again has no side effects.
+                 */
+                if (site->tail && at_entry) {
+                    result = eval_tail(frame->env, site->form);
+                    goto done;
+                }
+
+                result = eval(frame->env, site->form);
+                if (EXPR_ERR_P(result))
+                    goto error;
+
+                stack_push(result);
+                g_frames[g_frames_pos - 1].pc = site->end;
+            } break;
+
+            case OP_FUNC_CHECK: {
+                const CallSite* site = &frame->bc->sites[instr->arg];
+                Expr* func           = g_stack[g_stack_pos - 1];
+                if (!EXPR_APPLICABLE_P(func)) {
+                    result = err("Expected function or macro, got '%s'.",
+                                 exprtype2str(func->type));
+                    goto error;
+                }
+                if (!EXPR_MACRO_P(func))
+                    break;
+
+                /*
+                 * The function was not a symbol, so we can't evaluate the
+                 * whole form again. Expand the macro ourselves with the
+                 * unevaluated arguments.
+                 */
+                stack_pop();
+                if (debug_is_traced_function(func)) {
+                    result =
+                      call_external(frame->env, site, func, CDR(site->form));
+                } else {
+                    Expr* expansion =
+                      macro_expand_cached(frame->env, func, site->form);
+                    if (EXPR_ERR_P(expansion)) {
+                        result = expansion;
+                        goto error;
+                    }
+
+                    if (site->tail && at_entry) {
+                        result = eval_tail(frame->env, expansion);
+                        goto done;
+                    }
+
+                    result = eval(frame->env, expansion);
+                }
+                if (EXPR_ERR_P(result))
+                    goto error;
+
+                stack_push(result);
+                g_frames[g_frames_pos - 1].pc = site->end;
+            } break;
+
+            case OP_CALL: {
+                /*
+                 * All the values of the lambdas that are being executed are
+                 * in the value stack, so this is a safe point for the garbage
+                 * collector.
+                 */
+                gc_safepoint();
+
+                const CallSite* site  = &frame->bc->sites[instr->arg];
+                const size_t func_pos = g_stack_pos - site->argc - 1;
+                Expr* func            = g_stack[func_pos];
+                Expr** argv           = &g_stack[func_pos + 1];
+
+                if (!EXPR_LAMBDA_P(func) || debug_is_traced_function(func)) {
+                    /*
+                     * Call the external function with the arguments in the
+                     * value stack, and replace the function and its arguments
+                     * with the returned value. Vector primitives receive a
+                     * pointer to the stack itself, so no list is allocated.
+                     */
+                    result = call_external_argv(frame->env,
+                                                site,
+                                                func,
+                                                site->argc,
+                                                argv);
+                    if (EXPR_ERR_P(result))
+                        goto error;
+
+                    g_stack_pos = func_pos;
+
+                    stack_push(result);
+                    break;
+                }
+
+                LambdaCtx* callee = func->val.lambda;
+                Env* callee_env;
+
+                if (site->tail) {
+                    /*
+                     * Since the arguments are in the value stack, we don't
+                     * need the current frame anymore (unless it was captured,
+                     * which is handled by 'env_frame_free'). Release it before
+                     * creating the new one, so the frame stack doesn't grow.
+                     */
+                    env_frame_free(frame->env);
+                    frame->env = NULL;
+                    if (at_entry)
+                        *entry_env = NULL;
+
+                    result = lambdactx_bind_argv(callee, site->argc, argv,
+                                                 &callee_env);
+                    if (result != NULL)
+                        goto error;
+
+                    /* Reuse the current frame, and replace the callstack */
+                    frame->func = func;
+                    frame->bc   = callee->code;
+                    frame->pc   = 0;
+                    frame->env  = callee_env;
+                    g_stack_pos = frame->base;
+                    if (at_entry)
+                        *entry_env = callee_env;
+
+                    debug_callstack_pop();
+                    debug_callstack_push(callstack_func(site, func));
+                    break;
+                }
+
+                result = check_callstack();
+                if (result != NULL)
+                    goto error;
+
+                result =
+                  lambdactx_bind_argv(callee, site->argc, argv, &callee_env);
+                if (result != NULL)
+                    goto error;
+
+                /*
+                 * The returned value of the callee will be pushed where the
+                 * function was. Note that this might reallocate the frame
+                 * stack, so 'frame' is not valid after this point.
+                 */
+                g_stack_pos = func_pos;
+                debug_callstack_push(callstack_func(site, func));
+                frame_push(func, callee_env, func_pos);
+            } break;
+
+            case OP_EVAL: {
+                result = eval(frame->env, frame->bc->consts[instr->arg]);
+                if (EXPR_ERR_P(result))
+                    goto error;
+                stack_push(result);
+            } break;
+
+            case OP_RETURN: {
+                result = stack_pop();
+                if (at_entry)
+                    goto done;
+
+                /*
+                 * Return to the caller, which is also being executed by the
+                 * virtual machine.
+                 */
+                env_frame_free(frame->env);
+                debug_callstack_pop();
+                g_stack_pos = frame->base;
+                g_frames_pos--;
+                stack_push(result);
+            } break;
+        }
+    }
+
+error:
+    /*
+     * Release the frames of the lambdas that we called, in reverse order. The
+     * entry frame belongs to the caller.
+     */
+    while (g_frames_pos - 1 > entry_pos) {
+        VmFrame* frame = &g_frames[--g_frames_pos];
+        if (frame->env != NULL)
+            env_frame_free(frame->env);
+        debug_callstack_pop();
+    }
+
+done:
+    g_frames_pos = entry_pos;
+    g_stack_pos  = entry_stack;
+    return result;
+}
+
+void vm_mark_roots(void) {
+    for (size_t i = 0; i < g_stack_pos; i++)
+        gc_mark_expr(g_stack[i]);
+
+    for (size_t i = 0; i < g_frames_pos; i++)
+        gc_mark_expr(g_frames[i].func);
+}
+
+void vm_close(void) {
+    mem_free(g_stack);
+    g_stack     = NULL;
+    g_stack_sz  = 0;
+    g_stack_pos = 0;
+
+    mem_free(g_frames);
+    g_frames     = NULL;
+    g_frames_sz  = 0;
+    g_frames_pos = 0;
+}
@@ -0,0 +1,108 @@
+;; Return the value of a counter of the garbage collector. The values are not
+;; printed, since they depend on the allocations.
+(defun gc-stat (name)
+  (define find
+    (lambda (stats)
+      (if (equal? (car (car stats)) name)
+          (cdr (car stats))
+          (find (cdr stats)))))
+  (find (gc-stats)))
+
+;; Build a list with the integers from 1 to 'n', and a list nested 'n' levels
+;; deep in its 'car'.
+(defun build-list (n acc)
+  (if (= n 0)
+      acc
+      (build-list (- n 1) (cons n acc))))
+(defun build-nested (n acc)
+  (if (= n 0)
+      acc
+      (build-nested (- n 1) (cons acc nil))))
+(defun nested-depth (e acc)
+  (if (equal? e nil)
+      acc
+      (nested-depth (car e) (+ acc 1))))
+
+;; Marking very long or deeply nested lists doesn't overflow the C stack.
+(begin
+  (define long-list (build-list 200000 nil))
+  (define nested (build-nested 200000 nil))
+  (define majors (gc-stat 'major-collections))
+  nil)
+(gc)
+(list (length long-list) (last long-list) (nested-depth nested 0))
+(> (gc-stat 'major-collections) majors)
+
+;; Once the lists are not reachable, a collection frees them, and their items
+;; are reused by the new expressions. A major collection clears the marks of
+;; the old expressions, so only the reachable ones are counted.
+(> (gc-stat 'marked) 400000)
+(begin
+  (define long-list nil)
+  (define nested nil)
+  nil)
+(gc)
+(< (gc-stat 'marked) 100000)
+(begin
+  (define long-list (build-list 200000 nil))
+  nil)
+(list (length long-list) (car long-list) (last long-list))
+
+;; Old expressions that are modified to point to young ones keep them alive
+;; during minor collections.
+(defun make-garbage (n)
+  (if (= n 0)
+      nil
+      (begin
+        (list n n n n)
+        (make-garbage (- n 1)))))
+(define old-list (list 1 2 3))
+(gc)
+(set (car old-list) (list 'young (+ 40 2)))
+(make-garbage 100000)
+old-list
+
+;; The garbage is swept as the heap needs more free items, so allocating the
+;; same amount of garbage again reuses them, and the reachable expressions are
+;; not freed.
+(begin
+  (define items (gc-stat 'items))
+  nil)
+(make-garbage 100000)
+(list (length long-list) (last long-list) old-list)
+(= (gc-stat 'items) items)
+
+;; The heap grows as needed while building a long list. After a major
+;; collection, the arrays that only contained garbage are returned to the
+;; system, and the heap grows again for the next list.
+(begin
+  (define minors (gc-stat 'minor-collections))
+  (define long-list (build-list 200000 nil))
+  (define arrays (gc-stat 'arrays))
+  (define long-list nil)
+  nil)
+(gc)
+(list (> (gc-stat 'minor-collections) minors) (< (gc-stat 'arrays) arrays))
+(length (build-list 200000 nil))
+
+;; The environments captured by closures are traced like pairs, including long
+;; chains of nested environments.
+(defun make-counter ()
+  (define count 0)
+  (lambda ()
+    (set count (+ count 1))
+    (+ count 0)))
+(define counter (make-counter))
+(counter)
+(make-garbage 100000)
+(gc)
+(list (counter) (counter))
+(define chain-value 'reached)
+(define level-form
+  '(lambda (k)
+     (if (= k 0)
+         (lambda () (list k chain-value))
+         ((eval level-form) (- k 1)))))
+(define innermost ((eval level-form) 2000))
+(gc)
+(innermost)
@@ -8,6 +8,17 @@
 ;;   - Logical primitives (equal?, >)
 ;;------------------------------------------------------------------------------
 
+;; Recursion through primitives that call lambdas, like `apply', counts towards
+;; the limit of nested calls instead of overflowing the C stack. The error is
+;; tested first, since it's printed to a different stream.
+(define apply-loop
+  (lambda (n)
+    (if (= n 0)
+        'done
+        (apply apply-loop (list (- n 1))))))
+(apply-loop 100)
+(apply-loop 20000) ; Intentional error.
+
 ;; Defined in the global environment
 (define my-global 10)
 (define my-addition +)
@@ -64,7 +75,6 @@
 (fact-recur 5)
 
 ;; Example iterative function for calculating the factorial of a number.
-;; TODO: Tail-call optimization
 (define fact-iter
   (lambda (n)
     (define iter
@@ -74,3 +84,96 @@
           (iter (* total i) (+ i 1)))))
     (iter 1 2)))
 (fact-iter 5)
+
+;; Each call has its own environment, so the value of `n' is not overwritten by
+;; the recursive call.
+(define count-down
+  (lambda (n)
+    (if (equal? n 0)
+      nil
+      (begin
+        (count-down (- n 1))
+        n))))
+(count-down 5)
+
+;; Each closure keeps the environment of the call where it was created.
+(define add-1 (get-inner 1))
+(define add-100 (get-inner 100))
+(list (add-1 5) (add-100 5))
+
+;; Calls in tail position don't grow the callstack, so iterative processes can
+;; run for more iterations than the maximum callstack depth.
+(define sum-iter
+  (lambda (i end total)
+    (if (> i end)
+      total
+      (sum-iter (+ i 1) end (+ total i)))))
+(sum-iter 1 50000 0)
+
+;; Formal arguments shadow special forms and functions in the compiled body.
+(define shadow-if
+  (lambda (if list)
+    (list if)))
+(shadow-if 1 (lambda (x) (* x 2)))
+
+;; Macros in tail position don't grow the callstack either.
+(define count-cond
+  (lambda (n)
+    (cond ((equal? n 0) 'done)
+          (tru (count-cond (- n 1))))))
+(count-cond 50000)
+
+;; Redefining a global function, or shadowing it in a frame, affects the
+;; lambdas that were already using it.
+(define square (lambda (x) (* x x)))
+(define use-square (lambda (x) (square x)))
+(use-square 3)
+(define square (lambda (x) (+ x x)))
+(use-square 3)
+(define maybe-shadow
+  (lambda (shadow)
+    (if shadow (define square list) nil)
+    (square 3)))
+(list (maybe-shadow nil) (maybe-shadow tru) (maybe-shadow nil))
+
+;; The same applies to variables, and to the closures created in the frame
+;; before the variable was defined there.
+(define shadowed 'global)
+(define read-shadowed
+  (lambda (local)
+    (define get-shadowed (lambda () shadowed))
+    (get-shadowed)
+    (if local (define shadowed 'local) nil)
+    (list shadowed (get-shadowed))))
+(list (read-shadowed nil) (read-shadowed tru) (read-shadowed nil))
+
+;; Garbage is collected during long computations, without freeing the
+;; temporary values and closures that are still in use.
+(define keep-every
+  (lambda (n step acc)
+    (if (equal? n 0)
+        acc
+        (keep-every (- n 1)
+                    step
+                    (if (equal? (remainder n step) 0)
+                        (cons (lambda () (list n)) acc)
+                        (begin (list n n n) acc))))))
+(define kept (keep-every 50000 10000 nil))
+(list (length kept) ((car kept)) `(,@(list 1 2) ,(+ 1 2)))
+
+;; Closures created from the same lambda form share their bytecode, but each
+;; one uses its own environment. The special forms that were compiled inline
+;; are checked when the closure is called.
+(define make-adder
+  (lambda (n)
+    (lambda (x) (+ x n))))
+(define add-one (make-adder 1))
+(define add-ten (make-adder 10))
+(list (add-one 5) (add-ten 5) (add-one 5))
+(define make-checker
+  (lambda (shadow)
+    (if shadow (define if list) nil)
+    (lambda (x) (if x 'yes 'no))))
+(define plain-checker (make-checker nil))
+(define shadowed-checker (make-checker tru))
+(list (plain-checker nil) (shadowed-checker nil) (plain-checker tru))
@@ -65,3 +65,24 @@
   (define unused 'not-returned)
   (+ a b 10))
 (my-function 1 2)
+
+;; Macro expansions are memoized for each call, but redefining the macro makes
+;; the calls use the new definition.
+(defmacro twice (x)
+  `(* 2 ,x))
+(defun use-twice (n)
+  (twice n))
+(use-twice 5)
+(defmacro twice (x)
+  `(+ ,x ,x 1))
+(use-twice 5)
+
+;; Modifying a form that was already expanded makes it expand again.
+(defmacro tag-value (x)
+  `(list 'expanded ,x))
+(define tagged-form (list 'tag-value 5))
+(eval tagged-form)
+(set (cdr tagged-form) (list 7))
+(eval tagged-form)
+(set (car (cdr tagged-form)) 9)
+(eval tagged-form)
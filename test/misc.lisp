@@ -11,6 +11,16 @@ unbound-error-var ; Intentional error.
 (set (cadr my-list) 'foo)
 my-list
 
+;; The integers returned by arithmetic can be modified, without affecting other
+;; results with the same value.
+(define var3 (+ 1 2))
+(define my-pair (cons (+ 1 2) (+ 1 2)))
+(set var3 5)
+(set (car my-pair) 6)
+(list var3 my-pair (+ 1 2))
+(set (+ 1 2) 7)
+(+ 1 2)
+
 (define my-addition +)
 (my-addition var1 var2)
 
@@ -61,3 +71,15 @@ my-list
 (set-random-seed 50)
 (random 1337)
 (random 10.0)
+
+(define compact-list (list 1 2 3.5 "a string that is too long to be stored inline" 'sym))
+(defun make-adder (n) (lambda (x) (+ x n)))
+(define add5 (make-adder 5))
+(defmacro compact-twice (x) (list 'list x x))
+(gc-compact)
+compact-list
+(add5 10)
+(compact-twice (+ 1 2))
+
+(mapcar car (gc-stats))
+(mapcar car (cdr (last (gc-stats))))
@@ -49,16 +49,40 @@ SL_BIN="${SCRIPT_DIR}/../sl"
 SL_FLAGS=(--no-stdlib --silent "${SCRIPT_DIR}/../stdlib.lisp")
 DIFF_FLAGS=(--unified=0 --color)
 
+# Print the input that should be passed to the specified test file.
+test_input() {
+    if [ "$(basename "$1")" == "io.lisp" ]; then
+        echo -n "123"
+        echo -n "(+ 1 2 3 (- 5 4))"
+        echo -n "User string...\n"
+        echo -n "Another delimited line. EXTRA"
+    fi
+}
+
+# Compare the output of the interpreter with the expected output of the
+# specified test file, and exit if they don't match.
+check_output() {
+    local file="$1"
+    local normal_output="$2"
+    local desired_output_file="${file}.expected"
+
+    # FIXME: Don't call 'diff' twice, but still show colors when printing.
+    diff <(remove_colors "$normal_output") "$desired_output_file" &>/dev/null
+    diff_code=$?
+    if [ $diff_code -eq 1 ]; then
+        err "Output mismatch. Showing differences and stopping..."
+        diff "${DIFF_FLAGS[@]}" <(echo "$normal_output") "$desired_output_file"
+        exit 1
+    elif [ $diff_code -ge 2 ]; then
+        err "Error when running 'diff', aborting..."
+        exit 1
+    fi
+}
+
 for file in "$SCRIPT_DIR"/*.lisp; do
     file_msg "Testing" "$file"
 
-    input_str=""
-    if [ "$(basename "$file")" == "io.lisp" ]; then
-        input_str+="123"
-        input_str+="(+ 1 2 3 (- 5 4))"
-        input_str+="User string...\n"
-        input_str+="Another delimited line. EXTRA"
-    fi
+    input_str="$(test_input "$file")"
 
     echo -e "$input_str" | \
         valgrind --leak-check=full   \
@@ -75,19 +99,35 @@ for file in "$SCRIPT_DIR"/*.lisp; do
     fi
 
     normal_output="$(echo -e "$input_str" | "$SL_BIN" "${SL_FLAGS[@]}" "$file" 2>&1 | sed "s/<primitive 0x[[:xdigit:]]\+>/<primitive 0xDEADBEEF>/g")"
-    desired_output_file="${file}.expected"
+    check_output "$file" "$normal_output"
+done
 
-    # FIXME: Don't call 'diff' twice, but still show colors when printing.
-    diff <(remove_colors "$normal_output") "$desired_output_file" &>/dev/null
-    diff_code=$?
-    if [ $diff_code -eq 1 ]; then
-        err "Output mismatch. Showing differences and stopping..."
-        diff "${DIFF_FLAGS[@]}" <(echo "$normal_output") "$desired_output_file"
-        exit 1
-    elif [ $diff_code -ge 2 ]; then
-        err "Error when running 'diff', aborting..."
-        exit 1
-    fi
+# Run the tests again, starting from a heap image of the standard library
+# instead of loading it.
+IMAGE_FILE="$(mktemp)"
+trap 'rm -f "$IMAGE_FILE"' EXIT
+
+if ! "$SL_BIN" "${SL_FLAGS[@]}" --dump-image "$IMAGE_FILE"; then
+    err "Failed to dump the heap image, aborting..."
+    exit 1
+fi
+
+for file in "$SCRIPT_DIR"/*.lisp; do
+    file_msg "Testing with image" "$file"
+
+    input_str="$(test_input "$file")"
+    normal_output="$(echo -e "$input_str" | "$SL_BIN" --image "$IMAGE_FILE" "$file" 2>&1 | sed "s/<primitive 0x[[:xdigit:]]\+>/<primitive 0xDEADBEEF>/g")"
+    check_output "$file" "$normal_output"
+done
+
+# Run the tests again with the incremental collector, whose output should be the
+# same.
+for file in "$SCRIPT_DIR"/*.lisp; do
+    file_msg "Testing with incremental GC" "$file"
+
+    input_str="$(test_input "$file")"
+    normal_output="$(echo -e "$input_str" | "$SL_BIN" "${SL_FLAGS[@]}" --gc-mode incremental "$file" 2>&1 | sed "s/<primitive 0x[[:xdigit:]]\+>/<primitive 0xDEADBEEF>/g")"
+    check_output "$file" "$normal_output"
 done
 
 msg "No errors reported from valgrind."
@@ -52,3 +52,24 @@ must be valid inputs."                         ; Initial string
 (< "abc" "abc")
 (> "abz" "abc")
 (> "abc" "abc")
+
+;; Strings of up to 15 bytes are stored inline, longer ones are allocated
+(define str-inline "fifteen chars!!")
+(define str-long "sixteen chars!!!")
+(length str-inline)
+(length str-long)
+(substring str-long 0 15)
+(equal? (substring str-long 0 15) str-inline)
+(append str-inline str-long)
+(set str-inline str-long)
+str-inline
+
+;; Long strings are shared by their clones, and freed by the collector
+(defun make-strings (n)
+  (if (> n 0)
+      (cons (append str-long (int->str n)) (make-strings (- n 1)))
+      nil))
+(let ((strs (make-strings 500)))
+  (make-strings 500)
+  (list (length strs) (car strs) (last strs)))
+(equal? (car (list str-long)) str-long)